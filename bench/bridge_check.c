@@ -0,0 +1,518 @@
+// bridge_check.c - the PS/2-to-USB bridge (ps2_bridge.c) against a
+// simulated keyboard
+//
+// The bridge is the PS/2 host here. A keyboard model on the simulated lines
+// clocks its frames into ps2_bridge_clock_fall() one falling edge at a
+// time, the way the edge ISR would, 80us per bit. It gives way when the
+// bridge holds CLK low and then clocks the bridge's byte in, ACKing it on
+// the 11th clock, and answers commands as a keyboard does. The main loop
+// runs ps2_bridge_task() every PASS_US, and the keys it registers are
+// logged as the USB side would see them.
+//
+// Checks the start-up handshake and LED mirroring, then E0, F0 and E1
+// sequences (Print Screen's fake shifts, Pause, Ctrl+Pause, typematic
+// repeats), a bad frame answered with Resend, a keyboard that answers
+// Resend or nothing, a command due while the keyboard is sending, and a
+// hot-plug with keys held. Last, it types at random times
+// and reports the latency from a key's stop bit to the USB key event.
+// Exits 1 if any check fails.
+//
+//   make bridge
+#include "ps2_keyboard.c"
+#include "ps2_bridge.c"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+extern uint32_t bench_now_ms;
+
+#define CLK PS2_KB_CLK
+#define DATA PS2_KB_DATA
+
+#define HALF_US 40     // Half a keyboard clock period
+#define PASS_US 500    // Main loop pass
+#define GAP_US 200     // Keyboard's pause between frames
+#define BAT_MS 300     // Self-test after a reset
+#define LATENCY_EVENTS 2000
+
+static int failures;
+
+static void check(bool ok, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    printf("  %s  ", ok ? "ok  " : "FAIL");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    if (!ok) failures++;
+}
+
+static uint64_t bench_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// =============================================================================
+// KEYBOARD MODEL
+// =============================================================================
+
+static uint64_t now_us;
+
+static struct {
+    bool plugged;
+    bool phase;  // Falls on every other half period
+    enum { KBD_IDLE, KBD_SEND, KBD_RECEIVE } state;
+    uint8_t bit;         // Clock falls so far this frame
+    uint16_t frame;      // Start to stop bit, LSB first
+    uint8_t out[256];    // Bytes still to send, out[0] next
+    uint16_t out_len;
+    uint8_t last;        // Last byte sent, for the host's Resend
+    uint64_t quiet_until;
+    uint64_t bat_at;     // Self-test result due, 0 = none
+    uint64_t last_stop;  // Stop bit of the last byte sent
+    uint8_t argument_for;  // Command waiting for its argument
+    uint8_t leds;
+    uint8_t typematic;
+    uint8_t cmds[256];  // Bytes the bridge sent, in order
+    uint16_t cmd_count;
+    uint32_t aborted;  // Frames cut off by the host holding CLK low
+    // Faults, each for the next N
+    uint8_t bad_parity;  // Bytes sent with the parity bit flipped
+    uint8_t resend;      // Commands answered with Resend
+    uint8_t ignore;      // Commands not answered at all
+} kbd;
+
+static void kbd_queue(uint8_t byte) {
+    if (kbd.out_len < sizeof(kbd.out)) kbd.out[kbd.out_len++] = byte;
+}
+
+static void kbd_queue_front(uint8_t byte) {
+    memmove(kbd.out + 1, kbd.out, kbd.out_len);
+    kbd.out[0] = byte;
+    kbd.out_len++;
+}
+
+static void kbd_type(const uint8_t *bytes, uint8_t len) {
+    for (uint8_t i = 0; i < len; i++) kbd_queue(bytes[i]);
+}
+
+static void kbd_command(uint8_t byte) {
+    if (kbd.cmd_count < sizeof(kbd.cmds)) kbd.cmds[kbd.cmd_count++] = byte;
+
+    if (kbd.ignore) {
+        kbd.ignore--;
+        return;
+    }
+    if (kbd.resend) {
+        kbd.resend--;
+        kbd_queue_front(PS2_RESEND);
+        return;
+    }
+    if (byte == PS2_RESEND) {
+        kbd_queue_front(kbd.last);
+        return;
+    }
+    if (kbd.argument_for != 0) {
+        if (kbd.argument_for == PS2_CMD_SET_LEDS) kbd.leds = byte;
+        if (kbd.argument_for == PS2_CMD_SET_TYPEMATIC) kbd.typematic = byte;
+        kbd.argument_for = 0;
+        kbd_queue_front(PS2_ACK);
+        return;
+    }
+    if (byte == PS2_CMD_SET_LEDS || byte == PS2_CMD_SET_TYPEMATIC) kbd.argument_for = byte;
+    if (byte == PS2_CMD_RESET) {
+        kbd.out_len = 0;
+        kbd.bat_at = now_us + BAT_MS * 1000;
+    }
+    kbd_queue_front(PS2_ACK);
+}
+
+// One half clock period of the keyboard
+static void kbd_step(void) {
+    bool clk_held = ps2_gpio_sim.oe & CLK;  // By the bridge
+    bool data_low = ps2_gpio_sim.oe & DATA;
+
+    if (!kbd.plugged) return;
+    kbd.phase = !kbd.phase;
+    if (kbd.phase) return;
+
+    if (kbd.state == KBD_IDLE) {
+        if (clk_held) return;  // Inhibited
+        if (data_low) {
+            kbd.state = KBD_RECEIVE;  // Request to send
+            kbd.bit = 0;
+            kbd.frame = 0;
+        } else {
+            if (kbd.bat_at != 0 && now_us >= kbd.bat_at) {
+                kbd.bat_at = 0;
+                kbd_queue(PS2_BAT_SUCCESS);
+            }
+            if (kbd.out_len == 0 || now_us < kbd.quiet_until) return;
+            uint8_t byte = kbd.out[0];
+            bool parity = !__builtin_parity(byte);
+            if (kbd.bad_parity) {
+                kbd.bad_parity--;
+                parity = !parity;
+            }
+            kbd.state = KBD_SEND;
+            kbd.bit = 0;
+            kbd.frame = (uint16_t)byte << 1 | (uint16_t)parity << 9 | 1u << 10;
+        }
+    }
+
+    if (kbd.state == KBD_SEND) {
+        if (clk_held) {
+            kbd.state = KBD_IDLE;  // Cut off: the byte goes again later
+            kbd.aborted++;
+            return;
+        }
+        ps2_bridge_clock_fall((kbd.frame >> kbd.bit) & 1, ps2_micros());
+        if (++kbd.bit < 11) return;
+        kbd.last = kbd.out[0];
+        kbd.out_len--;
+        memmove(kbd.out, kbd.out + 1, kbd.out_len);
+        kbd.last_stop = now_us;
+        kbd.quiet_until = now_us + GAP_US;
+        kbd.state = KBD_IDLE;
+        return;
+    }
+
+    // Receiving: the bit is read before each fall; the 11th is the ACK
+    kbd.frame |= (uint16_t)!data_low << kbd.bit;
+    if (kbd.bit < 10) {
+        ps2_bridge_clock_fall(!data_low, ps2_micros());
+        kbd.bit++;
+        return;
+    }
+    ps2_bridge_clock_fall(false, ps2_micros());
+    kbd.state = KBD_IDLE;
+    kbd.quiet_until = now_us + GAP_US;
+    kbd_command((kbd.frame >> 1) & 0xFF);
+}
+
+// =============================================================================
+// CLOCK, MAIN LOOP AND USB SIDE
+// =============================================================================
+
+static uint64_t next_pass_us;
+
+static void advance(uint32_t us) {
+    for (uint32_t t = 0; t < us; t += HALF_US) {
+        kbd_step();
+        now_us += HALF_US;
+        bench_now_ms = now_us / 1000;
+    }
+}
+
+// The bridge's request to send
+void wait_us(int us) {
+    advance(us);
+}
+
+static struct {
+    uint8_t keycode[256];
+    bool down[256];
+    uint16_t count;
+    uint64_t latency_total;
+    uint32_t latency_max;
+    uint32_t latency_events;
+    bool measuring;
+} usb;
+
+static void usb_event(uint8_t keycode, bool down) {
+    if (usb.count < 256) {
+        usb.keycode[usb.count] = keycode;
+        usb.down[usb.count] = down;
+        usb.count++;
+    }
+    if (usb.measuring) {
+        uint32_t latency = now_us - kbd.last_stop;
+        usb.latency_total += latency;
+        if (latency > usb.latency_max) usb.latency_max = latency;
+        usb.latency_events++;
+    }
+}
+
+void register_code(uint8_t code) {
+    usb_event(code, true);
+}
+
+void unregister_code(uint8_t code) {
+    usb_event(code, false);
+}
+
+bool is_usb_mode(void) {
+    return true;
+}
+
+bool ps2_sniff_active(void) {
+    return false;
+}
+
+static uint64_t task_ns;  // In passes with bytes to decode
+
+static void run_us(uint64_t us) {
+    uint64_t end = now_us + us;
+    while (now_us < end) {
+        advance(HALF_US);
+        if (now_us < next_pass_us) continue;
+        next_pass_us += PASS_US;
+        ps2_timer_run(timer_read32());
+        if (rx_tail == rx_head) {
+            ps2_bridge_task();
+            continue;
+        }
+        uint64_t start = bench_ns();
+        ps2_bridge_task();
+        task_ns += bench_ns() - start;
+    }
+}
+
+static void run_ms(uint32_t ms) {
+    run_us((uint64_t)ms * 1000);
+}
+
+// Until the keyboard has sent everything, self-test included, and the
+// bridge has nothing left to say
+static void run_out(void) {
+    for (int i = 0; i < 1000; i++) {
+        bool keyboard_busy = kbd.out_len > 0 || kbd.state != KBD_IDLE || kbd.bat_at != 0;
+        bool bridge_busy = rx_tail != rx_head || link_state != LINK_IDLE || tx_len > 0 || awaiting || leds_dirty;
+        if (!keyboard_busy && !bridge_busy) break;
+        run_ms(1);
+    }
+    run_ms(5);
+}
+
+static bool cmds_end_with(const uint8_t *bytes, uint16_t len) {
+    return kbd.cmd_count >= len && memcmp(kbd.cmds + kbd.cmd_count - len, bytes, len) == 0;
+}
+
+static void usb_clear(void) {
+    usb.count = 0;
+}
+
+// Events as "+KC -KC" pairs, for the message
+static const char *usb_format(void) {
+    static char text[256];
+    int len = 0;
+    text[0] = 0;
+    for (uint16_t i = 0; i < usb.count && len < (int)sizeof(text) - 8; i++) {
+        len += snprintf(text + len, sizeof(text) - len, "%s%c%02X", i ? " " : "", usb.down[i] ? '+' : '-',
+                        usb.keycode[i]);
+    }
+    return text;
+}
+
+// =============================================================================
+// SCENARIOS
+// =============================================================================
+
+typedef struct {
+    const char *name;
+    uint8_t bytes[16];
+    uint8_t len;
+    int16_t events[8];  // +keycode pressed, -keycode released
+    uint8_t event_count;
+} sequence_t;
+
+static const sequence_t sequences[] = {
+    {"A", {0x1C, 0xF0, 0x1C}, 3, {KC_A, -KC_A}, 2},
+    {"Right arrow (E0)", {0xE0, 0x74, 0xE0, 0xF0, 0x74}, 5, {KC_RIGHT, -KC_RIGHT}, 2},
+    {"Right Ctrl and Right Alt, interleaved",
+     {0xE0, 0x14, 0xE0, 0x11, 0xE0, 0xF0, 0x14, 0xE0, 0xF0, 0x11}, 10,
+     {KC_RCTL, KC_RALT, -KC_RCTL, -KC_RALT}, 4},
+    {"Print Screen, fake shifts dropped",
+     {0xE0, 0x12, 0xE0, 0x7C, 0xE0, 0xF0, 0x7C, 0xE0, 0xF0, 0x12}, 10, {KC_PSCR, -KC_PSCR}, 2},
+    {"Pause (E1), one tap", {0xE1, 0x14, 0x77, 0xE1, 0xF0, 0x14, 0xF0, 0x77}, 8, {KC_PAUSE, -KC_PAUSE}, 2},
+    {"Ctrl+Pause (E0 7E)", {0x14, 0xE0, 0x7E, 0xE0, 0xF0, 0x7E, 0xF0, 0x14}, 8,
+     {KC_LCTL, KC_PAUSE, -KC_PAUSE, -KC_LCTL}, 4},
+    {"A with typematic repeats", {0x1C, 0x1C, 0x1C, 0x1C, 0xF0, 0x1C}, 6, {KC_A, -KC_A}, 2},
+};
+
+static bool usb_matches(const int16_t *events, uint8_t count) {
+    if (usb.count != count) return false;
+    for (uint8_t i = 0; i < count; i++) {
+        if (usb.keycode[i] != (events[i] < 0 ? -events[i] : events[i]) || usb.down[i] != (events[i] > 0)) return false;
+    }
+    return true;
+}
+
+static void scenario_start(void) {
+    static const uint8_t handshake[] = {PS2_CMD_RESET, PS2_CMD_SET_TYPEMATIC, PS2_BRIDGE_TYPEMATIC, PS2_CMD_SET_LEDS, 0};
+    static const uint8_t caps[] = {PS2_CMD_SET_LEDS, 0x04};
+
+    printf("start-up\n");
+    kbd.plugged = true;
+    check(ps2_bridge_start(), "bridge started");
+    run_out();
+    check(connected && kbd.cmd_count == sizeof(handshake) && memcmp(kbd.cmds, handshake, sizeof(handshake)) == 0,
+          "reset, self-test, then typematic %02X and the LEDs", PS2_BRIDGE_TYPEMATIC);
+    check(kbd.typematic == PS2_BRIDGE_TYPEMATIC, "keyboard set to its slowest typematic");
+
+    ps2_bridge_set_leds((led_t){.caps_lock = true});
+    run_out();
+    check(cmds_end_with(caps, sizeof(caps)) && kbd.leds == 0x04, "USB host's Caps Lock mirrored: ED 04");
+}
+
+static void scenario_sequences(void) {
+    printf("sequences\n");
+    for (size_t i = 0; i < sizeof(sequences) / sizeof(sequences[0]); i++) {
+        const sequence_t *seq = &sequences[i];
+        usb_clear();
+        kbd_type(seq->bytes, seq->len);
+        run_out();
+        check(usb_matches(seq->events, seq->event_count), "%s: %s", seq->name, usb_format());
+    }
+}
+
+static void scenario_resend(void) {
+    static const int16_t a[] = {KC_A, -KC_A};
+    static const uint8_t leds_num[] = {PS2_CMD_SET_LEDS, PS2_CMD_SET_LEDS, 0x02};
+
+    printf("resend\n");
+    uint32_t errors = ps2_stats[PS2_STAT_BRIDGE_ERRORS];
+    uint16_t cmds = kbd.cmd_count;
+    usb_clear();
+    kbd.bad_parity = 1;
+    kbd_type((const uint8_t[]){0x1C, 0xF0, 0x1C}, 3);
+    run_out();
+    check(kbd.cmd_count == cmds + 1 && kbd.cmds[cmds] == PS2_RESEND && usb_matches(a, 2),
+          "bad parity answered with FE, byte sent again: %s", usb_format());
+    check(ps2_stats[PS2_STAT_BRIDGE_ERRORS] == errors + 1, "counted as a bridge error");
+
+    errors = ps2_stats[PS2_STAT_BRIDGE_ERRORS];
+    kbd.resend = 1;
+    ps2_bridge_set_leds((led_t){.num_lock = true});
+    run_out();
+    check(cmds_end_with(leds_num, sizeof(leds_num)) && kbd.leds == 0x02,
+          "keyboard asks for ED again: sent again, then its argument");
+    check(ps2_stats[PS2_STAT_BRIDGE_ERRORS] == errors + 1, "counted as a bridge error");
+
+    errors = ps2_stats[PS2_STAT_BRIDGE_ERRORS];
+    kbd.ignore = 1;
+    uint64_t start = now_us;
+    ps2_bridge_set_leds((led_t){0});
+    run_out();
+    check(kbd.leds == 0 && kbd.cmd_count >= 3 && kbd.cmds[kbd.cmd_count - 3] == PS2_CMD_SET_LEDS,
+          "no answer: sent again after the %u ms response timeout", PS2_BRIDGE_RESPONSE_MS);
+    check(now_us - start >= PS2_BRIDGE_RESPONSE_MS * 1000 && ps2_stats[PS2_STAT_BRIDGE_ERRORS] == errors + 1,
+          "counted as a bridge error");
+
+    errors = ps2_stats[PS2_STAT_BRIDGE_ERRORS];
+    cmds = kbd.cmd_count;
+    kbd.ignore = PS2_BRIDGE_RETRIES;
+    ps2_bridge_set_leds((led_t){.scroll_lock = true});
+    run_out();
+    check(kbd.cmd_count == cmds + PS2_BRIDGE_RETRIES && tx_len == 0 && !awaiting,
+          "never answered: given up after %u tries", PS2_BRIDGE_RETRIES);
+    check(ps2_stats[PS2_STAT_BRIDGE_ERRORS] == errors + PS2_BRIDGE_RETRIES, "each try counted");
+
+    // The LED state the keyboard missed goes out with the next change
+    ps2_bridge_set_leds((led_t){0});
+    run_out();
+}
+
+static void scenario_cut_off(void) {
+    static const uint8_t burst[] = {0x1C, 0x32, 0x21, 0x23, 0x24, 0x2B, 0x34, 0x33};
+    static const uint8_t caps[] = {PS2_CMD_SET_LEDS, 0x04};
+
+    printf("command while the keyboard is sending\n");
+    usb_clear();
+    uint32_t aborted = kbd.aborted;
+    for (int i = 0; i < 4; i++) kbd_type(burst, sizeof(burst));
+    // The LEDs change in the middle of the first frame
+    run_us(HALF_US * 9);
+    ps2_bridge_set_leds((led_t){.caps_lock = true});
+    run_out();
+    check(kbd.aborted == aborted, "bridge waits for the keyboard's frame to end, none cut off");
+    check(cmds_end_with(caps, sizeof(caps)) && kbd.leds == 0x04, "ED 04 got through");
+    check(usb.count == sizeof(burst), "%u keys pressed, none lost or doubled", usb.count);
+
+    for (size_t i = 0; i < sizeof(burst); i++) {
+        kbd_queue(PS2_PREFIX_F0);
+        kbd_queue(burst[i]);
+    }
+    run_out();
+}
+
+static void scenario_hot_plug(void) {
+    static const uint8_t settings[] = {PS2_CMD_SET_TYPEMATIC, PS2_BRIDGE_TYPEMATIC, PS2_CMD_SET_LEDS, 0x04};
+    static const int16_t released[] = {KC_A, KC_RIGHT, -KC_A, -KC_RIGHT};
+    static const int16_t again[] = {KC_B, -KC_B};
+
+    printf("hot-plug\n");
+    usb_clear();
+    kbd_type((const uint8_t[]){0x1C, 0xE0, 0x74}, 3);
+    run_out();
+    kbd.plugged = false;
+    run_ms(500);
+
+    kbd.plugged = true;
+    kbd.argument_for = 0;
+    kbd.leds = 0;
+    kbd_queue(PS2_BAT_SUCCESS);
+    run_out();
+    check(usb_matches(released, 4), "keys held before the unplug released: %s", usb_format());
+    check(cmds_end_with(settings, sizeof(settings)) && kbd.leds == 0x04, "typematic and LEDs sent again");
+
+    usb_clear();
+    kbd_type((const uint8_t[]){0x32, 0xF0, 0x32}, 3);
+    run_out();
+    check(usb_matches(again, 2), "new keyboard typing: %s", usb_format());
+}
+
+static void scenario_latency(void) {
+    static const uint8_t keys[][3] = {{0x1C}, {0xE0, 0x74}, {0x12}, {0xE0, 0x14}, {0x5A}};
+    static const uint8_t key_len[] = {1, 2, 1, 2, 1};
+    uint32_t seed = 12345;
+
+    printf("latency: %u events at random times, main loop pass every %u us\n", LATENCY_EVENTS, PASS_US);
+    usb_clear();
+    uint32_t events = ps2_stats[PS2_STAT_BRIDGE_EVENTS];
+    uint64_t total_us = ps2_stats[PS2_STAT_BRIDGE_US_TOTAL];
+    task_ns = 0;
+    usb.measuring = true;
+    for (int i = 0; i < LATENCY_EVENTS / 2; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint8_t k = (seed >> 16) % 5;
+        kbd_type(keys[k], key_len[k]);
+        run_us(2000 + (seed >> 8) % 7919);
+        if (key_len[k] == 2) kbd_queue(PS2_PREFIX_E0);
+        kbd_queue(PS2_PREFIX_F0);
+        kbd_queue(keys[k][key_len[k] - 1]);
+        run_us(2000 + (seed >> 4) % 7919);
+    }
+    usb.measuring = false;
+    run_out();
+
+    double mean = (double)usb.latency_total / usb.latency_events;
+    check(usb.latency_events == LATENCY_EVENTS, "%u events, none lost", usb.latency_events);
+    check(ps2_stats[PS2_STAT_BRIDGE_EVENTS] - events == LATENCY_EVENTS, "bridge_events agrees");
+    check(usb.latency_max <= PASS_US + HALF_US * 2, "stop bit to USB event: mean %.0f us, max %u us", mean,
+          usb.latency_max);
+    printf("  bridge_us_* mean %.0f us (ps2_micros() ticks in ms off the RP2040), decode %.0f ns per event on this PC\n",
+           (double)(ps2_stats[PS2_STAT_BRIDGE_US_TOTAL] - total_us) / LATENCY_EVENTS,
+           (double)task_ns / LATENCY_EVENTS);
+}
+
+int main(void) {
+    ps2_gpio_sim.oe = 0;
+    now_us = 1000000;
+    bench_now_ms = now_us / 1000;
+    next_pass_us = now_us;
+
+    scenario_start();
+    scenario_sequences();
+    scenario_resend();
+    scenario_cut_off();
+    scenario_hot_plug();
+    scenario_latency();
+
+    ps2_bridge_stop();
+    printf("%s (%d failed)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
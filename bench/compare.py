@@ -0,0 +1,84 @@
+""" PS/2 Dual-Mode Keyboard - Benchmark Comparison
+=============================================
+Compares two `make json` runs of the host micro-benchmarks (bench/)
+and shows the change per benchmark.
+
+Usage:
+  python compare.py base.json new.json                 # Table
+  python compare.py base.json new.json --threshold 5   # Exit 1 if any
+                                                       # benchmark got >5% slower
+
+Author: Betzalel J. Lewis
+License: GPL-2.0
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    try:
+        with open(path) as f:
+            data = json.load(f)
+    except (OSError, ValueError) as e:
+        sys.exit("Can't read %s: %s" % (path, e))
+    return {b["name"]: b for b in data["benchmarks"]}
+
+
+def delta(old, new):
+    if old is None or new is None or old == 0:
+        return None
+    return (new - old) * 100.0 / old
+
+
+def fmt(value, spec):
+    return "-" if value is None else format(value, spec)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare two benchmark runs")
+    parser.add_argument("base")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float,
+                        help="fail if ns/op (or insns/op, when both runs have it) grew by more than this %%")
+    args = parser.parse_args()
+
+    base = load(args.base)
+    new = load(args.new)
+
+    print("%-30s %10s %10s %8s %10s %10s %8s" %
+          ("benchmark", "base ns", "new ns", "ns %", "base ins", "new ins", "ins %"))
+
+    regressions = []
+    for name, b in base.items():
+        n = new.get(name)
+        if n is None:
+            print("%-30s (missing from %s)" % (name, args.new))
+            continue
+
+        d_ns = delta(b["ns_per_op"], n["ns_per_op"])
+        d_ins = delta(b["insns_per_op"], n["insns_per_op"])
+        print("%-30s %10.2f %10.2f %+7.1f%% %10s %10s %8s" %
+              (name, b["ns_per_op"], n["ns_per_op"], d_ns,
+               fmt(b["insns_per_op"], ".1f"), fmt(n["insns_per_op"], ".1f"),
+               fmt(d_ins, "+.1f")))
+
+        # Instruction counts don't jitter - trust them over wall time
+        worst = d_ins if d_ins is not None else d_ns
+        if args.threshold is not None and worst > args.threshold:
+            regressions.append((name, worst))
+
+    for name in new:
+        if name not in base:
+            print("%-30s (new)" % name)
+
+    if regressions:
+        print()
+        for name, d in regressions:
+            print("REGRESSION: %s %+.1f%%" % (name, d))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
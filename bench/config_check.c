@@ -0,0 +1,348 @@
+// config_check.c - the settings store (ps2_config.c) across power cycles
+//
+// ps2_config.c and ps2_stats.c run against an EEPROM in shared memory.
+// Every boot runs in a fork of the untouched process, so RAM starts out
+// zeroed the way it is after a power cut, and only the EEPROM carries
+// over. A pass does what kb.c does each housekeeping pass: run the timer
+// wheel, take a counters checkpoint, hand the settings to the store, and
+// let it write if due.
+//
+// The settings are written back lazily: not before PS2_CONFIG_FLUSH_MS
+// have passed without a change or link traffic, not at all if they were
+// changed back, and only the bytes that differ. A block that doesn't
+// check out (torn by a power cut, old layout) must not be loaded.
+//
+// The lifetime counters have to come back after a power cycle as of their
+// last checkpoint, and typing must not write more often than
+// PS2_STATS_SAVE_MS. Uptime alone, which moves the mode time, must not
+// write at all. A mode switch and a reset go to EEPROM without waiting.
+// Exits 1 if any check fails.
+//
+//   make config
+#include "ps2_config.h"
+#include "ps2_crc.h"
+#include "ps2_stats.h"
+#include "ps2_timer.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "eeconfig.h"
+#include "timer.h"
+
+extern uint32_t bench_now_ms;
+
+#define TYPE_MS 100     // A key every 100 ms while typing
+#define BURST_MS 20000  // Typing this long, then
+#define PAUSE_MS 10000  // a pause, long enough for a write
+
+static int failures;
+
+static void check(bool ok, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    printf("  %s  ", ok ? "ok  " : "FAIL");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    if (!ok) failures++;
+}
+
+// =============================================================================
+// EEPROM
+// =============================================================================
+
+// Layout of ps2_config.c's block, to look at and forge
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    ps2_config_t config;
+    uint16_t crc;
+    uint16_t reserved;
+} block_t;
+
+// Kept across the fork: the EEPROM, and what each boot reports back
+static struct {
+    union {
+        uint8_t eeprom[EECONFIG_KB_DATA_SIZE];
+        block_t block;
+    };
+    uint32_t writes;  // eeconfig_update_kb_datablock() calls
+    uint32_t changed; // Bytes the last one changed
+    bool loaded;      // ps2_config_load() took the block
+    uint32_t typed;   // bytes_sent at the last checkpoint
+} *shared;
+
+void eeconfig_read_kb_datablock(void *data, uint32_t offset, uint32_t length) {
+    memcpy(data, shared->eeprom + offset, length);
+}
+
+// QMK only passes on the bytes that differ
+void eeconfig_update_kb_datablock(const void *data, uint32_t offset, uint32_t length) {
+    shared->changed = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        shared->changed += shared->eeprom[offset + i] != ((const uint8_t *)data)[i];
+    }
+    memcpy(shared->eeprom + offset, data, length);
+    shared->writes++;
+}
+
+static uint32_t stored_stat(uint8_t slot) {
+    return shared->block.config.stats[slot];
+}
+
+// Slots in ps2_config_t.stats (ps2_stats.c's lifetime_ids)
+#define SLOT_BYTES_SENT     0
+#define SLOT_MODE_SWITCHES  7
+#define SLOT_PS2_SECONDS    9
+
+// =============================================================================
+// MAIN LOOP
+// =============================================================================
+
+static ps2_config_t settings;  // What the hosts negotiated
+static bool usb_mode;
+
+// One housekeeping pass (kb_config_save())
+static void pass(bool link_busy) {
+    ps2_config_t config = settings;
+
+    ps2_timer_run(timer_read32());
+    ps2_stats_checkpoint(usb_mode, config.stats);
+    ps2_config_update(&config);
+    ps2_config_task(link_busy);
+    bench_now_ms++;
+}
+
+static void run_ms(uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) pass(false);
+}
+
+// A key every TYPE_MS, the link busy while it goes out
+static void type_ms(uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+        bool key = bench_now_ms % TYPE_MS == 0;
+        if (key) {
+            PS2_STAT_INC(PS2_STAT_BYTES_SENT);
+            PS2_STAT_INC(PS2_STAT_LATENCY_SAMPLES);
+        }
+        pass(key);
+    }
+}
+
+// Bursts of typing with pauses in between, for `ms`
+static void type_bursts(uint32_t ms) {
+    for (uint32_t end = bench_now_ms + ms; bench_now_ms < end;) {
+        type_ms(BURST_MS);
+        run_ms(PAUSE_MS);
+    }
+}
+
+// keyboard_post_init_kb()
+static void boot_begin(void) {
+    ps2_config_t config;
+
+    bench_now_ms = 0;
+    ps2_timer_run(0);
+    memset(&settings, 0, sizeof(settings));
+    settings.port_count = 1;
+    settings.ports[0].scancode_set = 2;
+    shared->loaded = ps2_config_load(&config);
+    if (shared->loaded) {
+        settings = config;
+        ps2_stats_restore(config.stats);
+    }
+}
+
+// Runs `run` in a fork of the untouched process
+static void boot(void (*run)(void)) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        failures = 0;  // The parent counts this boot's from the exit status
+        boot_begin();
+        run();
+        fflush(stdout);
+        _exit(failures);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    failures += WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+// =============================================================================
+// BOOTS
+// =============================================================================
+
+static void boot_blank(void) {
+    check(!shared->loaded, "blank: not loaded");
+    run_ms(PS2_CONFIG_FLUSH_MS - 10);
+    check(shared->writes == 0, "defaults not written before %u ms", PS2_CONFIG_FLUSH_MS);
+    run_ms(20);
+    check(shared->writes == 1 && ps2_stats[PS2_STAT_CONFIG_WRITES] == 1, "then written once, config_writes 1");
+}
+
+static void boot_settings(void) {
+    uint32_t writes = shared->writes;
+
+    check(shared->loaded && settings.ports[0].scancode_set == 2, "loaded");
+
+    settings.ports[0].typematic_delay_ms = 250;
+    run_ms(PS2_CONFIG_FLUSH_MS - 10);
+    check(shared->writes == writes, "typematic changed: not written before %u ms", PS2_CONFIG_FLUSH_MS);
+    run_ms(20);
+    check(shared->writes == writes + 1, "then written");
+    check(shared->changed <= 4, "%u bytes changed: the field and the CRC", shared->changed);
+
+    settings.ports[0].scancode_set = 3;
+    run_ms(1000);
+    settings.ports[0].scancode_set = 2;
+    run_ms(PS2_CONFIG_FLUSH_MS * 2);
+    check(shared->writes == writes + 1, "scan set changed and changed back: no write");
+
+    settings.ports[0].typematic_rate_ms = 50;
+    for (uint32_t i = 0; i < 30000; i++) pass(true);
+    check(shared->writes == writes + 1, "changed while the link is busy for 30 s: no write");
+    run_ms(PS2_CONFIG_FLUSH_MS - 10);
+    check(shared->writes == writes + 1, "not before %u ms of quiet", PS2_CONFIG_FLUSH_MS);
+    run_ms(20);
+    check(shared->writes == writes + 2, "then written");
+
+    for (uint16_t i = 0; i < 20; i++) {
+        settings.ports[0].typematic_delay_ms = 500 + i;
+        run_ms(PS2_CONFIG_FLUSH_MS / 5);
+    }
+    check(shared->writes == writes + 2, "changed every %u ms for 20 changes: no write", PS2_CONFIG_FLUSH_MS / 5);
+    run_ms(PS2_CONFIG_FLUSH_MS);
+    check(shared->writes == writes + 3 && shared->block.config.ports[0].typematic_delay_ms == 519,
+          "then the last one written, once");
+}
+
+static void boot_settings_kept(void) {
+    check(shared->loaded && settings.ports[0].typematic_delay_ms == 519 && settings.ports[0].typematic_rate_ms == 50,
+          "power cycle: settings back");
+}
+
+static void boot_torn(void) {
+    check(!shared->loaded, "torn block not loaded");
+    check(ps2_stats[PS2_STAT_BYTES_SENT] == 0, "counters start at zero");
+    run_ms(PS2_CONFIG_FLUSH_MS + 10);
+    check(shared->block.crc == ps2_crc16(&shared->block.config, sizeof(ps2_config_t)),
+          "defaults written over it, CRC good");
+}
+
+static void boot_typing(void) {
+    uint32_t writes = shared->writes;
+    uint32_t before = PS2_STATS_SAVE_MS - 2 * (BURST_MS + PAUSE_MS);
+
+    type_bursts(before);
+    check(shared->writes == writes + 1, "%u pauses in %u min of typing: only the settings written (%u writes)",
+          before / (BURST_MS + PAUSE_MS), before / 60000, shared->writes - writes);
+    check(stored_stat(SLOT_BYTES_SENT) == 0, "counters not written yet");
+
+    type_bursts(3 * (BURST_MS + PAUSE_MS));
+    check(shared->writes == writes + 2, "checkpoint at %u min: written in the next pause", PS2_STATS_SAVE_MS / 60000);
+    shared->typed = stored_stat(SLOT_BYTES_SENT);
+    check(shared->typed > 0 && shared->typed <= ps2_stats[PS2_STAT_BYTES_SENT], "bytes_sent stored: %u of %u",
+          shared->typed, ps2_stats[PS2_STAT_BYTES_SENT]);
+
+    type_bursts(3 * (BURST_MS + PAUSE_MS));  // Lost to the power cut
+    check(shared->writes == writes + 2, "3 more bursts and pauses: no write");
+}
+
+static void boot_restored(void) {
+    uint32_t writes = shared->writes;
+
+    check(shared->loaded, "block loaded");
+    check(ps2_stats[PS2_STAT_BYTES_SENT] == shared->typed, "bytes_sent back as of the checkpoint (%u)",
+          ps2_stats[PS2_STAT_BYTES_SENT]);
+    check(ps2_stats[PS2_STAT_LATENCY_SAMPLES] == 0, "session counters start at zero");
+    run_ms(PS2_CONFIG_FLUSH_MS * 2);
+    check(shared->writes == writes, "nothing changed: no write at boot");
+
+    type_ms(1000);
+    check(ps2_stats[PS2_STAT_BYTES_SENT] == shared->typed + 10, "counting on from there");
+
+    ps2_stats_mode_switch(true);
+    usb_mode = true;
+    settings.usb_mode = true;
+    run_ms(PS2_CONFIG_FLUSH_MS + 10);
+    check(shared->writes == writes + 1 && stored_stat(SLOT_MODE_SWITCHES) == 1 &&
+              stored_stat(SLOT_BYTES_SENT) == shared->typed + 10,
+          "mode switch: written with the counters, without waiting for the checkpoint");
+}
+
+static void boot_idle(void) {
+    uint32_t writes = shared->writes;
+    uint32_t seconds = stored_stat(SLOT_PS2_SECONDS);
+
+    run_ms(3 * PS2_STATS_SAVE_MS);
+    check(shared->writes == writes, "idle for %u min: no write", 3 * PS2_STATS_SAVE_MS / 60000);
+
+    type_ms(1000);
+    run_ms(PS2_CONFIG_FLUSH_MS + 10);
+    check(shared->writes == writes + 1, "a key: written in the next pause");
+    check(stored_stat(SLOT_PS2_SECONDS) - seconds >= 3 * PS2_STATS_SAVE_MS / 1000,
+          "with the idle time (%u s)", stored_stat(SLOT_PS2_SECONDS) - seconds);
+}
+
+static void boot_reset(void) {
+    check(ps2_stats[PS2_STAT_MODE_SWITCHES] == 1, "mode switch count survived");
+    ps2_stats_reset();
+    run_ms(PS2_CONFIG_FLUSH_MS + 10);
+    check(stored_stat(SLOT_BYTES_SENT) == 0 && stored_stat(SLOT_MODE_SWITCHES) == 0, "reset: cleared in EEPROM");
+}
+
+static void boot_cleared(void) {
+    check(shared->loaded && ps2_stats[PS2_STAT_BYTES_SENT] == 0, "still zero after a power cycle");
+}
+
+static void boot_old_layout(void) {
+    check(!shared->loaded, "version 1 block not loaded");
+    check(ps2_stats[PS2_STAT_BYTES_SENT] == 0, "counters start at zero");
+}
+
+int main(void) {
+    shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) return 2;
+
+    printf("blank EEPROM\n");
+    boot(boot_blank);
+
+    printf("settings changing\n");
+    boot(boot_settings);
+    boot(boot_settings_kept);
+
+    printf("power cut halfway through a write\n");
+    shared->block.config.ports[0].typematic_delay_ms ^= 0x0100;
+    boot(boot_torn);
+
+    memset(shared->eeprom, 0, sizeof(shared->eeprom));
+    shared->writes = 0;
+
+    printf("blank EEPROM, typing in bursts for %u min\n", PS2_STATS_SAVE_MS / 60000 + 2);
+    boot(boot_typing);
+
+    printf("power cycle\n");
+    boot(boot_restored);
+
+    printf("power cycle, left idle\n");
+    boot(boot_idle);
+
+    printf("power cycle, counters reset\n");
+    boot(boot_reset);
+    boot(boot_cleared);
+
+    printf("block from before the counters were stored\n");
+    shared->block.version = 1;
+    shared->block.size = 28;
+    boot(boot_old_layout);
+
+    printf("%s (%d failed)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
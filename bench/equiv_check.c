@@ -0,0 +1,794 @@
+// equiv_check.c - the PS/2 host driver against what USB would have sent
+//
+// Every report goes to two host drivers: a capture standing in for
+// original_usb_driver, which just keeps the last keyboard, consumer and
+// system report, and the firmware's own ps2_keyboard_driver(). The bytes
+// the PS/2 side queues are taken straight out of send_buffer (no wire) and
+// decoded back into a set of held scancodes, and that set has to equal the
+// one the USB state maps to.
+//
+// The reference mapping is built from the raw tables in ps2_scancodes.h
+// (plus its own copy of the modifier codes), not from qmk_to_ps2_scancode()
+// and friends, so a rewrite of the lookup or encode paths is checked
+// against the data rather than against itself. The decoder also rejects
+// anything structurally wrong on the way: a stray prefix, a make for a key
+// already down, a break for one that isn't, a malformed Pause.
+//
+// Each host setup (set 2, set 1 by host command, XT) runs three ways:
+//   - the recorded corpus below plus any FILEs, drained after every report
+//   - random max-churn reports, drained after every report: the held sets
+//     match exactly after each one, and every byte in between moves a key
+//     toward the new state
+//   - the same generator with the drain throttled to a random few bytes per
+//     report, so the event queue backs up and presses get deferred: every
+//     byte is checked structurally, and the sets match whenever it drains
+// Exits 1 on the first mismatch of each run, printing the reports leading
+// up to it in the corpus format so they can be saved and replayed.
+//
+//   make equiv
+//   ./equiv_check [-n REPORTS] [-s SEED] [FILE...]
+//
+// Corpus format, one report per line (hex):
+//   K mods [key...]   keyboard report, up to 6 keycodes
+//   C usage           consumer report, 0 = released
+//   S usage           system report, 0 = released
+//   # ...             comment
+#include "ps2_keyboard.c"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define P (&ps2_ports[0])
+
+#define DEFAULT_REPORTS 2000000u
+#define HISTORY 16  // Reports kept for the failure dump
+
+static int failures;
+
+static void check(bool ok, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    printf("  %s  ", ok ? "ok  " : "FAIL");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    if (!ok) failures++;
+}
+
+static uint64_t bench_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// =============================================================================
+// REFERENCE MAPPING
+// =============================================================================
+
+// Scancodes are E0 << 8 | make code, in the port's set. Index 0 is set 2,
+// index 1 set 1.
+#define CODE_E0 0x100
+#define CODE_BITS 512
+
+typedef struct {
+    uint8_t count;        // Codes held while down: 0 (unmapped, Pause), 1, or 2 (Print Screen)
+    uint16_t code[2][2];  // [set][n]
+} ref_key_t;
+
+// The modifier bits, Left Ctrl up, in set 2
+static const uint16_t ref_mod_codes[8] = {
+    0x14, 0x12, 0x11, CODE_E0 | 0x1F, CODE_E0 | 0x14, 0x59, CODE_E0 | 0x11, CODE_E0 | 0x27,
+};
+
+// Pause sends this on make and nothing on break
+static const uint8_t ref_pause[2][8] = {
+    {0xE1, 0x14, 0x77, 0xE1, 0xF0, 0x14, 0xF0, 0x77},
+    {0xE1, 0x1D, 0x45, 0xE1, 0x9D, 0xC5},
+};
+static const uint8_t ref_pause_len[2] = {8, 6};
+
+static ref_key_t ref_keys[256];
+static ref_key_t ref_mods[8];
+static ref_key_t ref_consumer[PS2_CONSUMER_MAPPINGS_SIZE];
+static ref_key_t ref_system[PS2_SYSTEM_MAPPINGS_SIZE];
+
+static uint16_t ref_set1(uint16_t code) {
+    uint8_t make = code & 0xFF;
+    make = make == PS2_F7 ? PS2_SET1_F7 : make < 0x80 ? ps2_set1_translation[make] : 0;
+    return (code & CODE_E0) | make;
+}
+
+static void ref_add(ref_key_t *key, uint16_t code) {
+    key->code[0][key->count] = code;
+    key->code[1][key->count] = ref_set1(code);
+    key->count++;
+}
+
+static ref_key_t ref_from_mapping(ps2_mapping_t mapping) {
+    ref_key_t key = {0};
+
+    if (mapping.scancode == 0) return key;
+    switch (mapping.special_type) {
+        case PS2_KEY_PRINTSCREEN:
+            ref_add(&key, CODE_E0 | 0x7C);
+            ref_add(&key, CODE_E0 | 0x12);  // The fake shift goes with it
+            break;
+        case PS2_KEY_PAUSE:
+            break;
+        default:
+            ref_add(&key, (mapping.needs_e0_prefix ? CODE_E0 : 0) | mapping.scancode);
+            break;
+    }
+    return key;
+}
+
+static const ref_key_t *ref_usage(const ref_key_t *refs, size_t count, const void *table, size_t stride, uint16_t usage) {
+    static const ref_key_t none;
+
+    for (size_t i = 0; i < count; i++) {
+        if (*(const uint16_t *)((const uint8_t *)table + i * stride) == usage) return &refs[i];
+    }
+    return &none;
+}
+
+static const ref_key_t *ref_consumer_key(uint16_t usage) {
+    return ref_usage(ref_consumer, PS2_CONSUMER_MAPPINGS_SIZE, ps2_consumer_mappings, sizeof(ps2_consumer_mappings[0]), usage);
+}
+
+static const ref_key_t *ref_system_key(uint16_t usage) {
+    return ref_usage(ref_system, PS2_SYSTEM_MAPPINGS_SIZE, ps2_system_mappings, sizeof(ps2_system_mappings[0]), usage);
+}
+
+static void ref_build(void) {
+    for (size_t keycode = 0; keycode < 256; keycode++) {
+        ps2_mapping_t mapping = {0};
+        if (keycode < PS2_SCANCODE_LOOKUP_SIZE) mapping = ps2_scancode_lookup[keycode];
+        for (size_t i = 0; mapping.scancode == 0 && i < PS2_EXTENDED_KEYS_SIZE; i++) {
+            if (ps2_extended_keys[i].qmk_keycode == keycode) mapping = ps2_extended_keys[i].mapping;
+        }
+        ref_keys[keycode] = ref_from_mapping(mapping);
+    }
+    for (int i = 0; i < 8; i++) {
+        ref_add(&ref_mods[i], ref_mod_codes[i]);
+    }
+    for (size_t i = 0; i < PS2_CONSUMER_MAPPINGS_SIZE; i++) {
+        ref_consumer[i] = ref_from_mapping(ps2_consumer_mappings[i].mapping);
+    }
+    for (size_t i = 0; i < PS2_SYSTEM_MAPPINGS_SIZE; i++) {
+        ref_system[i] = ref_from_mapping(ps2_system_mappings[i].mapping);
+    }
+}
+
+typedef struct {
+    uint64_t bits[CODE_BITS / 64];
+} codes_t;
+
+static inline void codes_set(codes_t *codes, uint16_t code) {
+    codes->bits[code >> 6] |= 1ull << (code & 63);
+}
+
+static inline bool codes_has(const codes_t *codes, uint16_t code) {
+    return (codes->bits[code >> 6] >> (code & 63)) & 1;
+}
+
+static inline void codes_add(codes_t *codes, const ref_key_t *key, uint8_t set) {
+    for (uint8_t i = 0; i < key->count; i++) {
+        codes_set(codes, key->code[set][i]);
+    }
+}
+
+// =============================================================================
+// USB SIDE
+// =============================================================================
+
+static struct {
+    report_keyboard_t report;
+    uint16_t consumer;
+    uint16_t system;
+    uint32_t pause_presses;
+} usb;
+
+static bool report_has(const report_keyboard_t *report, uint8_t keycode) {
+    for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        if (report->keys[i] == keycode) return true;
+    }
+    return false;
+}
+
+static uint8_t usb_leds(void) {
+    return 0;
+}
+
+static void usb_send_keyboard(report_keyboard_t *report) {
+    if (report_has(report, KC_PAUSE) && !report_has(&usb.report, KC_PAUSE)) usb.pause_presses++;
+    usb.report = *report;
+}
+
+static void usb_send_nkro(report_nkro_t *report) {}
+static void usb_send_mouse(report_mouse_t *report) {}
+
+static void usb_send_extra(report_extra_t *report) {
+    if (report->report_id == REPORT_ID_CONSUMER) usb.consumer = report->usage;
+    if (report->report_id == REPORT_ID_SYSTEM) usb.system = report->usage;
+}
+
+static host_driver_t usb_capture_driver = {
+    usb_leds, usb_send_keyboard, usb_send_nkro, usb_send_mouse, usb_send_extra,
+};
+
+// What the USB state should look like on the PS/2 side
+static void usb_expect(codes_t *expect, uint8_t set) {
+    memset(expect, 0, sizeof(*expect));
+    for (int i = 0; i < 8; i++) {
+        if (usb.report.mods & (1 << i)) codes_add(expect, &ref_mods[i], set);
+    }
+    for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        if (usb.report.keys[i] != 0) codes_add(expect, &ref_keys[usb.report.keys[i]], set);
+    }
+    if (usb.consumer != 0) codes_add(expect, ref_consumer_key(usb.consumer), set);
+    if (usb.system != 0) codes_add(expect, ref_system_key(usb.system), set);
+}
+
+// =============================================================================
+// PS/2 DECODER
+// =============================================================================
+
+static struct {
+    uint8_t set;           // 0: set 2, 1: set 1
+    bool e0, f0;
+    uint8_t pause;         // Bytes of a Pause sequence seen so far
+    codes_t held;
+    const codes_t *target; // Set while draining in full: every change heads here
+    uint32_t pauses;
+    uint64_t events;       // Makes, breaks and Pauses decoded
+    uint64_t bytes;
+    uint32_t errors;
+    char error[96];        // First one
+} dec;
+
+static void dec_error(const char *fmt, ...) {
+    va_list args;
+
+    if (dec.errors++ > 0) return;
+    va_start(args, fmt);
+    vsnprintf(dec.error, sizeof(dec.error), fmt, args);
+    va_end(args);
+}
+
+static void dec_reset(uint8_t set) {
+    memset(&dec, 0, sizeof(dec));
+    dec.set = set;
+}
+
+static bool dec_at_boundary(void) {
+    return !dec.e0 && !dec.f0 && dec.pause == 0;
+}
+
+static void dec_code(uint16_t code, bool release) {
+    uint64_t *word = &dec.held.bits[code >> 6];
+    uint64_t bit = 1ull << (code & 63);
+
+    dec.events++;
+    if (!release) {
+        if (*word & bit) dec_error("make for %03X, already down", code);
+        *word |= bit;
+        if (dec.target && !codes_has(dec.target, code)) dec_error("make for %03X, not held over USB", code);
+    } else {
+        if (!(*word & bit)) dec_error("break for %03X, never made", code);
+        *word &= ~bit;
+        if (dec.target && codes_has(dec.target, code)) dec_error("break for %03X, still held over USB", code);
+    }
+}
+
+static void dec_byte(uint8_t byte) {
+    dec.bytes++;
+
+    if (dec.pause > 0) {
+        if (byte != ref_pause[dec.set][dec.pause]) {
+            dec_error("byte %02X at %u of a Pause sequence", byte, dec.pause);
+            dec.pause = 0;
+        } else if (++dec.pause == ref_pause_len[dec.set]) {
+            dec.pause = 0;
+            dec.pauses++;
+            dec.events++;
+        }
+        return;
+    }
+
+    if (byte == PS2_PREFIX_E1) {
+        if (!dec_at_boundary()) dec_error("E1 after a prefix");
+        dec.e0 = dec.f0 = false;
+        dec.pause = 1;
+        return;
+    }
+    if (byte == PS2_PREFIX_E0) {
+        if (dec.e0 || dec.f0) dec_error("E0 after a prefix");
+        dec.e0 = true;
+        return;
+    }
+
+    if (dec.set == 0) {
+        if (byte == PS2_PREFIX_F0) {
+            if (dec.f0) dec_error("F0 F0");
+            dec.f0 = true;
+            return;
+        }
+        dec_code((dec.e0 ? CODE_E0 : 0) | byte, dec.f0);
+    } else {
+        dec_code((dec.e0 ? CODE_E0 : 0) | (byte & 0x7F), byte & 0x80);
+    }
+    dec.e0 = dec.f0 = false;
+}
+
+// =============================================================================
+// DRIVING THE PORT
+// =============================================================================
+
+static host_driver_t *ps2_driver;
+
+// Move up to `budget` scancode bytes out of send_buffer, refilling it from
+// the event queue as ps2_port_task() does. Responses (ACKs) are dropped.
+static void pump(uint32_t budget) {
+    while (budget > 0) {
+        uint8_t byte;
+
+        ps2_event_drain(P);
+        ps2_lane_t lane = ps2_port_next_byte(P, &byte);
+        if (lane == PS2_LANE_NONE) return;
+        ps2_port_byte_sent(P, lane);
+        if (lane == PS2_LANE_SCANCODE) {
+            dec_byte(byte);
+            budget--;
+        }
+    }
+}
+
+static bool port_quiet(void) {
+    return P->send_buffer_head == P->send_buffer_tail && P->event_count == 0 && !P->event_deferred;
+}
+
+// =============================================================================
+// REPORTS
+// =============================================================================
+
+typedef struct {
+    char kind;  // 'K', 'C' or 'S'
+    report_keyboard_t report;
+    uint16_t usage;
+} step_t;
+
+static step_t history[HISTORY];
+static uint32_t step_count;
+
+static void step_print(const step_t *step) {
+    if (step->kind == 'K') {
+        printf("    K %02X", step->report.mods);
+        for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+            if (step->report.keys[i] != 0) printf(" %02X", step->report.keys[i]);
+        }
+        printf("\n");
+    } else {
+        printf("    %c %04X\n", step->kind, step->usage);
+    }
+}
+
+// Both drivers get the same report
+static void step_send(const step_t *step) {
+    history[step_count++ % HISTORY] = *step;
+
+    if (step->kind == 'K') {
+        report_keyboard_t usb_report = step->report;
+        report_keyboard_t ps2_report = step->report;
+        usb_capture_driver.send_keyboard(&usb_report);
+        ps2_driver->send_keyboard(&ps2_report);
+    } else {
+        report_extra_t report = {
+            .report_id = step->kind == 'C' ? REPORT_ID_CONSUMER : REPORT_ID_SYSTEM,
+            .usage = step->usage,
+        };
+        usb_capture_driver.send_extra(&report);
+        ps2_driver->send_extra(&report);
+    }
+}
+
+static void codes_print(const char *label, const codes_t *codes, const codes_t *other) {
+    printf("    %s:", label);
+    for (uint16_t code = 0; code < CODE_BITS; code++) {
+        if (codes_has(codes, code)) printf(codes_has(other, code) ? " %03X" : " [%03X]", code);
+    }
+    printf("\n");
+}
+
+// Held sets equal and the decoder between sequences; on failure, dump the
+// reports that led here
+static bool compare(const char *run, bool pauses_exact) {
+    codes_t expect;
+
+    usb_expect(&expect, dec.set);
+    bool same = memcmp(&expect, &dec.held, sizeof(expect)) == 0;
+    bool pauses = pauses_exact ? dec.pauses == usb.pause_presses : dec.pauses <= usb.pause_presses;
+    if (same && pauses && dec.errors == 0 && dec_at_boundary()) return true;
+
+    check(false, "%s: diverged at report %u", run, step_count);
+    if (dec.errors > 0) printf("    decoder: %s (%u errors)\n", dec.error, dec.errors);
+    if (!dec_at_boundary()) printf("    decoder stopped mid-sequence\n");
+    if (!pauses) printf("    Pause: %u sent for %u presses\n", dec.pauses, usb.pause_presses);
+    if (!same) {
+        codes_print("usb", &expect, &dec.held);
+        codes_print("ps2", &dec.held, &expect);
+    }
+    printf("    last reports:\n");
+    uint32_t first = step_count > HISTORY ? step_count - HISTORY : 0;
+    for (uint32_t i = first; i < step_count; i++) {
+        step_print(&history[i % HISTORY]);
+    }
+    return false;
+}
+
+// One report, then the whole backlog out
+static bool step_full(const step_t *step, const char *run) {
+    codes_t expect;
+
+    step_send(step);
+    usb_expect(&expect, dec.set);
+    dec.target = &expect;
+    pump(UINT32_MAX);
+    dec.target = NULL;
+    if (dec.errors == 0 && memcmp(&expect, &dec.held, sizeof(expect)) == 0 && dec.pauses == usb.pause_presses) {
+        return true;
+    }
+    return compare(run, true);
+}
+
+// =============================================================================
+// HOST SETUPS
+// =============================================================================
+
+typedef enum {
+    HOST_SET2,
+    HOST_SET1,  // AT host that asked for set 1 (F0 01)
+    HOST_XT,
+} host_t;
+
+static const char *const host_names[] = {
+    [HOST_SET2] = "set 2",
+    [HOST_SET1] = "set 1 (F0 01)",
+    [HOST_XT]   = "XT",
+};
+
+static void host_command(uint8_t cmd) {
+    ps2_device_process_host_command(cmd);
+    pump(UINT32_MAX);
+}
+
+// Everything up, state on both sides cleared
+static void fresh(host_t host) {
+    const step_t release[] = {{.kind = 'K'}, {.kind = 'C'}, {.kind = 'S'}};
+
+    ps2_keyboard_set_protocol(host == HOST_XT ? PS2_PROTOCOL_XT : PS2_PROTOCOL_AT);
+    ps2_driver = ps2_keyboard_driver(0);
+    for (size_t i = 0; i < sizeof(release) / sizeof(release[0]); i++) {
+        step_send(&release[i]);
+    }
+    pump(UINT32_MAX);
+
+    host_command(PS2_CMD_SET_SCANCODE_SET);
+    host_command(host == HOST_SET1 ? 1 : 2);
+
+    memset(&usb, 0, sizeof(usb));
+    dec_reset(ps2_port_set1(P));
+    step_count = 0;
+}
+
+// =============================================================================
+// RECORDED SEQUENCES
+// =============================================================================
+
+static const char *const corpus[] = {
+    "# Shift-A, released in either order",
+    "K 02 04", "K 02", "K 00", "K 02 04", "K 00 04", "K 00",
+    "# Six-key rollover, one key swapped per report",
+    "K 00 04 05 06 07 08 09", "K 00 0A 05 06 07 08 09", "K 00 0A 0B 06 07 08 09",
+    "K 00 0A 0B 0C 0D 0E 0F", "K 00",
+    "# All eight modifiers in one report, then half of them swapped",
+    "K FF", "K 00", "K AA", "K 55", "K 00",
+    "# E0 keys under the E0 modifiers",
+    "K 50 4F 50 51 52 49 4C", "K 10 4F", "K 40", "K 00",
+    "# Print Screen alone, under Shift, and outliving the Shift",
+    "K 00 46", "K 00", "K 02 46", "K 00 46", "K 00",
+    "# Pause: make only, twice, and held across another key",
+    "K 00 48", "K 00", "K 00 48", "K 00 48 04", "K 00 04", "K 00",
+    "# Keypad Enter and Slash next to Enter and Slash",
+    "K 00 58 28 54 38", "K 00 28 38", "K 00",
+    "# F7, the one set 2 make code above 7F",
+    "K 00 40", "K 04 40 41", "K 00",
+    "# Media key pressed under Shift and released after it",
+    "K 02", "C 00E9", "K 00", "C 0000",
+    "# Consumer usage switching without a release in between",
+    "C 00E2", "C 00CD", "C 0183", "C 0000",
+    "# System keys",
+    "S 0081", "S 0082", "S 0000",
+    "# Unmapped keycodes and usages send nothing",
+    "K 00 01 A4", "C 0001", "S 00A0", "K 00", "C 0000", "S 0000",
+    "# Everything at once",
+    "K FF 46 48 4F 58 40 04", "C 00B5", "S 0083", "K 00", "C 0000", "S 0000",
+};
+
+// One corpus line; false if it isn't one
+static bool step_parse(const char *line, step_t *step, bool *blank) {
+    char *end;
+
+    while (*line == ' ' || *line == '\t') line++;
+    *blank = *line == '\0' || *line == '\n' || *line == '#';
+    if (*blank) return true;
+
+    memset(step, 0, sizeof(*step));
+    step->kind = *line++;
+    if (step->kind == 'C' || step->kind == 'S') {
+        unsigned long usage = strtoul(line, &end, 16);
+        if (end == line || usage > 0xFFFF) return false;
+        step->usage = usage;
+        return true;
+    }
+    if (step->kind != 'K') return false;
+
+    unsigned long mods = strtoul(line, &end, 16);
+    if (end == line || mods > 0xFF) return false;
+    step->report.mods = mods;
+    for (int i = 0;; i++) {
+        line = end;
+        unsigned long keycode = strtoul(line, &end, 16);
+        if (end == line) break;
+        if (i == KEYBOARD_REPORT_KEYS || keycode > 0xFF) return false;
+        step->report.keys[i] = keycode;
+    }
+    while (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n') end++;
+    return *end == '\0';
+}
+
+// Replay lines through each host setup, drained after every report
+static void replay(const char *name, const char *const *lines, size_t count) {
+    for (host_t host = HOST_SET2; host <= HOST_XT; host++) {
+        uint32_t reports = 0;
+        bool ok = true;
+        char run[64];
+
+        snprintf(run, sizeof(run), "%s, %s", name, host_names[host]);
+        fresh(host);
+        for (size_t i = 0; i < count && ok; i++) {
+            step_t step;
+            bool blank;
+
+            if (!step_parse(lines[i], &step, &blank)) {
+                check(false, "%s: bad line %zu: %s", name, i + 1, lines[i]);
+                return;
+            }
+            if (blank) continue;
+            ok = step_full(&step, run);
+            reports++;
+        }
+        if (ok) check(true, "%s: %u reports", run, reports);
+    }
+}
+
+static void replay_file(const char *path) {
+    static char storage[4096][64];
+    const char *lines[4096];
+    size_t count = 0;
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        check(false, "%s: can't open", path);
+        return;
+    }
+    while (count < 4096 && fgets(storage[count], sizeof(storage[count]), file)) {
+        lines[count] = storage[count];
+        count++;
+    }
+    fclose(file);
+    replay(path, lines, count);
+}
+
+// =============================================================================
+// RANDOM REPORTS
+// =============================================================================
+
+static uint32_t rng_state;
+
+static inline uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+#define POOL_UNMAPPED 4  // Keycodes with no mapping the generator uses
+
+// What the generator picks from. Keys and usages that share a scancode
+// with one already taken (in either set) are left out - USB can hold both,
+// the PS/2 host can't tell them apart - as are set 1 codes whose break
+// would read as a prefix. Unmapped ones are kept: they must send nothing.
+static uint8_t pool_keys[256];
+static uint16_t pool_keys_count;
+static uint16_t pool_consumer[PS2_CONSUMER_MAPPINGS_SIZE + 2];
+static uint16_t pool_consumer_count;
+static uint16_t pool_system[PS2_SYSTEM_MAPPINGS_SIZE + 2];
+static uint16_t pool_system_count;
+
+static bool pool_claim(codes_t claimed[2], const ref_key_t *key) {
+    for (uint8_t i = 0; i < key->count; i++) {
+        uint16_t set1 = key->code[1][i];
+        uint8_t make = set1 & 0xFF;
+        if (make == 0 || make == (PS2_PREFIX_E0 & 0x7F) || make == (PS2_PREFIX_E1 & 0x7F)) return false;
+        if (codes_has(&claimed[0], key->code[0][i]) || codes_has(&claimed[1], set1)) return false;
+    }
+    for (uint8_t i = 0; i < key->count; i++) {
+        codes_set(&claimed[0], key->code[0][i]);
+        codes_set(&claimed[1], key->code[1][i]);
+    }
+    return true;
+}
+
+static void pool_build(void) {
+    codes_t claimed[2] = {0};
+    uint8_t unmapped = 0;
+
+    for (int i = 0; i < 8; i++) {
+        pool_claim(claimed, &ref_mods[i]);
+    }
+    for (size_t i = 0; i < PS2_CONSUMER_MAPPINGS_SIZE; i++) {
+        if (pool_claim(claimed, &ref_consumer[i])) pool_consumer[pool_consumer_count++] = ps2_consumer_mappings[i].usage_code;
+    }
+    pool_consumer[pool_consumer_count++] = 0x0001;  // Unmapped
+    pool_consumer[pool_consumer_count++] = 0;
+    for (size_t i = 0; i < PS2_SYSTEM_MAPPINGS_SIZE; i++) {
+        if (pool_claim(claimed, &ref_system[i])) pool_system[pool_system_count++] = ps2_system_mappings[i].usage_code;
+    }
+    pool_system[pool_system_count++] = 0x00A0;  // Unmapped
+    pool_system[pool_system_count++] = 0;
+
+    // Keycodes for those usages (KC_AUDIO_MUTE...) lose to them here
+    for (int keycode = 1; keycode < KC_LCTL; keycode++) {
+        const ref_key_t *key = &ref_keys[keycode];
+        bool pause = ps2_scancode_lookup[keycode].special_type == PS2_KEY_PAUSE;
+        if (key->count == 0 && !pause && unmapped++ >= POOL_UNMAPPED) continue;
+        if (pool_claim(claimed, key)) pool_keys[pool_keys_count++] = keycode;
+    }
+}
+
+// As much change per report as a report can carry: random modifiers
+// flipping, each key slot kept, emptied or replaced, with now and then a
+// consumer or system report in between
+static void random_step(step_t *step) {
+    uint32_t r = rng();
+
+    if ((r & 15) == 0) {
+        step->kind = (r & 16) ? 'C' : 'S';
+        step->usage = step->kind == 'C' ? pool_consumer[(r >> 8) % pool_consumer_count]
+                                        : pool_system[(r >> 8) % pool_system_count];
+        return;
+    }
+
+    report_keyboard_t report = usb.report;
+    report.mods ^= r >> 8;
+    for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        uint32_t pick = rng();
+        switch (pick & 3) {
+            case 0:
+                report.keys[i] = 0;
+                break;
+            case 1: {
+                uint8_t keycode = pool_keys[(pick >> 8) % pool_keys_count];
+                report.keys[i] = report_has(&report, keycode) ? 0 : keycode;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    step->kind = 'K';
+    step->report = report;
+}
+
+// Drained after every report
+static void random_full(host_t host, uint32_t reports) {
+    char run[64];
+    step_t step;
+    uint32_t done = 0;
+
+    snprintf(run, sizeof(run), "random, drained, %s", host_names[host]);
+    fresh(host);
+
+    uint64_t start = bench_ns();
+    while (done < reports) {
+        random_step(&step);
+        if (!step_full(&step, run)) return;
+        done++;
+    }
+    double seconds = (bench_ns() - start) / 1e9;
+
+    check(true, "%s: %u reports, %llu key events in %llu bytes, %.2fM reports/s, %.1fM key events/s",
+          run, done, (unsigned long long)dec.events, (unsigned long long)dec.bytes, done / seconds / 1e6,
+          dec.events / seconds / 1e6);
+}
+
+// A random few bytes out per report, now and then all of them
+static void random_throttled(host_t host, uint32_t reports) {
+    char run[64];
+    step_t step;
+    uint32_t quiet = 0;
+    uint32_t deferred = ps2_stats[PS2_STAT_EVENT_DROPS];
+
+    snprintf(run, sizeof(run), "random, throttled, %s", host_names[host]);
+    fresh(host);
+
+    for (uint32_t done = 0; done < reports; done++) {
+        random_step(&step);
+        step_send(&step);
+
+        uint32_t r = rng();
+        pump((r & 31) == 0 ? UINT32_MAX : (r >> 8) % 12);
+        if (dec.errors > 0) {
+            compare(run, false);
+            return;
+        }
+        if (port_quiet()) {
+            if (!compare(run, false)) return;
+            quiet++;
+        }
+    }
+    pump(UINT32_MAX);
+    if (!compare(run, false)) return;
+
+    deferred = ps2_stats[PS2_STAT_EVENT_DROPS] - deferred;
+    check(quiet > 0 && deferred > 0, "%s: %u reports, matched at %u drained points, %u presses deferred",
+          run, reports, quiet, deferred);
+}
+
+int main(int argc, char **argv) {
+    uint32_t reports = DEFAULT_REPORTS;
+    int opt;
+
+    rng_state = 0x2545F491;
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                reports = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                rng_state = strtoul(optarg, NULL, 0) | 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n REPORTS] [-s SEED] [FILE...]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    ref_build();
+    pool_build();
+    ps2_keyboard_init();
+    ps2_keyboard_set_protocol(PS2_PROTOCOL_AT);
+    pump(UINT32_MAX);
+
+    printf("pool: %u keycodes, %u consumer and %u system usages, seed %u\n",
+           pool_keys_count, pool_consumer_count, pool_system_count, rng_state);
+
+    printf("recorded\n");
+    replay("corpus", corpus, sizeof(corpus) / sizeof(corpus[0]));
+    for (int i = optind; i < argc; i++) {
+        replay_file(argv[i]);
+    }
+
+    printf("random\n");
+    for (host_t host = HOST_SET2; host <= HOST_XT; host++) {
+        random_full(host, reports);
+        random_throttled(host, reports / 4);
+    }
+
+    printf("%s (%d failed)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
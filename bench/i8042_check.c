@@ -0,0 +1,797 @@
+// i8042_check.c - ps2_keyboard.c against a simulated i8042 host controller
+//
+// The bit-banged firmware runs on a simulated open-collector bus with 1us
+// resolution: its busy-waits advance the clock, and on every tick the host
+// model looks at CLK and DATA the way an 8042 does. It clocks in device
+// frames on CLK falls and checks start, parity and stop. It sends bytes
+// with a request to send: CLK held low, DATA low, CLK released, then bit
+// N on DATA at the Nth device clock fall (D0-D7, parity, stop) and the ACK
+// read at the 11th. It times out a device that doesn't clock within 15ms
+// or takes over 2ms per frame, and any clock after the ACK is an error.
+//
+// Faults are scripted. Each built-in script is a session a Linux atkbd
+// host would run, with inhibits, interrupting commands and Resends put in
+// at chosen clocks. More scripts can be given as FILEs. Exits 1 if any
+// step fails, naming it. Reports command-response latency, how long the
+// device takes to get a byte through after an inhibit, and typing
+// throughput. Then the same taps go out over set 2 and over XT, with the
+// host reading XT frames (a 0 and a 1 start bit, 8 data bits), and both
+// are timed.
+//
+//   make i8042
+//   ./i8042_check [FILE...]
+//
+// Script format, one step per line (bytes and keycodes in hex):
+//   cmd XX [XX...]     send bytes (command, then arguments), each ACKed
+//   badparity XX       send a byte with the wrong parity bit
+//   expect [XX...]     the device's next bytes, nothing else within 20ms
+//   press KC           key down, QMK keycode
+//   release KC         key up
+//   inhibit N US       next device frame: CLK held low at its Nth fall
+//   rts N XX           next device frame: interrupted at its Nth fall by XX
+//   resend             answer the next device byte with FE, discard it
+//   hold US            after each byte, hold CLK low US (the OS reading it)
+//   leds N             the device's LED state is N (ED bit layout)
+//   set N              the device is on scancode set N
+//   wait MS            run MS milliseconds
+//   burst N            type N letters as fast as the link takes them
+//   # ...              comment
+#include "ps2_keyboard.c"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define P (&ps2_ports[0])
+
+extern uint32_t bench_now_ms;
+
+#define CLK PS2_KB_CLK
+#define DATA PS2_KB_DATA
+
+#define PASS_US 50  // Main loop pass with nothing on the wire
+
+// 8042 limits: a device has 15ms to start clocking a host byte and 2ms to
+// finish it. Device frames are timed per bit, as the bit-banged clock
+// (300us a bit) runs a whole frame past 2ms: one stopped for a millisecond
+// is dropped.
+#define I8042_RTS_TIMEOUT_US 15000
+#define I8042_FRAME_TIMEOUT_US 2000
+#define I8042_BIT_TIMEOUT_US 1000
+
+// Inhibit before a request to send. The spec minimum is 100us; a full bit
+// time and more, so the device sees it wherever it is in a frame.
+#define I8042_RTS_HOLD_US 250
+
+// After the ACK clock: a fall within a bit time is a 12th clock. An
+// answer comes later, after the device has set up its start bit.
+#define I8042_TAIL_US 150
+
+#define EXPECT_QUIET_MS 20
+#define RX_LOG 256
+
+static int failures;
+
+static void check(bool ok, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    printf("  %s  ", ok ? "ok  " : "FAIL");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    if (!ok) failures++;
+}
+
+// =============================================================================
+// HOST MODEL
+// =============================================================================
+
+typedef enum { HOST_IDLE, HOST_INHIBIT, HOST_RTS, HOST_SENDING, HOST_TAIL } host_state_t;
+
+typedef enum { FAULT_NONE, FAULT_INHIBIT, FAULT_RTS } fault_t;
+
+static uint32_t now_us;
+static bool prev_clk = true;
+static char host_error[96];  // First protocol error since the last step
+
+static struct {
+    host_state_t state;
+    uint32_t until;  // HOST_INHIBIT, HOST_RTS, HOST_TAIL: when it ends
+    uint32_t hold_us;
+
+    // Device-to-host
+    uint16_t frame;
+    uint8_t bits;
+    uint32_t last_fall;
+    uint8_t rx[RX_LOG];
+    uint32_t rx_us[RX_LOG];  // Stop bit fall
+    uint16_t rx_count;
+    uint16_t rx_read;  // Consumed by expect steps
+    bool resend_next;
+    bool xt;  // Reading XT frames: 10 clocks, no commands
+
+    // Host-to-device: bytes waiting, the one on the wire
+    uint16_t tx_queue[8];  // Frame bits: data, parity << 8
+    uint8_t tx_count;
+    uint16_t tx_frame;
+    uint8_t tx_falls;
+    uint32_t tx_start;  // DATA pulled low
+    uint32_t tx_first_fall;
+    bool acked;
+
+    // Scripted fault for the next device frame
+    fault_t fault;
+    uint8_t fault_fall;
+    uint32_t fault_us;
+    uint8_t fault_byte;
+    uint32_t recover_from;  // Inhibit released, waiting for a whole byte
+} host;
+
+static struct {
+    uint32_t latency_min, latency_max, latency_count;
+    uint64_t latency_sum;
+    uint32_t recovery_min, recovery_max, recovery_count;
+    uint64_t recovery_sum;
+} stats = {UINT32_MAX, 0, 0, 0, UINT32_MAX, 0, 0, 0};
+
+static void host_fail(const char *fmt, ...) {
+    va_list args;
+
+    if (host_error[0] != '\0') return;
+    va_start(args, fmt);
+    vsnprintf(host_error, sizeof(host_error), fmt, args);
+    va_end(args);
+}
+
+static inline uint32_t bus_lines(void) {
+    return ~(ps2_gpio_sim.oe | ps2_gpio_sim.host_low);
+}
+
+static void host_pull(uint32_t lines, bool low) {
+    if (low) {
+        ps2_gpio_sim.host_low |= lines;
+    } else {
+        ps2_gpio_sim.host_low &= ~lines;
+    }
+}
+
+static void host_queue(uint8_t byte, bool parity_ok) {
+    bool parity = !__builtin_parity(byte) ^ !parity_ok;
+    if (host.tx_count < sizeof(host.tx_queue) / sizeof(host.tx_queue[0])) {
+        host.tx_queue[host.tx_count++] = byte | (uint16_t)parity << 8;
+    }
+}
+
+// Request to send: CLK low, then DATA low and CLK released
+static void host_rts(void) {
+    host.tx_frame = host.tx_queue[0] | 1u << 9;  // Stop bit
+    host.tx_count--;
+    memmove(host.tx_queue, host.tx_queue + 1, host.tx_count * sizeof(host.tx_queue[0]));
+    host.frame = 0;
+    host.bits = 0;
+    host_pull(CLK, true);
+    host.state = HOST_RTS;
+    host.until = now_us + I8042_RTS_HOLD_US;
+}
+
+static void host_inhibit(uint32_t us) {
+    host.frame = 0;
+    host.bits = 0;
+    host_pull(CLK, true);
+    host.state = HOST_INHIBIT;
+    host.until = now_us + us;
+}
+
+static void host_byte(uint8_t byte) {
+    if (host.recover_from != 0) {
+        uint32_t us = now_us - host.recover_from;
+        stats.recovery_min = us < stats.recovery_min ? us : stats.recovery_min;
+        stats.recovery_max = us > stats.recovery_max ? us : stats.recovery_max;
+        stats.recovery_sum += us;
+        stats.recovery_count++;
+        host.recover_from = 0;
+    }
+
+    if (host.resend_next) {
+        host.resend_next = false;
+        host_queue(PS2_CMD_RESEND, true);
+    } else if (host.rx_count < RX_LOG) {
+        host.rx_us[host.rx_count] = now_us;
+        host.rx[host.rx_count++] = byte;
+    }
+    if (host.hold_us > 0) host_inhibit(host.hold_us);
+}
+
+// A device CLK fall while nothing of ours is on the wire: the next bit of
+// a device frame, sampled now (the device changes DATA with CLK high)
+static void host_device_fall(uint32_t lines) {
+    host.last_fall = now_us;
+    host.frame |= (uint16_t)((lines & DATA) ? 1 : 0) << host.bits;
+    host.bits++;
+
+    uint8_t fall = host.bits;
+    if (host.xt && host.bits == 10) {
+        uint16_t frame = host.frame;
+        host.frame = 0;
+        host.bits = 0;
+        if ((frame & 3) != 2) {
+            host_fail("XT frame error (0x%03X)", frame);
+        } else {
+            host_byte(frame >> 2);
+        }
+    } else if (host.bits == 11) {
+        uint16_t frame = host.frame;
+        host.frame = 0;
+        host.bits = 0;
+        if ((frame & 1) || !((frame >> 10) & 1) || !__builtin_parity((frame >> 1) & 0x1FF)) {
+            host_fail("device frame error (0x%03X)", frame);
+            host_queue(PS2_CMD_RESEND, true);
+        } else {
+            host_byte((frame >> 1) & 0xFF);
+        }
+    }
+
+    // Scripted fault at this clock. At the 11th the byte is already in.
+    if (host.fault != FAULT_NONE && fall == host.fault_fall) {
+        fault_t fault = host.fault;
+        host.fault = FAULT_NONE;
+        if (fault == FAULT_INHIBIT) {
+            host_inhibit(host.fault_us);
+            if (fall < 11) host.recover_from = host.until;
+        } else {
+            host_queue(host.fault_byte, true);
+            host_rts();
+        }
+    }
+}
+
+// One microsecond of the 8042
+static void host_tick(void) {
+    uint32_t lines = bus_lines();
+    bool clk = lines & CLK;
+    bool fell = prev_clk && !clk && !(ps2_gpio_sim.host_low & CLK);
+    prev_clk = clk;
+
+    switch (host.state) {
+        case HOST_INHIBIT:
+            if ((int32_t)(now_us - host.until) >= 0) {
+                host_pull(CLK, false);
+                prev_clk = bus_lines() & CLK;
+                host.state = HOST_IDLE;
+            }
+            return;
+
+        case HOST_RTS:
+            if ((int32_t)(now_us - host.until) >= 0) {
+                host_pull(DATA, true);  // Start bit
+                host_pull(CLK, false);
+                prev_clk = bus_lines() & CLK;
+                host.state = HOST_SENDING;
+                host.tx_falls = 0;
+                host.tx_start = now_us;
+                host.acked = false;
+            }
+            return;
+
+        case HOST_SENDING:
+            if (host.tx_falls == 0 && now_us - host.tx_start > I8042_RTS_TIMEOUT_US) {
+                host_fail("device never clocked the host byte 0x%02X", host.tx_frame & 0xFF);
+                host_pull(DATA, false);
+                host.state = HOST_IDLE;
+                return;
+            }
+            if (host.tx_falls > 0 && now_us - host.tx_first_fall > I8042_FRAME_TIMEOUT_US) {
+                host_fail("host byte 0x%02X stalled after %u clocks", host.tx_frame & 0xFF, host.tx_falls);
+                host_pull(DATA, false);
+                host.state = HOST_IDLE;
+                return;
+            }
+            if (!fell) return;
+            if (++host.tx_falls == 1) host.tx_first_fall = now_us;
+            if (host.tx_falls <= 10) {
+                host_pull(DATA, !((host.tx_frame >> (host.tx_falls - 1)) & 1));
+                return;
+            }
+            host.acked = !(lines & DATA);
+            if (!host.acked) host_fail("no ACK at clock 11 for host byte 0x%02X", host.tx_frame & 0xFF);
+            host.state = HOST_TAIL;
+            host.until = now_us + I8042_TAIL_US;
+            return;
+
+        case HOST_TAIL:
+            if (fell) {
+                host_fail("clock 12 after host byte 0x%02X", host.tx_frame & 0xFF);
+            } else if ((int32_t)(now_us - host.until) >= 0) {
+                host.state = HOST_IDLE;
+            }
+            return;
+
+        case HOST_IDLE:
+            break;
+    }
+
+    if (host.bits > 0 && now_us - host.last_fall > I8042_BIT_TIMEOUT_US) {
+        host_fail("device frame stalled after %u clocks", host.bits);
+        host.frame = 0;
+        host.bits = 0;
+    }
+    if (fell) {
+        host_device_fall(lines);
+    } else if (host.tx_count > 0 && host.bits == 0 && clk) {
+        host_rts();
+    }
+}
+
+static void run_us(uint32_t us) {
+    while (us--) {
+        host_tick();
+        now_us++;
+        bench_now_ms = now_us / 1000;
+    }
+}
+
+// The firmware's busy-waits run the bus
+void wait_us(int us) {
+    run_us(us);
+}
+
+void wait_ms(int ms) {
+    run_us(ms * 1000);
+}
+
+static void firmware_pass(void) {
+    ps2_timer_run(timer_read32());
+    ps2_keyboard_task();
+    run_us(PASS_US);
+}
+
+static bool host_quiet(void) {
+    return host.state == HOST_IDLE && host.tx_count == 0 && host.bits == 0;
+}
+
+// =============================================================================
+// SCRIPTS
+// =============================================================================
+
+static report_keyboard_t report;
+static char script_note[96];  // Printed under the script's result
+static uint32_t last_cmd_us;  // Request to send of the last cmd step
+static bool latency_pending;
+
+// Set 2 make codes of a-z, for burst
+static const uint8_t letter_codes[26] = {
+    0x1C, 0x32, 0x21, 0x23, 0x24, 0x2B, 0x34, 0x33, 0x43, 0x3B, 0x42, 0x4B, 0x3A,
+    0x31, 0x44, 0x4D, 0x15, 0x2D, 0x1B, 0x2C, 0x3C, 0x2A, 0x1D, 0x22, 0x35, 0x1A,
+};
+
+static void report_key(uint8_t keycode, bool down) {
+    for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        if (down ? report.keys[i] == 0 : report.keys[i] == keycode) {
+            report.keys[i] = down ? keycode : 0;
+            break;
+        }
+    }
+    ps2_send_keyboard(P, &report);
+}
+
+static uint8_t parse_bytes(const char *args, uint8_t *out, uint8_t max) {
+    uint8_t count = 0;
+    char *end;
+
+    while (count < max) {
+        unsigned long value = strtoul(args, &end, 16);
+        if (end == args) break;
+        out[count++] = value;
+        args = end;
+    }
+    return count;
+}
+
+static bool step_cmd(const char *args, bool parity_ok, char *why, size_t why_len) {
+    uint8_t bytes[8];
+    uint8_t count = parse_bytes(args, bytes, sizeof(bytes));
+
+    if (count == 0) {
+        snprintf(why, why_len, "no bytes");
+        return false;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        uint16_t answered = host.rx_count;
+        host_queue(bytes[i], parity_ok);
+        // Send it and let the device answer, or take the timeout
+        uint32_t start = now_us;
+        while ((host.tx_count > 0 || host.state == HOST_RTS) && now_us - start < I8042_RTS_TIMEOUT_US) {
+            firmware_pass();
+        }
+        last_cmd_us = host.tx_start - I8042_RTS_HOLD_US;
+        latency_pending = true;
+        while (host.state == HOST_SENDING || host.state == HOST_TAIL) {
+            firmware_pass();
+        }
+        if (!host.acked) {
+            snprintf(why, why_len, "0x%02X not ACKed", bytes[i]);
+            return false;
+        }
+        // Arguments go after the ACK, like atkbd's ps2_command()
+        if (i + 1 < count) {
+            for (uint32_t t = 0; t < EXPECT_QUIET_MS * 1000 && host.rx_count == answered; t += PASS_US) {
+                firmware_pass();
+            }
+            if (host.rx_count == answered || host.rx[answered] != PS2_ACK) {
+                snprintf(why, why_len, "0x%02X not answered FA", bytes[i]);
+                return false;
+            }
+            host.rx_read = host.rx_count;
+        }
+    }
+    return true;
+}
+
+static bool step_expect(const char *args, char *why, size_t why_len) {
+    uint8_t want[32];
+    uint8_t count = parse_bytes(args, want, sizeof(want));
+    uint32_t quiet = 0;
+
+    // Until it is all in and the link has been quiet a while
+    while (quiet < EXPECT_QUIET_MS * 1000) {
+        uint16_t before = host.rx_count;
+        firmware_pass();
+        quiet = host.rx_count != before || !host_quiet() || ps2_keyboard_busy() ? 0 : quiet + PASS_US;
+    }
+
+    uint16_t got = host.rx_count - host.rx_read;
+    bool ok = got == count && memcmp(host.rx + host.rx_read, want, count) == 0;
+    if (!ok) {
+        int len = snprintf(why, why_len, "got");
+        for (uint16_t i = 0; i < got && len < (int)why_len; i++) {
+            len += snprintf(why + len, why_len - len, " %02X", host.rx[host.rx_read + i]);
+        }
+        if (got == 0 && len < (int)why_len) snprintf(why + len, why_len - len, " nothing");
+    }
+    if (ok && count > 0 && latency_pending) {
+        uint32_t us = host.rx_us[host.rx_read] - last_cmd_us;
+        stats.latency_min = us < stats.latency_min ? us : stats.latency_min;
+        stats.latency_max = us > stats.latency_max ? us : stats.latency_max;
+        stats.latency_sum += us;
+        stats.latency_count++;
+    }
+    latency_pending = false;
+    host.rx_read = host.rx_count;
+    return ok;
+}
+
+static bool step_burst(uint32_t keys, char *why, size_t why_len) {
+    uint32_t fed = 0, bytes = 0;
+    uint32_t start = now_us;
+
+    host.rx_count = host.rx_read = 0;
+    while ((fed < keys * 2 || ps2_keyboard_busy() || !host_quiet()) && now_us - start < keys * 50000) {
+        if (fed < keys * 2 && P->event_count == 0) {
+            report_key(KC_A + (fed / 2) % 26, !(fed & 1));
+            fed++;
+        }
+        firmware_pass();
+
+        // Check and drop what came in, so the log never fills
+        for (uint16_t i = 0; i < host.rx_count; i++, bytes++) {
+            uint8_t want = bytes % 3 == 1 ? 0xF0 : letter_codes[(bytes / 3) % 26];
+            if (host.rx[i] != want) {
+                snprintf(why, why_len, "byte %u: got %02X, not %02X", bytes, host.rx[i], want);
+                return false;
+            }
+        }
+        host.rx_count = host.rx_read = 0;
+    }
+
+    uint32_t us = now_us - start;
+    if (bytes != keys * 3) {
+        snprintf(why, why_len, "%u of %u bytes", bytes, keys * 3);
+        return false;
+    }
+    snprintf(script_note, sizeof(script_note), "burst: %u keys, %u bytes in %.1fms: %.0f bytes/s, %.1f keys/s", keys,
+             bytes, us / 1000.0, bytes * 1e6 / us, keys * 1e6 / us);
+    return true;
+}
+
+static bool step_run(const char *line, char *why, size_t why_len) {
+    char op[16];
+    int used = 0;
+    unsigned a = 0, b = 0;
+
+    if (sscanf(line, " %15s%n", op, &used) != 1 || op[0] == '#') return true;
+    const char *args = line + used;
+
+    if (strcmp(op, "cmd") == 0) return step_cmd(args, true, why, why_len);
+    if (strcmp(op, "badparity") == 0) return step_cmd(args, false, why, why_len);
+    if (strcmp(op, "expect") == 0) return step_expect(args, why, why_len);
+    if (strcmp(op, "resend") == 0) {
+        host.resend_next = true;
+        return true;
+    }
+
+    int n = sscanf(args, "%x %x", &a, &b);
+    if (strcmp(op, "press") == 0 && n >= 1) {
+        report_key(a, true);
+    } else if (strcmp(op, "release") == 0 && n >= 1) {
+        report_key(a, false);
+    } else if (strcmp(op, "inhibit") == 0 && sscanf(args, "%u %u", &a, &b) == 2) {
+        host.fault = FAULT_INHIBIT;
+        host.fault_fall = a;
+        host.fault_us = b;
+    } else if (strcmp(op, "rts") == 0 && sscanf(args, "%u %x", &a, &b) == 2) {
+        host.fault = FAULT_RTS;
+        host.fault_fall = a;
+        host.fault_byte = b;
+    } else if (strcmp(op, "hold") == 0 && sscanf(args, "%u", &a) == 1) {
+        host.hold_us = a;
+    } else if (strcmp(op, "leds") == 0 && n >= 1) {
+        uint8_t leds = P->leds.scroll_lock | P->leds.num_lock << 1 | P->leds.caps_lock << 2;
+        if (leds != a) snprintf(why, why_len, "LEDs are %u", leds);
+        return leds == a;
+    } else if (strcmp(op, "set") == 0 && n >= 1) {
+        if (P->scancode_set != a) snprintf(why, why_len, "on set %u", P->scancode_set);
+        return P->scancode_set == a;
+    } else if (strcmp(op, "wait") == 0 && sscanf(args, "%u", &a) == 1) {
+        for (uint32_t t = 0; t < a * 1000; t += PASS_US) {
+            firmware_pass();
+        }
+    } else if (strcmp(op, "burst") == 0 && sscanf(args, "%u", &a) == 1) {
+        return step_burst(a, why, why_len);
+    } else {
+        snprintf(why, why_len, "bad step");
+        return false;
+    }
+    return true;
+}
+
+static void script_reset(void) {
+    memset(&host, 0, sizeof(host));
+    memset(&report, 0, sizeof(report));
+    script_note[0] = '\0';
+    ps2_gpio_sim.host_low = 0;
+    prev_clk = true;
+    latency_pending = false;
+}
+
+static void script_run(const char *name, const char *text) {
+    char line[128];
+    char why[128] = "";
+    unsigned steps = 0;
+    bool ok = true;
+
+    script_reset();
+    while (*text != '\0' && ok) {
+        size_t len = strcspn(text, "\n");
+        snprintf(line, sizeof(line), "%.*s", (int)len, text);
+        text += len + (text[len] == '\n');
+        if (strspn(line, " \t\r") == strlen(line)) continue;
+
+        host_error[0] = '\0';
+        ok = step_run(line, why, sizeof(why));
+        if (ok && host_error[0] != '\0') {
+            ok = false;
+            snprintf(why, sizeof(why), "%s", host_error);
+        }
+        steps++;
+    }
+    if (ok) {
+        // Leave the link drained for the next script
+        char tail[96] = "";
+        ok = step_expect("", tail, sizeof(tail));
+        if (!ok) snprintf(why, sizeof(why), "left over: %s", tail);
+        if (!ok) snprintf(line, sizeof(line), "(end)");
+    }
+    check(ok, "%s (%u steps)", name, steps);
+    if (!ok) printf("        at `%s`: %s\n", line, why);
+    if (script_note[0] != '\0') printf("        %s\n", script_note);
+}
+
+typedef struct {
+    const char *name;
+    const char *text;
+} script_t;
+
+static const script_t scripts[] = {
+    {"atkbd probe and setup",
+     "cmd FF\n"
+     "expect FA AA\n"
+     "cmd F2\n"
+     "expect FA AB 83\n"
+     "cmd F0 02\n"
+     "expect FA\n"
+     "set 2\n"
+     "cmd F0 00\n"
+     "expect FA 02\n"
+     "cmd F3 00\n"
+     "expect FA\n"
+     "cmd ED 07\n"
+     "expect FA\n"
+     "leds 7\n"
+     "cmd ED 02\n"
+     "expect FA\n"
+     "leds 2\n"
+     "cmd F4\n"
+     "expect FA\n"
+     "cmd EE\n"
+     "expect EE\n"
+     "cmd F7\n"
+     "expect FE\n"},
+    {"typing",
+     "press 04\n"
+     "expect 1C\n"
+     "release 04\n"
+     "expect F0 1C\n"
+     "press 4F\n"
+     "expect E0 74\n"
+     "release 4F\n"
+     "expect E0 F0 74\n"},
+    {"host asks for a Resend",
+     "resend\n"
+     "press 04\n"
+     "expect 1C\n"
+     "resend\n"
+     "release 04\n"
+     "expect F0 1C\n"},
+    {"Resend in the middle of an answer",
+     "resend\n"
+     "cmd F2\n"
+     "expect FA AB 83\n"},
+    {"bad parity from the host",
+     "badparity ED\n"
+     "expect FE\n"
+     "cmd ED 04\n"
+     "expect FA\n"
+     "leds 4\n"
+     "cmd ED 00\n"
+     "expect FA\n"},
+    {"inhibit mid-frame",
+     "inhibit 1 400\n"
+     "press 04\n"
+     "expect 1C\n"
+     "inhibit 5 400\n"
+     "release 04\n"
+     "expect F0 1C\n"
+     "inhibit 10 2000\n"
+     "press 05\n"
+     "expect 32\n"
+     "# After the 11th clock the byte is in: not sent twice\n"
+     "inhibit 11 400\n"
+     "release 05\n"
+     "expect F0 32\n"},
+    {"host command interrupts a frame",
+     "rts 4 ED\n"
+     "press 04\n"
+     "expect FA 1C\n"
+     "cmd 01\n"
+     "expect FA\n"
+     "leds 1\n"
+     "rts 9 F2\n"
+     "release 04\n"
+     "expect FA AB 83 F0 1C\n"
+     "cmd ED 00\n"
+     "expect FA\n"},
+    {"host slow to read",
+     "hold 1500\n"
+     "press 04\n"
+     "release 04\n"
+     "expect 1C F0 1C\n"
+     "cmd F2\n"
+     "expect FA AB 83\n"
+     "burst 26\n"
+     "hold 0\n"},
+    {"throughput", "burst 500\n"},
+};
+
+// =============================================================================
+// XT AGAINST SET 2
+// =============================================================================
+
+#define TAPS 300
+
+// Tap i: a letter, an arrow or a modifier in turn. Set 2 takes 3, 5 and 3
+// bytes for them (1C F0 1C, E0 6B E0 F0 6B, 12 F0 12), XT 2, 4 and 2.
+static void tap_report(uint32_t i, bool down) {
+    static const uint8_t arrows[] = {KC_LEFT, KC_RIGHT, KC_UP, KC_DOWN};
+    static const uint8_t mods[] = {MOD_BIT(KC_LCTL), MOD_BIT(KC_LSFT), MOD_BIT(KC_LALT)};
+
+    switch (i % 3) {
+        case 0:
+            report_key(KC_A + (i / 3) % 26, down);
+            break;
+        case 1:
+            report_key(arrows[(i / 3) % 4], down);
+            break;
+        default:
+            report.mods = down ? mods[(i / 3) % 3] : 0;
+            ps2_send_keyboard(P, &report);
+            break;
+    }
+}
+
+// TAPS taps as fast as the link takes them; returns the time in us, 0 if
+// the bytes didn't come through
+static uint32_t wire_taps(ps2_protocol_t protocol, uint32_t *bytes) {
+    uint32_t want = protocol == PS2_PROTOCOL_XT ? TAPS / 3 * 8 : TAPS / 3 * 11;
+    uint32_t fed = 0;
+    uint32_t start = now_us;
+
+    script_reset();
+    host.xt = protocol == PS2_PROTOCOL_XT;
+    host_error[0] = '\0';
+    ps2_keyboard_set_protocol(protocol);
+    *bytes = 0;
+    while ((fed < TAPS * 2 || ps2_keyboard_busy() || !host_quiet()) && now_us - start < TAPS * 50000) {
+        if (fed < TAPS * 2 && P->event_count == 0) {
+            tap_report(fed / 2, !(fed & 1));
+            fed++;
+        }
+        firmware_pass();
+        *bytes += host.rx_count;
+        host.rx_count = host.rx_read = 0;
+    }
+    ps2_keyboard_set_protocol(PS2_PROTOCOL_AT);
+
+    uint32_t us = now_us - start;
+    check(*bytes == want && host_error[0] == '\0', "%s: %u taps, %u bytes in %.2fs, %.0f keys/s%s%s",
+          protocol == PS2_PROTOCOL_XT ? "XT" : "set 2", TAPS, *bytes, us / 1e6, TAPS * 1e6 / us,
+          host_error[0] != '\0' ? ": " : "", host_error);
+    return *bytes == want ? us : 0;
+}
+
+static void xt_against_set2(void) {
+    uint32_t at_bytes, xt_bytes;
+
+    printf("XT against set 2 (letter, arrow, modifier taps)\n");
+    uint32_t at_us = wire_taps(PS2_PROTOCOL_AT, &at_bytes);
+    uint32_t xt_us = wire_taps(PS2_PROTOCOL_XT, &xt_bytes);
+    if (at_us > 0 && xt_us > 0) {
+        check(xt_us < at_us, "XT %.0f%% faster: %u%% of the bytes, 10 clocks a frame against 11",
+              (at_us - xt_us) * 100.0 / xt_us, xt_bytes * 100 / at_bytes);
+    }
+}
+
+static bool script_file(const char *path) {
+    static char text[64 * 1024];
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    size_t len = fread(text, 1, sizeof(text) - 1, file);
+    text[len] = '\0';
+    fclose(file);
+    script_run(path, text);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    ps2_keyboard_init();
+    ps2_keyboard_set_protocol(PS2_PROTOCOL_AT);
+    run_us(1000);
+
+    printf("scripts\n");
+    for (size_t i = 0; i < sizeof(scripts) / sizeof(scripts[0]); i++) {
+        script_run(scripts[i].name, scripts[i].text);
+    }
+    for (int i = 1; i < argc; i++) {
+        if (!script_file(argv[i])) failures++;
+    }
+    xt_against_set2();
+
+    printf("timing\n");
+    if (stats.latency_count > 0) {
+        printf("  command to first answer:  %u-%uus, mean %.0fus (%u commands, RTS to stop bit)\n",
+               stats.latency_min, stats.latency_max, (double)stats.latency_sum / stats.latency_count,
+               stats.latency_count);
+    }
+    if (stats.recovery_count > 0) {
+        printf("  inhibit to byte through:  %u-%uus, mean %.0fus (%u inhibits, release to stop bit)\n",
+               stats.recovery_min, stats.recovery_max, (double)stats.recovery_sum / stats.recovery_count,
+               stats.recovery_count);
+    }
+
+    printf("%s (%d failed)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
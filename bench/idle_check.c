@@ -0,0 +1,306 @@
+// idle_check.c - the idle planner and sleep (ps2_idle.c)
+//
+// The plan is arithmetic: deadlines folded in, a busy flag, and a budget
+// of 0 below PS2_IDLE_MIN_SLEEP_MS and at most PS2_IDLE_MAX_SLEEP_MS. Its
+// checks cover both ends and a clock about to wrap.
+//
+// The sleep is ChibiOS code, built here against a fake kernel
+// (qmk_shim/ch.h and hal.h). chThdSuspendTimeoutS() moves the clock on
+// until the timeout, or until an edge scripted for that sleep resumes it.
+// matrix.c runs a 4-key direct-pin board with MATRIX_SIM_EDGES, and a
+// pass is what QMK's main loop does: scan, ps2_idle_note_scan() from
+// matrix_scan_kb(), then the plan and the sleep. Checks that an idle loop
+// sleeps the whole budget, that a key wakes it and holds it awake for
+// PS2_IDLE_HOLDOFF_MS, that CLK held low or falling and the mode switch
+// keep it awake, and that a key pressed while the matrix is being read
+// isn't slept through. Exits 1 if any check fails.
+//
+//   make idle
+#define MATRIX_ROWS 1
+#define MATRIX_COLS 4
+#define DIRECT_PINS { { GP0, GP1, GP2, GP3 } }
+#define MATRIX_SIM_EDGES
+
+#include "matrix.c"
+
+// The sleep half, against the kernel below
+#define PROTOCOL_CHIBIOS
+#include "ps2_idle.c"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+extern uint32_t bench_now_ms;
+
+void matrix_sim_edge(uint8_t source);
+
+static int failures;
+
+static void check(bool ok, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    printf("  %s  ", ok ? "ok  " : "FAIL");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    if (!ok) failures++;
+}
+
+// =============================================================================
+// FAKE KERNEL
+// =============================================================================
+
+static struct {
+    bool asleep;
+    bool resumed;
+    uint32_t suspends;
+    uint32_t slept_ms;  // The last suspend, until its timeout or a resume
+    // Runs once, `event_ms` into the next suspend: an ISR firing
+    void (*event)(void);
+    uint32_t event_ms;
+    palcallback_t callback[32];
+    void *arg[32];
+    uint32_t armed;  // Bit per line with its event enabled
+} os;
+
+void chSysLock(void) {}
+void chSysUnlock(void) {}
+void chSysLockFromISR(void) {}
+void chSysUnlockFromISR(void) {}
+
+void chThdResumeI(thread_reference_t *trp, msg_t msg) {
+    if (os.asleep) os.resumed = true;
+}
+
+msg_t chThdSuspendTimeoutS(thread_reference_t *trp, sysinterval_t timeout) {
+    os.suspends++;
+    os.asleep = true;
+    os.resumed = false;
+    for (os.slept_ms = 0; os.slept_ms < timeout && !os.resumed;) {
+        bench_now_ms++;
+        os.slept_ms++;
+        if (os.event != NULL && os.slept_ms == os.event_ms) {
+            void (*event)(void) = os.event;
+            os.event = NULL;
+            event();
+        }
+    }
+    os.asleep = false;
+    return os.resumed ? MSG_OK : MSG_TIMEOUT;
+}
+
+void palSetLineCallback(pin_t line, palcallback_t cb, void *arg) {
+    os.callback[line] = cb;
+    os.arg[line] = arg;
+}
+
+void palEnableLineEvent(pin_t line, uint32_t mode) {
+    os.armed |= 1UL << line;
+}
+
+void palDisableLineEvent(pin_t line) {
+    os.armed &= ~(1UL << line);
+}
+
+bool palReadLine(pin_t line) {
+    return PS2_GPIO_IN() & PS2_GPIO_MASK(line);
+}
+
+// An edge on `line`: its ISR runs if the event is enabled
+static void line_edge(pin_t line) {
+    if ((os.armed & (1UL << line)) && os.callback[line] != NULL) os.callback[line](os.arg[line]);
+}
+
+// =============================================================================
+// BOARD AND MAIN LOOP
+// =============================================================================
+
+static uint32_t held;        // GPIO bits of the keys down
+static uint32_t after_read;  // Keys pressed right after the next bank read
+static matrix_row_t reported[MATRIX_ROWS];
+
+uint32_t matrix_sim_read(uint32_t rows_low) {
+    uint32_t bank = ~held;
+
+    for (uint32_t keys = after_read; keys; keys &= keys - 1) {
+        held |= 1UL << __builtin_ctz(keys);
+        matrix_sim_edge(__builtin_ctz(keys));
+    }
+    after_read = 0;
+    return bank;
+}
+
+static void key(uint8_t col, bool down) {
+    if (down) {
+        held |= 1UL << col;
+    } else {
+        held &= ~(1UL << col);
+    }
+    matrix_sim_edge(col);
+}
+
+static void key_0_down(void) {
+    key(0, true);
+}
+
+static void key_0_up(void) {
+    key(0, false);
+}
+
+static void host_clk_falls(void) {
+    ps2_gpio_sim.host_low |= PS2_KB_CLK;
+    line_edge(PS2_KEYBOARD_CLOCK_PIN);
+}
+
+static void mode_switch_flips(void) {
+    line_edge(MODE_SWITCH_PIN);
+}
+
+static bool is_reported(uint8_t col) {
+    return reported[0] & (MATRIX_ROW_SHIFTER << col);
+}
+
+// One main loop pass; `between` runs after the scan, before the sleep.
+// Returns the ms slept, 0 if it didn't suspend.
+static uint32_t pass_with(void (*between)(void)) {
+    uint32_t suspends = os.suspends;
+
+    matrix_scan_custom(reported);
+    ps2_idle_note_scan();  // matrix_scan_kb()
+    if (between != NULL) between();
+
+    ps2_idle_plan_t plan;
+    ps2_idle_plan_begin(&plan, timer_read32());
+    matrix_idle_plan(&plan);
+    ps2_idle_sleep(&plan);
+
+    if (os.suspends == suspends) {
+        bench_now_ms++;  // The rest of the pass
+        return 0;
+    }
+    return os.slept_ms;
+}
+
+static uint32_t pass(void) {
+    return pass_with(NULL);
+}
+
+// Until a pass sleeps out its whole budget
+static void settle(void) {
+    for (int i = 0; i < 1000 && pass() != PS2_IDLE_MAX_SLEEP_MS; i++) {
+    }
+}
+
+// =============================================================================
+// SCENARIOS
+// =============================================================================
+
+static uint32_t budget_for(uint32_t now, uint32_t deadline, bool busy) {
+    ps2_idle_plan_t plan;
+    ps2_idle_plan_begin(&plan, now);
+    ps2_idle_plan_deadline(&plan, deadline);
+    if (busy) ps2_idle_plan_busy(&plan);
+    return ps2_idle_plan_budget(&plan);
+}
+
+static void scenario_plan(void) {
+    ps2_idle_plan_t plan;
+
+    printf("plan and budget\n");
+    ps2_idle_plan_begin(&plan, 1000);
+    check(ps2_idle_plan_budget(&plan) == PS2_IDLE_MAX_SLEEP_MS, "nothing due: %u ms", PS2_IDLE_MAX_SLEEP_MS);
+
+    ps2_idle_plan_deadline(&plan, 1030);
+    ps2_idle_plan_deadline(&plan, 1050);
+    check(ps2_idle_plan_budget(&plan) == 30, "earliest deadline wins: 30 ms");
+    ps2_idle_plan_busy(&plan);
+    check(ps2_idle_plan_budget(&plan) == 0, "busy: no sleep");
+
+    check(budget_for(1000, 1000 + PS2_IDLE_MAX_SLEEP_MS + 500, false) == PS2_IDLE_MAX_SLEEP_MS,
+          "far deadline cut to %u ms", PS2_IDLE_MAX_SLEEP_MS);
+    check(budget_for(1000, 1000 + PS2_IDLE_MIN_SLEEP_MS, false) == PS2_IDLE_MIN_SLEEP_MS, "%u ms away: sleeps",
+          PS2_IDLE_MIN_SLEEP_MS);
+    check(budget_for(1000, 1000 + PS2_IDLE_MIN_SLEEP_MS - 1, false) == 0, "closer than %u ms: no sleep",
+          PS2_IDLE_MIN_SLEEP_MS);
+    check(budget_for(1000, 1000, false) == 0 && budget_for(1000, 990, false) == 0, "due now or overdue: no sleep");
+
+    check(budget_for(0xFFFFFFF0u, 0x00000018u, false) == 40, "deadline past the wrap: 40 ms");
+    check(budget_for(0x00000008u, 0xFFFFFFF8u, false) == 0, "overdue from before the wrap: no sleep");
+}
+
+static void scenario_sleep(void) {
+    uint32_t slept;
+
+    printf("sleep\n");
+    settle();
+    slept = pass();
+    check(slept == PS2_IDLE_MAX_SLEEP_MS && os.armed == 1UL << MODE_SWITCH_PIN,
+          "idle: sleeps %u ms, CLK disarmed after", slept);
+
+    os.event = key_0_down;
+    os.event_ms = 30;
+    slept = pass();
+    check(slept == 30, "key pressed 30 ms in: woken (%u ms)", slept);
+    uint32_t woke = bench_now_ms;
+    pass();
+    check(is_reported(0), "and reported on the next scan");
+
+    while (pass() == 0) {
+    }
+    check(bench_now_ms - os.slept_ms - woke >= PS2_IDLE_HOLDOFF_MS, "awake %u ms after it (holdoff %u ms)",
+          bench_now_ms - os.slept_ms - woke, PS2_IDLE_HOLDOFF_MS);
+
+    os.event = key_0_up;
+    os.event_ms = 10;
+    pass();
+    for (int i = 0; i < 100 && is_reported(0); i++) pass();
+    check(!is_reported(0), "released while asleep: reported after the debounce");
+    settle();
+
+    ps2_gpio_sim.host_low |= PS2_KB_CLK;
+    check(pass() == 0, "host holding CLK low: no sleep");
+    ps2_gpio_sim.host_low &= ~PS2_KB_CLK;
+    settle();
+
+    os.event = host_clk_falls;
+    os.event_ms = 10;
+    slept = pass();
+    check(slept == 10 && os.armed == 1UL << MODE_SWITCH_PIN, "CLK falls 10 ms in: woken (%u ms), disarmed after",
+          slept);
+    ps2_gpio_sim.host_low &= ~PS2_KB_CLK;
+    settle();
+
+    check(pass_with(mode_switch_flips) == 0, "mode switch flipped after the scan: no sleep");
+    settle();
+}
+
+static void scenario_during_scan(void) {
+    printf("key pressed while the matrix is read\n");
+    settle();
+
+    // The first key comes in while the loop is awake; the second just
+    // after the scan has read the bank
+    key(1, true);
+    after_read = 1UL << 2;
+    uint32_t start = bench_now_ms;
+    uint32_t slept = pass();
+    check(is_reported(1) && !is_reported(2), "first key reported, second missed by the read");
+    check(slept == 0, "no sleep with the second key's edge unscanned (slept %u ms)", slept);
+    pass();
+    check(is_reported(2), "second key reported %u ms after the first", bench_now_ms - start);
+}
+
+int main(void) {
+    ps2_gpio_sim.oe = 0;
+    bench_now_ms = 1000;
+    ps2_idle_init();
+    matrix_init_custom();
+
+    scenario_plan();
+    scenario_sleep();
+    scenario_during_scan();
+
+    printf("%s (%d failed)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,69 @@
+// matrix_bench.c - matrix.c on a full-size board
+//
+// Builds the real matrix.c for a 112-key diode matrix: 8 rows (GP20-GP27)
+// by 14 columns (GP0-GP13, consecutive, so each row is one shift). These
+// are bit positions in the simulated bank; a Pico has fewer free pins (see
+// the README for a 5x12 layout it can wire). The
+// simulated bank answers with the columns of whatever keys the bench holds
+// in the rows being pulled low. The row settle delay is skipped like every
+// other wait, so a pass here is the CPU part of a scan; on the RP2040 add
+// MATRIX_ROWS * MATRIX_ROW_SETTLE_US.
+#define MATRIX_ROWS 8
+#define MATRIX_COLS 14
+#define MATRIX_ROW_PINS { GP20, GP21, GP22, GP23, GP24, GP25, GP26, GP27 }
+#define MATRIX_COL_PINS { GP0, GP1, GP2, GP3, GP4, GP5, GP6, GP7, GP8, GP9, GP10, GP11, GP12, GP13 }
+
+#include "matrix.c"
+
+extern uint32_t bench_now_ms;
+
+static volatile uint32_t bench_sink;  // Keeps results alive
+
+static matrix_row_t held_keys[MATRIX_ROWS];  // What the fingers are on
+static matrix_row_t reported[MATRIX_ROWS];   // QMK's copy
+
+uint32_t matrix_sim_read(uint32_t rows_low) {
+    uint32_t cols = 0;
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        if (rows_low & PS2_GPIO_MASK(row_pins[row])) cols |= (uint32_t)held_keys[row] << col_run;
+    }
+    return ~cols;
+}
+
+static void bench_matrix_reset(void) {
+    memset(held_keys, 0, sizeof(held_keys));
+    memset(reported, 0, sizeof(reported));
+    ps2_gpio_sim.oe = 0;
+    matrix_init_custom();
+}
+
+// Nothing held, clock standing still: sample and compare, nothing to count
+uint32_t bench_matrix_idle(uint32_t iterations) {
+    uint32_t changes = 0;
+
+    bench_matrix_reset();
+    for (uint32_t i = 0; i < iterations; i++) {
+        changes += matrix_scan_custom(reported);
+    }
+    bench_sink = changes;
+    return iterations;
+}
+
+// Typing: a new key goes down every ms while the one pressed 3 ms earlier
+// comes up, so there are always presses, releases and counts running
+uint32_t bench_matrix_typing(uint32_t iterations) {
+    uint32_t changes = 0;
+
+    bench_matrix_reset();
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint32_t down = (i * 37) % (MATRIX_ROWS * MATRIX_COLS);
+        uint32_t up = ((i - 3) * 37) % (MATRIX_ROWS * MATRIX_COLS);
+
+        held_keys[down / MATRIX_COLS] |= MATRIX_ROW_SHIFTER << (down % MATRIX_COLS);
+        if (i >= 3) held_keys[up / MATRIX_COLS] &= ~(MATRIX_ROW_SHIFTER << (up % MATRIX_COLS));
+        bench_now_ms++;
+        changes += matrix_scan_custom(reported);
+    }
+    bench_sink = changes;
+    return iterations;
+}
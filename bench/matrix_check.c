@@ -0,0 +1,163 @@
+// matrix_check.c - matrix.c's scan skipping on a diode matrix
+//
+// Builds the real matrix.c for the 8x14 board of matrix_bench.c with
+// MATRIX_SIM_EDGES, which compiles in the scan skip that the edge ISR
+// allows on the keyboard. The harness stands in for the ISR: whenever the
+// keys it holds change, it raises an edge on every column whose level
+// changed with all rows held low, which is all the hardware would see.
+//
+// Checks that every press and release is reported, including those on the
+// column of a key already held (no edge at all), that an idle matrix still
+// skips its scans, and what the idle sleep is cut to while a key is down.
+// Exits 1 if any check fails.
+//
+//   make matrix
+#define MATRIX_ROWS 8
+#define MATRIX_COLS 14
+#define MATRIX_ROW_PINS { GP20, GP21, GP22, GP23, GP24, GP25, GP26, GP27 }
+#define MATRIX_COL_PINS { GP0, GP1, GP2, GP3, GP4, GP5, GP6, GP7, GP8, GP9, GP10, GP11, GP12, GP13 }
+#define MATRIX_SIM_EDGES
+
+#include "matrix.c"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+extern uint32_t bench_now_ms;
+
+void matrix_sim_edge(uint8_t source);
+
+static int failures;
+
+static void check(bool ok, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    printf("  %s  ", ok ? "ok  " : "FAIL");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    if (!ok) failures++;
+}
+
+static matrix_row_t held_keys[MATRIX_ROWS];  // What the fingers are on
+static matrix_row_t reported[MATRIX_ROWS];   // QMK's copy
+static uint32_t bank_reads;
+static uint32_t edges_raised;
+
+uint32_t matrix_sim_read(uint32_t rows_low) {
+    uint32_t cols = 0;
+
+    bank_reads++;
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        if (rows_low & PS2_GPIO_MASK(row_pins[row])) cols |= (uint32_t)held_keys[row] << col_run;
+    }
+    return ~cols;
+}
+
+// Columns as the ISR sees them between scans, every row low
+static matrix_row_t columns_low(void) {
+    matrix_row_t cols = 0;
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) cols |= held_keys[row];
+    return cols;
+}
+
+static void key(uint8_t row, uint8_t col, bool down) {
+    matrix_row_t before = columns_low();
+
+    if (down) {
+        held_keys[row] |= MATRIX_ROW_SHIFTER << col;
+    } else {
+        held_keys[row] &= ~(MATRIX_ROW_SHIFTER << col);
+    }
+    for (matrix_row_t moved = before ^ columns_low(); moved; moved &= moved - 1) {
+        matrix_sim_edge(__builtin_ctz(moved));
+        edges_raised++;
+    }
+}
+
+static bool is_reported(uint8_t row, uint8_t col) {
+    return reported[row] & (MATRIX_ROW_SHIFTER << col);
+}
+
+// One scan per ms; the number of passes until (row, col) reads `down`
+// in QMK's copy, 0 if it never does within `limit`
+static uint32_t scans_until(uint8_t row, uint8_t col, bool down, uint32_t limit) {
+    for (uint32_t i = 1; i <= limit; i++) {
+        bench_now_ms++;
+        matrix_scan_custom(reported);
+        if (is_reported(row, col) == down) return i;
+    }
+    return 0;
+}
+
+// Bank reads per pass over `passes` passes with nothing moving
+static double idle_reads(uint32_t passes) {
+    uint32_t start = bank_reads;
+    for (uint32_t i = 0; i < passes; i++) {
+        bench_now_ms++;
+        matrix_scan_custom(reported);
+    }
+    return (double)(bank_reads - start) / passes;
+}
+
+static uint32_t idle_budget(void) {
+    ps2_idle_plan_t plan;
+    ps2_idle_plan_begin(&plan, timer_read32());
+    matrix_idle_plan(&plan);
+    return ps2_idle_plan_budget(&plan);
+}
+
+int main(void) {
+    const uint32_t release_limit = MATRIX_DEBOUNCE_MS + 2;
+    uint32_t n;
+
+    ps2_gpio_sim.oe = 0;
+    matrix_init_custom();
+    bench_now_ms = 1000;
+    matrix_scan_custom(reported);  // The startup scan
+
+    printf("idle\n");
+    double reads = idle_reads(1000);
+    check(reads == 1, "nothing held: %.2f bank reads per pass, no row walk", reads);
+    check(idle_budget() == PS2_IDLE_MAX_SLEEP_MS, "idle sleep not cut (%u ms)", idle_budget());
+
+    printf("keys on one column (row 0 and row 1, column 3)\n");
+    key(0, 3, true);
+    n = scans_until(0, 3, true, 1);
+    check(n == 1 && edges_raised == 1, "first key: edge, reported on the next scan");
+
+    key(1, 3, true);
+    n = scans_until(1, 3, true, 1);
+    check(n == 1 && edges_raised == 1, "second key: no edge, still reported on the next scan");
+    check(idle_budget() == PS2_IDLE_MIN_SLEEP_MS, "idle sleep cut to %u ms while a column is low", idle_budget());
+
+    reads = idle_reads(100);
+    check(reads == MATRIX_ROWS + 2, "a key down: every pass scans (%.2f bank reads per pass)", reads);
+
+    key(1, 3, false);
+    n = scans_until(1, 3, false, release_limit);
+    check(n > 0 && n <= MATRIX_DEBOUNCE_MS + 1 && edges_raised == 1 && is_reported(0, 3),
+          "second key let go: no edge, released after %u scans, first key still down", n);
+
+    key(1, 3, true);
+    n = scans_until(1, 3, true, 1);
+    check(n == 1, "second key again, reported on the next scan");
+
+    key(0, 3, false);
+    n = scans_until(0, 3, false, release_limit);
+    check(n > 0 && n <= MATRIX_DEBOUNCE_MS + 1 && edges_raised == 1 && is_reported(1, 3),
+          "first key let go under the second: released after %u scans", n);
+
+    key(1, 3, false);
+    n = scans_until(1, 3, false, release_limit);
+    check(n > 0 && edges_raised == 2, "last key let go: edge, released after %u scans", n);
+
+    printf("idle again\n");
+    reads = idle_reads(1000);
+    check(reads == 1, "nothing held: back to %.2f bank reads per pass", reads);
+    check(idle_budget() == PS2_IDLE_MAX_SLEEP_MS, "idle sleep not cut (%u ms)", idle_budget());
+
+    printf("%s (%d failed)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
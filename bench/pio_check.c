@@ -0,0 +1,581 @@
+// pio_check.c - the PIO transceiver against a simulated PS/2 host
+//
+// Runs ps2_pio_program (the words the firmware loads) in the PIO
+// interpreter, pio_sim.c, on a simulated bus with 1us resolution: the state
+// machine steps every 5us (PS2_PIO_HZ), a host model clocks frames in and
+// out and inhibits when told to, and every edge is logged. The firmware's
+// ps2_keyboard.c is built with PS2_PIO_ENABLE on top of it, its
+// ps2_pio_*() calls served from here.
+//
+// Checks framing, parity, inhibit aborts, host-to-device frames with their
+// ACK and the device clock against the PS/2 timing limits, then clocks the
+// same byte out bit-banged (ps2_send_byte, its delays advancing the
+// simulated bus) for comparison. Exits 1 if any check fails.
+//
+//   make pio
+#define PS2_PIO_ENABLE
+#include "ps2_keyboard.c"
+
+#include "ps2_pio_program.h"
+#include "pio_sim.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#define P (&ps2_ports[0])
+
+extern uint32_t bench_now_ms;
+
+#define CLK PS2_KB_CLK
+#define DATA PS2_KB_DATA
+
+#define PIO_US_PER_CYCLE (1000000 / PS2_PIO_HZ)
+
+// PS/2 device clock limits: 10-16.7kHz, each phase 30-50us, DATA changes
+// at least 5us after CLK rises and 5-25us before it falls
+#define SPEC_PHASE_MIN 30
+#define SPEC_PHASE_MAX 50
+#define SPEC_SETUP_MIN 5
+#define SPEC_SETUP_MAX 25
+#define SPEC_HOLD_MIN 5
+
+static int failures;
+
+static void check(bool ok, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    printf("  %s  ", ok ? "ok  " : "FAIL");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    if (!ok) failures++;
+}
+
+// =============================================================================
+// BUS
+// =============================================================================
+
+static uint32_t now_us;
+static uint32_t host_pull;  // Lines the host model is pulling low
+static pio_sim_t pio;
+static bool pio_running;
+
+static uint32_t bus_lines(void) {
+    uint32_t low = ps2_gpio_sim.oe | host_pull | (pio_running ? pio_sim_pulled_low(&pio) : 0);
+    return ~low;
+}
+
+// Edge log: every change of CLK or DATA
+#define LOG_SIZE 4096
+
+typedef struct {
+    uint32_t us;
+    bool clk, data;
+} edge_t;
+
+static edge_t edges[LOG_SIZE];
+static uint16_t edge_count;
+static uint32_t last_lines;
+
+static void log_edges(void) {
+    uint32_t lines = bus_lines() & (CLK | DATA);
+    if (lines == last_lines || edge_count == LOG_SIZE) return;
+    edges[edge_count++] = (edge_t){now_us, lines & CLK, lines & DATA};
+    last_lines = lines;
+}
+
+static void log_reset(void) {
+    edge_count = 0;
+    last_lines = bus_lines() & (CLK | DATA);
+}
+
+// =============================================================================
+// HOST MODEL
+// =============================================================================
+
+typedef enum { HOST_IDLE, HOST_RTS, HOST_SENDING } host_state_t;
+
+static struct {
+    // Device-to-host: bits clocked in on CLK falls
+    uint16_t frame;
+    uint8_t bits;
+    uint32_t last_fall;
+    uint8_t rx[64];
+    uint8_t rx_count;
+    uint8_t rx_errors;
+    uint16_t falls;  // Device CLK falls seen
+
+    // Host-to-device: D0 goes out on the first CLK fall, then parity and
+    // stop, and the ACK is read on the 11th. A fall right after it is a
+    // 12th clock.
+    host_state_t state;
+    uint16_t tx_frame;
+    uint8_t tx_falls;
+    uint32_t rts_at;
+    bool acked;
+    uint32_t acked_at;
+    uint8_t extra_clocks;
+} host;
+
+static bool prev_clk = true;
+
+static void host_set_data(bool high) {
+    host_pull = high ? host_pull & ~DATA : host_pull | DATA;
+}
+
+static void host_tick(void) {
+    uint32_t lines = bus_lines();
+    bool clk = lines & CLK;
+    bool fell = prev_clk && !clk && !(host_pull & CLK);
+    prev_clk = clk;
+
+    switch (host.state) {
+        case HOST_RTS:
+            // CLK low 100us, then DATA low (start) and CLK released
+            if (now_us - host.rts_at >= 100) {
+                host_set_data(false);
+                host_pull &= ~CLK;
+                prev_clk = true;
+                host.state = HOST_SENDING;
+                host.tx_falls = 0;
+            }
+            return;
+
+        case HOST_SENDING:
+            if (!fell) return;
+            if (++host.tx_falls <= 10) {
+                host_set_data((host.tx_frame >> (host.tx_falls - 1)) & 1);
+            } else {
+                host.acked = !(lines & DATA);
+                host.acked_at = now_us;
+                host.state = HOST_IDLE;
+            }
+            return;
+
+        case HOST_IDLE:
+            break;
+    }
+
+    // A frame that stalls for a millisecond is abandoned
+    if (host.bits > 0 && now_us - host.last_fall > 1000) host.bits = 0;
+    if (!fell) return;
+    if (host.acked && now_us - host.acked_at < 150) {
+        host.extra_clocks++;
+        return;
+    }
+
+    host.falls++;
+    host.last_fall = now_us;
+    host.frame |= (uint16_t)((lines & DATA) ? 1 : 0) << host.bits;
+    if (++host.bits < 11) return;
+
+    uint8_t data = (host.frame >> 1) & 0xFF;
+    bool ok = !(host.frame & 1) && ((host.frame >> 10) & 1) && __builtin_parity((host.frame >> 1) & 0x1FF);
+    if (ok && host.rx_count < sizeof(host.rx)) {
+        host.rx[host.rx_count++] = data;
+    } else if (!ok) {
+        host.rx_errors++;
+    }
+    host.frame = 0;
+    host.bits = 0;
+}
+
+static void host_reset(void) {
+    memset(&host, 0, sizeof(host));
+    host_pull = 0;
+    prev_clk = true;
+}
+
+// Inhibit: CLK held low. Drops any partial frame.
+static void host_inhibit(bool on) {
+    host_pull = on ? host_pull | CLK : host_pull & ~CLK;
+    host.frame = 0;
+    host.bits = 0;
+}
+
+// Start a host-to-device frame: the start bit is DATA pulled low, then 8
+// data, parity (`parity_ok` false sends the wrong one), stop
+static void host_send(uint8_t data, bool parity_ok) {
+    bool parity = !__builtin_parity(data) ^ !parity_ok;
+    host.tx_frame = data | ((uint16_t)parity << 8) | (1u << 9);
+    host.state = HOST_RTS;
+    host.rts_at = now_us;
+    host.tx_falls = 0;
+    host.acked = false;
+    host.extra_clocks = 0;
+    host_pull |= CLK;
+}
+
+// =============================================================================
+// CLOCK
+// =============================================================================
+
+static void bus_sync(void) {
+    uint32_t pio_low = pio_running ? pio_sim_pulled_low(&pio) : 0;
+    ps2_gpio_sim.host_low = host_pull | pio_low;
+}
+
+static void tick(void) {
+    if (pio_running && now_us % PIO_US_PER_CYCLE == 0) {
+        pio_sim_step(&pio, bus_lines());
+    }
+    host_tick();
+    bus_sync();
+    log_edges();
+
+    now_us++;
+    bench_now_ms = now_us / 1000;
+}
+
+static void run_us(uint32_t us) {
+    while (us--) tick();
+}
+
+// The firmware's busy-waits run the bus, so bit-banged frames are timed too
+void wait_us(int us) {
+    bus_sync();
+    log_edges();
+    run_us(us);
+}
+
+// =============================================================================
+// PS2_PIO_*: THE STATE MACHINE, SIMULATED
+// =============================================================================
+
+bool ps2_pio_init(uint8_t port, pin_t clk_pin, pin_t data_pin) {
+    if (port != 0 || data_pin != clk_pin + 1) return false;
+
+    pio_sim_config_t cfg = {
+        .program = ps2_pio_program,
+        .length = PS2_PIO_PROGRAM_LENGTH,
+        .wrap_target = PS2_PIO_WRAP_TARGET,
+        .wrap = PS2_PIO_WRAP,
+        .sideset_bits = PS2_PIO_SIDESET_BITS,
+        .sideset_pindirs = true,
+        .sideset_base = clk_pin,
+        .set_base = clk_pin,
+        .set_count = 2,
+        .out_base = data_pin,
+        .out_count = 1,
+        .in_base = data_pin,
+        .jmp_pin = clk_pin,
+        .in_shift_right = true,
+        .out_shift_right = true,
+        .status_n = 1,
+    };
+    pio.pins = 0;
+    pio.pindirs = 0;
+    pio_sim_init(&pio, &cfg);
+    pio_running = true;
+    bus_sync();
+    return true;
+}
+
+void ps2_pio_stop(uint8_t port, pin_t clk_pin, pin_t data_pin) {
+    pio_running = false;
+    bus_sync();
+}
+
+void ps2_pio_put(uint8_t port, uint32_t word) {
+    if (!pio_sim_put(&pio, word)) check(false, "TX FIFO overflow");
+}
+
+bool ps2_pio_get(uint8_t port, uint32_t *word) {
+    return pio_sim_get(&pio, word);
+}
+
+// Run until the state machine reports something, `limit_us` at most
+static bool pio_wait_word(uint32_t *word, uint32_t limit_us) {
+    for (uint32_t t = 0; t < limit_us; t++) {
+        if (pio_sim_get(&pio, word)) return true;
+        tick();
+    }
+    return false;
+}
+
+static void pio_fresh(void) {
+    host_reset();
+    ps2_gpio_sim.oe = 0;
+    ps2_pio_init(0, PS2_KEYBOARD_CLOCK_PIN, PS2_KEYBOARD_DATA_PIN);
+    run_us(200);
+    log_reset();
+}
+
+// =============================================================================
+// TIMING
+// =============================================================================
+
+typedef struct {
+    uint32_t low_min, low_max, high_min, high_max;
+    uint32_t setup_min, setup_max;  // DATA change to CLK fall
+    uint32_t hold_min;              // CLK rise to DATA change
+    uint32_t period_max;            // CLK fall to fall
+    uint32_t frame_us;              // First CLK fall to last CLK rise, last frame
+    uint16_t clocks;
+} timing_t;
+
+#define FRAME_GAP_US 200  // CLK high longer than this: a new frame
+
+// Device frame edges in the log: phases between CLK edges, and where each
+// DATA change falls within the high phase around it
+static timing_t timing_measure(void) {
+    timing_t t = {UINT32_MAX, 0, UINT32_MAX, 0, UINT32_MAX, 0, UINT32_MAX, 0, 0, 0};
+    uint32_t last_fall = 0, last_rise = 0, first_fall = 0, data_change = 0;
+    bool clk = true, data = true, have_rise = false, have_change = false;
+
+    for (uint16_t i = 0; i < edge_count; i++) {
+        const edge_t *e = &edges[i];
+
+        if (e->clk != clk) {
+            if (!e->clk) {
+                if (have_rise && e->us - last_rise > FRAME_GAP_US) have_rise = false;
+                if (!have_rise) first_fall = e->us;
+                if (have_rise) {
+                    uint32_t period = e->us - last_fall;
+                    t.period_max = period > t.period_max ? period : t.period_max;
+                    uint32_t high = e->us - last_rise;
+                    t.high_min = high < t.high_min ? high : t.high_min;
+                    t.high_max = high > t.high_max ? high : t.high_max;
+                }
+                if (have_change) {
+                    uint32_t setup = e->us - data_change;
+                    t.setup_min = setup < t.setup_min ? setup : t.setup_min;
+                    t.setup_max = setup > t.setup_max ? setup : t.setup_max;
+                    have_change = false;
+                }
+                last_fall = e->us;
+                t.clocks++;
+            } else {
+                uint32_t low = e->us - last_fall;
+                t.low_min = low < t.low_min ? low : t.low_min;
+                t.low_max = low > t.low_max ? low : t.low_max;
+                last_rise = e->us;
+                have_rise = true;
+                t.frame_us = e->us - first_fall;
+            }
+            clk = e->clk;
+        }
+        if (e->data != data) {
+            if (have_rise && clk) {
+                uint32_t hold = e->us - last_rise;
+                t.hold_min = hold < t.hold_min ? hold : t.hold_min;
+            }
+            data_change = e->us;
+            have_change = true;
+            data = e->data;
+        }
+    }
+    return t;
+}
+
+static bool timing_in_spec(const timing_t *t) {
+    return t->low_min >= SPEC_PHASE_MIN && t->low_max <= SPEC_PHASE_MAX && t->high_min >= SPEC_PHASE_MIN &&
+           t->high_max <= SPEC_PHASE_MAX && t->setup_min >= SPEC_SETUP_MIN && t->setup_max <= SPEC_SETUP_MAX &&
+           t->hold_min >= SPEC_HOLD_MIN;
+}
+
+static void timing_print(const char *name, const timing_t *t) {
+    printf("  %-10s %3u-%-3u   %3u-%-3u   %4u-%-4u  %4u   %5u   %5.1f\n", name, t->low_min, t->low_max, t->high_min,
+           t->high_max, t->setup_min, t->setup_max, t->hold_min, t->frame_us, 1000.0 / t->period_max);
+}
+
+// =============================================================================
+// SCENARIOS
+// =============================================================================
+
+static timing_t pio_timing;
+
+static void scenario_tx(void) {
+    static const uint8_t bytes[] = {0x1C, 0xF0, 0xAA, 0x00, 0xFF, 0xE0};
+    bool all_sent = true;
+    uint32_t word;
+
+    printf("device to host\n");
+    pio_fresh();
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        ps2_pio_put(0, ps2_pio_tx_word(bytes[i]));
+        all_sent &= pio_wait_word(&word, 5000) && word == PS2_PIO_SENT;
+    }
+    run_us(500);
+
+    check(all_sent, "%zu frames reported SENT", sizeof(bytes));
+    check(host.rx_count == sizeof(bytes) && memcmp(host.rx, bytes, sizeof(bytes)) == 0 && host.rx_errors == 0,
+          "host read them back, parity and stop bits good (%u bytes, %u errors)", host.rx_count, host.rx_errors);
+
+    pio_timing = timing_measure();
+    check(pio_timing.clocks == 11 * sizeof(bytes), "11 clocks per frame (%u)", pio_timing.clocks);
+    check(timing_in_spec(&pio_timing),
+          "CLK low %u-%uus, high %u-%uus, DATA %u-%uus before fall and %uus+ after rise", pio_timing.low_min,
+          pio_timing.low_max, pio_timing.high_min, pio_timing.high_max, pio_timing.setup_min, pio_timing.setup_max,
+          pio_timing.hold_min);
+}
+
+static void scenario_inhibit_mid_frame(void) {
+    uint32_t word = 0;
+
+    printf("host inhibits mid-frame\n");
+    pio_fresh();
+    ps2_pio_put(0, ps2_pio_tx_word(0x1C));
+    for (uint32_t t = 0; t < 5000 && host.falls < 4; t++) tick();
+    host_inhibit(true);
+    bool reported = pio_wait_word(&word, 500);
+    check(reported && word == PS2_PIO_ABORTED, "state machine reports ABORTED (0x%08X)", word);
+    check(bus_lines() & DATA, "DATA released while CLK is held");
+    check(host.rx_count == 0, "no byte reached the host");
+
+    host_inhibit(false);
+    run_us(2000);
+    check(host.falls == 4, "no clocks after the host lets go, until told");
+
+    ps2_pio_put(0, ps2_pio_tx_word(0x1C));
+    bool sent = pio_wait_word(&word, 5000) && word == PS2_PIO_SENT;
+    run_us(200);
+    check(sent && host.rx_count == 1 && host.rx[0] == 0x1C, "sent again in full");
+}
+
+static void scenario_inhibit_before(void) {
+    uint32_t word;
+
+    printf("host inhibits before the frame\n");
+    pio_fresh();
+    host_inhibit(true);
+    ps2_pio_put(0, ps2_pio_tx_word(0x5A));
+    run_us(3000);
+    check(host.falls == 0 && pio.rx_level == 0, "nothing clocked while CLK is held");
+
+    host_inhibit(false);
+    uint32_t released = now_us;
+    log_reset();
+    bool sent = pio_wait_word(&word, 5000) && word == PS2_PIO_SENT;
+    uint32_t first_fall = 0;
+    for (uint16_t i = 0; i < edge_count; i++) {
+        if (!edges[i].clk) {
+            first_fall = edges[i].us;
+            break;
+        }
+    }
+    run_us(200);
+    check(sent && host.rx_count == 1 && host.rx[0] == 0x5A, "sent once the host lets go");
+    check(first_fall - released >= 50, "first clock %uus after release (50us+)", first_fall - released);
+}
+
+static void scenario_host_frames(void) {
+    uint32_t word = 0;
+
+    printf("host to device\n");
+    pio_fresh();
+    host_send(0xED, true);
+    bool got = pio_wait_word(&word, 5000);
+    run_us(200);
+    check(got && ps2_pio_rx_data(word) == 0xED && ps2_pio_rx_parity_ok(word) && ps2_pio_rx_stop_ok(word),
+          "0xED clocked in (word 0x%08X)", word);
+    check(host.acked && host.extra_clocks == 0, "host saw the ACK on clock 11, no 12th clock");
+    check((bus_lines() & (CLK | DATA)) == (CLK | DATA), "both lines released after");
+
+    host_send(0x55, false);
+    got = pio_wait_word(&word, 5000);
+    run_us(200);
+    check(got && ps2_pio_rx_data(word) == 0x55 && !ps2_pio_rx_parity_ok(word), "bad parity flagged");
+
+    // Inhibit halfway through a host frame: the host gave up on it
+    host_send(0xF4, true);
+    for (uint32_t t = 0; t < 5000 && host.tx_falls < 5; t++) tick();
+    host.state = HOST_IDLE;
+    host_pull = CLK;
+    got = pio_wait_word(&word, 500);
+    host_inhibit(false);
+    run_us(500);
+    check(got && word == PS2_PIO_ABORTED, "host frame abandoned mid-way reports ABORTED (0x%08X)", word);
+}
+
+// Run the firmware and the bus until the host has `count` bytes
+static bool firmware_run(uint8_t count, uint32_t limit_us) {
+    for (uint32_t t = 0; t < limit_us && host.rx_count < count; t += 50) {
+        ps2_timer_run(timer_read32());
+        ps2_keyboard_task();
+        run_us(50);
+    }
+    return host.rx_count >= count;
+}
+
+static void scenario_firmware(void) {
+    printf("firmware on the PIO (PS2_PIO_ENABLE)\n");
+    host_reset();
+    ps2_gpio_sim.oe = 0;
+    ps2_keyboard_init();
+    ps2_keyboard_set_protocol(PS2_PROTOCOL_AT);
+    check(P->pio && pio_running, "port 0 runs on the state machine");
+    run_us(200);
+
+    report_keyboard_t report = {0};
+    report.keys[0] = KC_A;
+    ps2_send_keyboard(P, &report);
+    report.keys[0] = 0;
+    ps2_send_keyboard(P, &report);
+    bool ok = firmware_run(3, 50000);
+    check(ok && host.rx[0] == 0x1C && host.rx[1] == 0xF0 && host.rx[2] == 0x1C, "A press/release: 1C F0 1C");
+
+    host_reset();
+    host_send(PS2_CMD_RESET, true);
+    ok = firmware_run(2, 50000);
+    check(ok && host.acked && host.rx[0] == PS2_ACK && host.rx[1] == PS2_BAT_SUCCESS, "reset (FF) answered FA AA");
+
+    // Inhibit during the answer: the byte stays queued and goes out whole
+    host_reset();
+    host_send(PS2_CMD_ECHO, true);
+    for (uint32_t t = 0; t < 20000 && host.falls < 3; t += 5) {
+        ps2_keyboard_task();
+        run_us(5);
+    }
+    host_inhibit(true);
+    for (uint32_t t = 0; t < 1000; t += 50) {
+        ps2_keyboard_task();
+        run_us(50);
+    }
+    host_inhibit(false);
+    ok = firmware_run(1, 50000);
+    check(ok && host.rx[0] == PS2_ECHO_RESPONSE && host.rx_errors == 0, "echo inhibited mid-frame, resent whole");
+    firmware_run(UINT8_MAX, 2000);  // The SENT word lands after the last clock
+    check(!ps2_keyboard_busy(), "port idle afterwards");
+
+    // Off to USB mode: the state machine has to let go of the pins
+    ps2_keyboard_stop();
+    check(!pio_running && !P->pio, "state machine stopped on the way to USB");
+    ps2_keyboard_init();
+    ps2_keyboard_set_protocol(PS2_PROTOCOL_AT);
+    check(P->pio && pio_running, "and started again on the way back");
+}
+
+static void scenario_compare(void) {
+    timing_t soft;
+
+    printf("bit-banged vs PIO\n");
+    ps2_pio_stop(0, P->clk_pin, P->data_pin);
+    P->pio = false;
+    host_reset();
+    run_us(200);
+    log_reset();
+
+    bool sent = ps2_send_byte(P, 0x1C);
+    soft = timing_measure();
+    check(sent && host.rx_count == 1 && host.rx[0] == 0x1C, "bit-banged frame reads back");
+
+    printf("             CLK low   CLK high  DATA setup  hold   frame   kHz\n");
+    timing_print("bit-bang", &soft);
+    timing_print("pio", &pio_timing);
+    printf("  (PS/2 limits: 30-50us per phase, setup 5-25us, hold 5us+, 10-16.7kHz; reported only)\n");
+}
+
+int main(void) {
+    scenario_tx();
+    scenario_inhibit_mid_frame();
+    scenario_inhibit_before();
+    scenario_host_frames();
+    scenario_firmware();
+    scenario_compare();
+
+    if (pio.error) check(false, "interpreter: %s", pio.error);
+    printf("%s (%d failed)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,271 @@
+// pio_sim.c - cycle-accurate RP2040 PIO state machine, for the host
+#include "pio_sim.h"
+
+#include <string.h>
+
+enum { OP_JMP, OP_WAIT, OP_IN, OP_OUT, OP_PUSH_PULL, OP_MOV, OP_IRQ, OP_SET };
+
+static uint32_t rotr(uint32_t v, uint8_t n) {
+    n &= 31;
+    return n ? (v >> n) | (v << (32 - n)) : v;
+}
+
+static uint32_t low_mask(uint8_t n) {
+    return n >= 32 ? 0xFFFFFFFFu : (1u << n) - 1;
+}
+
+// Write `count` pins from `base` (wrapping at 31) to the low bits of `value`
+static void write_pins(uint32_t *latch, uint8_t base, uint8_t count, uint32_t value) {
+    for (uint8_t i = 0; i < count; i++) {
+        uint32_t bit = 1u << ((base + i) & 31);
+        *latch = (value >> i) & 1 ? *latch | bit : *latch & ~bit;
+    }
+}
+
+static uint8_t threshold(uint8_t n) {
+    return n ? n : 32;
+}
+
+void pio_sim_init(pio_sim_t *sm, const pio_sim_config_t *cfg) {
+    uint32_t pins = sm->pins, pindirs = sm->pindirs;
+
+    memset(sm, 0, sizeof(*sm));
+    sm->cfg = *cfg;
+    sm->pc = cfg->wrap_target;
+    sm->osr_count = 32;
+    sm->pins = pins;
+    sm->pindirs = pindirs;
+}
+
+bool pio_sim_put(pio_sim_t *sm, uint32_t word) {
+    if (sm->tx_level == PIO_SIM_FIFO_DEPTH) return false;
+    sm->tx_fifo[(sm->tx_head + sm->tx_level++) % PIO_SIM_FIFO_DEPTH] = word;
+    return true;
+}
+
+bool pio_sim_get(pio_sim_t *sm, uint32_t *word) {
+    if (sm->rx_level == 0) return false;
+    *word = sm->rx_fifo[sm->rx_head];
+    sm->rx_head = (sm->rx_head + 1) % PIO_SIM_FIFO_DEPTH;
+    sm->rx_level--;
+    return true;
+}
+
+static uint32_t mov_source(pio_sim_t *sm, uint8_t src, uint32_t in) {
+    switch (src) {
+        case 0: return rotr(in, sm->cfg.in_base);
+        case 1: return sm->x;
+        case 2: return sm->y;
+        case 3: return 0;
+        case 5: {
+            uint8_t level = sm->cfg.status_rx ? sm->rx_level : sm->tx_level;
+            return level < sm->cfg.status_n ? 0xFFFFFFFFu : 0;
+        }
+        case 6: return sm->isr;
+        case 7: return sm->osr;
+    }
+    sm->error = "MOV: reserved source";
+    return 0;
+}
+
+// Execute `insn`. False if it stalls; *jump gets a taken branch's target.
+static bool execute(pio_sim_t *sm, uint16_t insn, uint32_t in, int *jump) {
+    uint8_t arg1 = (insn >> 5) & 7;
+    uint8_t arg2 = insn & 0x1F;
+
+    switch (insn >> 13) {
+        case OP_JMP: {
+            bool take = false;
+            switch (arg1) {
+                case 0: take = true; break;
+                case 1: take = sm->x == 0; break;
+                case 2: take = sm->x-- != 0; break;
+                case 3: take = sm->y == 0; break;
+                case 4: take = sm->y-- != 0; break;
+                case 5: take = sm->x != sm->y; break;
+                case 6: take = (in >> sm->cfg.jmp_pin) & 1; break;
+                case 7: take = sm->osr_count < threshold(sm->cfg.pull_threshold); break;
+            }
+            if (take) *jump = arg2;
+            return true;
+        }
+
+        case OP_WAIT: {
+            bool polarity = (insn >> 7) & 1;
+            uint8_t source = (insn >> 5) & 3;
+            bool level;
+            if (source == 0) {
+                level = (in >> arg2) & 1;
+            } else if (source == 1) {
+                level = (in >> ((sm->cfg.in_base + arg2) & 31)) & 1;
+            } else {
+                sm->error = "WAIT: only GPIO and PIN sources are modelled";
+                return true;
+            }
+            return level == polarity;
+        }
+
+        case OP_IN: {
+            uint8_t n = arg2 ? arg2 : 32;
+            uint32_t data;
+            switch (arg1) {
+                case 0: data = rotr(in, sm->cfg.in_base); break;
+                case 1: data = sm->x; break;
+                case 2: data = sm->y; break;
+                case 3: data = 0; break;
+                case 6: data = sm->isr; break;
+                case 7: data = sm->osr; break;
+                default: sm->error = "IN: reserved source"; return true;
+            }
+            data &= low_mask(n);
+            if (n == 32) {
+                sm->isr = data;
+            } else if (sm->cfg.in_shift_right) {
+                sm->isr = (sm->isr >> n) | (data << (32 - n));
+            } else {
+                sm->isr = (sm->isr << n) | data;
+            }
+            sm->isr_count = sm->isr_count + n > 32 ? 32 : sm->isr_count + n;
+            return true;
+        }
+
+        case OP_OUT: {
+            uint8_t n = arg2 ? arg2 : 32;
+            uint32_t data;
+            if (n == 32) {
+                data = sm->osr;
+                sm->osr = 0;
+            } else if (sm->cfg.out_shift_right) {
+                data = sm->osr & low_mask(n);
+                sm->osr >>= n;
+            } else {
+                data = sm->osr >> (32 - n);
+                sm->osr <<= n;
+            }
+            sm->osr_count = sm->osr_count + n > 32 ? 32 : sm->osr_count + n;
+            switch (arg1) {
+                case 0: write_pins(&sm->pins, sm->cfg.out_base, sm->cfg.out_count, data); break;
+                case 1: sm->x = data; break;
+                case 2: sm->y = data; break;
+                case 3: break;
+                case 4: write_pins(&sm->pindirs, sm->cfg.out_base, sm->cfg.out_count, data); break;
+                case 5: *jump = data & 0x1F; break;
+                case 6: sm->isr = data; sm->isr_count = n; break;
+                case 7: sm->error = "OUT EXEC is not modelled"; break;
+            }
+            return true;
+        }
+
+        case OP_PUSH_PULL: {
+            bool pull = (insn >> 7) & 1;
+            bool if_cond = (insn >> 6) & 1;
+            bool block = (insn >> 5) & 1;
+
+            if (!pull) {
+                if (if_cond && sm->isr_count < threshold(sm->cfg.push_threshold)) return true;
+                if (sm->rx_level == PIO_SIM_FIFO_DEPTH) {
+                    if (block) return false;
+                } else {
+                    sm->rx_fifo[(sm->rx_head + sm->rx_level++) % PIO_SIM_FIFO_DEPTH] = sm->isr;
+                }
+                sm->isr = 0;
+                sm->isr_count = 0;
+            } else {
+                if (if_cond && sm->osr_count < threshold(sm->cfg.pull_threshold)) return true;
+                if (sm->tx_level == 0) {
+                    if (block) return false;
+                    sm->osr = sm->x;  // Non-blocking pull from an empty FIFO
+                } else {
+                    sm->osr = sm->tx_fifo[sm->tx_head];
+                    sm->tx_head = (sm->tx_head + 1) % PIO_SIM_FIFO_DEPTH;
+                    sm->tx_level--;
+                }
+                sm->osr_count = 0;
+            }
+            return true;
+        }
+
+        case OP_MOV: {
+            uint32_t data = mov_source(sm, insn & 7, in);
+            uint8_t op = (insn >> 3) & 3;
+            if (op == 1) {
+                data = ~data;
+            } else if (op == 2) {
+                uint32_t r = 0;
+                for (int i = 0; i < 32; i++) r |= ((data >> i) & 1) << (31 - i);
+                data = r;
+            } else if (op == 3) {
+                sm->error = "MOV: reserved operation";
+            }
+            switch (arg1) {
+                case 0: write_pins(&sm->pins, sm->cfg.out_base, sm->cfg.out_count, data); break;
+                case 1: sm->x = data; break;
+                case 2: sm->y = data; break;
+                case 5: *jump = data & 0x1F; break;
+                case 6: sm->isr = data; sm->isr_count = 0; break;
+                case 7: sm->osr = data; sm->osr_count = 0; break;
+                default: sm->error = "MOV: EXEC and reserved destinations are not modelled"; break;
+            }
+            return true;
+        }
+
+        case OP_IRQ:
+            sm->error = "IRQ is not modelled";
+            return true;
+
+        case OP_SET:
+            switch (arg1) {
+                case 0: write_pins(&sm->pins, sm->cfg.set_base, sm->cfg.set_count, arg2); break;
+                case 1: sm->x = arg2; break;
+                case 2: sm->y = arg2; break;
+                case 4: write_pins(&sm->pindirs, sm->cfg.set_base, sm->cfg.set_count, arg2); break;
+                default: sm->error = "SET: reserved destination"; break;
+            }
+            return true;
+    }
+    return true;
+}
+
+void pio_sim_step(pio_sim_t *sm, uint32_t gpio_in) {
+    if (sm->error) return;
+
+    sm->cycles++;
+    if (sm->delay > 0) {
+        sm->delay--;
+        return;
+    }
+
+    uint16_t insn = sm->cfg.program[sm->pc];
+    uint8_t field = (insn >> 8) & 0x1F;
+    uint8_t delay_bits = 5 - sm->cfg.sideset_bits;
+    uint8_t side_bits = sm->cfg.sideset_bits;
+    uint8_t side = field >> delay_bits;
+    bool side_enabled = side_bits > 0;
+
+    if (sm->cfg.sideset_opt && side_bits > 0) {
+        side_bits--;
+        side_enabled = (side >> side_bits) & 1;
+        side &= low_mask(side_bits);
+    }
+
+    int jump = -1;
+    bool done = execute(sm, insn, gpio_in, &jump);
+
+    // Side-set goes out as the instruction issues, stalled or not, and
+    // overrides whatever the instruction itself wrote to those pins
+    if (side_enabled) {
+        write_pins(sm->cfg.sideset_pindirs ? &sm->pindirs : &sm->pins, sm->cfg.sideset_base, side_bits, side);
+    }
+
+    sm->stalled = !done;
+    if (!done) return;
+
+    sm->delay = field & low_mask(delay_bits);
+    if (jump >= 0) {
+        sm->pc = jump;
+    } else if (sm->pc == sm->cfg.wrap) {
+        sm->pc = sm->cfg.wrap_target;
+    } else {
+        sm->pc = (sm->pc + 1) % 32;
+    }
+}
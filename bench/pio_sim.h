@@ -0,0 +1,71 @@
+// pio_sim.h - cycle-accurate RP2040 PIO state machine, for the host
+//
+// Runs one state machine's program one clock cycle per pio_sim_step(),
+// following the RP2040 datasheet (3.4): side-set applies as an instruction
+// issues, even when it then stalls, and wins over SET/OUT on the same pin;
+// delay cycles start once it completes; 4-deep FIFOs; EXECCTRL wrap and
+// MOV STATUS. IRQ, EXEC and autopull/autopush aren't modelled - a program
+// that needs them stops with `error` set.
+//
+// Pins are the raw 32-bit GPIO bank: pio_sim_step() takes what the pads
+// read, and pio_sim_pulled_low() is what the state machine drives low
+// (output latch 0, pindir 1 - the open drain idiom).
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PIO_SIM_FIFO_DEPTH 4
+
+typedef struct {
+    const uint16_t *program;
+    uint8_t length;
+    uint8_t wrap_target, wrap;
+
+    uint8_t sideset_bits;  // SIDESET_COUNT, the enable bit included
+    bool sideset_opt;
+    bool sideset_pindirs;
+    uint8_t sideset_base;
+    uint8_t set_base, set_count;
+    uint8_t out_base, out_count;
+    uint8_t in_base;
+    uint8_t jmp_pin;
+
+    bool in_shift_right, out_shift_right;
+    uint8_t push_threshold, pull_threshold;  // 32 if 0
+
+    bool status_rx;  // MOV STATUS: RX level (else TX level) < status_n
+    uint8_t status_n;
+} pio_sim_config_t;
+
+typedef struct {
+    pio_sim_config_t cfg;
+
+    uint8_t pc;
+    uint32_t x, y, isr, osr;
+    uint8_t isr_count, osr_count;
+
+    uint32_t tx_fifo[PIO_SIM_FIFO_DEPTH], rx_fifo[PIO_SIM_FIFO_DEPTH];
+    uint8_t tx_head, tx_level, rx_head, rx_level;
+
+    uint32_t pins, pindirs;  // Output latches
+    uint8_t delay;           // Delay cycles still to run
+    bool stalled;            // Current instruction is waiting
+    uint64_t cycles;
+    const char *error;       // Set once the program does something unmodelled
+} pio_sim_t;
+
+// Reset to the state pio_sm_init() leaves: pc at wrap_target, registers,
+// FIFOs and shift counts cleared (OSR empty), output latches kept
+void pio_sim_init(pio_sim_t *sm, const pio_sim_config_t *cfg);
+
+// One clock cycle, `gpio_in` being the pad inputs
+void pio_sim_step(pio_sim_t *sm, uint32_t gpio_in);
+
+// pio_sm_put() / pio_sm_get(): false if the FIFO is full / empty
+bool pio_sim_put(pio_sim_t *sm, uint32_t word);
+bool pio_sim_get(pio_sim_t *sm, uint32_t *word);
+
+static inline uint32_t pio_sim_pulled_low(const pio_sim_t *sm) {
+    return sm->pindirs & ~sm->pins;
+}
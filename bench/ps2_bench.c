@@ -0,0 +1,330 @@
+// ps2_bench.c - Host micro-benchmarks for the PS/2 hot paths
+//
+// Builds the real ps2_keyboard.c (included below, so its static functions
+// are in reach) against the QMK shims in qmk_shim/, with the lines
+// simulated (PS2_GPIO_SIM) and every delay returning at once. Each
+// benchmark reports the best of BENCH_REPEATS runs in ns/op and, where the
+// kernel allows perf counters, instructions/op.
+//
+//   ./ps2_bench            table
+//   ./ps2_bench --json     machine readable, for compare.py
+#include "ps2_keyboard.c"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#define BENCH_REPEATS 7
+#define BENCH_CHURN_REPORTS 1024
+
+#define P (&ps2_ports[0])
+
+static volatile uint32_t bench_sink;  // Keeps results alive
+
+// =============================================================================
+// MEASUREMENT
+// =============================================================================
+
+static int insn_fd = -1;
+
+static void bench_perf_open(void) {
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof(attr),
+        .config = PERF_COUNT_HW_INSTRUCTIONS,
+        .disabled = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    insn_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t bench_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+typedef struct {
+    const char *name;
+    void (*setup)(void);
+    uint32_t (*run)(uint32_t iterations);  // Returns the number of ops done
+    uint32_t iterations;
+} bench_t;
+
+typedef struct {
+    double ns_per_op;
+    double insns_per_op;  // < 0: no perf counters
+} bench_result_t;
+
+static bench_result_t bench_measure(const bench_t *bench) {
+    bench_result_t best = {1e30, -1};
+
+    if (bench->setup) bench->setup();
+    bench->run(bench->iterations / 10 + 1);  // Warm caches and branch predictors
+
+    for (int r = 0; r < BENCH_REPEATS; r++) {
+        uint64_t insns = 0;
+
+        if (insn_fd >= 0) {
+            ioctl(insn_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(insn_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        uint64_t start = bench_ns();
+        uint32_t ops = bench->run(bench->iterations);
+        uint64_t elapsed = bench_ns() - start;
+        if (insn_fd >= 0) {
+            ioctl(insn_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(insn_fd, &insns, sizeof(insns)) != sizeof(insns)) insns = 0;
+        }
+
+        double ns = (double)elapsed / ops;
+        if (ns < best.ns_per_op) {
+            best.ns_per_op = ns;
+            best.insns_per_op = insn_fd >= 0 ? (double)insns / ops : -1;
+        }
+    }
+    return best;
+}
+
+// =============================================================================
+// FIXTURES
+// =============================================================================
+
+// Everything a benchmark op put in send_buffer is thrown away, so the ring
+// never fills and no op is refused for lack of room
+static inline void bench_ring_drop(void) {
+    P->send_buffer_tail = P->send_buffer_head;
+    P->mid_sequence = false;
+}
+
+static void bench_port_reset(void) {
+    ps2_keyboard_init();
+    ps2_keyboard_set_protocol(PS2_PROTOCOL_AT);
+    report_keyboard_t empty = {0};
+    ps2_send_keyboard(P, &empty);
+    report_extra_t none = {REPORT_ID_CONSUMER, 0};
+    ps2_send_extra(P, &none);
+    none.report_id = REPORT_ID_SYSTEM;
+    ps2_send_extra(P, &none);
+    bench_ring_drop();
+    ps2_flight_resume();
+}
+
+// =============================================================================
+// MAPPING
+// =============================================================================
+
+// Every uint16_t keycode: table hits below 0x100, then the linear search
+// through ps2_extended_keys for everything else
+static uint32_t bench_qmk_to_ps2(uint32_t iterations) {
+    uint32_t sink = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        for (uint32_t keycode = 0; keycode <= 0xFFFF; keycode++) {
+            sink += qmk_to_ps2_scancode(keycode).scancode;
+        }
+    }
+    bench_sink = sink;
+    return iterations * 0x10000;
+}
+
+// Every consumer page usage (0x000-0x3FF); unmapped ones cost a full search
+static uint32_t bench_consumer_to_ps2(uint32_t iterations) {
+    uint32_t sink = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+        for (uint16_t usage = 0; usage < 0x400; usage++) {
+            sink += consumer_to_ps2_scancode(usage).scancode;
+        }
+    }
+    bench_sink = sink;
+    return iterations * 0x400;
+}
+
+// =============================================================================
+// REPORT DIFF
+// =============================================================================
+
+// held_N: reports alternate between N-1 and N keys down, so every op is
+// one press or release diffed against N-1 other held keys (held_0 sends
+// the same empty report: the no-change path)
+static report_keyboard_t held_reports[2];
+
+static void bench_held_setup(uint8_t held) {
+    static const uint8_t keys[KEYBOARD_REPORT_KEYS] = {KC_A, KC_S, KC_D, KC_F, KC_UP, KC_SPACE};
+
+    bench_port_reset();
+    memset(held_reports, 0, sizeof(held_reports));
+    for (uint8_t i = 0; i < held; i++) {
+        held_reports[1].keys[i] = keys[i];
+        if (i + 1 < held) held_reports[0].keys[i] = keys[i];
+    }
+}
+
+static void bench_held_0(void) { bench_held_setup(0); }
+static void bench_held_1(void) { bench_held_setup(1); }
+static void bench_held_2(void) { bench_held_setup(2); }
+static void bench_held_3(void) { bench_held_setup(3); }
+static void bench_held_4(void) { bench_held_setup(4); }
+static void bench_held_5(void) { bench_held_setup(5); }
+static void bench_held_6(void) { bench_held_setup(6); }
+
+static uint32_t bench_send_keyboard_held(uint32_t iterations) {
+    for (uint32_t i = 0; i < iterations; i++) {
+        report_keyboard_t report = held_reports[i & 1];
+        ps2_send_keyboard(P, &report);
+        bench_ring_drop();
+    }
+    return iterations;
+}
+
+// Random churn: any mods, 0-6 distinct keys, every report independent of
+// the last. Fixed seed, so runs compare.
+static report_keyboard_t churn_reports[BENCH_CHURN_REPORTS];
+
+static void bench_churn_setup(void) {
+    uint32_t state = 0x2545F491;
+
+    bench_port_reset();
+    for (int r = 0; r < BENCH_CHURN_REPORTS; r++) {
+        report_keyboard_t *report = &churn_reports[r];
+        memset(report, 0, sizeof(*report));
+
+        state ^= state << 13, state ^= state >> 17, state ^= state << 5;
+        report->mods = state & 0xFF;
+        uint8_t count = (state >> 8) % (KEYBOARD_REPORT_KEYS + 1);
+        for (uint8_t i = 0; i < count; i++) {
+            uint8_t keycode;
+            do {
+                state ^= state << 13, state ^= state >> 17, state ^= state << 5;
+                keycode = KC_A + state % (KC_UP - KC_A + 1);
+            } while (report_has_key(report, keycode));
+            report->keys[i] = keycode;
+        }
+    }
+}
+
+static uint32_t bench_send_keyboard_churn(uint32_t iterations) {
+    for (uint32_t i = 0; i < iterations; i++) {
+        report_keyboard_t report = churn_reports[i % BENCH_CHURN_REPORTS];
+        ps2_send_keyboard(P, &report);
+        bench_ring_drop();
+    }
+    return iterations;
+}
+
+// Press/release of one media key, then of one ACPI key
+static uint32_t bench_send_extra_consumer(uint32_t iterations) {
+    for (uint32_t i = 0; i < iterations; i++) {
+        report_extra_t report = {REPORT_ID_CONSUMER, (i & 1) ? 0 : 0x00E9};  // Volume Up
+        ps2_send_extra(P, &report);
+        bench_ring_drop();
+    }
+    return iterations;
+}
+
+static uint32_t bench_send_extra_system(uint32_t iterations) {
+    for (uint32_t i = 0; i < iterations; i++) {
+        report_extra_t report = {REPORT_ID_SYSTEM, (i & 1) ? 0 : 0x0082};  // Sleep
+        ps2_send_extra(P, &report);
+        bench_ring_drop();
+    }
+    return iterations;
+}
+
+// =============================================================================
+// SEND RING
+// =============================================================================
+
+static uint32_t bench_ring_enqueue(uint32_t iterations) {
+    static const uint8_t seq[] = {PS2_PREFIX_E0, PS2_PREFIX_F0, 0x75};  // Up released
+    for (uint32_t i = 0; i < iterations; i++) {
+        ps2_port_send_sequence(P, seq, sizeof(seq));
+        bench_ring_drop();
+    }
+    return iterations;
+}
+
+// One byte in, then out through ps2_port_transmit: a whole simulated frame
+// (bit loop, flight recorder, counters) minus the wire delays
+static uint32_t bench_ring_roundtrip(uint32_t iterations) {
+    uint8_t byte = 0x1C;
+    for (uint32_t i = 0; i < iterations; i++) {
+        ps2_port_send_sequence(P, &byte, 1);
+        ps2_port_transmit(P);
+    }
+    return iterations;
+}
+
+// =============================================================================
+// MATRIX
+// =============================================================================
+
+// matrix_bench.c: one matrix_scan_custom pass over 112 keys
+uint32_t bench_matrix_idle(uint32_t iterations);
+uint32_t bench_matrix_typing(uint32_t iterations);
+
+// =============================================================================
+// MAIN
+// =============================================================================
+
+static const bench_t benches[] = {
+    {"qmk_to_ps2/all_keycodes", NULL, bench_qmk_to_ps2, 20},
+    {"consumer_to_ps2/all_usages", NULL, bench_consumer_to_ps2, 200},
+    {"send_keyboard/held_0", bench_held_0, bench_send_keyboard_held, 200000},
+    {"send_keyboard/held_1", bench_held_1, bench_send_keyboard_held, 200000},
+    {"send_keyboard/held_2", bench_held_2, bench_send_keyboard_held, 200000},
+    {"send_keyboard/held_3", bench_held_3, bench_send_keyboard_held, 200000},
+    {"send_keyboard/held_4", bench_held_4, bench_send_keyboard_held, 200000},
+    {"send_keyboard/held_5", bench_held_5, bench_send_keyboard_held, 200000},
+    {"send_keyboard/held_6", bench_held_6, bench_send_keyboard_held, 200000},
+    {"send_keyboard/random_churn", bench_churn_setup, bench_send_keyboard_churn, 100000},
+    {"send_extra/consumer_toggle", bench_port_reset, bench_send_extra_consumer, 200000},
+    {"send_extra/system_toggle", bench_port_reset, bench_send_extra_system, 200000},
+    {"ring/enqueue_3", bench_port_reset, bench_ring_enqueue, 1000000},
+    {"ring/enqueue_transmit_1", bench_port_reset, bench_ring_roundtrip, 200000},
+    {"matrix/scan_112_idle", NULL, bench_matrix_idle, 200000},
+    {"matrix/scan_112_typing", NULL, bench_matrix_typing, 200000},
+};
+
+#define BENCH_COUNT (sizeof(benches) / sizeof(benches[0]))
+
+int main(int argc, char **argv) {
+    bool json = argc > 1 && strcmp(argv[1], "--json") == 0;
+    bench_result_t results[BENCH_COUNT];
+
+    bench_perf_open();
+    for (size_t i = 0; i < BENCH_COUNT; i++) {
+        results[i] = bench_measure(&benches[i]);
+    }
+
+    if (json) {
+        printf("{\n  \"insns_available\": %s,\n  \"benchmarks\": [\n", insn_fd >= 0 ? "true" : "false");
+        for (size_t i = 0; i < BENCH_COUNT; i++) {
+            printf("    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"insns_per_op\": ", benches[i].name, results[i].ns_per_op);
+            if (results[i].insns_per_op < 0) {
+                printf("null");
+            } else {
+                printf("%.1f", results[i].insns_per_op);
+            }
+            printf("}%s\n", i + 1 < BENCH_COUNT ? "," : "");
+        }
+        printf("  ]\n}\n");
+    } else {
+        printf("%-30s %12s %12s\n", "benchmark", "ns/op", "insns/op");
+        for (size_t i = 0; i < BENCH_COUNT; i++) {
+            printf("%-30s %12.2f ", benches[i].name, results[i].ns_per_op);
+            if (results[i].insns_per_op < 0) {
+                printf("%12s\n", "n/a");
+            } else {
+                printf("%12.1f\n", results[i].insns_per_op);
+            }
+        }
+        if (insn_fd < 0) printf("(no perf counters here - insns/op needs perf_event_paranoid <= 2)\n");
+    }
+    return 0;
+}
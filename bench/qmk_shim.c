@@ -0,0 +1,68 @@
+// qmk_shim.c - bench shim: QMK services the PS/2 sources call
+#include <stdint.h>
+#include "quantum.h"
+#include "send_string.h"
+#include "ps2_gpio.h"
+
+ps2_gpio_sim_t ps2_gpio_sim;  // Nothing pulls the lines low: the host is idle
+
+uint32_t bench_now_ms;
+
+bool debug_enable;
+
+uint32_t timer_read32(void) {
+    return bench_now_ms;
+}
+
+uint32_t timer_elapsed32(uint32_t last) {
+    return bench_now_ms - last;
+}
+
+// pio_check.c runs its simulated bus in wait_us(), wcet_check.c its
+// virtual clock in both
+__attribute__((weak)) void wait_ms(int ms) {}
+__attribute__((weak)) void wait_us(int us) {}
+
+void setPinInputHigh(pin_t pin) {}
+void writePinLow(pin_t pin) {}
+
+__attribute__((weak)) bool readPin(pin_t pin) {
+    return true;
+}
+
+__attribute__((weak)) int uprintf(const char *fmt, ...) {
+    return 0;
+}
+
+// QMK's send_string tables (quantum/send_string/send_string.c), for
+// ps2_send_string.c and stream_check.c. Bit c % 8 of byte c / 8: c is typed
+// with Shift.
+const uint8_t ascii_to_shift_lut[16] = {
+    0, 0, 0, 0, 0x7E, 0x0F, 0, 0xD4, 0xFF, 0xFF, 0xFF, 0xC7, 0, 0, 0, 0x78,
+};
+
+const uint8_t ascii_to_keycode_lut[128] = {
+    ['\b'] = KC_BACKSPACE, ['\t'] = KC_TAB, ['\n'] = KC_ENTER, [0x1B] = KC_ESCAPE,
+    [' '] = KC_SPACE, ['!'] = KC_1, ['"'] = KC_QUOTE, ['#'] = KC_3,
+    ['$'] = KC_4, ['%'] = KC_5, ['&'] = KC_7, ['\''] = KC_QUOTE,
+    ['('] = KC_9, [')'] = KC_0, ['*'] = KC_8, ['+'] = KC_EQUAL,
+    [','] = KC_COMMA, ['-'] = KC_MINUS, ['.'] = KC_DOT, ['/'] = KC_SLASH,
+    ['0'] = KC_0, ['1'] = KC_1, ['2'] = KC_2, ['3'] = KC_3, ['4'] = KC_4,
+    ['5'] = KC_5, ['6'] = KC_6, ['7'] = KC_7, ['8'] = KC_8, ['9'] = KC_9,
+    [':'] = KC_SEMICOLON, [';'] = KC_SEMICOLON, ['<'] = KC_COMMA, ['='] = KC_EQUAL,
+    ['>'] = KC_DOT, ['?'] = KC_SLASH, ['@'] = KC_2,
+    ['A'] = KC_A, ['B'] = KC_B, ['C'] = KC_C, ['D'] = KC_D, ['E'] = KC_E, ['F'] = KC_F,
+    ['G'] = KC_G, ['H'] = KC_H, ['I'] = KC_I, ['J'] = KC_J, ['K'] = KC_K, ['L'] = KC_L,
+    ['M'] = KC_M, ['N'] = KC_N, ['O'] = KC_O, ['P'] = KC_P, ['Q'] = KC_Q, ['R'] = KC_R,
+    ['S'] = KC_S, ['T'] = KC_T, ['U'] = KC_U, ['V'] = KC_V, ['W'] = KC_W, ['X'] = KC_X,
+    ['Y'] = KC_Y, ['Z'] = KC_Z,
+    ['['] = KC_LEFT_BRACKET, ['\\'] = KC_BACKSLASH, [']'] = KC_RIGHT_BRACKET,
+    ['^'] = KC_6, ['_'] = KC_MINUS, ['`'] = KC_GRAVE,
+    ['a'] = KC_A, ['b'] = KC_B, ['c'] = KC_C, ['d'] = KC_D, ['e'] = KC_E, ['f'] = KC_F,
+    ['g'] = KC_G, ['h'] = KC_H, ['i'] = KC_I, ['j'] = KC_J, ['k'] = KC_K, ['l'] = KC_L,
+    ['m'] = KC_M, ['n'] = KC_N, ['o'] = KC_O, ['p'] = KC_P, ['q'] = KC_Q, ['r'] = KC_R,
+    ['s'] = KC_S, ['t'] = KC_T, ['u'] = KC_U, ['v'] = KC_V, ['w'] = KC_W, ['x'] = KC_X,
+    ['y'] = KC_Y, ['z'] = KC_Z,
+    ['{'] = KC_LEFT_BRACKET, ['|'] = KC_BACKSLASH, ['}'] = KC_RIGHT_BRACKET,
+    ['~'] = KC_GRAVE, [0x7F] = KC_DELETE,
+};
@@ -0,0 +1,22 @@
+// ch.h - bench shim: the ChibiOS kernel calls ps2_idle.c makes. Only
+// idle_check.c builds with PROTOCOL_CHIBIOS, and it implements them.
+#pragma once
+
+#include <stdint.h>
+
+typedef int32_t msg_t;
+typedef uint32_t sysinterval_t;
+typedef struct thread *thread_reference_t;
+
+#define MSG_OK      ((msg_t)0)
+#define MSG_TIMEOUT ((msg_t)-1)
+#define MSG_RESET   ((msg_t)-2)
+
+#define TIME_MS2I(ms) ((sysinterval_t)(ms))  // One tick per ms
+
+void chSysLock(void);
+void chSysUnlock(void);
+void chSysLockFromISR(void);
+void chSysUnlockFromISR(void);
+void chThdResumeI(thread_reference_t *trp, msg_t msg);
+msg_t chThdSuspendTimeoutS(thread_reference_t *trp, sysinterval_t timeout);
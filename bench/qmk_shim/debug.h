@@ -0,0 +1,14 @@
+// debug.h - bench shim: QMK's debug switch and dprintf, off unless a bench
+// turns it on
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>  // glibc's own dprintf(fd, ...), declared before the macro hides it
+#include "print.h"
+
+extern bool debug_enable;
+
+#define dprintf(...)                            \
+    do {                                        \
+        if (debug_enable) uprintf(__VA_ARGS__); \
+    } while (0)
@@ -0,0 +1,7 @@
+// eeconfig.h - bench shim: the keyboard's datablock in QMK's EEPROM
+#pragma once
+
+#include <stdint.h>
+
+void eeconfig_read_kb_datablock(void *data, uint32_t offset, uint32_t length);
+void eeconfig_update_kb_datablock(const void *data, uint32_t offset, uint32_t length);
@@ -0,0 +1,44 @@
+// gpio.h - bench shim: pin numbers only (line state is ps2_gpio.h's PS2_GPIO_SIM)
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint32_t pin_t;
+
+#define GP0 0U
+#define GP1 1U
+#define GP2 2U
+#define GP3 3U
+#define GP4 4U
+#define GP5 5U
+#define GP6 6U
+#define GP7 7U
+#define GP8 8U
+#define GP9 9U
+#define GP10 10U
+#define GP11 11U
+#define GP12 12U
+#define GP13 13U
+#define GP14 14U
+#define GP15 15U
+#define GP16 16U
+#define GP17 17U
+#define GP18 18U
+#define GP19 19U
+#define GP20 20U
+#define GP21 21U
+#define GP22 22U
+#define GP23 23U
+#define GP24 24U
+#define GP25 25U
+#define GP26 26U
+#define GP27 27U
+#define GP28 28U
+#define GP29 29U
+
+#define NO_PIN 0xFFFFFFFFU
+
+void setPinInputHigh(pin_t pin);
+void writePinLow(pin_t pin);
+bool readPin(pin_t pin);
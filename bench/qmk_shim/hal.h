@@ -0,0 +1,27 @@
+// hal.h - bench shim: the PAL line events ps2_idle.c arms, implemented by
+// idle_check.c, and the RP2040 timer ps2_time.h reads under MCU_RP
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "gpio.h"
+
+typedef void (*palcallback_t)(void *arg);
+
+#define PAL_EVENT_MODE_RISING_EDGE  1U
+#define PAL_EVENT_MODE_FALLING_EDGE 2U
+#define PAL_EVENT_MODE_BOTH_EDGES   3U
+
+void palSetLineCallback(pin_t line, palcallback_t cb, void *arg);
+void palEnableLineEvent(pin_t line, uint32_t mode);
+void palDisableLineEvent(pin_t line);
+bool palReadLine(pin_t line);
+
+#if defined(MCU_RP)
+// Declared only: make ram compiles objects, never links them
+typedef struct {
+    volatile uint32_t TIMERAWL;
+} bench_rp_timer_t;
+
+extern bench_rp_timer_t *const TIMER;
+#endif
@@ -0,0 +1,10 @@
+// host.h - bench shim: QMK's host driver switch and keyboard state
+#pragma once
+
+#include "host_driver.h"
+
+host_driver_t *host_get_driver(void);
+void host_set_driver(host_driver_t *driver);
+
+void clear_keyboard(void);
+void send_keyboard_report(void);
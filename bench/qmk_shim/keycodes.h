@@ -0,0 +1,65 @@
+// keycodes.h - bench shim: QMK basic keycodes (values as in QMK's keycodes.h)
+#pragma once
+
+enum qk_keycode_defines {
+    KC_NO = 0x0000,
+    KC_A  = 0x0004, KC_B, KC_C, KC_D, KC_E, KC_F, KC_G, KC_H, KC_I, KC_J, KC_K, KC_L, KC_M,
+    KC_N, KC_O, KC_P, KC_Q, KC_R, KC_S, KC_T, KC_U, KC_V, KC_W, KC_X, KC_Y, KC_Z,
+    KC_1, KC_2, KC_3, KC_4, KC_5, KC_6, KC_7, KC_8, KC_9, KC_0,
+    KC_ENTER, KC_ESCAPE, KC_BACKSPACE, KC_TAB, KC_SPACE, KC_MINUS, KC_EQUAL, KC_LEFT_BRACKET,
+    KC_RIGHT_BRACKET, KC_BACKSLASH, KC_NONUS_HASH, KC_SEMICOLON, KC_QUOTE, KC_GRAVE, KC_COMMA,
+    KC_DOT, KC_SLASH, KC_CAPS_LOCK,
+    KC_F1, KC_F2, KC_F3, KC_F4, KC_F5, KC_F6, KC_F7, KC_F8, KC_F9, KC_F10, KC_F11, KC_F12,
+    KC_PRINT_SCREEN, KC_SCROLL_LOCK, KC_PAUSE, KC_INSERT, KC_HOME, KC_PAGE_UP, KC_DELETE, KC_END,
+    KC_PAGE_DOWN, KC_RIGHT, KC_LEFT, KC_DOWN, KC_UP,
+    KC_NUM_LOCK, KC_KP_SLASH, KC_KP_ASTERISK, KC_KP_MINUS, KC_KP_PLUS, KC_KP_ENTER, KC_KP_1,
+    KC_KP_2, KC_KP_3, KC_KP_4, KC_KP_5, KC_KP_6, KC_KP_7, KC_KP_8, KC_KP_9, KC_KP_0, KC_KP_DOT,
+    KC_NONUS_BACKSLASH, KC_APPLICATION, KC_KB_POWER, KC_KP_EQUAL,
+    KC_F13, KC_F14, KC_F15, KC_F16, KC_F17, KC_F18, KC_F19, KC_F20, KC_F21, KC_F22, KC_F23, KC_F24,
+    KC_INTERNATIONAL_1 = 0x0087, KC_INTERNATIONAL_2, KC_INTERNATIONAL_3, KC_INTERNATIONAL_4,
+    KC_INTERNATIONAL_5, KC_INTERNATIONAL_6, KC_INTERNATIONAL_7, KC_INTERNATIONAL_8,
+    KC_INTERNATIONAL_9, KC_LANGUAGE_1, KC_LANGUAGE_2, KC_LANGUAGE_3, KC_LANGUAGE_4, KC_LANGUAGE_5,
+    KC_SYSTEM_POWER = 0x00A5, KC_SYSTEM_SLEEP, KC_SYSTEM_WAKE,
+    KC_AUDIO_MUTE, KC_AUDIO_VOL_UP, KC_AUDIO_VOL_DOWN, KC_MEDIA_NEXT_TRACK, KC_MEDIA_PREV_TRACK,
+    KC_MEDIA_STOP, KC_MEDIA_PLAY_PAUSE, KC_MEDIA_SELECT, KC_MEDIA_EJECT, KC_MAIL, KC_CALCULATOR,
+    KC_MY_COMPUTER, KC_WWW_SEARCH, KC_WWW_HOME, KC_WWW_BACK, KC_WWW_FORWARD, KC_WWW_STOP,
+    KC_WWW_REFRESH, KC_WWW_FAVORITES,
+    KC_LEFT_CTRL = 0x00E0, KC_LEFT_SHIFT, KC_LEFT_ALT, KC_LEFT_GUI,
+    KC_RIGHT_CTRL, KC_RIGHT_SHIFT, KC_RIGHT_ALT, KC_RIGHT_GUI,
+    QK_KB_0 = 0x7E00, QK_KB_1, QK_KB_2, QK_KB_3, QK_KB_4, QK_KB_5, QK_KB_6, QK_KB_7,
+};
+
+#define MOD_BIT(code) (1 << ((code) & 0x07))
+
+// Short aliases (QMK's keycodes.h)
+#define KC_BSPC KC_BACKSPACE
+#define KC_LBRC KC_LEFT_BRACKET
+#define KC_RBRC KC_RIGHT_BRACKET
+#define KC_BSLS KC_BACKSLASH
+#define KC_SCLN KC_SEMICOLON
+#define KC_CAPS KC_CAPS_LOCK
+#define KC_PSCR KC_PRINT_SCREEN
+#define KC_SCRL KC_SCROLL_LOCK
+#define KC_PAUS KC_PAUSE
+#define KC_PGUP KC_PAGE_UP
+#define KC_PGDN KC_PAGE_DOWN
+#define KC_NUM  KC_NUM_LOCK
+#define KC_INT1 KC_INTERNATIONAL_1
+#define KC_INT2 KC_INTERNATIONAL_2
+#define KC_INT3 KC_INTERNATIONAL_3
+#define KC_INT4 KC_INTERNATIONAL_4
+#define KC_INT5 KC_INTERNATIONAL_5
+#define KC_INT6 KC_INTERNATIONAL_6
+#define KC_LNG1 KC_LANGUAGE_1
+#define KC_LNG2 KC_LANGUAGE_2
+#define KC_LNG3 KC_LANGUAGE_3
+#define KC_LNG4 KC_LANGUAGE_4
+#define KC_LNG5 KC_LANGUAGE_5
+#define KC_LCTL KC_LEFT_CTRL
+#define KC_LSFT KC_LEFT_SHIFT
+#define KC_LALT KC_LEFT_ALT
+#define KC_LGUI KC_LEFT_GUI
+#define KC_RCTL KC_RIGHT_CTRL
+#define KC_RSFT KC_RIGHT_SHIFT
+#define KC_RALT KC_RIGHT_ALT
+#define KC_RGUI KC_RIGHT_GUI
@@ -0,0 +1,18 @@
+// matrix.h - bench shim: QMK's row type and the CUSTOM_MATRIX = lite hooks
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#if MATRIX_COLS <= 8
+typedef uint8_t matrix_row_t;
+#elif MATRIX_COLS <= 16
+typedef uint16_t matrix_row_t;
+#else
+typedef uint32_t matrix_row_t;
+#endif
+
+#define MATRIX_ROW_SHIFTER ((matrix_row_t)1)
+
+void matrix_init_custom(void);
+bool matrix_scan_custom(matrix_row_t current_matrix[]);
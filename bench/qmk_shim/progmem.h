@@ -0,0 +1,5 @@
+// progmem.h - bench shim: flash and RAM are one address space
+#pragma once
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
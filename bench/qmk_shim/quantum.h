@@ -0,0 +1,48 @@
+// quantum.h - bench shim: the parts of QMK's quantum.h the PS/2 sources use
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include "keycodes.h"
+#include "report.h"
+#include "host_driver.h"
+#include "print.h"
+#include "debug.h"
+#include "timer.h"
+#include "wait.h"
+#include "gpio.h"
+#include "progmem.h"
+
+typedef struct keyrecord {
+    struct {
+        bool pressed;
+    } event;
+} keyrecord_t;
+
+typedef union {
+    uint8_t raw;
+    struct {
+        bool num_lock : 1;
+        bool caps_lock : 1;
+        bool scroll_lock : 1;
+        bool compose : 1;
+        bool kana : 1;
+        uint8_t reserved : 3;
+    };
+} led_t;
+
+void register_code(uint8_t code);
+void unregister_code(uint8_t code);
+void send_string(const char *str);
+void send_string_P(const char *str);
+
+// Keyboard-level hooks kb.c passes on to
+void keyboard_pre_init_user(void);
+void keyboard_post_init_user(void);
+void housekeeping_task_user(void);
+bool process_record_user(uint16_t keycode, keyrecord_t *record);
+bool led_update_user(led_t led_state);
+void matrix_init_user(void);
+void matrix_scan_user(void);
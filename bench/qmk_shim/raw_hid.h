@@ -0,0 +1,9 @@
+// raw_hid.h - bench shim: the harness is the USB host
+#pragma once
+
+#include <stdint.h>
+
+#define RAW_EPSIZE 32  // usb_descriptor.h in QMK
+
+void raw_hid_receive(uint8_t *data, uint8_t length);
+void raw_hid_send(uint8_t *data, uint8_t length);
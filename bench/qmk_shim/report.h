@@ -0,0 +1,39 @@
+// report.h - bench shim: QMK HID report layouts
+#pragma once
+
+#include <stdint.h>
+
+#define KEYBOARD_REPORT_KEYS 6
+#define NKRO_REPORT_BITS     30
+
+enum hid_report_ids {
+    REPORT_ID_ALL = 0,
+    REPORT_ID_KEYBOARD,
+    REPORT_ID_MOUSE,
+    REPORT_ID_SYSTEM,
+    REPORT_ID_CONSUMER,
+    REPORT_ID_PROGRAMMABLE_BUTTON,
+    REPORT_ID_NKRO,
+};
+
+typedef struct {
+    uint8_t mods;
+    uint8_t reserved;
+    uint8_t keys[KEYBOARD_REPORT_KEYS];
+} report_keyboard_t;
+
+typedef struct {
+    uint8_t report_id;
+    uint8_t mods;
+    uint8_t bits[NKRO_REPORT_BITS];
+} report_nkro_t;
+
+typedef struct {
+    uint8_t buttons;
+    int8_t x, y, v, h;
+} report_mouse_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t report_id;
+    uint16_t usage;
+} report_extra_t;
@@ -0,0 +1,7 @@
+// send_string.h - bench shim: the ASCII tables ps2_send_string.c reads
+#pragma once
+
+#include <stdint.h>
+
+extern const uint8_t ascii_to_shift_lut[16];
+extern const uint8_t ascii_to_keycode_lut[128];
@@ -0,0 +1,7 @@
+// timer.h - bench shim: a millisecond clock the bench can set
+#pragma once
+
+#include <stdint.h>
+
+uint32_t timer_read32(void);
+uint32_t timer_elapsed32(uint32_t last);
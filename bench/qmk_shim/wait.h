@@ -0,0 +1,6 @@
+// wait.h - bench shim: delays return at once, so a simulated frame costs
+// only its bit-banging
+#pragma once
+
+void wait_ms(int ms);
+void wait_us(int us);
@@ -0,0 +1,181 @@
+""" PS/2 Dual-Mode Keyboard - SRAM Placement A/B Check
+=============================================
+Builds of ps2_keyboard.c and ps2_bridge.c with MCU_RP defined, once as
+shipped and once with PS2_NO_RAM_PLACEMENT, compared section by section
+(make ram builds the objects; the host compiler stands in for
+arm-none-eabi-gcc, so byte counts are x86 ones).
+
+With placement on, every PS2_RAM_FUNC/PS2_RAM_DATA symbol must sit in
+its own .time_critical.* section, and code there must not call or read
+anything that stays in flash: no .text, no .rodata, no external
+function. A call like that would be an XIP fetch in the middle of a
+clock phase, which is what the placement is for. The one exception is
+ps2_receive_check(), which runs after the ACK clock (and
+ps2_wcet_overrun(), after a probe has closed). External data is taken to
+be the other files' counters in SRAM. With placement off
+there must be no .time_critical section at all, and the check reports
+how much of the frame path that leaves in flash.
+
+Usage (make ram runs it for the default and the PS2_WCET_ASSERT build):
+  python3 ram_check.py --on ram_keyboard.o ram_bridge.o --off ram_keyboard_off.o ram_bridge_off.o
+
+Exits 1 if any check fails.
+
+Author: Betzalel J. Lewis
+License: GPL-2.0
+"""
+
+import argparse
+import glob
+import os
+import re
+import subprocess
+import sys
+
+FW = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "ps2demo")
+
+# Called from RAM code once the frame is over
+AFTER_FRAME = {"ps2_receive_check", "ps2_wcet_overrun"}
+
+# Host stand-ins for inline register reads (ps2_profile_now())
+HOST_ONLY = {"clock_gettime"}
+
+TAG = re.compile(r"PS2_RAM_(FUNC|DATA)\((\w+)\)")
+
+failures = 0
+
+
+def check(ok, text):
+    global failures
+    print("  %s  %s" % ("ok  " if ok else "FAIL", text))
+    if not ok:
+        failures += 1
+
+
+def readelf(flag, path):
+    try:
+        return subprocess.run(["readelf", flag, "-W", path], capture_output=True, text=True, check=True).stdout
+    except (OSError, subprocess.CalledProcessError) as e:
+        sys.exit("readelf %s %s: %s" % (flag, path, e))
+
+
+def tagged():
+    """Every symbol the firmware tags, from the sources: name -> FUNC/DATA"""
+    tags = {}
+    for path in sorted(glob.glob(os.path.join(FW, "*.[ch]"))):
+        if path.endswith("ps2_ram.h"):
+            continue
+        with open(path) as f:
+            for kind, name in TAG.findall(f.read()):
+                tags[name] = kind
+    return tags
+
+
+class Object:
+    def __init__(self, path):
+        self.path = path
+        self.sections = {}  # index -> (name, size, executable)
+        for m in re.finditer(r"^\s*\[\s*(\d+)\]\s+(\S+)\s+\S+\s+[0-9a-f]+\s+[0-9a-f]+\s+([0-9a-f]+)\s+\S+\s+(\S*)",
+                             readelf("-S", path), re.MULTILINE):
+            self.sections[int(m.group(1))] = (m.group(2), int(m.group(3), 16), "X" in m.group(4))
+
+        self.symbols = []  # (name, section name or None if undefined, value, size, type)
+        for line in readelf("-s", path).splitlines():
+            f = line.split()
+            if len(f) < 8 or not f[0][:-1].isdigit():
+                continue
+            section = self.sections[int(f[6])][0] if f[6].isdigit() else None  # UND, ABS, COM
+            self.symbols.append((f[7], section, int(f[1], 16), int(f[2], 0), f[3]))
+
+        self.relocs = []  # (from section, type, target symbol, addend)
+        section = None
+        for line in readelf("-r", path).splitlines():
+            m = re.match(r"Relocation section '\.rela(\S+)'", line)
+            if m:
+                section = m.group(1)
+                continue
+            m = re.match(r"\s*[0-9a-f]{8,}\s+[0-9a-f]+\s+(\S+)\s+[0-9a-f]+\s+(\S+)\s*([+-])\s*([0-9a-f]+)", line)
+            if section and m:
+                addend = int(m.group(4), 16) * (1 if m.group(3) == "+" else -1)
+                self.relocs.append((section, m.group(1), m.group(2), addend))
+
+    def ram_sections(self):
+        return {name: (size, x) for name, size, x in self.sections.values() if name.startswith(".time_critical.")}
+
+    def resolve(self, target, addend):
+        """(section, symbol) a relocation lands on; section None if external.
+        Calls to static functions come as section + offset."""
+        for name, section, value, size, kind in self.symbols:
+            if name == target and kind != "SECTION":
+                return section, name
+        offset = addend + 4  # PC-relative: the addend counts from the next instruction
+        for name, section, value, size, kind in self.symbols:
+            if section == target and kind in ("FUNC", "OBJECT") and value <= offset < value + size:
+                return section, name
+        return target, target
+
+    def size_of(self, name):
+        """Bytes of a symbol, however the compiler renamed it (.constprop.0)"""
+        return sum(size for sym, _, _, size, kind in self.symbols
+                   if kind in ("FUNC", "OBJECT") and (sym == name or sym.startswith(name + ".")))
+
+
+def flash_refs(obj):
+    """What RAM code in obj reaches in flash: (from, target, what)"""
+    refs = []
+    for section, kind, target, addend in obj.relocs:
+        if not section.startswith(".time_critical."):
+            continue
+        where, name = obj.resolve(target, addend)
+        if name.split(".")[0] in AFTER_FRAME | HOST_ONLY:
+            continue
+        if where is None:
+            if kind.endswith("PLT32"):
+                refs.append((section, name, "external call"))
+        elif where.startswith(".text"):
+            refs.append((section, name, "flash code"))
+        elif where.startswith(".rodata"):
+            refs.append((section, name, "flash data"))
+    return refs
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Check SRAM placement against PS2_NO_RAM_PLACEMENT")
+    parser.add_argument("--on", nargs="+", required=True, help="objects built as shipped")
+    parser.add_argument("--off", nargs="+", required=True, help="objects built with PS2_NO_RAM_PLACEMENT")
+    args = parser.parse_args()
+
+    tags = tagged()
+    on = [Object(p) for p in args.on]
+    off = [Object(p) for p in args.off]
+
+    print("placement on")
+    ram = {}
+    for obj in on:
+        ram.update(obj.ram_sections())
+    missing = [name for name in tags if ".time_critical." + name not in ram]
+    code = sum(size for size, x in ram.values() if x)
+    data = sum(size for size, x in ram.values() if not x)
+    check(not missing, "%d tagged symbols in .time_critical sections: %d B code, %d B tables%s" %
+          (len(tags), code, data, " (missing: %s)" % ", ".join(missing) if missing else ""))
+
+    refs = [ref for obj in on for ref in flash_refs(obj)]
+    for section, target, what in refs:
+        print("        %s -> %s (%s)" % (section[len(".time_critical."):], target, what))
+    check(not refs, "no calls or reads into flash from SRAM code (%d found)" % len(refs))
+
+    print("placement off (PS2_NO_RAM_PLACEMENT)")
+    stray = [name for obj in off for name in obj.ram_sections()]
+    check(not stray, "no .time_critical sections%s" % (" (found: %s)" % ", ".join(stray) if stray else ""))
+    # Without noinline the smaller functions are inlined into their callers
+    inlined = [name for name, kind in tags.items() if kind == "FUNC" and not any(obj.size_of(name) for obj in off)]
+    print("        frame path in flash: %d B tables, code in .text%s" %
+          (sum(obj.size_of(name) for obj in off for name, kind in tags.items() if kind == "DATA"),
+           " (%s inlined into callers)" % ", ".join(inlined) if inlined else ""))
+
+    print("%s (%d failed)" % ("FAIL" if failures else "PASS", failures))
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main()
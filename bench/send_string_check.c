@@ -0,0 +1,324 @@
+// send_string_check.c - ps2_send_string() typing over the bit-banged wire
+//
+// ps2_keyboard.c and ps2_send_string.c run on a virtual clock. Their
+// busy-waits advance it, and every CLK fall is decoded off the simulated
+// lines back to ASCII, tracking Left Shift the way the host does.
+//
+// Types a 10 KB payload and reports the rate the wire sustains, then checks
+// that Left Shift stays right when the user presses or lets go of it
+// halfway through a string: the event queue sends those changes too, and
+// the string must pick them up before its next character and give the
+// user's Shift back at the end. Exits 1 if any check fails.
+//
+//   make string
+#include "ps2_keyboard.c"
+
+#include "ps2_send_string.h"
+#include "send_string.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define P (&ps2_ports[0])
+
+extern uint32_t bench_now_ms;
+
+#define CLK PS2_KB_CLK
+#define DATA PS2_KB_DATA
+
+#define PASS_US 50  // Main loop pass with nothing on the wire
+
+#define PAYLOAD_BYTES (10u * 1024)
+
+static int failures;
+
+static void check(bool ok, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    printf("  %s  ", ok ? "ok  " : "FAIL");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    if (!ok) failures++;
+}
+
+// =============================================================================
+// CLOCK AND WIRE
+// =============================================================================
+
+static uint64_t now_us;
+
+static struct {
+    bool clk;
+    uint16_t frame;
+    uint8_t bits;
+    uint64_t last_fall;
+    uint32_t bytes;
+    uint32_t errors;
+} wire;
+
+static void text_byte(uint8_t byte);
+
+// Lines only change between the firmware's waits, so looking on the way
+// into each one sees every edge
+static void wire_sample(void) {
+    uint32_t lines = PS2_GPIO_IN();
+    bool clk = lines & CLK;
+    bool fell = wire.clk && !clk;
+
+    wire.clk = clk;
+    if (!fell) return;
+
+    if (wire.bits > 0 && now_us - wire.last_fall > 1000) wire.bits = 0;
+    if (wire.bits == 0) wire.frame = 0;
+    wire.last_fall = now_us;
+    wire.frame |= (uint16_t)((lines & DATA) ? 1 : 0) << wire.bits;
+    if (++wire.bits < 11) return;
+
+    wire.bits = 0;
+    bool ok = !(wire.frame & 1) && ((wire.frame >> 10) & 1) && __builtin_parity((wire.frame >> 1) & 0x1FF);
+    if (ok) {
+        wire.bytes++;
+        text_byte((wire.frame >> 1) & 0xFF);
+    } else {
+        wire.errors++;
+    }
+}
+
+static void advance(uint32_t us) {
+    now_us += us;
+    bench_now_ms = now_us / 1000;
+}
+
+void wait_us(int us) {
+    wire_sample();
+    advance(us);
+}
+
+// =============================================================================
+// TEXT DECODER: SET 2 BACK TO ASCII
+// =============================================================================
+
+static uint8_t text_rev[2][256][2];  // [E0][scancode][shift] -> ASCII, 0 if none
+
+static struct {
+    bool e0, release, shift;
+    uint32_t shift_makes;  // Left Shift makes while already down
+    char got[256];         // First characters decoded
+    uint32_t pos;
+    const uint8_t *expect;
+    uint32_t expect_len;
+    uint32_t mismatches;
+    uint32_t first_bad;
+} text;
+
+// The inverse of ps2_send_string_encode(), from the same tables. Lowest
+// code wins where two share a key.
+static void text_build(void) {
+    for (int c = 127; c > 0; c--) {
+        uint8_t keycode = ascii_to_keycode_lut[c];
+        if (keycode == KC_NO) continue;
+
+        ps2_mapping_t mapping = qmk_to_ps2_scancode(keycode);
+        if (mapping.scancode == 0 || mapping.special_type != PS2_KEY_NORMAL) continue;
+
+        bool shifted = (ascii_to_shift_lut[c / 8] >> (c % 8)) & 1;
+        text_rev[mapping.needs_e0_prefix][mapping.scancode][shifted] = c;
+    }
+}
+
+static void text_expect(const uint8_t *expect, uint32_t len) {
+    bool shift = text.shift;
+
+    memset(&text, 0, sizeof(text));
+    text.shift = shift;  // The host's Shift carries over
+    text.expect = expect;
+    text.expect_len = len;
+}
+
+static void text_byte(uint8_t byte) {
+    if (byte == PS2_PREFIX_E0) {
+        text.e0 = true;
+        return;
+    }
+    if (byte == PS2_PREFIX_F0) {
+        text.release = true;
+        return;
+    }
+
+    if (!text.e0 && byte == PS2_LSHIFT) {
+        if (!text.release && text.shift) text.shift_makes++;
+        text.shift = !text.release;
+    } else if (!text.release) {
+        uint8_t c = text_rev[text.e0][byte][text.shift];
+        if (text.pos < sizeof(text.got) - 1) text.got[text.pos] = c ? c : '?';
+        if (text.pos >= text.expect_len || text.expect[text.pos] != c) {
+            if (text.mismatches++ == 0) text.first_bad = text.pos;
+        }
+        text.pos++;
+    }
+    text.e0 = false;
+    text.release = false;
+}
+
+// =============================================================================
+// MAIN LOOP
+// =============================================================================
+
+static uint64_t wire_busy_us;
+
+// One pass of housekeeping_task_kb() in PS/2 mode
+static void pass(void) {
+    ps2_timer_run(timer_read32());
+    uint64_t start = now_us;
+    ps2_keyboard_task();
+    wire_busy_us += now_us - start;
+    ps2_send_string_task();
+
+    wire_sample();
+    advance(PASS_US);
+}
+
+static void run_ms(uint32_t ms) {
+    uint64_t end = now_us + (uint64_t)ms * 1000;
+    while (now_us < end) pass();
+}
+
+// Until the string is typed and the wire has gone quiet
+static void run_out(void) {
+    while (ps2_send_string_busy() || ps2_keyboard_busy()) pass();
+    run_ms(10);
+}
+
+// Until `chars` characters have been decoded off the wire
+static void run_until(uint32_t chars) {
+    while (text.pos < chars && ps2_send_string_busy()) pass();
+}
+
+static void user_shift(bool down) {
+    report_keyboard_t report = {.mods = down ? MOD_BIT(KC_LSFT) : 0};
+    ps2_send_keyboard(P, &report);
+}
+
+static void fresh(void) {
+    ps2_send_string_cancel();
+    ps2_gpio_sim.oe = 0;
+    ps2_gpio_sim.host_low = 0;
+    wire.clk = true;
+    ps2_keyboard_init();
+    ps2_keyboard_set_protocol(PS2_PROTOCOL_AT);
+    run_ms(1000);  // BAT
+    memset(&text, 0, sizeof(text));
+    memset(&wire, 0, sizeof(wire));
+    wire.clk = true;
+    ps2_stats_reset();
+}
+
+// =============================================================================
+// SCENARIOS
+// =============================================================================
+
+// Printable ASCII with the odd tab and newline, from a fixed seed
+static uint8_t *payload_make(uint32_t len) {
+    uint8_t *data = malloc(len + 1);
+    uint32_t seed = 12345;
+
+    for (uint32_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = seed >> 8;
+        data[i] = r % 61 == 0 ? '\n' : r % 97 == 0 ? '\t' : ' ' + (r >> 8) % 95;
+    }
+    data[len] = 0;
+    return data;
+}
+
+static void scenario_throughput(void) {
+    printf("throughput: %u KiB of generated text\n", PAYLOAD_BYTES / 1024);
+    fresh();
+
+    uint8_t *payload = payload_make(PAYLOAD_BYTES);
+    text_expect(payload, PAYLOAD_BYTES);
+
+    uint64_t start = now_us;
+    wire_busy_us = 0;
+    check(ps2_send_string((const char *)payload), "started");
+    run_out();
+    uint64_t elapsed_us = now_us - start;
+
+    check(text.pos == PAYLOAD_BYTES && text.mismatches == 0, "decoded text matches (%u chars, %u wrong, first at %u)",
+          text.pos, text.mismatches, text.first_bad);
+    check(wire.errors == 0 && ps2_stats[PS2_STAT_BUFFER_DROPS] == 0, "nothing dropped");
+    check(!text.shift, "Shift up at the end");
+
+    double seconds = elapsed_us / 1e6;
+    printf("  %.1f s simulated: %.1f chars/s, %.0f wire bytes/s, %.2f bytes/char, wire busy %.1f%%\n", seconds,
+           PAYLOAD_BYTES / seconds, wire.bytes / seconds, (double)wire.bytes / PAYLOAD_BYTES,
+           100.0 * wire_busy_us / elapsed_us);
+    free(payload);
+}
+
+static void scenario_user_lets_go(void) {
+    static const char str[] = "abcdefghijklmnop";
+
+    printf("user lets go of Shift halfway through lowercase\n");
+    fresh();
+    user_shift(true);
+    run_ms(10);
+    text_expect((const uint8_t *)str, sizeof(str) - 1);
+    ps2_send_string(str);
+    run_until(4);
+    user_shift(false);
+    run_out();
+
+    check(text.mismatches == 0, "typed \"%s\"", text.got);
+    check(!text.shift, "Shift not put back down at the end");
+}
+
+static void scenario_user_presses(void) {
+    static const char str[] = "abcdefghijklmnop";
+
+    printf("user presses Shift halfway through lowercase\n");
+    fresh();
+    text_expect((const uint8_t *)str, sizeof(str) - 1);
+    ps2_send_string(str);
+    run_until(4);
+    user_shift(true);
+    run_out();
+
+    check(text.mismatches == 0, "typed \"%s\"", text.got);
+    check(text.shift && text.shift_makes == 0, "Shift down at the end, as the user holds it");
+    user_shift(false);
+    run_ms(20);
+    check(!text.shift, "and up when the user lets go");
+}
+
+static void scenario_mixed(void) {
+    static const char str[] = "Hello, World! ABC def GHI";
+
+    printf("user taps Shift while capitals are typed\n");
+    fresh();
+    text_expect((const uint8_t *)str, sizeof(str) - 1);
+    ps2_send_string(str);
+    for (uint32_t at = 3; at < sizeof(str) - 1; at += 5) {
+        run_until(at);
+        user_shift(at % 2);
+    }
+    user_shift(false);
+    run_out();
+
+    check(text.mismatches == 0, "typed \"%s\"", text.got);
+    check(!text.shift, "Shift up at the end");
+}
+
+int main(void) {
+    text_build();
+    scenario_throughput();
+    scenario_user_lets_go();
+    scenario_user_presses();
+    scenario_mixed();
+
+    printf("%s (%d failed)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,573 @@
+// stream_check.c - keystroke streaming (ps2_stream.c) against a simulated PC
+//
+// The firmware's ps2_keyboard.c and ps2_stream.c run on a virtual clock.
+// Their busy-waits advance it, and every CLK fall the bit-banged frames make
+// is decoded off the simulated lines, so what the host would read is checked
+// byte for byte. The PC is modelled the way a full-speed raw HID device
+// sees it: one OUT and one IN report per 1ms frame. It sends a chunk
+// whenever it holds a credit and picks up the credits the firmware returns.
+//
+// Checks the key ops, that keys the stream holds are released however it
+// ends, and the refusals, then streams a multi-megabyte text
+// file. That text is decoded back to ASCII off the wire and compared, and
+// the run reports the rate it sustained against how busy the wire was.
+// Exits 1 if any check fails.
+//
+//   make stream
+#include "ps2_keyboard.c"
+
+#include "ps2_stream.h"
+#include "ps2_hid.h"
+#include "raw_hid.h"
+#include "send_string.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define P (&ps2_ports[0])
+
+extern uint32_t bench_now_ms;
+
+#define CLK PS2_KB_CLK
+#define DATA PS2_KB_DATA
+
+#define USB_FRAME_US 1000  // Full-speed interrupt endpoints, bInterval 1
+#define PASS_US 50         // Main loop pass with nothing on the wire (matrix scan and the rest)
+
+#define PAYLOAD_BYTES (2u * 1024 * 1024)
+
+static int failures;
+
+static void check(bool ok, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    printf("  %s  ", ok ? "ok  " : "FAIL");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    if (!ok) failures++;
+}
+
+// =============================================================================
+// CLOCK AND WIRE
+// =============================================================================
+
+static uint64_t now_us;
+
+// Device-to-host frames, decoded on CLK falls
+static struct {
+    bool clk;
+    uint16_t frame;
+    uint8_t bits;
+    uint64_t last_fall;
+    uint32_t bytes;
+    uint32_t errors;
+    uint8_t log[64];  // First bytes since wire_reset(), for exact checks
+    uint8_t log_count;
+    uint8_t last[2];  // And the last two
+} wire;
+
+static void text_byte(uint8_t byte);
+
+static void wire_byte(uint8_t byte) {
+    wire.bytes++;
+    wire.last[0] = wire.last[1];
+    wire.last[1] = byte;
+    if (wire.log_count < sizeof(wire.log)) wire.log[wire.log_count++] = byte;
+    text_byte(byte);
+}
+
+// Lines only change between the firmware's waits, so looking on the way
+// into each one sees every edge
+static void wire_sample(void) {
+    uint32_t lines = PS2_GPIO_IN();
+    bool clk = lines & CLK;
+    bool fell = wire.clk && !clk;
+
+    wire.clk = clk;
+    if (!fell) return;
+
+    // A frame that stalls for a millisecond is abandoned
+    if (wire.bits > 0 && now_us - wire.last_fall > 1000) wire.bits = 0;
+    if (wire.bits == 0) wire.frame = 0;
+    wire.last_fall = now_us;
+    wire.frame |= (uint16_t)((lines & DATA) ? 1 : 0) << wire.bits;
+    if (++wire.bits < 11) return;
+
+    wire.bits = 0;
+    bool ok = !(wire.frame & 1) && ((wire.frame >> 10) & 1) && __builtin_parity((wire.frame >> 1) & 0x1FF);
+    if (ok) {
+        wire_byte((wire.frame >> 1) & 0xFF);
+    } else {
+        wire.errors++;
+    }
+}
+
+static void wire_reset(void) {
+    wire.log_count = 0;
+    wire.bytes = 0;
+    wire.errors = 0;
+}
+
+static void advance(uint32_t us) {
+    now_us += us;
+    bench_now_ms = now_us / 1000;
+}
+
+void wait_us(int us) {
+    wire_sample();
+    advance(us);
+}
+
+// =============================================================================
+// TEXT DECODER: SET 2 BACK TO ASCII
+// =============================================================================
+
+static uint8_t text_rev[2][256][2];  // [E0][scancode][shift] -> ASCII, 0 if none
+
+static struct {
+    bool e0, release, shift;
+    const uint8_t *expect;
+    uint32_t expect_len;
+    uint32_t pos;         // Characters decoded
+    uint32_t mismatches;
+    uint32_t first_bad;
+    uint32_t other;       // Makes that aren't text
+} text;
+
+// The inverse of ps2_send_string_encode(), from the same tables. Lowest
+// code wins where two share a key.
+static void text_build(void) {
+    for (int c = 127; c > 0; c--) {
+        uint8_t keycode = ascii_to_keycode_lut[c];
+        if (keycode == KC_NO) continue;
+
+        ps2_mapping_t mapping = qmk_to_ps2_scancode(keycode);
+        if (mapping.scancode == 0 || mapping.special_type != PS2_KEY_NORMAL) continue;
+
+        bool shifted = (ascii_to_shift_lut[c / 8] >> (c % 8)) & 1;
+        text_rev[mapping.needs_e0_prefix][mapping.scancode][shifted] = c;
+    }
+}
+
+static void text_expect(const uint8_t *expect, uint32_t len) {
+    memset(&text, 0, sizeof(text));
+    text.expect = expect;
+    text.expect_len = len;
+}
+
+static void text_byte(uint8_t byte) {
+    if (byte == PS2_PREFIX_E0) {
+        text.e0 = true;
+        return;
+    }
+    if (byte == PS2_PREFIX_F0) {
+        text.release = true;
+        return;
+    }
+
+    if (!text.e0 && byte == PS2_LSHIFT) {
+        text.shift = !text.release;
+    } else if (!text.release) {
+        uint8_t c = text_rev[text.e0][byte][text.shift];
+        if (c == 0) {
+            text.other++;
+        } else {
+            if (text.pos >= text.expect_len || text.expect[text.pos] != c) {
+                if (text.mismatches++ == 0) text.first_bad = text.pos;
+            }
+            text.pos++;
+        }
+    }
+    text.e0 = false;
+    text.release = false;
+}
+
+// =============================================================================
+// PC MODEL
+// =============================================================================
+
+static bool usb_mode;
+
+bool is_usb_mode(void) {
+    return usb_mode;
+}
+
+// IN reports the firmware queued, one goes up per frame
+#define IN_QUEUE 16
+
+static struct {
+    const uint8_t *data;
+    uint32_t len;
+    uint32_t sent;
+    uint8_t credits;
+    uint8_t chunk;
+    uint8_t seq;
+    bool streaming;
+    uint64_t next_frame;
+
+    uint8_t in[IN_QUEUE][RAW_EPSIZE];
+    uint8_t in_head, in_count;
+    uint32_t in_overflows;
+
+    uint32_t frames;   // USB frames while streaming
+    uint32_t stalls;   // ...with data to send but no credit
+    uint32_t refused;  // OUT reports answered with an error
+    uint32_t credit_reports;
+} pc;
+
+void raw_hid_send(uint8_t *data, uint8_t length) {
+    if (pc.in_count == IN_QUEUE) {
+        pc.in_overflows++;
+        return;
+    }
+    memcpy(pc.in[(pc.in_head + pc.in_count++) % IN_QUEUE], data, RAW_EPSIZE);
+}
+
+// What ps2_hid.c does with a stream report
+static bool pc_request(uint8_t *report) {
+    if (report[0] == PS2_HID_STREAM_DATA) {
+        if (ps2_stream_data(report, RAW_EPSIZE)) return true;
+        pc.refused++;
+        return false;
+    }
+    report[1] = ps2_stream_command(report, RAW_EPSIZE);
+    return report[1] == PS2_HID_OK;
+}
+
+static bool pc_send_chunk(uint8_t seq, const uint8_t *bytes, uint8_t len) {
+    uint8_t report[RAW_EPSIZE] = {PS2_HID_STREAM_DATA, seq, len};
+    memcpy(&report[PS2_STREAM_HEADER], bytes, len);
+    return pc_request(report);
+}
+
+static bool pc_open(void) {
+    uint8_t report[RAW_EPSIZE] = {PS2_HID_STREAM_OPEN};
+    if (!pc_request(report)) return false;
+    pc.credits = report[2];
+    pc.chunk = report[3];
+    pc.seq = 0;
+    return true;
+}
+
+static void pc_close(void) {
+    uint8_t report[RAW_EPSIZE] = {PS2_HID_STREAM_CLOSE};
+    pc_request(report);
+}
+
+static uint32_t get_u32(const uint8_t *buf) {
+    return buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24;
+}
+
+static void pc_status(uint8_t *report) {
+    memset(report, 0, RAW_EPSIZE);
+    report[0] = PS2_HID_STREAM_STATUS;
+    pc_request(report);
+}
+
+static void pc_frame(void) {
+    if (pc.in_count > 0) {
+        uint8_t *in = pc.in[pc.in_head];
+        pc.in_head = (pc.in_head + 1) % IN_QUEUE;
+        pc.in_count--;
+        if (in[0] == PS2_HID_STREAM_CREDIT) {
+            pc.credits += in[2];
+            pc.credit_reports++;
+        }
+    }
+
+    if (!pc.streaming || pc.sent == pc.len) return;
+
+    pc.frames++;
+    if (pc.credits == 0) {
+        pc.stalls++;
+        return;
+    }
+    uint32_t len = pc.len - pc.sent < pc.chunk ? pc.len - pc.sent : pc.chunk;
+    pc_send_chunk(pc.seq++, &pc.data[pc.sent], len);
+    pc.credits--;
+    pc.sent += len;
+}
+
+static void pc_reset(void) {
+    memset(&pc, 0, sizeof(pc));
+    pc.next_frame = (now_us / USB_FRAME_US + 1) * USB_FRAME_US;
+}
+
+// =============================================================================
+// MAIN LOOP
+// =============================================================================
+
+static uint64_t wire_busy_us;  // Time spent inside ps2_keyboard_task()
+
+// Chunk latencies, summed here too: the firmware's u32 total wraps on a
+// run this long
+static uint32_t latency_seen;
+static uint64_t latency_sum_us;
+
+static void latency_collect(void) {
+    if (ps2_stats[PS2_STAT_STREAM_CHUNKS] == latency_seen) return;
+    latency_seen = ps2_stats[PS2_STAT_STREAM_CHUNKS];
+    latency_sum_us += ps2_stats[PS2_STAT_STREAM_US_LAST];
+}
+
+// One pass of housekeeping_task_kb() in PS/2 mode, USB frames that came due
+// delivered first (raw_hid_receive runs from the main loop too)
+static void pass(void) {
+    while (now_us >= pc.next_frame) {
+        pc_frame();
+        pc.next_frame += USB_FRAME_US;
+    }
+
+    ps2_timer_run(timer_read32());
+    uint64_t start = now_us;
+    ps2_keyboard_task();
+    wire_busy_us += now_us - start;
+    ps2_stream_task();
+    latency_collect();
+
+    wire_sample();
+    advance(PASS_US);
+}
+
+static void run_ms(uint32_t ms) {
+    uint64_t end = now_us + (uint64_t)ms * 1000;
+    while (now_us < end) pass();
+}
+
+static void fresh(void) {
+    ps2_stream_cancel();
+    ps2_gpio_sim.oe = 0;
+    ps2_gpio_sim.host_low = 0;
+    wire.clk = true;
+    usb_mode = false;
+    ps2_keyboard_init();
+    ps2_keyboard_set_protocol(PS2_PROTOCOL_AT);
+    pc_reset();
+    run_ms(1000);  // BAT and anything else from power-up
+    wire_reset();
+    text_expect(NULL, 0);
+    ps2_stats_reset();
+    latency_seen = 0;
+    latency_sum_us = 0;
+}
+
+// =============================================================================
+// SCENARIOS
+// =============================================================================
+
+static void scenario_ops(void) {
+    static const uint8_t expect[] = {
+        0x12,                          // Left Shift down
+        0x1C, 0xF0, 0x1C,              // A tapped
+        0xF0, 0x12,                    // Left Shift up
+        0x32, 0xF0, 0x32,              // b
+        0x03, 0xF0, 0x03,              // F5 tapped
+        0xE0, 0x74, 0xE0, 0xF0, 0x74,  // Right tapped
+        0x22, 0xF0, 0x22,              // x, then an op cut off
+    };
+    const uint8_t chunk[] = {
+        PS2_STREAM_OP_PRESS, KC_LSFT, PS2_STREAM_OP_TAP, KC_A, PS2_STREAM_OP_RELEASE, KC_LSFT, 'b',
+        PS2_STREAM_OP_TAP, KC_F5, PS2_STREAM_OP_TAP, KC_RIGHT,
+    };
+    const uint8_t dangling[] = {'x', PS2_STREAM_OP_TAP};
+
+    printf("key ops\n");
+    fresh();
+    bool opened = pc_open();
+    check(opened && pc.credits == PS2_STREAM_SLOTS && pc.chunk == RAW_EPSIZE - PS2_STREAM_HEADER,
+          "open grants %u credits of %u bytes", pc.credits, pc.chunk);
+    check(pc_send_chunk(0, chunk, sizeof(chunk)) && pc_send_chunk(1, dangling, sizeof(dangling)),
+          "two chunks staged");
+    pc_close();
+    run_ms(500);
+
+    check(wire.log_count == sizeof(expect) && memcmp(wire.log, expect, sizeof(expect)) == 0 && wire.errors == 0,
+          "wire carries exactly the ops and text (%u bytes)", wire.log_count);
+    check(ps2_stats[PS2_STAT_STREAM_ERRORS] == 1, "op cut off at the end of a chunk counted as an error");
+    check(pc.credit_reports == 0, "no credits returned after close");
+    check(!ps2_stream_busy(), "stream closed once typed");
+    printf("  lone chunk, arrival -> last byte out: %.1f ms\n", ps2_stats[PS2_STAT_STREAM_US_LAST] / 1000.0);
+}
+
+static void check_wire(const uint8_t *expect, uint8_t len, const char *what) {
+    check(wire.log_count == len && memcmp(wire.log, expect, len) == 0 && wire.errors == 0, "%s (%u bytes)", what,
+          wire.log_count);
+}
+
+// Keys a stream leaves down are let go of however it ends
+static void scenario_held_keys(void) {
+    static const uint8_t typed[] = {
+        0x14,              // Left Ctrl down
+        0x21,              // C down
+        0x12,              // Left Shift down for X
+        0x22, 0xF0, 0x22,  // X
+    };
+    static const uint8_t released[] = {0xF0, 0x21, 0xF0, 0x14, 0xF0, 0x12};
+    static const uint8_t all[] = {0x14, 0x21, 0x12, 0x22, 0xF0, 0x22, 0xF0, 0x21, 0xF0, 0x14, 0xF0, 0x12};
+    const uint8_t chunk[] = {PS2_STREAM_OP_PRESS, KC_LCTL, PS2_STREAM_OP_PRESS, KC_C, 'X'};
+
+    printf("held keys\n");
+    fresh();
+    pc_open();
+    pc_send_chunk(0, chunk, sizeof(chunk));
+    run_ms(100);
+    check_wire(typed, sizeof(typed), "ops held, Shift held for the capital");
+    pc_close();
+    run_ms(100);
+    check(wire.log_count == sizeof(all) && memcmp(&wire.log[sizeof(typed)], released, sizeof(released)) == 0,
+          "close releases C, Ctrl and Shift");
+    check(!ps2_stream_busy(), "stream closed");
+
+    fresh();
+    pc_open();
+    pc_send_chunk(0, chunk, sizeof(chunk));
+    run_ms(100);
+    ps2_stream_cancel();
+    run_ms(100);
+    check_wire(all, sizeof(all), "cancel releases C, Ctrl and Shift");
+
+    // Held past the typematic delay: C repeats until the timeout lets go
+    const uint8_t hold[] = {PS2_STREAM_OP_PRESS, KC_C};
+    fresh();
+    pc_open();
+    pc_send_chunk(0, hold, sizeof(hold));
+    run_ms(PS2_STREAM_TIMEOUT_MS + 500);
+    uint32_t repeats = 0;
+    for (uint8_t i = 1; i < wire.log_count && wire.log[i] == 0x21; i++) repeats++;
+    check(wire.log[0] == 0x21 && repeats > 0 && wire.last[0] == 0xF0 && wire.last[1] == 0x21 && wire.errors == 0,
+          "C repeats while held, released by the idle timeout (%u bytes)", wire.bytes);
+    check(!ps2_stream_busy(), "stream closed");
+
+    // Lowercase while the user holds Shift: Shift goes up for it and comes
+    // back once the stream is done
+    static const uint8_t user_shift[] = {
+        0x12,              // user's Shift
+        0xF0, 0x12,        // held up for the stream
+        0x1C, 0xF0, 0x1C,  // a
+        0x12,              // given back at close
+    };
+    report_keyboard_t report = {.mods = MOD_BIT(KC_LSFT)};
+    const uint8_t lower[] = {'a'};
+    fresh();
+    ps2_send_keyboard(P, &report);
+    pc_open();
+    pc_send_chunk(0, lower, sizeof(lower));
+    pc_close();
+    run_ms(100);
+    check_wire(user_shift, sizeof(user_shift), "user's Shift held up for lowercase, then given back");
+    memset(&report, 0, sizeof(report));
+    ps2_send_keyboard(P, &report);
+    run_ms(10);
+    check(wire.log_count == sizeof(user_shift) + 2 && wire.log[wire.log_count - 1] == 0x12,
+          "and released when the user lets go");
+}
+
+static void scenario_refusals(void) {
+    const uint8_t chunk[] = "abc";
+    uint8_t status[RAW_EPSIZE];
+
+    printf("flow control\n");
+    fresh();
+
+    usb_mode = true;
+    check(!pc_open(), "open refused in USB mode");
+    usb_mode = false;
+
+    ps2_send_string("busy");
+    check(!pc_open(), "open refused while send_string types");
+    ps2_send_string_cancel();
+
+    check(pc_open(), "open");
+    check(!pc_open(), "second open refused");
+    check(!pc_send_chunk(1, chunk, 3), "out-of-sequence chunk refused");
+
+    // Nothing typed yet, so nothing handed back: one past the window fails
+    bool staged = true;
+    for (uint8_t i = 0; i < PS2_STREAM_SLOTS; i++) staged &= pc_send_chunk(i, chunk, 3);
+    check(staged, "%u chunks staged, one per credit", PS2_STREAM_SLOTS);
+    pc.credits = 0;
+    check(!pc_send_chunk(PS2_STREAM_SLOTS, chunk, 3), "chunk without a credit refused");
+    check(ps2_stats[PS2_STAT_STREAM_ERRORS] == 2, "both counted as stream errors");
+
+    run_ms(500);
+    check(pc.credit_reports > 0 && pc.credits == PS2_STREAM_SLOTS, "every credit comes back once typed (%u reports)",
+          pc.credit_reports);
+    check(pc_send_chunk(PS2_STREAM_SLOTS, chunk, 3), "the refused chunk goes in with a returned credit");
+
+    run_ms(PS2_STREAM_TIMEOUT_MS + 500);
+    pc_status(status);
+    check(status[23] == PS2_STREAM_CLOSED && !ps2_stream_busy(), "stream left idle closes after %u ms",
+          PS2_STREAM_TIMEOUT_MS);
+    check(text.other == 0 && wire.errors == 0, "only text on the wire");
+}
+
+// Printable ASCII with the odd tab and newline, from a fixed seed
+static uint8_t *payload_make(uint32_t len) {
+    uint8_t *data = malloc(len);
+    uint32_t seed = 12345;
+
+    for (uint32_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = seed >> 8;
+        data[i] = r % 61 == 0 ? '\n' : r % 97 == 0 ? '\t' : ' ' + (r >> 8) % 95;
+    }
+    return data;
+}
+
+static void scenario_throughput(void) {
+    uint8_t status[RAW_EPSIZE];
+
+    printf("throughput: %u KiB of generated text\n", PAYLOAD_BYTES / 1024);
+    fresh();
+
+    uint8_t *payload = payload_make(PAYLOAD_BYTES);
+    text_expect(payload, PAYLOAD_BYTES);
+    pc.data = payload;
+    pc.len = PAYLOAD_BYTES;
+    check(pc_open(), "open");
+    pc.streaming = true;
+
+    uint64_t start = now_us;
+    wire_busy_us = 0;
+    while (pc.sent < pc.len) pass();
+    pc_close();
+    while (ps2_stream_busy()) pass();
+    uint64_t elapsed_us = now_us - start;
+    pc_status(status);
+
+    uint32_t samples = ps2_stats[PS2_STAT_STREAM_CHUNKS];
+    check(text.pos == PAYLOAD_BYTES && text.mismatches == 0 && text.other == 0,
+          "decoded text matches (%u chars, %u wrong, first at %u)", text.pos, text.mismatches, text.first_bad);
+    check(wire.errors == 0 && ps2_stats[PS2_STAT_BUFFER_DROPS] == 0 && ps2_stats[PS2_STAT_STREAM_ERRORS] == 0 &&
+              pc.refused == 0 && pc.in_overflows == 0,
+          "nothing dropped or refused");
+    check(ps2_stats[PS2_STAT_STREAM_BYTES] == PAYLOAD_BYTES && ps2_stats[PS2_STAT_STREAM_KEYS] == PAYLOAD_BYTES,
+          "counters: %lu bytes, %lu keys", ps2_stats[PS2_STAT_STREAM_BYTES], ps2_stats[PS2_STAT_STREAM_KEYS]);
+    check(samples == (PAYLOAD_BYTES + pc.chunk - 1) / pc.chunk, "every chunk timed (%lu)", samples);
+
+    double seconds = elapsed_us / 1e6;
+    printf("  %.0f s simulated (%.1f h): %.1f chars/s, %.0f wire bytes/s, %.2f bytes/char\n", seconds, seconds / 3600,
+           PAYLOAD_BYTES / seconds, wire.bytes / seconds, (double)wire.bytes / PAYLOAD_BYTES);
+    printf("  wire busy %.2f%% of the time; PC out of credit in %.1f%% of %u frames\n",
+           100.0 * wire_busy_us / elapsed_us, 100.0 * pc.stalls / pc.frames, pc.frames);
+    printf("  chunk arrival -> last byte out, up to %u chunks queued ahead: last %.1f ms, mean %.1f ms, max %.1f ms\n",
+           PS2_STREAM_SLOTS - 1, ps2_stats[PS2_STAT_STREAM_US_LAST] / 1000.0, latency_sum_us / 1000.0 / samples,
+           ps2_stats[PS2_STAT_STREAM_US_MAX] / 1000.0);
+    printf("  STREAM_STATUS reports %u keys in %u ms\n", get_u32(&status[6]), get_u32(&status[10]));
+    free(payload);
+}
+
+int main(void) {
+    text_build();
+    ps2_stream_init();
+    scenario_ops();
+    scenario_held_keys();
+    scenario_refusals();
+    scenario_throughput();
+
+    printf("%s (%d failed)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,318 @@
+// timer_check.c - the timer wheel (ps2_timer.c) on a virtual clock
+//
+// timer_read32() is the bench clock, and the wheel only sees it when the
+// harness calls ps2_timer_run(), like the main loop does between idle
+// sleeps. Every timer records the tick it fired on (ps2_timer_now() in the
+// callback) and the clock at the time, which are checked against when it
+// was due:
+//  - single timers across every level boundary, run every ms
+//  - a timer armed after a sleep the wheel hasn't caught up with yet
+//  - a periodic timer re-armed from its callback, run in big jumps
+//  - callbacks cancelling and re-arming other timers due on the same tick
+//  - random arms, cancels and clock jumps against a reference model, with
+//    the clock moved only to ps2_timer_next_deadline() some of the time,
+//    as the idle sleep does
+// Exits 1 if any check fails.
+//
+//   make timer
+#include "ps2_timer.h"
+#include "timer.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+extern uint32_t bench_now_ms;
+
+static int failures;
+
+static void check(bool ok, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    printf("  %s  ", ok ? "ok  " : "FAIL");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    if (!ok) failures++;
+}
+
+typedef struct {
+    ps2_timer_t timer;
+    uint32_t due;        // Reference model: when it should fire
+    bool armed;
+    uint32_t fired;      // Times it ran
+    uint32_t fired_tick; // ps2_timer_now() in the callback
+    uint32_t fired_at;   // The clock when it ran
+    uint32_t period;     // Re-armed from the callback, 0 = one-shot
+} probe_t;
+
+static void probe_fire(void *arg) {
+    probe_t *p = arg;
+
+    p->fired++;
+    p->fired_tick = ps2_timer_now();
+    p->fired_at = timer_read32();
+    p->armed = false;
+    if (p->period) {
+        ps2_timer_arm(&p->timer, p->period);
+        p->due = p->fired_tick + p->period;
+        p->armed = true;
+    }
+}
+
+static void probe_init(probe_t *p) {
+    memset(p, 0, sizeof(*p));
+    ps2_timer_init(&p->timer, probe_fire, p);
+}
+
+// The tick the wheel is on has been run already: a timer due then goes
+// on the next one
+static void probe_arm(probe_t *p, uint32_t delay) {
+    ps2_timer_arm(&p->timer, delay);
+    p->due = timer_read32() + delay;
+    if ((int32_t)(p->due - ps2_timer_now()) <= 0) p->due = ps2_timer_now() + 1;
+    p->armed = true;
+}
+
+// Main loop pass at the current clock
+static void run(void) {
+    ps2_timer_run(timer_read32());
+}
+
+static void run_to(uint32_t ms) {
+    while (bench_now_ms != ms) {
+        bench_now_ms++;
+        run();
+    }
+}
+
+// =============================================================================
+// SCENARIOS
+// =============================================================================
+
+static void scenario_levels(void) {
+    static const uint32_t delays[] = {0, 1, 2, 31, 32, 33, 63, 64, 1023, 1024, 1025, 32767, 32768, 40000};
+    probe_t p;
+    uint32_t exact = 0;
+
+    printf("one timer, run every ms\n");
+    for (size_t i = 0; i < sizeof(delays) / sizeof(delays[0]); i++) {
+        // Start at odd offsets inside a block, so every boundary gets crossed
+        run_to(bench_now_ms + 1 + (uint32_t)i * 7);
+        probe_init(&p);
+        probe_arm(&p, delays[i]);
+        run_to(p.due);
+        if (p.fired == 1 && p.fired_tick == p.due && p.fired_at == p.due) exact++;
+    }
+    check(exact == sizeof(delays) / sizeof(delays[0]), "fires on its tick, 0 to 40000 ms (%u of %zu)", exact,
+          sizeof(delays) / sizeof(delays[0]));
+}
+
+static void scenario_after_sleep(void) {
+    probe_t p;
+    uint32_t deadline;
+
+    printf("armed after a sleep\n");
+    run_to(bench_now_ms + 10);
+
+    // The main loop sleeps 100 ms: the wheel last saw the clock before it
+    bench_now_ms += 100;
+    probe_init(&p);
+    probe_arm(&p, 500);
+    bool has_deadline = ps2_timer_next_deadline(&deadline);
+    check(has_deadline && (int32_t)(deadline - p.due) <= 0 && (int32_t)(deadline - bench_now_ms) > 0,
+          "next deadline between now and 500 ms from now (%u ms)", deadline - bench_now_ms);
+
+    bench_now_ms += 499;
+    run();
+    check(p.fired == 0, "not fired 1 ms early");
+    bench_now_ms++;
+    run();
+    check(p.fired == 1 && p.fired_tick == p.due, "fired on time");
+}
+
+static void scenario_periodic(void) {
+    probe_t p;
+
+    printf("periodic, re-armed from the callback\n");
+    probe_init(&p);
+    p.period = 33;
+    probe_arm(&p, 33);
+    uint32_t first = p.due;
+
+    // Big jumps, like a long sleep: the wheel catches up tick by tick
+    for (int i = 0; i < 20; i++) {
+        bench_now_ms += 97;
+        run();
+    }
+    uint32_t expect = (bench_now_ms - first) / 33 + 1;
+    check(p.fired == expect && (p.fired_tick - first) % 33 == 0, "no drift: %u fires on multiples of 33 ms", p.fired);
+    ps2_timer_cancel(&p.timer);
+}
+
+static probe_t *pair[2];
+
+// Whichever of the pair runs first cancels the other
+static void pair_fire(void *arg) {
+    probe_t *p = arg;
+    probe_t *other = pair[p == pair[0]];
+
+    probe_fire(p);
+    ps2_timer_cancel(&other->timer);
+    other->armed = false;
+}
+
+static void scenario_same_tick(void) {
+    probe_t a, b, c;
+
+    printf("callbacks touching timers due on the same tick\n");
+    probe_init(&a);
+    probe_init(&b);
+    probe_init(&c);
+    a.timer.callback = pair_fire;
+    b.timer.callback = pair_fire;
+    pair[0] = &a;
+    pair[1] = &b;
+    probe_arm(&a, 40);
+    probe_arm(&b, 40);
+    probe_arm(&c, 40);
+    c.period = 1;  // Re-arms itself for the next tick
+    run_to(bench_now_ms + 42);
+    check(a.fired + b.fired == 1, "cancelled by a callback on its own tick: never runs");
+    check(c.fired == 3 && c.fired_tick == c.due - 1, "re-armed for 1 ms from its callback: runs on the next tick");
+    ps2_timer_cancel(&c.timer);
+}
+
+// =============================================================================
+// RANDOM
+// =============================================================================
+
+#define RANDOM_TIMERS 64
+#define RANDOM_STEPS 200000
+
+static uint32_t rng = 2463534242u;
+
+static uint32_t random_u32(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static uint32_t random_delay(void) {
+    switch (random_u32() % 4) {
+        case 0:
+            return random_u32() % 32;
+        case 1:
+            return random_u32() % 1024;
+        case 2:
+            return random_u32() % 32768;
+        default:
+            return random_u32() % 100000;
+    }
+}
+
+static void scenario_random(void) {
+    static probe_t probes[RANDOM_TIMERS];
+    uint32_t fires = 0, late = 0, early = 0, off_tick = 0, missed = 0, sleeps = 0, bad_deadline = 0;
+
+    printf("random: %u timers, %u steps\n", RANDOM_TIMERS, RANDOM_STEPS);
+    for (int i = 0; i < RANDOM_TIMERS; i++) probe_init(&probes[i]);
+
+    for (uint32_t step = 0; step < RANDOM_STEPS; step++) {
+        probe_t *p = &probes[random_u32() % RANDOM_TIMERS];
+        uint32_t before[RANDOM_TIMERS];
+
+        switch (random_u32() % 8) {
+            case 0:
+                ps2_timer_cancel(&p->timer);
+                p->armed = false;
+                break;
+            case 1:
+                p->period = 1 + random_u32() % 200;
+                probe_arm(p, p->period);
+                break;
+            default:
+                p->period = 0;
+                probe_arm(p, random_delay());
+                break;
+        }
+
+        // The earliest due timer, as the idle planner would see it
+        uint32_t earliest = 0;
+        bool any = false;
+        for (int i = 0; i < RANDOM_TIMERS; i++) {
+            if (probes[i].armed && (!any || (int32_t)(probes[i].due - earliest) < 0)) earliest = probes[i].due;
+            any |= probes[i].armed;
+        }
+        uint32_t deadline;
+        bool has_deadline = ps2_timer_next_deadline(&deadline);
+        if (has_deadline != any || (any && (int32_t)(deadline - earliest) > 0)) bad_deadline++;
+
+        // Move the clock: a few ms, a long stretch, or a sleep to the deadline
+        switch (random_u32() % 3) {
+            case 0:
+                bench_now_ms += random_u32() % 4;
+                break;
+            case 1:
+                bench_now_ms += random_u32() % 3000;
+                break;
+            default:
+                if (has_deadline && (int32_t)(deadline - bench_now_ms) > 0) {
+                    bench_now_ms = deadline;
+                    sleeps++;
+                }
+                break;
+        }
+
+        // probe_fire() moves these on
+        uint32_t due[RANDOM_TIMERS];
+        bool was_armed[RANDOM_TIMERS];
+        for (int i = 0; i < RANDOM_TIMERS; i++) {
+            before[i] = probes[i].fired;
+            due[i] = probes[i].due;
+            was_armed[i] = probes[i].armed;
+        }
+        run();
+
+        for (int i = 0; i < RANDOM_TIMERS; i++) {
+            probe_t *q = &probes[i];
+            bool is_due = was_armed[i] && (int32_t)(bench_now_ms - due[i]) >= 0;
+
+            if (q->fired == before[i]) {
+                if (is_due) missed++;
+                continue;
+            }
+            fires++;
+            // A periodic one may fire several times in one run: each on a
+            // whole number of periods after the first, and caught up by now
+            if (!was_armed[i] || (int32_t)(due[i] - q->fired_at) > 0) early++;
+            if (q->period == 0 && q->fired_tick != due[i]) off_tick++;
+            if (q->period != 0 && (q->fired_tick - due[i]) % q->period != 0) off_tick++;
+            if (q->period != 0 && (int32_t)(q->due - bench_now_ms) <= 0) late++;
+        }
+    }
+
+    check(early == 0 && late == 0 && missed == 0 && off_tick == 0,
+          "%u fires: none early, late, missed or off their tick (%u sleeps to the deadline)", fires, sleeps);
+    check(bad_deadline == 0, "next deadline never after the earliest timer");
+
+    for (int i = 0; i < RANDOM_TIMERS; i++) ps2_timer_cancel(&probes[i].timer);
+    uint32_t deadline;
+    check(!ps2_timer_next_deadline(&deadline), "empty once everything is cancelled");
+}
+
+int main(void) {
+    bench_now_ms = 1000;
+    run();
+
+    scenario_levels();
+    scenario_after_sleep();
+    scenario_periodic();
+    scenario_same_tick();
+    scenario_random();
+
+    printf("%s (%d failed)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,371 @@
+// warm_check.c - warm restart across a simulated reset (kb.c, ps2_warm.c)
+//
+// Builds the whole keyboard like wcet_check.c, with a PC on port 0 that
+// clocks its commands in and decodes what the keyboard sends. Every boot
+// runs in a fork of the untouched process, so each static starts out the
+// way startup leaves it - except the warm block, which is handed from one
+// boot to the next as the RAM startup doesn't clear would keep it. The
+// EEPROM starts blank every boot, so only the warm block can carry the
+// settings over.
+//
+// The first boot switches to PS/2, and the PC sets the LEDs, typematic
+// and scan set 1 while a key is held. The block that leaves behind is then
+// booted from as is, with a byte of its state flipped, from an older
+// layout version, with the wrong size, as power-on noise, and once more
+// after a boot that reset again before its first housekeeping pass. Only
+// the first may resume: PS/2 on the first pass, the PC's settings back,
+// and the held key's release sent. Every other one has to cold-start.
+// Exits 1 if any check fails.
+//
+//   make warm
+#include "ps2_keyboard.c"
+#include "ps2_warm.c"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "eeconfig.h"
+#include "host.h"
+#include "kb.h"
+#include "raw_hid.h"
+
+extern uint32_t bench_now_ms;
+
+#define P (&ps2_ports[0])
+
+#define PASS_US 1000     // Matrix scan and the rest of the main loop
+#define BOOT_MS 500      // Passes run per boot
+#define TYPEMATIC 0x45   // F3 argument the PC sends: 750 ms, 54 ms
+
+static int failures;
+
+static void check(bool ok, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    printf("  %s  ", ok ? "ok  " : "FAIL");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    if (!ok) failures++;
+}
+
+// =============================================================================
+// SIMULATED BOARD
+// =============================================================================
+
+static struct {
+    uint64_t now_us;
+    bool mode_pin;  // MODE_SWITCH_PIN: high = USB
+    // The PC sending one host-to-device frame at a time
+    uint16_t frame;  // Data, parity and stop bits, LSB first
+    int8_t edge;     // CLK falls seen this frame; -1 = not sending
+    bool clk_low;    // CLK as the last wait saw it
+    uint32_t nacks;
+} sim;
+
+// What the PC decoded off the wire
+static struct {
+    bool clk;
+    uint16_t frame;
+    uint8_t bits;
+    uint64_t last_fall;
+    uint8_t log[64];
+    uint8_t count;
+    uint32_t errors;
+} wire;
+
+static void sim_advance(uint32_t us) {
+    sim.now_us += us;
+    bench_now_ms = sim.now_us / 1000;
+}
+
+// Device-to-host frames, read on CLK falls while the PC isn't sending
+static void wire_sample(void) {
+    uint32_t lines = PS2_GPIO_IN();
+    bool clk = lines & P->clk;
+    bool fell = wire.clk && !clk;
+
+    wire.clk = clk;
+    if (!fell || sim.edge >= 0) return;
+
+    if (wire.bits > 0 && sim.now_us - wire.last_fall > 1000) wire.bits = 0;
+    if (wire.bits == 0) wire.frame = 0;
+    wire.last_fall = sim.now_us;
+    wire.frame |= (uint16_t)((lines & P->data) ? 1 : 0) << wire.bits;
+    if (++wire.bits < 11) return;
+
+    wire.bits = 0;
+    bool ok = !(wire.frame & 1) && ((wire.frame >> 10) & 1) && __builtin_parity((wire.frame >> 1) & 0x1FF);
+    if (!ok) {
+        wire.errors++;
+    } else if (wire.count < sizeof(wire.log)) {
+        wire.log[wire.count++] = (wire.frame >> 1) & 0xFF;
+    }
+}
+
+// The PC's half of a host-to-device frame, as in wcet_check.c
+static void sim_host_clock(void) {
+    bool clk_low = ps2_gpio_sim.oe & P->clk;
+
+    if (clk_low && !sim.clk_low && sim.edge >= 0) {
+        if (++sim.edge <= 10) {
+            if ((sim.frame >> (sim.edge - 1)) & 1) {
+                ps2_gpio_sim.host_low &= ~P->data;
+            } else {
+                ps2_gpio_sim.host_low |= P->data;
+            }
+        } else {
+            if (PS2_GPIO_IN() & P->data) sim.nacks++;
+            sim.edge = -1;
+        }
+    }
+    sim.clk_low = clk_low;
+}
+
+void wait_us(int us) {
+    wire_sample();
+    sim_host_clock();
+    sim_advance(us);
+}
+
+void wait_ms(int ms) {
+    wait_us(ms * 1000);
+}
+
+bool readPin(pin_t pin) {
+    return pin == MODE_SWITCH_PIN ? sim.mode_pin : true;
+}
+
+// The rest of QMK kb.c talks to
+static host_driver_t *driver;
+static report_keyboard_t keyboard_report;
+static uint8_t eeprom[EECONFIG_KB_DATA_SIZE];
+
+host_driver_t *host_get_driver(void) {
+    return driver;
+}
+
+void host_set_driver(host_driver_t *new_driver) {
+    driver = new_driver;
+}
+
+void send_keyboard_report(void) {
+    report_keyboard_t report = keyboard_report;
+    if (driver != NULL) driver->send_keyboard(&report);
+}
+
+void clear_keyboard(void) {
+    memset(&keyboard_report, 0, sizeof(keyboard_report));
+    send_keyboard_report();
+}
+
+void eeconfig_read_kb_datablock(void *data, uint32_t offset, uint32_t length) {
+    memcpy(data, eeprom + offset, length);
+}
+
+void eeconfig_update_kb_datablock(const void *data, uint32_t offset, uint32_t length) {
+    memcpy(eeprom + offset, data, length);
+}
+
+void raw_hid_send(uint8_t *data, uint8_t length) {}
+void register_code(uint8_t code) {}
+void unregister_code(uint8_t code) {}
+void send_string(const char *str) {}
+void send_string_P(const char *str) {}
+void keyboard_pre_init_user(void) {}
+void keyboard_post_init_user(void) {}
+void housekeeping_task_user(void) {}
+bool process_record_user(uint16_t keycode, keyrecord_t *record) {
+    return true;
+}
+bool led_update_user(led_t led_state) {
+    return true;
+}
+void matrix_init_user(void) {}
+void matrix_scan_user(void) {}
+void matrix_idle_plan(ps2_idle_plan_t *plan) {}  // matrix.c isn't built here
+
+// Stands in for original_usb_driver
+static uint8_t usb_leds(void) {
+    return 0;
+}
+static void usb_send_keyboard(report_keyboard_t *report) {}
+static void usb_send_nkro(report_nkro_t *report) {}
+static void usb_send_mouse(report_mouse_t *report) {}
+static void usb_send_extra(report_extra_t *report) {}
+
+static host_driver_t usb_driver = {
+    usb_leds, usb_send_keyboard, usb_send_nkro, usb_send_mouse, usb_send_extra,
+};
+
+// =============================================================================
+// BOOTS
+// =============================================================================
+
+// Kept across the fork: the RAM startup skips, and what the first boot left
+static struct {
+    ps2_warm_block_t block;
+    ps2_warm_port_t before;  // Port 0 going into the reset
+} *shared;
+
+static void pass(void) {
+    housekeeping_task_kb();
+    sim_advance(PASS_US);
+}
+
+// One byte from the PC, clocked in and ACKed
+static void host_send(uint8_t byte) {
+    sim.frame = byte | (uint16_t)!__builtin_parity(byte) << 8 | 1u << 9;
+    sim.edge = 0;
+    ps2_gpio_sim.host_low |= P->data;  // Request to send
+    for (int i = 0; i < 20 && sim.edge >= 0; i++) pass();
+}
+
+static bool wire_has(uint8_t byte) {
+    for (uint8_t i = 0; i < wire.count; i++) {
+        if (wire.log[i] == byte) return true;
+    }
+    return false;
+}
+
+// Power on with the switch on PS/2: QMK's USB driver comes in after
+// keyboard_post_init_kb, as on the keyboard
+static void boot_begin(void) {
+    sim.edge = -1;
+    sim.mode_pin = false;
+    wire.clk = true;
+    keyboard_pre_init_kb();
+    keyboard_post_init_kb();
+    host_set_driver(&usb_driver);
+}
+
+static void boot_session(void) {
+    boot_begin();
+    for (int i = 0; i < BOOT_MS && !is_ps2_mode(); i++) pass();
+    check(is_ps2_mode(), "switched to PS/2 mode");
+
+    host_send(PS2_CMD_SET_LEDS);
+    host_send(0x04);
+    host_send(PS2_CMD_SET_TYPEMATIC);
+    host_send(TYPEMATIC);
+    host_send(PS2_CMD_SET_SCANCODE_SET);
+    host_send(1);
+
+    report_keyboard_t report = {.keys = {KC_A}};
+    keyboard_report = report;
+    driver->send_keyboard(&report);
+    for (int i = 0; i < 20; i++) pass();
+
+    check(sim.nacks == 0 && P->leds.caps_lock && P->scancode_set == 1 && P->typematic.delay_ms == 750,
+          "PC set Caps Lock, typematic %02X and scan set 1", TYPEMATIC);
+    check(wire_has(0x1E), "A held, make sent in set 1");
+
+    shared->before = (ps2_warm_port_t){
+        .enabled = P->enabled,
+        .leds = P->leds.scroll_lock | P->leds.num_lock << 1 | P->leds.caps_lock << 2,
+        .scancode_set = P->scancode_set,
+        .typematic_delay_ms = P->typematic.delay_ms,
+        .typematic_rate_ms = P->typematic.rate_ms,
+    };
+}
+
+// Resets again before its first housekeeping pass
+static void boot_crash(void) {
+    boot_begin();
+}
+
+static bool settings_kept(void) {
+    return P->leds.caps_lock && P->scancode_set == shared->before.scancode_set &&
+           P->typematic.delay_ms == shared->before.typematic_delay_ms &&
+           P->typematic.rate_ms == shared->before.typematic_rate_ms;
+}
+
+static void boot_resume(void) {
+    boot_begin();
+    pass();
+    check(is_ps2_mode() && driver == ps2_keyboard_driver(0), "PS/2 on the first pass, no debounce");
+    for (int i = 0; i < BOOT_MS; i++) pass();
+    check(settings_kept(), "LEDs, typematic and scan set as the PC left them");
+    check(wire.count == 1 && wire.log[0] == 0x9E, "only A's release sent (%u bytes, first %02X)", wire.count,
+          wire.log[0]);
+}
+
+static void boot_cold(void) {
+    boot_begin();
+    pass();
+    check(!is_ps2_mode(), "not resumed: the mode switch debounces");
+    for (int i = 0; i < BOOT_MS; i++) pass();
+    check(is_ps2_mode(), "PS/2 mode after the debounce");
+    check(!P->leds.caps_lock && P->scancode_set == 2 && P->typematic.delay_ms == PS2_TYPEMATIC_DEFAULT_DELAY_MS,
+          "power-on defaults: LEDs off, set 2, default typematic");
+    check(wire.count == 0, "nothing sent (%u bytes)", wire.count);
+}
+
+// Runs `boot` in a fork of the untouched process, with the warm block
+// handed over before it and taken back after
+static void boot(void (*run)(void)) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        failures = 0;  // The parent counts this boot's from the exit status
+        warm_block = shared->block;
+        run();
+        shared->block = warm_block;
+        fflush(stdout);
+        _exit(failures);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    failures += WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+static void block_resign(void) {
+    shared->block.crc = ps2_crc16(&shared->block.state, sizeof(ps2_warm_state_t));
+}
+
+int main(void) {
+    shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) return 2;
+
+    printf("first boot: the PC sets up the keyboard, A held\n");
+    boot(boot_session);
+    ps2_warm_block_t saved = shared->block;
+    check(saved.magic == PS2_WARM_MAGIC, "warm block written");
+
+    printf("reset, block intact\n");
+    boot(boot_resume);
+
+    printf("reset, a byte of the state flipped\n");
+    shared->block = saved;
+    shared->block.state.ports[0].leds ^= 0x02;
+    boot(boot_cold);
+
+    printf("reset, block from an older layout version\n");
+    shared->block = saved;
+    shared->block.version = PS2_WARM_VERSION - 1;
+    block_resign();
+    boot(boot_cold);
+
+    printf("reset, block size doesn't match the layout\n");
+    shared->block = saved;
+    shared->block.size = sizeof(ps2_warm_state_t) - 4;
+    boot(boot_cold);
+
+    printf("power on: noise where the block goes\n");
+    srand(1);
+    for (size_t i = 0; i < sizeof(shared->block); i++) ((uint8_t *)&shared->block)[i] = rand();
+    boot(boot_cold);
+
+    printf("reset, then again before the first housekeeping pass\n");
+    shared->block = saved;
+    boot(boot_crash);
+    check(shared->block.magic == 0, "block consumed by the load");
+    boot(boot_cold);
+
+    printf("%s (%d failed)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
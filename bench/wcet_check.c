@@ -0,0 +1,938 @@
+// wcet_check.c - worst-case cost of the callbacks QMK's main loop runs
+//
+// The PS/2 host driver's send_keyboard and send_extra, a typematic repeat
+// and housekeeping_task_kb all run inline in QMK's main loop, and nothing
+// bounds them but the code. This builds the whole keyboard - kb.c's mode
+// switch, the ports, streaming, the timer wheel - against the shims, with
+// a PC on port 0 simulated in wait_us(), and goes looking for the inputs
+// that make each of them slowest:
+//   - a hill-climbing search per callback over the report held going in,
+//     the report sent, how far the event queue is backed up and how much
+//     of send_buffer is still queued. One start has all six keys and all
+//     eight modifiers flipping, the rest are random.
+//   - main loop sessions: max-churn reports every pass, all-keys flips, a
+//     host inhibiting until the queue is full, host commands mid-burst,
+//     typematic at the fastest rate into a full buffer, and the mode
+//     switch flipped during a burst (and flipped back mid-switch).
+//
+// Time is virtual. Every wait_us()/wait_ms() is charged to the callback
+// that made it and moves the clock on, as it blocks the main loop on the
+// target. CPU time is rdtsc cycles (ns off x86), and each input is run
+// REPEATS times - searches in place, sessions in forked copies of the same
+// state - with the cheapest run counting, so a preemption doesn't pass for
+// a worst case.
+//
+// Each callback's worst case is set against its PS2_WCET_* budget
+// (ps2_profile.h). The host is far faster than a 125MHz Cortex-M0+, so
+// the CPU part is scaled by -x (default HOST_SCALE) before the waits are
+// added. That makes the comparison rough - on the target the budgets are
+// checked by PS2_WCET_ASSERT, whose overrun path is exercised at the end.
+//
+//   make wcet
+//   ./wcet_check [-n ITERATIONS] [-p PASSES] [-s SEED] [-x SCALE] [-d]
+//
+// -d turns QMK's debug on, so the dprintf trace lines are formatted too.
+#include "ps2_keyboard.c"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#if defined(__x86_64__) || defined(__i386__)
+#    include <x86intrin.h>
+#endif
+#include "eeconfig.h"
+#include "host.h"
+#include "kb.h"
+#include "raw_hid.h"
+
+extern uint32_t bench_now_ms;
+
+#define P (&ps2_ports[0])
+
+#define DEFAULT_ITERATIONS 3000u  // Search steps per callback
+#define DEFAULT_PASSES 20000u     // Main loop passes per session
+#define REPEATS 3                 // Runs of each input; the cheapest counts
+#define RESTARTS 4                // Search starts per callback
+#define HOST_SCALE 60             // Host CPU time to the RP2040's, roughly
+#define WARMUP_PASSES 16          // Session passes not counted: the fork's caches are cold
+#define BACKLOG_MAX 24            // Undrained report pairs a search input can pile up
+#define DRAIN_ALL 0xFF
+
+static int failures;
+
+static void check(bool ok, const char *fmt, ...) {
+    va_list args;
+
+    va_start(args, fmt);
+    printf("  %s  ", ok ? "ok  " : "FAIL");
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+    if (!ok) failures++;
+}
+
+static uint64_t bench_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint32_t rng_state;
+
+static inline uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// =============================================================================
+// MEASUREMENT
+// =============================================================================
+
+typedef enum {
+    CB_SEND_KEYBOARD,
+    CB_SEND_EXTRA,
+    CB_TYPEMATIC,
+    CB_HOUSEKEEPING,
+    CB_COUNT
+} callback_t;
+
+static const struct {
+    const char *name;
+    uint32_t budget_us;
+} callbacks[CB_COUNT] = {
+    [CB_SEND_KEYBOARD] = {"send_keyboard", PS2_WCET_SEND_KEYBOARD_US},
+    [CB_SEND_EXTRA]    = {"send_extra", PS2_WCET_SEND_EXTRA_US},
+    [CB_TYPEMATIC]     = {"typematic", PS2_WCET_TYPEMATIC_US},
+    [CB_HOUSEKEEPING]  = {"housekeeping", PS2_WCET_HOUSEKEEPING_US},
+};
+
+typedef struct {
+    uint64_t cycles;  // CPU, meter overhead taken off
+    uint32_t wait_us;  // Blocked in wait_us()/wait_ms()
+} cost_t;
+
+typedef struct {
+    uint64_t start;
+    uint64_t waited;
+} meter_t;
+
+static struct {
+    uint64_t now_us;     // Virtual time; bench_now_ms follows it
+    uint64_t waited_us;  // Every wait so far
+    bool mode_pin;       // MODE_SWITCH_PIN: high = USB
+    // The PC on port 0, sending one host-to-device frame at a time
+    uint16_t frame;  // Data, parity and stop bits, LSB first
+    int8_t edge;     // CLK falls seen this frame; -1 = not sending
+    bool clk_low;    // CLK as the last wait saw it
+    uint32_t nacks;  // Frames with DATA high at the 11th fall
+} sim;
+
+static double cycles_per_ns = 1.0;
+static uint64_t meter_overhead;
+static uint32_t host_scale = HOST_SCALE;
+
+static inline uint64_t meter_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    uint64_t cycles = __rdtsc();
+    _mm_lfence();
+    return cycles;
+#else
+    return bench_ns();
+#endif
+}
+
+static inline void meter_begin(meter_t *meter) {
+    meter->waited = sim.waited_us;
+    meter->start = meter_cycles();
+}
+
+static inline cost_t meter_end(const meter_t *meter) {
+    uint64_t cycles = meter_cycles() - meter->start;
+    return (cost_t){
+        .cycles = cycles > meter_overhead ? cycles - meter_overhead : 0,
+        .wait_us = sim.waited_us - meter->waited,
+    };
+}
+
+static void meter_calibrate(void) {
+    uint64_t ns = bench_ns();
+    uint64_t cycles = meter_cycles();
+    while (bench_ns() - ns < 20000000) {
+    }
+    cycles_per_ns = (double)(meter_cycles() - cycles) / (bench_ns() - ns);
+
+    meter_overhead = UINT64_MAX;
+    for (int i = 0; i < 10000; i++) {
+        uint64_t start = meter_cycles();
+        uint64_t cycles = meter_cycles() - start;
+        if (cycles < meter_overhead) meter_overhead = cycles;
+    }
+}
+
+static double cost_ns(cost_t cost) {
+    return cost.cycles / cycles_per_ns;
+}
+
+// What it would block the target's main loop for: waits plus scaled CPU
+static double cost_target_us(cost_t cost) {
+    return cost.wait_us + cost_ns(cost) * host_scale / 1000.0;
+}
+
+// Worst case found per callback
+static struct {
+    cost_t cost;
+    char input[160];  // Where it was found
+} worst[CB_COUNT];
+
+static void worst_offer(callback_t cb, cost_t cost, const char *fmt, ...) {
+    va_list args;
+
+    if (cost_target_us(cost) <= cost_target_us(worst[cb].cost)) return;
+    worst[cb].cost = cost;
+    va_start(args, fmt);
+    vsnprintf(worst[cb].input, sizeof(worst[cb].input), fmt, args);
+    va_end(args);
+}
+
+// =============================================================================
+// SIMULATED BOARD
+// =============================================================================
+
+static void sim_advance(uint32_t us) {
+    sim.now_us += us;
+    bench_now_ms = sim.now_us / 1000;
+}
+
+// The PC's half of a host-to-device frame. The firmware clocks it; the PC
+// puts D0 on DATA at the first CLK fall, parity and stop at the 9th and
+// 10th, and reads the ACK at the 11th.
+static void sim_host_clock(void) {
+    bool clk_low = ps2_gpio_sim.oe & P->clk;
+
+    if (clk_low && !sim.clk_low && sim.edge >= 0) {
+        if (++sim.edge <= 10) {
+            if ((sim.frame >> (sim.edge - 1)) & 1) {
+                ps2_gpio_sim.host_low &= ~P->data;
+            } else {
+                ps2_gpio_sim.host_low |= P->data;
+            }
+        } else {
+            if (PS2_GPIO_IN() & P->data) sim.nacks++;
+            sim.edge = -1;
+        }
+    }
+    sim.clk_low = clk_low;
+}
+
+static void host_send(uint8_t byte) {
+    if (sim.edge >= 0) return;  // Still waiting for the last one to be clocked in
+    sim.frame = byte | (uint16_t)!__builtin_parity(byte) << 8 | 1u << 9;
+    sim.edge = 0;
+    ps2_gpio_sim.host_low |= P->data;  // Request to send
+}
+
+static void host_inhibit(bool inhibit) {
+    if (inhibit) {
+        ps2_gpio_sim.host_low |= P->clk;
+    } else {
+        ps2_gpio_sim.host_low &= ~P->clk;
+    }
+}
+
+void wait_us(int us) {
+    sim_host_clock();
+    sim_advance(us);
+    sim.waited_us += us;
+}
+
+void wait_ms(int ms) {
+    wait_us(ms * 1000);
+}
+
+bool readPin(pin_t pin) {
+    return pin == MODE_SWITCH_PIN ? sim.mode_pin : true;
+}
+
+// Formatted and dropped, so log lines cost what they cost
+int uprintf(const char *fmt, ...) {
+    static char line[256];
+    va_list args;
+
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    return len;
+}
+
+// The rest of QMK kb.c talks to
+static host_driver_t *driver;
+static report_keyboard_t keyboard_report;
+static uint8_t eeprom[EECONFIG_KB_DATA_SIZE];
+
+host_driver_t *host_get_driver(void) {
+    return driver;
+}
+
+void host_set_driver(host_driver_t *new_driver) {
+    driver = new_driver;
+}
+
+void send_keyboard_report(void) {
+    report_keyboard_t report = keyboard_report;
+    if (driver != NULL) driver->send_keyboard(&report);
+}
+
+void clear_keyboard(void) {
+    memset(&keyboard_report, 0, sizeof(keyboard_report));
+    send_keyboard_report();
+}
+
+void eeconfig_read_kb_datablock(void *data, uint32_t offset, uint32_t length) {
+    memcpy(data, eeprom + offset, length);
+}
+
+void eeconfig_update_kb_datablock(const void *data, uint32_t offset, uint32_t length) {
+    memcpy(eeprom + offset, data, length);
+}
+
+void raw_hid_send(uint8_t *data, uint8_t length) {}
+void register_code(uint8_t code) {}
+void unregister_code(uint8_t code) {}
+void send_string(const char *str) {}
+void send_string_P(const char *str) {}
+void keyboard_pre_init_user(void) {}
+void keyboard_post_init_user(void) {}
+void housekeeping_task_user(void) {}
+bool process_record_user(uint16_t keycode, keyrecord_t *record) {
+    return true;
+}
+bool led_update_user(led_t led_state) {
+    return true;
+}
+void matrix_init_user(void) {}
+void matrix_scan_user(void) {}
+void matrix_idle_plan(ps2_idle_plan_t *plan) {}  // matrix.c isn't built here
+
+// Stands in for original_usb_driver
+static uint8_t usb_leds(void) {
+    return 0;
+}
+static void usb_send_keyboard(report_keyboard_t *report) {}
+static void usb_send_nkro(report_nkro_t *report) {}
+static void usb_send_mouse(report_mouse_t *report) {}
+static void usb_send_extra(report_extra_t *report) {}
+
+static host_driver_t usb_driver = {
+    usb_leds, usb_send_keyboard, usb_send_nkro, usb_send_mouse, usb_send_extra,
+};
+
+static bool is_ps2_driver(host_driver_t *candidate) {
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        if (candidate == ps2_keyboard_driver(i)) return true;
+    }
+    return false;
+}
+
+// =============================================================================
+// INPUTS
+// =============================================================================
+
+static uint8_t pool_keys[256];
+static uint16_t pool_keys_count;
+static uint16_t pool_consumer[PS2_CONSUMER_MAPPINGS_SIZE];
+static uint16_t pool_system[PS2_SYSTEM_MAPPINGS_SIZE];
+
+// Every basic keycode, mapped or not - the search finds the costly ones
+static void pool_build(void) {
+    for (int keycode = KC_A; keycode < KC_LCTL; keycode++) {
+        pool_keys[pool_keys_count++] = keycode;
+    }
+    for (size_t i = 0; i < PS2_CONSUMER_MAPPINGS_SIZE; i++) {
+        pool_consumer[i] = ps2_consumer_mappings[i].usage_code;
+    }
+    for (size_t i = 0; i < PS2_SYSTEM_MAPPINGS_SIZE; i++) {
+        pool_system[i] = ps2_system_mappings[i].usage_code;
+    }
+}
+
+static bool report_has(const report_keyboard_t *report, uint8_t keycode) {
+    for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        if (report->keys[i] == keycode) return true;
+    }
+    return false;
+}
+
+// Keep the slot, empty it or put a new key in it
+static void random_slot(report_keyboard_t *report, int slot) {
+    uint32_t pick = rng();
+    switch (pick & 3) {
+        case 0:
+            report->keys[slot] = 0;
+            break;
+        case 1: {
+            uint8_t keycode = pool_keys[(pick >> 8) % pool_keys_count];
+            report->keys[slot] = report_has(report, keycode) ? 0 : keycode;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// As much change as a report can carry, from the last one
+static void random_report(report_keyboard_t *report) {
+    report->mods ^= rng();
+    for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        random_slot(report, i);
+    }
+}
+
+static report_extra_t random_extra(void) {
+    uint32_t r = rng();
+    bool consumer = r & 1;
+    uint16_t usage = 0;
+
+    if (r & 6) usage = consumer ? pool_consumer[(r >> 8) % PS2_CONSUMER_MAPPINGS_SIZE]
+                                : pool_system[(r >> 8) % PS2_SYSTEM_MAPPINGS_SIZE];
+    return (report_extra_t){
+        .report_id = consumer ? REPORT_ID_CONSUMER : REPORT_ID_SYSTEM,
+        .usage = usage,
+    };
+}
+
+// Six keys and eight modifiers one way, six other keys the other
+static void flip_reports(report_keyboard_t *a, report_keyboard_t *b) {
+    static const uint8_t keys_a[KEYBOARD_REPORT_KEYS] = {KC_PAUSE, KC_PRINT_SCREEN, KC_INSERT, KC_HOME, KC_PAGE_UP, KC_KP_SLASH};
+    static const uint8_t keys_b[KEYBOARD_REPORT_KEYS] = {KC_DELETE, KC_END, KC_PAGE_DOWN, KC_RIGHT, KC_LEFT, KC_KP_ENTER};
+
+    memset(a, 0, sizeof(*a));
+    memset(b, 0, sizeof(*b));
+    a->mods = 0xFF;
+    memcpy(a->keys, keys_a, sizeof(keys_a));
+    memcpy(b->keys, keys_b, sizeof(keys_b));
+}
+
+static int report_format(char *out, size_t size, const report_keyboard_t *report) {
+    int len = snprintf(out, size, "K %02X", report->mods);
+    for (int i = 0; i < KEYBOARD_REPORT_KEYS && len < (int)size; i++) {
+        if (report->keys[i] != 0) len += snprintf(out + len, size - len, " %02X", report->keys[i]);
+    }
+    return len;
+}
+
+// =============================================================================
+// SEARCH
+// =============================================================================
+
+typedef struct {
+    report_keyboard_t before;    // Held going in
+    report_keyboard_t after;     // Sent last - measured for send_keyboard
+    report_extra_t extra_after;  // Measured for send_extra
+    uint8_t backlog;             // after/before pairs sent on top, undrained
+    uint8_t drain;               // Bytes then clocked out, DRAIN_ALL = everything
+} input_t;
+
+// Move up to `budget` bytes out of send_buffer, refilling it from the
+// event queue as ps2_port_task() does. No wire - the search only wants the
+// state it leaves.
+static void pump(uint32_t budget) {
+    while (budget > 0) {
+        uint8_t byte;
+
+        ps2_event_drain(P);
+        ps2_lane_t lane = ps2_port_next_byte(P, &byte);
+        if (lane == PS2_LANE_NONE) return;
+        ps2_port_byte_sent(P, lane);
+        budget--;
+    }
+}
+
+static void search_keyboard(const report_keyboard_t *report) {
+    report_keyboard_t copy = *report;
+    ps2_keyboard_driver(0)->send_keyboard(&copy);
+}
+
+static void search_extra(const report_extra_t *report) {
+    report_extra_t copy = *report;
+    ps2_keyboard_driver(0)->send_extra(&copy);
+}
+
+// Everything up and sent, typematic off
+static void fresh(void) {
+    const report_keyboard_t none = {0};
+
+    search_keyboard(&none);
+    search_extra(&(report_extra_t){.report_id = REPORT_ID_CONSUMER});
+    search_extra(&(report_extra_t){.report_id = REPORT_ID_SYSTEM});
+    pump(UINT32_MAX);
+    ps2_keyboard_typematic_disable();
+}
+
+static cost_t input_run(const input_t *input, callback_t target) {
+    meter_t meter;
+    cost_t cost = {0};
+
+    fresh();
+    search_keyboard(&input->before);
+    pump(UINT32_MAX);
+    for (uint8_t i = 0; i < input->backlog; i++) {
+        search_keyboard(&input->after);
+        search_keyboard(&input->before);
+    }
+    pump(input->drain == DRAIN_ALL ? UINT32_MAX : input->drain);
+
+    switch (target) {
+        case CB_SEND_KEYBOARD:
+            meter_begin(&meter);
+            search_keyboard(&input->after);
+            cost = meter_end(&meter);
+            break;
+
+        case CB_SEND_EXTRA:
+            meter_begin(&meter);
+            search_extra(&input->extra_after);
+            cost = meter_end(&meter);
+            break;
+
+        case CB_TYPEMATIC:
+            // The last key pressed repeats; the wheel unlinks a timer
+            // before running it
+            search_keyboard(&input->after);
+            if (!ps2_timer_pending(&P->typematic.timer)) break;
+            ps2_timer_cancel(&P->typematic.timer);
+            meter_begin(&meter);
+            ps2_typematic_fire(P);
+            cost = meter_end(&meter);
+            break;
+
+        default:
+            break;
+    }
+    return cost;
+}
+
+static cost_t input_cost(const input_t *input, callback_t target) {
+    cost_t best = input_run(input, target);
+    for (int i = 1; i < REPEATS; i++) {
+        cost_t cost = input_run(input, target);
+        if (cost.cycles < best.cycles) best = cost;
+    }
+    return best;
+}
+
+static void input_random(input_t *input) {
+    memset(input, 0, sizeof(*input));
+    random_report(&input->before);
+    input->after = input->before;
+    random_report(&input->after);
+    input->extra_after = random_extra();
+    input->backlog = rng() % (BACKLOG_MAX + 1);
+    input->drain = rng() % 2 ? DRAIN_ALL : rng() % 64;
+}
+
+static void input_mutate(input_t *input) {
+    uint32_t r = rng();
+    report_keyboard_t *report = r & 1 ? &input->after : &input->before;
+
+    switch ((r >> 1) % 5) {
+        case 0:
+            report->mods ^= 1 << ((r >> 8) & 7);
+            break;
+        case 1:
+            random_slot(report, (r >> 8) % KEYBOARD_REPORT_KEYS);
+            break;
+        case 2:
+            input->backlog = rng() % (BACKLOG_MAX + 1);
+            break;
+        case 3:
+            input->drain = rng() % 4 == 0 ? DRAIN_ALL : rng() % 64;
+            break;
+        case 4:
+            input->extra_after = random_extra();
+            break;
+    }
+}
+
+static void input_format(char *out, size_t size, const input_t *input, callback_t target) {
+    int len = snprintf(out, size, "search: ");
+    len += report_format(out + len, size - len, &input->before);
+    len += snprintf(out + len, size - len, " -> ");
+    if (target == CB_SEND_EXTRA) {
+        len += snprintf(out + len, size - len, "%c %04X", input->extra_after.report_id == REPORT_ID_CONSUMER ? 'C' : 'S',
+                        input->extra_after.usage);
+    } else {
+        len += report_format(out + len, size - len, &input->after);
+    }
+    len += snprintf(out + len, size - len, ", backlog %u, drain ", input->backlog);
+    if (input->drain == DRAIN_ALL) {
+        snprintf(out + len, size - len, "all");
+    } else {
+        snprintf(out + len, size - len, "%u", input->drain);
+    }
+}
+
+// Hill climbing: keep a mutation unless it's cheaper. Plateaus are walked,
+// so the search keeps moving once it's stuck at a maximum.
+static void search(callback_t target, uint32_t iterations) {
+    char text[sizeof(worst[0].input)];
+
+    for (int restart = 0; restart < RESTARTS; restart++) {
+        input_t best;
+        input_random(&best);
+        if (restart == 0) {
+            flip_reports(&best.before, &best.after);
+            best.backlog = 0;
+            best.drain = DRAIN_ALL;
+        }
+        cost_t best_cost = input_cost(&best, target);
+
+        for (uint32_t i = 0; i < iterations / RESTARTS; i++) {
+            input_t candidate = best;
+            for (uint32_t n = 1 + rng() % 3; n > 0; n--) {
+                input_mutate(&candidate);
+            }
+            cost_t cost = input_cost(&candidate, target);
+            if (cost_target_us(cost) >= cost_target_us(best_cost)) {
+                best = candidate;
+                best_cost = cost;
+            }
+        }
+
+        input_format(text, sizeof(text), &best, target);
+        worst_offer(target, best_cost, "%s", text);
+    }
+}
+
+// =============================================================================
+// MAIN LOOP SESSIONS
+// =============================================================================
+
+typedef struct {
+    cost_t cost[CB_COUNT];
+    uint8_t called;  // Bit per callback
+} pass_cost_t;
+
+static pass_cost_t *pass_now;  // The pass being recorded, NULL outside sessions
+
+static void pass_record(callback_t cb, cost_t cost) {
+    if (pass_now == NULL) return;
+    // A pass can repeat on more than one port; the dearer one counts
+    if (!(pass_now->called & (1 << cb)) || cost_target_us(cost) > cost_target_us(pass_now->cost[cb])) {
+        pass_now->cost[cb] = cost;
+    }
+    pass_now->called |= 1 << cb;
+}
+
+// What QMK's host_keyboard_send() does, metered when it's our driver
+static void loop_keyboard(const report_keyboard_t *report) {
+    report_keyboard_t copy = *report;
+    meter_t meter;
+
+    keyboard_report = *report;
+    if (!is_ps2_driver(driver)) {
+        driver->send_keyboard(&copy);
+        return;
+    }
+    meter_begin(&meter);
+    driver->send_keyboard(&copy);
+    pass_record(CB_SEND_KEYBOARD, meter_end(&meter));
+}
+
+static void loop_extra(report_extra_t report) {
+    meter_t meter;
+
+    if (!is_ps2_driver(driver)) {
+        driver->send_extra(&report);
+        return;
+    }
+    meter_begin(&meter);
+    driver->send_extra(&report);
+    pass_record(CB_SEND_EXTRA, meter_end(&meter));
+}
+
+// Stands in for ps2_typematic_fire on the timer wheel, every port
+static void loop_typematic(void *arg) {
+    meter_t meter;
+
+    meter_begin(&meter);
+    ps2_typematic_fire(arg);
+    pass_record(CB_TYPEMATIC, meter_end(&meter));
+}
+
+static report_keyboard_t loop_held;  // What the matrix says
+static report_keyboard_t flip_a, flip_b;
+static uint8_t host_argument;  // Argument byte still to send, 0 = none
+static uint32_t mode_flip_at;
+
+// A command the PC might send at any time, argument next pass
+static void host_next_command(void) {
+    static const uint8_t commands[] = {
+        PS2_CMD_SET_LEDS, PS2_CMD_SET_TYPEMATIC, PS2_CMD_SET_SCANCODE_SET, PS2_CMD_ECHO, PS2_CMD_IDENTIFY,
+        PS2_CMD_ENABLE, PS2_CMD_DISABLE, PS2_CMD_SET_DEFAULTS, PS2_CMD_RESEND, PS2_CMD_RESET,
+    };
+    uint32_t r = rng();
+
+    if (host_argument != 0) {
+        host_send(host_argument == PS2_CMD_SET_SCANCODE_SET ? (r & 3) : (uint8_t)r);
+        host_argument = 0;
+        return;
+    }
+    uint8_t cmd = commands[r % sizeof(commands)];
+    host_send(cmd);
+    if (cmd == PS2_CMD_SET_LEDS || cmd == PS2_CMD_SET_TYPEMATIC || cmd == PS2_CMD_SET_SCANCODE_SET) {
+        host_argument = cmd;
+    }
+}
+
+static void session_churn(uint32_t pass) {
+    random_report(&loop_held);
+    loop_keyboard(&loop_held);
+    if ((rng() & 15) == 0) loop_extra(random_extra());
+}
+
+static void session_flip(uint32_t pass) {
+    loop_keyboard(pass & 1 ? &flip_b : &flip_a);
+}
+
+// Bursts into a host that holds CLK low until the queue is full
+static void session_inhibit(uint32_t pass) {
+    host_inhibit(pass % 80 < 64);
+    session_churn(pass);
+}
+
+static void session_host(uint32_t pass) {
+    session_churn(pass);
+    if (pass % 4 == 0) host_next_command();
+}
+
+// Fastest rate and shortest delay, one key held, modifiers churning, and
+// the buffer full for most of it
+static void session_typematic(uint32_t pass) {
+    if (pass == 0) host_send(PS2_CMD_SET_TYPEMATIC);
+    if (pass == 1) host_send(0x00);
+    host_inhibit(pass % 400 >= 100);
+    loop_held.mods = rng();
+    memset(loop_held.keys, 0, sizeof(loop_held.keys));
+    loop_held.keys[0] = pass % 2000 < 1000 ? KC_A : KC_RIGHT;
+    loop_keyboard(&loop_held);
+}
+
+// The switch flipped mid-burst, now and then flipped back before the
+// debounce or the switch itself is done
+static void session_mode(uint32_t pass) {
+    session_host(pass);
+    if (pass >= mode_flip_at) {
+        sim.mode_pin = !sim.mode_pin;
+        mode_flip_at = pass + 5 + rng() % (rng() & 1 ? 40 : 200);
+    }
+}
+
+static const struct {
+    const char *name;
+    void (*inputs)(uint32_t pass);
+} sessions[] = {
+    {"churn", session_churn},
+    {"flip", session_flip},
+    {"inhibit", session_inhibit},
+    {"host", session_host},
+    {"typematic", session_typematic},
+    {"mode", session_mode},
+};
+
+static void loop_pass(void (*inputs)(uint32_t pass), uint32_t pass) {
+    meter_t meter;
+
+    inputs(pass);
+    meter_begin(&meter);
+    housekeeping_task_kb();
+    pass_record(CB_HOUSEKEEPING, meter_end(&meter));
+
+    sim_advance(200 + rng() % 1000);  // Matrix scan and the rest of the loop
+}
+
+// Runs the session REPEATS times, each in a fork of the same state, and
+// takes the cheapest run of every pass
+static void session(int index, uint32_t passes) {
+    size_t size = sizeof(pass_cost_t) * passes * REPEATS;
+    pass_cost_t *costs = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    uint32_t diverged = 0;
+    bool exited = true, nacked = false;
+
+    if (costs == MAP_FAILED) {
+        check(false, "%s: no memory for %u passes", sessions[index].name, passes);
+        return;
+    }
+    memset(costs, 0, size);
+    fflush(stdout);
+
+    for (int run = 0; run < REPEATS; run++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Take the copy-on-write faults now rather than in a callback
+            mlockall(MCL_CURRENT);
+            for (uint32_t pass = 0; pass < passes; pass++) {
+                pass_now = &costs[run * passes + pass];
+                loop_pass(sessions[index].inputs, pass);
+            }
+            _exit(sim.nacks > 0 ? 3 : 0);
+        }
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+            exited = false;
+        } else if (WEXITSTATUS(status) == 3) {
+            nacked = true;
+        } else if (WEXITSTATUS(status) != 0) {
+            exited = false;
+        }
+    }
+
+    for (uint32_t pass = 0; exited && pass < passes; pass++) {
+        if (pass < WARMUP_PASSES) continue;
+        pass_cost_t best = costs[pass];
+        for (int run = 1; run < REPEATS; run++) {
+            const pass_cost_t *other = &costs[run * passes + pass];
+            for (int cb = 0; cb < CB_COUNT; cb++) {
+                if (other->cost[cb].wait_us != best.cost[cb].wait_us) diverged++;
+                if (other->cost[cb].cycles < best.cost[cb].cycles) best.cost[cb].cycles = other->cost[cb].cycles;
+            }
+            if (other->called != best.called) diverged++;
+        }
+        for (int cb = 0; cb < CB_COUNT; cb++) {
+            if (best.called & (1 << cb)) worst_offer(cb, best.cost[cb], "session %s, pass %u", sessions[index].name, pass);
+        }
+    }
+
+    check(exited && diverged == 0, "%s: %u passes x %d, runs identical", sessions[index].name, passes, REPEATS);
+    if (nacked) check(false, "%s: host bytes without an ACK on clock 11", sessions[index].name);
+    munmap(costs, size);
+}
+
+// =============================================================================
+// BUDGET ASSERTION
+// =============================================================================
+
+// A probe held past its budget has to count, freeze the flight recorder
+// and say so
+static void assert_check(void) {
+#ifdef PS2_WCET_ASSERT
+    uint32_t overruns = ps2_stats[PS2_STAT_WCET_OVERRUNS];
+
+    ps2_flight_resume();
+    {
+        PS2_PROBE(PS2_PROBE_TYPEMATIC);
+        uint64_t start = bench_ns();
+        while (bench_ns() - start < 2000u * PS2_WCET_TYPEMATIC_US) {
+        }
+    }
+    check(ps2_stats[PS2_STAT_WCET_OVERRUNS] == overruns + 1, "overrun counted in wcet_overruns");
+    check(ps2_flight.state == PS2_FLIGHT_WCET_OVERRUN, "overrun froze the flight recorder");
+    ps2_flight_resume();
+#else
+    printf("  (built without PS2_WCET_ASSERT - overrun path not checked)\n");
+#endif
+}
+
+// =============================================================================
+
+int main(int argc, char **argv) {
+    uint32_t iterations = DEFAULT_ITERATIONS;
+    uint32_t passes = DEFAULT_PASSES;
+    int opt;
+
+    rng_state = 0x2545F491;
+    while ((opt = getopt(argc, argv, "n:p:s:x:d")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                passes = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                rng_state = strtoul(optarg, NULL, 0) | 1;
+                break;
+            case 'x':
+                host_scale = strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                debug_enable = true;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n ITERATIONS] [-p PASSES] [-s SEED] [-x SCALE] [-d]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    meter_calibrate();
+    pool_build();
+    flip_reports(&flip_a, &flip_b);
+    sim.edge = -1;
+
+    // Boot in USB mode, then throw the switch
+    sim.mode_pin = true;
+    keyboard_pre_init_kb();
+    keyboard_post_init_kb();
+    host_set_driver(&usb_driver);
+    for (int i = 0; i < 500 && !is_ps2_mode(); i++) {
+        if (i == 10) sim.mode_pin = false;
+        housekeeping_task_kb();
+        sim_advance(1000);
+    }
+    check(is_ps2_mode(), "switched to PS/2 mode");
+
+    // The PC's frames have to come in as sent, each ACKed on clock 11
+    host_send(PS2_CMD_SET_LEDS);
+    for (int i = 0; i < 20 && sim.edge >= 0; i++) {
+        housekeeping_task_kb();
+        sim_advance(1000);
+    }
+    host_send(0x05);
+    for (int i = 0; i < 20 && sim.edge >= 0; i++) {
+        housekeeping_task_kb();
+        sim_advance(1000);
+    }
+    check(sim.nacks == 0 && P->leds.scroll_lock && !P->leds.num_lock && P->leds.caps_lock,
+          "host frames clocked in: ED 05 set the LEDs, both ACKed");
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        ps2_timer_init(&ps2_ports[i].typematic.timer, loop_typematic, &ps2_ports[i]);
+    }
+
+    printf("%.2f cycles/ns, meter overhead %" PRIu64 " cycles, host scale x%u, seed %u%s\n", cycles_per_ns,
+           meter_overhead, host_scale, rng_state, debug_enable ? ", debug on" : "");
+
+    printf("search\n");
+    for (callback_t cb = CB_SEND_KEYBOARD; cb <= CB_TYPEMATIC; cb++) {
+        search(cb, iterations);
+    }
+    fresh();
+
+    printf("sessions\n");
+    for (size_t i = 0; i < sizeof(sessions) / sizeof(sessions[0]); i++) {
+        session(i, passes);
+    }
+
+    printf("worst case\n");
+    printf("  %-14s %10s %10s %8s %10s %10s  %s\n", "callback", "cycles", "ns", "wait_us", "target_us", "budget_us", "input");
+    for (callback_t cb = 0; cb < CB_COUNT; cb++) {
+        printf("  %-14s %10" PRIu64 " %10.0f %8u %10.1f %10u  %s\n", callbacks[cb].name, worst[cb].cost.cycles,
+               cost_ns(worst[cb].cost), worst[cb].cost.wait_us, cost_target_us(worst[cb].cost), callbacks[cb].budget_us,
+               worst[cb].input);
+    }
+    for (callback_t cb = 0; cb < CB_COUNT; cb++) {
+        check(cost_target_us(worst[cb].cost) <= callbacks[cb].budget_us, "%s within budget", callbacks[cb].name);
+    }
+
+    printf("assert\n");
+    assert_check();
+
+    printf("%s (%d failed)\n", failures ? "FAIL" : "PASS", failures);
+    return failures ? 1 : 0;
+}
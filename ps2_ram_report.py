@@ -0,0 +1,60 @@
+""" PS/2 Dual-Mode Keyboard - SRAM Placement Build Report
+=============================================
+Lists what the firmware placed in SRAM through PS2_RAM_FUNC/PS2_RAM_DATA
+(ps2demo/ps2_ram.h) and what it costs, read from the linker map file QMK
+writes next to the firmware.
+
+Every .time_critical.* section costs its size twice: once in SRAM, and
+once in flash for the copy the startup code loads from.
+
+Usage (on the PC, after `qmk compile`):
+  python ps2_ram_report.py                          # Default map file
+  python ps2_ram_report.py .build/other_keymap.map  # Explicit map file
+
+Author: Betzalel J. Lewis
+License: GPL-2.0
+"""
+
+import re
+import sys
+
+DEFAULT_MAP = ".build/bjl_ps2demo_default.map"
+
+# Input section, then address and size; ld wraps long section names
+SECTION = re.compile(r"^ (\.time_critical\.\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S+)", re.MULTILINE)
+
+SRAM_BASE = 0x20000000
+
+
+def main():
+    path = sys.argv[1] if len(sys.argv) > 1 else DEFAULT_MAP
+    try:
+        with open(path) as f:
+            text = f.read()
+    except OSError as e:
+        sys.exit("Can't read map file %s: %s" % (path, e))
+
+    rows = []
+    for name, addr, size, obj in SECTION.findall(text):
+        # Only ours - the SDK/ChibiOS put their own code there too
+        if "ps2demo" not in obj:
+            continue
+        rows.append((name[len(".time_critical."):], int(addr, 16), int(size, 16)))
+
+    if not rows:
+        sys.exit("No PS/2 .time_critical sections in %s (built with PS2_NO_RAM_PLACEMENT?)" % path)
+
+    total = 0
+    print("%-28s %-10s %6s" % ("symbol", "address", "bytes"))
+    for name, addr, size in sorted(rows, key=lambda r: -r[2]):
+        where = "" if addr >= SRAM_BASE else "  (NOT in SRAM - check the linker script)"
+        print("%-28s 0x%08X %6d%s" % (name, addr, size, where))
+        total += size
+
+    print()
+    print("SRAM:  %d bytes" % total)
+    print("Flash: %d bytes (load image)" % total)
+
+
+if __name__ == "__main__":
+    main()
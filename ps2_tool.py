@@ -0,0 +1,431 @@
+""" PS/2 Dual-Mode Keyboard - Raw HID Host Tool
+=============================================
+Talks to the keyboard firmware over its raw HID interface
+(usage page 0xFF60, usage 0x61) to read link telemetry.
+
+Requirements (on the PC, not the Pico):
+  pip install hidapi
+
+Usage:
+  python ps2_tool.py stats           # Print link health counters
+  python ps2_tool.py stats --json    # Same, machine readable
+  python ps2_tool.py stats --reset   # Clear the counters
+  python ps2_tool.py stats --console # Dump counters to the QMK console
+  python ps2_tool.py sniff           # Decode PS/2 bus traffic (USB mode, Ctrl+C stops)
+  python ps2_tool.py sniff --raw     # Same, bytes only
+  python ps2_tool.py profile         # Dump hot-path timings to the QMK console
+  python ps2_tool.py profile --reset # Clear them
+  python ps2_tool.py flight          # Dump the wire flight recorder to the QMK console
+  python ps2_tool.py flight --resume # Clear it and record again
+  python ps2_tool.py stream FILE     # Type a file over PS/2 (PS/2 mode, - = stdin)
+  python ps2_tool.py stream --text T # Type a string
+
+Author: Betzalel J. Lewis
+License: GPL-2.0
+"""
+
+import argparse
+import json
+import struct
+import sys
+import time
+
+import hid
+
+# USB IDs from info.json
+VENDOR_ID = 0xFEED
+PRODUCT_ID = 0x6060
+RAW_USAGE_PAGE = 0xFF60
+RAW_USAGE = 0x61
+RAW_EPSIZE = 32
+
+# Commands (must match ps2demo/ps2_hid.h)
+PS2_HID_STATS_GET = 0x01
+PS2_HID_STATS_PRINT = 0x02
+PS2_HID_STATS_RESET = 0x03
+PS2_HID_SNIFF_START = 0x04
+PS2_HID_SNIFF_STOP = 0x05
+PS2_HID_SNIFF_DATA = 0x06  # Unsolicited, while a capture runs
+PS2_HID_PROFILE_PRINT = 0x07
+PS2_HID_PROFILE_RESET = 0x08
+PS2_HID_FLIGHT_DUMP = 0x09
+PS2_HID_FLIGHT_RESUME = 0x0A
+PS2_HID_STREAM_OPEN = 0x0B
+PS2_HID_STREAM_DATA = 0x0C  # No reply unless refused
+PS2_HID_STREAM_CREDIT = 0x0D  # Unsolicited, while a stream is open
+PS2_HID_STREAM_CLOSE = 0x0E
+PS2_HID_STREAM_STATUS = 0x0F
+
+PS2_HID_OK = 0x00
+
+# Counter IDs, in ps2_stat_id_t order (ps2demo/ps2_stats.h)
+STAT_NAMES = [
+    "bytes_sent",
+    "inhibit_aborts",
+    "host_resends",
+    "parity_errors",
+    "buffer_drops",
+    "queue_high_water",
+    "typematic_repeats",
+    "mode_switches",
+    "usb_mode_seconds",
+    "ps2_mode_seconds",
+    "event_drops",
+    "commands_received",
+    "framing_errors",
+    "latency_last_us",
+    "latency_max_us",
+    "latency_samples",
+    "latency_total_us",
+    "frame_us_min",
+    "frame_us_max",
+    "sniff_frames",
+    "sniff_drops",
+    "bridge_us_last",
+    "bridge_us_max",
+    "bridge_events",
+    "bridge_us_total",
+    "bridge_errors",
+    "event_wait_us_max",
+    "config_writes",
+    "stream_bytes",
+    "stream_keys",
+    "stream_us_last",
+    "stream_us_max",
+    "stream_chunks",
+    "stream_us_total",
+    "stream_errors",
+    "wcet_overruns",
+]
+
+# Sniffer frame flags (ps2demo/ps2_sniff.h)
+SNIFF_FROM_HOST = 0x01
+SNIFF_PARITY_ERR = 0x02
+SNIFF_FRAMING_ERR = 0x04
+SNIFF_ACK = 0x08
+SNIFF_ABORTED = 0x10
+SNIFF_HEADER = 6
+SNIFF_FRAME = struct.Struct("<IHBB")  # start_us, duration_us, data, flags
+
+# Keystroke stream (ps2demo/ps2_stream.h)
+STREAM_HEADER = 3
+STREAM_STATUS = struct.Struct("<5IBB")  # bytes, keys, elapsed_ms, us_last, us_max, credits, state
+STREAM_CLOSED = 0
+
+HOST_COMMANDS = {
+    0xED: "Set LEDs", 0xEE: "Echo", 0xF0: "Scancode set", 0xF2: "Read ID",
+    0xF3: "Typematic rate", 0xF4: "Enable", 0xF5: "Disable", 0xF6: "Set defaults",
+    0xF7: "All typematic", 0xF8: "All make/break", 0xF9: "All make",
+    0xFA: "All typematic/make/break", 0xFE: "Resend", 0xFF: "Reset",
+}
+
+DEVICE_RESPONSES = {
+    0x00: "Overrun", 0xAA: "BAT passed", 0xAB: "ID", 0xEE: "Echo",
+    0xFA: "ACK", 0xFC: "BAT failed", 0xFE: "Resend", 0xFF: "Overrun",
+}
+
+# Scancode set 2 make codes (unprefixed and E0-prefixed)
+SET2 = {
+    0x1C: "A", 0x32: "B", 0x21: "C", 0x23: "D", 0x24: "E", 0x2B: "F", 0x34: "G",
+    0x33: "H", 0x43: "I", 0x3B: "J", 0x42: "K", 0x4B: "L", 0x3A: "M", 0x31: "N",
+    0x44: "O", 0x4D: "P", 0x15: "Q", 0x2D: "R", 0x1B: "S", 0x2C: "T", 0x3C: "U",
+    0x2A: "V", 0x1D: "W", 0x22: "X", 0x35: "Y", 0x1A: "Z",
+    0x45: "0", 0x16: "1", 0x1E: "2", 0x26: "3", 0x25: "4", 0x2E: "5", 0x36: "6",
+    0x3D: "7", 0x3E: "8", 0x46: "9",
+    0x0E: "`", 0x4E: "-", 0x55: "=", 0x5D: "\\", 0x54: "[", 0x5B: "]", 0x4C: ";",
+    0x52: "'", 0x41: ",", 0x49: ".", 0x4A: "/",
+    0x66: "Backspace", 0x29: "Space", 0x0D: "Tab", 0x58: "Caps Lock", 0x5A: "Enter",
+    0x76: "Esc", 0x12: "Left Shift", 0x59: "Right Shift", 0x14: "Left Ctrl",
+    0x11: "Left Alt", 0x77: "Num Lock", 0x7E: "Scroll Lock",
+    0x05: "F1", 0x06: "F2", 0x04: "F3", 0x0C: "F4", 0x03: "F5", 0x0B: "F6",
+    0x83: "F7", 0x0A: "F8", 0x01: "F9", 0x09: "F10", 0x78: "F11", 0x07: "F12",
+    0x70: "KP 0", 0x69: "KP 1", 0x72: "KP 2", 0x7A: "KP 3", 0x6B: "KP 4",
+    0x73: "KP 5", 0x74: "KP 6", 0x6C: "KP 7", 0x75: "KP 8", 0x7D: "KP 9",
+    0x71: "KP .", 0x79: "KP +", 0x7B: "KP -", 0x7C: "KP *",
+}
+
+SET2_E0 = {
+    0x14: "Right Ctrl", 0x11: "Right Alt", 0x1F: "Left GUI", 0x27: "Right GUI",
+    0x2F: "Menu", 0x70: "Insert", 0x6C: "Home", 0x7D: "Page Up", 0x71: "Delete",
+    0x69: "End", 0x7A: "Page Down", 0x75: "Up", 0x6B: "Left", 0x72: "Down",
+    0x74: "Right", 0x4A: "KP /", 0x5A: "KP Enter", 0x12: "(fake shift)",
+    0x7C: "(print screen)", 0x37: "Power", 0x3F: "Sleep", 0x5E: "Wake",
+    0x23: "Mute", 0x32: "Volume Down", 0x21: "Volume Up", 0x34: "Play/Pause",
+    0x3B: "Stop", 0x15: "Previous Track", 0x4D: "Next Track",
+}
+
+
+def open_keyboard():
+    """Open the raw HID interface of the first matching keyboard."""
+    for info in hid.enumerate(VENDOR_ID, PRODUCT_ID):
+        if info["usage_page"] == RAW_USAGE_PAGE and info["usage"] == RAW_USAGE:
+            device = hid.device()
+            device.open_path(info["path"])
+            return device
+    sys.exit("Keyboard raw HID interface not found (VID 0x%04X PID 0x%04X)" % (VENDOR_ID, PRODUCT_ID))
+
+
+def command(device, cmd, *args, check=True):
+    """Send one command and return the response payload (after cmd/status).
+
+    With check=False a failed command returns None instead of exiting.
+    """
+    request = bytes([cmd, *args]).ljust(RAW_EPSIZE, b"\0")
+    device.write(b"\0" + request)  # Leading 0 = report ID
+    response = bytes(device.read(RAW_EPSIZE, 1000))
+    # A running capture or stream interleaves its own reports
+    while response and response[0] in (PS2_HID_SNIFF_DATA, PS2_HID_STREAM_CREDIT) and response[0] != cmd:
+        response = bytes(device.read(RAW_EPSIZE, 1000))
+    if len(response) < 2 or response[0] != cmd:
+        sys.exit("No/invalid response to command 0x%02X" % cmd)
+    if response[1] != PS2_HID_OK:
+        if not check:
+            return None
+        sys.exit("Command 0x%02X failed with status 0x%02X" % (cmd, response[1]))
+    return response[2:]
+
+
+def read_stats(device):
+    """Read every counter the firmware has, 7 per report."""
+    stats = {}
+    first = 0
+    while True:
+        # Asking past the last counter fails - that's the end of the list
+        payload = command(device, PS2_HID_STATS_GET, first, check=False)
+        if payload is None or payload[1] == 0:
+            break
+        start, count = payload[0], payload[1]
+        values = struct.unpack_from("<%dI" % count, payload, 2)
+        for i, value in enumerate(values):
+            index = start + i
+            name = STAT_NAMES[index] if index < len(STAT_NAMES) else "stat_%d" % index
+            stats[name] = value
+        first = start + count
+    return stats
+
+
+def cmd_stats(device, args):
+    if args.reset:
+        command(device, PS2_HID_STATS_RESET)
+        print("Counters reset")
+        return
+    if args.console:
+        command(device, PS2_HID_STATS_PRINT)
+        print("Counters dumped to the QMK console (qmk console)")
+        return
+
+    stats = read_stats(device)
+    if args.json:
+        print(json.dumps(stats, indent=2))
+    else:
+        for name, value in stats.items():
+            print("%-20s %d" % (name, value))
+
+
+def cmd_profile(device, args):
+    cmd = PS2_HID_PROFILE_RESET if args.reset else PS2_HID_PROFILE_PRINT
+    if command(device, cmd, check=False) is None:
+        sys.exit("Profiler not built in (define PS2_PROFILE_ENABLE in config.h)")
+    print("Probes reset" if args.reset else "Probes dumped to the QMK console (qmk console)")
+
+
+def cmd_flight(device, args):
+    if args.resume:
+        command(device, PS2_HID_FLIGHT_RESUME)
+        print("Flight recorder cleared and recording")
+        return
+    command(device, PS2_HID_FLIGHT_DUMP, min(args.count, 255))
+    print("Flight recorder dumped to the QMK console (qmk console)")
+
+
+class Set2Decoder:
+    """Names device bytes, following E0/E1/F0 prefixes and command replies."""
+
+    def __init__(self):
+        self.e0 = False
+        self.release = False
+        self.pause = 0  # E1 sequence bytes still to swallow
+        self.expect_arg = None  # Host command waiting for its argument byte
+
+    def host(self, byte):
+        if self.expect_arg is not None:
+            name, self.expect_arg = "%s argument" % self.expect_arg, None
+            return name
+        name = HOST_COMMANDS.get(byte, "")
+        if byte in (0xED, 0xF0, 0xF3):
+            self.expect_arg = name
+        return name
+
+    def device(self, byte):
+        if self.pause:
+            self.pause -= 1
+            return "" if self.pause else "Pause"
+        if byte == 0xE1:
+            self.pause = 7
+            return "(pause)"
+        if byte == 0xE0:
+            self.e0 = True
+            return "(extended)"
+        if byte == 0xF0:
+            self.release = True
+            return "(release)"
+        if not self.e0 and not self.release and byte in DEVICE_RESPONSES:
+            return DEVICE_RESPONSES[byte]
+
+        table = SET2_E0 if self.e0 else SET2
+        key = table.get(byte, "key 0x%02X" % byte)
+        name = "%s %s" % (key, "up" if self.release else "down")
+        self.e0 = self.release = False
+        return name
+
+
+def sniff_flags(flags):
+    notes = []
+    if flags & SNIFF_ABORTED:
+        notes.append("ABORTED")
+    if flags & SNIFF_PARITY_ERR:
+        notes.append("PARITY")
+    if flags & SNIFF_FRAMING_ERR:
+        notes.append("FRAMING")
+    if flags & SNIFF_FROM_HOST and not flags & (SNIFF_ACK | SNIFF_ABORTED):
+        notes.append("NO ACK")
+    return " [%s]" % ", ".join(notes) if notes else ""
+
+
+def cmd_sniff(device, args):
+    if command(device, PS2_HID_SNIFF_START, check=False) is None:
+        sys.exit("Can't sniff in PS/2 mode - switch the keyboard to USB mode first")
+    print("Capturing on the PS/2 port pins, Ctrl+C to stop")
+
+    decoder = Set2Decoder()
+    seq = drops = base_us = None
+    try:
+        while True:
+            report = bytes(device.read(RAW_EPSIZE, 1000))
+            if len(report) < SNIFF_HEADER or report[0] != PS2_HID_SNIFF_DATA:
+                continue
+            report_seq, count, report_drops = report[2], report[3], struct.unpack_from("<H", report, 4)[0]
+
+            if seq is not None and report_seq != (seq + 1) & 0xFF:
+                print("!! %d report(s) lost over USB" % ((report_seq - seq - 1) & 0xFF))
+            if drops is not None and report_drops != drops:
+                print("!! %d frame(s) lost on the device" % ((report_drops - drops) & 0xFFFF))
+            seq, drops = report_seq, report_drops
+
+            for i in range(count):
+                start_us, duration_us, data, flags = SNIFF_FRAME.unpack_from(report, SNIFF_HEADER + i * SNIFF_FRAME.size)
+                if base_us is None:
+                    base_us = start_us
+                when = ((start_us - base_us) & 0xFFFFFFFF) / 1e6
+                if flags & SNIFF_FROM_HOST:
+                    who, name = "host", decoder.host(data)
+                else:
+                    who, name = "kbd ", decoder.device(data)
+                if args.raw:
+                    name = ""
+                print("%12.6f %s %02X %5dus %s%s" % (when, who, data, duration_us, name, sniff_flags(flags)))
+    except KeyboardInterrupt:
+        pass
+    finally:
+        command(device, PS2_HID_SNIFF_STOP)
+        print("Capture stopped")
+
+
+def stream_payload(args):
+    if args.text is not None:
+        data = args.text.encode()
+    elif args.file == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.file, "rb") as f:
+            data = f.read()
+    # One Enter per line, and 0x01-0x03 would read as key ops
+    return bytes(b for b in data.replace(b"\r\n", b"\n") if b > 0x03)
+
+
+def cmd_stream(device, args):
+    if args.text is None and args.file is None:
+        sys.exit("Nothing to type: give a file, - for stdin, or --text")
+    data = stream_payload(args)
+
+    opened = command(device, PS2_HID_STREAM_OPEN, check=False)
+    if opened is None:
+        sys.exit("Can't stream - the keyboard must be in PS/2 mode, with no string or other stream being typed")
+    credits, chunk = opened[0], opened[1]
+    print("Typing %d bytes (%d credits of %d bytes), Ctrl+C stops" % (len(data), credits, chunk))
+
+    seq = sent = stalls = 0
+    try:
+        while sent < len(data):
+            # Out of credit: the keyboard hands one back per chunk typed
+            if credits == 0:
+                stalls += 1
+            while credits == 0:
+                report = bytes(device.read(RAW_EPSIZE, 1000))
+                if report and report[0] == PS2_HID_STREAM_CREDIT:
+                    credits += report[2]
+                elif report and report[0] == PS2_HID_STREAM_DATA:
+                    sys.exit("Chunk refused by the keyboard (stream closed or out of step)")
+
+            piece = data[sent:sent + chunk]
+            request = bytes([PS2_HID_STREAM_DATA, seq, len(piece)]) + piece
+            device.write(b"\0" + request.ljust(RAW_EPSIZE, b"\0"))
+            seq = (seq + 1) & 0xFF
+            credits -= 1
+            sent += len(piece)
+    except KeyboardInterrupt:
+        print("Interrupted, typing what was sent")
+    finally:
+        command(device, PS2_HID_STREAM_CLOSE)
+
+    # Staged chunks are still going out
+    while True:
+        status = STREAM_STATUS.unpack_from(command(device, PS2_HID_STREAM_STATUS))
+        if status[6] == STREAM_CLOSED:
+            break
+        time.sleep(0.1)
+
+    nbytes, keys, elapsed_ms, us_last, us_max = status[:5]
+    rate = keys * 1000 / elapsed_ms if elapsed_ms else 0
+    print("%d bytes, %d keys in %.2fs (%.0f keys/s)" % (nbytes, keys, elapsed_ms / 1000, rate))
+    print("Chunk latency: last %.1f ms, worst %.1f ms; waited for credit %d times" % (us_last / 1000, us_max / 1000, stalls))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="PS/2 dual-mode keyboard raw HID tool")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    stats = sub.add_parser("stats", help="link health counters")
+    stats.add_argument("--json", action="store_true", help="machine-readable output")
+    stats.add_argument("--reset", action="store_true", help="clear all counters")
+    stats.add_argument("--console", action="store_true", help="dump to the QMK console")
+    stats.set_defaults(func=cmd_stats)
+
+    sniff = sub.add_parser("sniff", help="passive PS/2 bus capture (USB mode)")
+    sniff.add_argument("--raw", action="store_true", help="don't decode, bytes only")
+    sniff.set_defaults(func=cmd_sniff)
+
+    profile = sub.add_parser("profile", help="hot-path timings (PS2_PROFILE_ENABLE builds)")
+    profile.add_argument("--reset", action="store_true", help="clear all probes")
+    profile.set_defaults(func=cmd_profile)
+
+    flight = sub.add_parser("flight", help="wire flight recorder (last bytes on the PS/2 link)")
+    flight.add_argument("--count", type=int, default=0, help="entries to dump, 0 = all kept (max 255)")
+    flight.add_argument("--resume", action="store_true", help="clear and unfreeze")
+    flight.set_defaults(func=cmd_flight)
+
+    stream = sub.add_parser("stream", help="type text over PS/2, paced by the keyboard (PS/2 mode)")
+    stream.add_argument("file", nargs="?", help="file to type, - for stdin")
+    stream.add_argument("--text", help="type this string instead")
+    stream.set_defaults(func=cmd_stream)
+
+    args = parser.parse_args()
+    device = open_keyboard()
+    try:
+        args.func(device, args)
+    finally:
+        device.close()
+
+
+if __name__ == "__main__":
+    main()
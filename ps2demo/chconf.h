@@ -0,0 +1,7 @@
+// keyboards/bjl/ps2demo/chconf.h
+#pragma once
+
+// Let the ChibiOS idle thread WFI while the main loop sleeps in PS/2 mode
+#define CORTEX_ENABLE_WFI_IDLE TRUE
+
+#include_next <chconf.h>
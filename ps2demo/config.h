@@ -12,6 +12,30 @@
 #define PS2_KEYBOARD_CLOCK_PIN  GP16
 #define PS2_KEYBOARD_DATA_PIN   GP17
 
+// Extra PS/2 ports, one keyboard driving several machines (KVM fan-out).
+// Select with the PS2_PORT_NEXT / PS2_PORT_1..4 keycodes.
+// #define PS2_PORT_COUNT 2
+// #define PS2_PORT_CLOCK_PINS { PS2_KEYBOARD_CLOCK_PIN, GP20 }
+// #define PS2_PORT_DATA_PINS  { PS2_KEYBOARD_DATA_PIN, GP21 }
+
+// PS/2-to-USB bridge: in USB mode, read a legacy PS/2 keyboard plugged into
+// the keyboard port and type its keys over USB (ps2_bridge.c)
+// #define PS2_BRIDGE_ENABLE
+
+// PIO transceiver: AT/PS/2 ports run their CLK/DATA framing on an RP2040
+// state machine instead of bit-banging (ps2_pio.h). The DATA pin must be
+// the GPIO right after CLK. Uses pio0 unless PS2_PIO_USE_PIO1 is defined.
+// #define PS2_PIO_ENABLE
+
+// Hot-path profiler: per-function call count and min/mean/max time, dumped
+// to the console with `ps2_tool.py profile` (ps2_profile.h)
+// #define PS2_PROFILE_ENABLE
+
+// Debug builds: hold the main loop callbacks to their worst-case budgets
+// (PS2_WCET_*_US in ps2_profile.h, from bench/wcet_check.c). An overrun
+// counts wcet_overruns and freezes the flight recorder. Turns the profiler on.
+// #define PS2_WCET_ASSERT
+
 // PS/2 Mouse Pin definitions (future)
 #define PS2_MOUSE_CLOCK_PIN     GP18
 #define PS2_MOUSE_DATA_PIN      GP19
@@ -19,8 +43,21 @@
 // Mode switch pin (to toggle between USB and PS/2)
 #define MODE_SWITCH_PIN GP14  // High = USB, Low = PS/2
 
-// Debounce reduces chatter (can also be set in info.json)
-#define DEBOUNCE 5
+// XT jumper: pulled low, PS/2 mode speaks the IBM XT protocol (scan set 1,
+// device-to-host only) for PC/XT-class machines
+// #define XT_MODE_PIN GP13
+
+// Settings store (ps2_config.c): size of ps2_config_block_t, checked at
+// compile time. Bump PS2_CONFIG_VERSION with it.
+#define EECONFIG_KB_DATA_SIZE 80
+
+// Debounce is done in matrix.c (eager on press, deferred on release),
+// so QMK's own debounce pass is turned off
+#define MATRIX_DEBOUNCE_MS 5
+#define DEBOUNCE 0
+
+// Diode matrix boards (rows/cols in info.json): settle time per row
+// #define MATRIX_ROW_SETTLE_US 2
 
 // Note: USB IDs, matrix configuration, and processor info
 // are now defined in info.json instead of here
@@ -0,0 +1,7 @@
+// keyboards/bjl/ps2demo/halconf.h
+#pragma once
+
+// Pin edge callbacks wake the main loop from tickless idle (ps2_idle.c)
+#define PAL_USE_CALLBACKS TRUE
+
+#include_next <halconf.h>
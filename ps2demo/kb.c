@@ -1,13 +1,47 @@
 // keyboards/bjl/ps2demo/kb.c - FIXED VERSION with proper USB driver restoration
 #include "kb.h"
 #include "ps2_keyboard.h"
+#include "ps2_bridge.h"
+#include "ps2_config.h"
+#include "ps2_flight.h"
+#include "ps2_profile.h"
+#include "ps2_send_string.h"
+#include "ps2_sniff.h"
+#include "ps2_stats.h"
+#include "ps2_stream.h"
+#include "ps2_timer.h"
+#include "ps2_warm.h"
 #include "print.h"
 #include "host.h"
 
+// Mode switch must be stable this long before we act on it
+#define MODE_SWITCH_DEBOUNCE_MS 50
+
 // Mode state
 static bool usb_mode = true;
 static bool last_mode = true;
 
+// Mode switch debounce: armed when the pin first disagrees with the mode,
+// cancelled if it agrees again before the timer runs out
+static ps2_timer_t mode_timer;
+static void kb_mode_settled(void *arg);
+
+// Mode switch in steps, SWITCH_SETTLE_MS apart on the timer wheel, so the
+// main loop keeps running while the old driver's last report goes out.
+// usb_mode follows the host driver: it changes on the step that swaps it.
+#define SWITCH_SETTLE_MS 20
+
+typedef enum {
+    SWITCH_IDLE,
+    SWITCH_PS2_ATTACH,    // USB released, bring up the ports
+    SWITCH_USB_RELEASE,   // USB driver back, send an empty report
+    SWITCH_USB_FINISH,    // Report out, start the bridge
+} kb_switch_step_t;
+
+static ps2_timer_t switch_timer;
+static kb_switch_step_t switch_step = SWITCH_IDLE;
+static void kb_switch_settled(void *arg);
+
 // Store original USB driver to restore later
 static host_driver_t *original_usb_driver = NULL;
 
@@ -19,91 +53,289 @@ bool is_ps2_mode(void) {
     return !usb_mode;
 }
 
+void kb_send_string(const char *str) {
+    if (usb_mode) {
+        send_string(str);
+    } else {
+        ps2_send_string(str);
+    }
+}
+
+void kb_send_string_P(const char *str) {
+    if (usb_mode) {
+        send_string_P(str);
+    } else {
+        ps2_send_string_P(str);
+    }
+}
+
 void keyboard_pre_init_kb(void) {
     setPinInputHigh(MODE_SWITCH_PIN);
+#ifdef XT_MODE_PIN
+    setPinInputHigh(XT_MODE_PIN);
+#endif
+    ps2_timer_init(&mode_timer, kb_mode_settled, NULL);
+    ps2_timer_init(&switch_timer, kb_switch_settled, NULL);
+    ps2_stream_init();
     keyboard_pre_init_user();
 }
 
+// PS/2 mode speaks XT while XT_MODE_PIN is jumpered to ground. Read on the
+// way into PS/2 mode, like the mode switch itself.
+static ps2_protocol_t kb_ps2_protocol(void) {
+#ifdef XT_MODE_PIN
+    if (!readPin(XT_MODE_PIN)) return PS2_PROTOCOL_XT;
+#endif
+    return PS2_PROTOCOL_AT;
+}
+
+// Warm restart: state found at boot, applied on the first housekeeping
+// pass (QMK only sets the USB host driver after keyboard_post_init_kb)
+static ps2_warm_state_t warm_state;
+static bool warm_pending = false;
+
+// Stored settings say we were powered off in PS/2 mode
+static bool config_ps2_pending = false;
+
 void keyboard_post_init_kb(void) {
+    ps2_config_t config;
+
+    ps2_idle_init();
+    if (ps2_config_load(&config)) {
+        ps2_keyboard_config_apply(&config);
+        ps2_stats_restore(config.stats);
+        config_ps2_pending = !config.usb_mode;
+    }
+    warm_pending = ps2_warm_load(&warm_state);
+#ifdef PS2_BRIDGE_ENABLE
+    // Only when booting into USB mode - in PS/2 mode a PC is on the port
+    if (readPin(MODE_SWITCH_PIN)) ps2_bridge_start();
+#endif
     keyboard_post_init_user();
 }
 
-void housekeeping_task_kb(void) {
-    static uint32_t mode_change_time = 0;
+static void kb_warm_resume(void) {
+    // Still a PS/2 session? Then skip the debounce and the USB hand-over,
+    // and don't re-init the ports - the hosts never saw us go away
+    if (!warm_state.usb_mode && !readPin(MODE_SWITCH_PIN)) {
+        original_usb_driver = host_get_driver();
+        last_mode = false;
+        usb_mode = false;
+        ps2_keyboard_init();
+        ps2_keyboard_set_protocol(kb_ps2_protocol());
+        ps2_keyboard_warm_resume(&warm_state);
+        host_set_driver(ps2_keyboard_driver(ps2_keyboard_active_port()));
+        uprintf("[WARM] Resumed PS/2 mode\n");
+    } else {
+        ps2_keyboard_warm_resume(&warm_state);
+        uprintf("[WARM] Resumed settings, booting %s mode normally\n", readPin(MODE_SWITCH_PIN) ? "USB" : "PS/2");
+    }
+}
+
+static void kb_warm_save(void) {
+    ps2_warm_state_t state;
+    ps2_keyboard_warm_save(&state);
+    state.usb_mode = usb_mode;
+    ps2_warm_save(&state);
+}
+
+static void kb_config_save(void) {
+    ps2_config_t config;
+    ps2_keyboard_config_save(&config);
+    config.usb_mode = usb_mode;
+    ps2_stats_checkpoint(usb_mode, config.stats);
+    ps2_config_update(&config);
+
+    // Flash writes stall the main loop - keep them away from PS/2 traffic
+    ps2_config_task(!usb_mode && ps2_keyboard_busy());
+}
+
+static void kb_switch_next(kb_switch_step_t step) {
+    switch_step = step;
+    ps2_timer_arm(&switch_timer, SWITCH_SETTLE_MS);
+}
+
+static void kb_switch_mode(bool new_usb_mode) {
+    last_mode = new_usb_mode;
+    ps2_stats_mode_switch(new_usb_mode);
+
+    uprintf("================================\n");
+    uprintf("Mode switch: %s\n", new_usb_mode ? "USB" : "PS/2");
+    uprintf("================================\n");
+
+    if (!new_usb_mode) {
+        // ===== Switching TO PS/2 =====
+
+        // CRITICAL: Capture the driver here, where we know it is valid
+        if (original_usb_driver == NULL) {
+            original_usb_driver = host_get_driver();
+        }
+
+        // We're about to drive these lines ourselves
+        ps2_sniff_stop();
+        ps2_bridge_stop();
+
+        // Clear USB keyboard state while USB driver is still active
+        clear_keyboard();
+        kb_switch_next(SWITCH_PS2_ATTACH);
+
+    } else {
+        // ===== Switching TO USB =====
+        // Disable PS/2 typematic and any text being typed first
+        ps2_keyboard_typematic_disable();
+        ps2_send_string_cancel();
+        ps2_stream_cancel();
+        ps2_keyboard_stop();
+
+        // Restore the original USB driver
+        if (original_usb_driver != NULL) {
+            host_set_driver(original_usb_driver);
+            uprintf("[USB] USB driver restored\n");
+        } else {
+            uprintf("[USB] ERROR: original_usb_driver is NULL!\n");
+        }
+        usb_mode = true;
+        kb_switch_next(SWITCH_USB_RELEASE);
+    }
+}
+
+static void kb_switch_settled(void *arg) {
+    (void)arg;
+
+    switch (switch_step) {
+        case SWITCH_PS2_ATTACH:
+            // Now switch to PS/2 (or XT)
+            ps2_keyboard_init();
+            ps2_keyboard_set_protocol(kb_ps2_protocol());
+            host_set_driver(ps2_keyboard_driver(ps2_keyboard_active_port()));
+            usb_mode = false;
+            switch_step = SWITCH_IDLE;
+            uprintf("[PS2] %s driver activated\n", ps2_keyboard_protocol() == PS2_PROTOCOL_XT ? "XT" : "PS/2");
+            break;
+
+        case SWITCH_USB_RELEASE:
+            // Clear keyboard state in USB mode
+            clear_keyboard();
+            send_keyboard_report();
+            kb_switch_next(SWITCH_USB_FINISH);
+            break;
+
+        case SWITCH_USB_FINISH:
+            switch_step = SWITCH_IDLE;
+#ifdef PS2_BRIDGE_ENABLE
+            ps2_bridge_start();
+#endif
+            break;
+
+        case SWITCH_IDLE:
+            break;
+    }
+}
+
+static void kb_mode_settled(void *arg) {
+    (void)arg;
+    // Still finishing the last switch - look again once it's done
+    if (switch_step != SWITCH_IDLE) {
+        ps2_timer_arm(&mode_timer, SWITCH_SETTLE_MS);
+        return;
+    }
+    // Mode stable for MODE_SWITCH_DEBOUNCE_MS - switch!
+    kb_switch_mode(!last_mode);
+}
+
+// Everything housekeeping does except sleep and flash writes - the part
+// worth profiling, and the part held to its WCET budget (ps2_profile.h)
+static void kb_housekeeping(void) {
+    PS2_PROBE(PS2_PROBE_HOUSEKEEPING);
+
+    if (warm_pending) {
+        warm_pending = false;
+        config_ps2_pending = false;
+        kb_warm_resume();
+    } else if (config_ps2_pending) {
+        // Powered off in PS/2 mode and the switch still says so - it has
+        // settled long ago, so skip the debounce
+        config_ps2_pending = false;
+        if (!readPin(MODE_SWITCH_PIN)) kb_switch_mode(false);
+    }
+
+    ps2_timer_run(timer_read32());
+
     bool current_mode = readPin(MODE_SWITCH_PIN);
 
     // Check for mode mismatch (current pin vs last known mode)
     // This handles both runtime switching AND initial boot detection
     if (current_mode != last_mode) {
-        if (mode_change_time == 0) {
-            mode_change_time = timer_read32();
-        } else if (timer_elapsed32(mode_change_time) > 50) {
-            // Mode stable for 50ms - switch!
-            last_mode = current_mode;
-            usb_mode = current_mode;
-            mode_change_time = 0;
-
-            uprintf("================================\n");
-            uprintf("Mode switch: %s\n", usb_mode ? "USB" : "PS/2");
-            uprintf("================================\n");
-
-            if (!usb_mode) {
-                // ===== Switching TO PS/2 =====
-
-                // CRITICAL: Capture the driver here, where we know it is valid
-                if (original_usb_driver == NULL) {
-                    original_usb_driver = host_get_driver();
-                }
-
-                // Clear USB keyboard state while USB driver is still active
-                clear_keyboard();
-                wait_ms(20);
-
-                // Now switch to PS/2
-                ps2_keyboard_init(PS2_KEYBOARD_CLOCK_PIN, PS2_KEYBOARD_DATA_PIN);
-                host_set_driver(&ps2_keyboard_host_driver);
-                uprintf("[PS2] PS/2 driver activated\n");
-
-            } else {
-                // ===== Switching TO USB =====
-                // Disable PS/2 typematic first
-                ps2_keyboard_typematic_disable();
-
-                // Restore the original USB driver
-                if (original_usb_driver != NULL) {
-                    host_set_driver(original_usb_driver);
-                    uprintf("[USB] USB driver restored\n");
-                } else {
-                    uprintf("[USB] ERROR: original_usb_driver is NULL!\n");
-                }
-
-                wait_ms(20);
-
-                // Clear keyboard state in USB mode
-                clear_keyboard();
-                send_keyboard_report();
-
-                wait_ms(20);
-            }
+        if (!ps2_timer_pending(&mode_timer)) {
+            ps2_timer_arm(&mode_timer, MODE_SWITCH_DEBOUNCE_MS + 1);
         }
     } else {
-        mode_change_time = 0;
+        ps2_timer_cancel(&mode_timer);
     }
 
     // Run PS/2 task only in PS/2 mode
     if (!usb_mode) {
         ps2_keyboard_task();
+        ps2_stream_task();
+    } else {
+        ps2_bridge_task();
+        ps2_sniff_task();
     }
 
     housekeeping_task_user();
+
+    kb_warm_save();
+}
+
+void housekeeping_task_kb(void) {
+    kb_housekeeping();
+
+    // Not part of the budget: a flash write takes milliseconds however
+    // it is timed
+    kb_config_save();
+
+    // Nothing due until the next deadline or pin edge - sleep until then
+    if (!usb_mode) {
+        ps2_idle_plan_t plan;
+        uint32_t deadline;
+        ps2_idle_plan_begin(&plan, timer_read32());
+        if (ps2_timer_next_deadline(&deadline)) {
+            ps2_idle_plan_deadline(&plan, deadline);
+        }
+        ps2_keyboard_idle_plan(&plan);
+        matrix_idle_plan(&plan);
+        // The PC is waiting on credits while a stream is open
+        if (ps2_stream_busy()) ps2_idle_plan_busy(&plan);
+        ps2_idle_sleep(&plan);
+    }
+}
+
+void kb_select_ps2_port(uint8_t port) {
+    if (port >= PS2_PORT_COUNT || port == ps2_keyboard_active_port()) return;
+
+    if (!usb_mode) {
+        // Let go of everything on the machine we're leaving. Its port keeps
+        // being serviced, so the releases still reach it.
+        clear_keyboard();
+        ps2_send_string_cancel();
+        ps2_stream_cancel();
+    }
+
+    ps2_keyboard_select_port(port);
+    if (!usb_mode) {
+        host_set_driver(ps2_keyboard_driver(port));
+    }
+    uprintf("[PS2] Active port: %u\n", port);
 }
 
 bool process_record_kb(uint16_t keycode, keyrecord_t *record) {
     // In PS/2 mode, ensure the correct driver is set BEFORE processing
     if (!usb_mode) {
-        if (host_get_driver() != &ps2_keyboard_host_driver) {
+        host_driver_t *ps2_driver = ps2_keyboard_driver(ps2_keyboard_active_port());
+        if (host_get_driver() != ps2_driver) {
             uprintf("[ERROR] Wrong driver in PS/2 mode! Fixing...\n");
-            host_set_driver(&ps2_keyboard_host_driver);
+            ps2_flight_freeze(PS2_FLIGHT_WRONG_DRIVER);
+            host_set_driver(ps2_driver);
         }
     }
 
@@ -111,6 +343,20 @@ bool process_record_kb(uint16_t keycode, keyrecord_t *record) {
         return false;
     }
 
+    switch (keycode) {
+        case PS2_PORT_NEXT:
+            if (record->event.pressed) {
+                kb_select_ps2_port((ps2_keyboard_active_port() + 1) % PS2_PORT_COUNT);
+            }
+            return false;
+
+        case PS2_PORT_1 ... PS2_PORT_4:
+            if (record->event.pressed) {
+                kb_select_ps2_port(keycode - PS2_PORT_1);
+            }
+            return false;
+    }
+
     if (record->event.pressed) {
         uprintf("[DEBUG] Key pressed: keycode=0x%04X (%s mode)\n",
                 keycode, usb_mode ? "USB" : "PS/2");
@@ -128,6 +374,7 @@ bool led_update_kb(led_t led_state) {
     if (!usb_mode) {
         return false;  // Don't process LED updates in PS/2 mode
     }
+    ps2_bridge_set_leds(led_state);
     return led_update_user(led_state);
 }
 
@@ -136,5 +383,6 @@ void matrix_init_kb(void) {
 }
 
 void matrix_scan_kb(void) {
+    ps2_idle_note_scan();
     matrix_scan_user();
 }
@@ -31,3 +31,21 @@ bool process_record_kb(uint16_t keycode, keyrecord_t *record);
 // Mode detection
 bool is_usb_mode(void);
 bool is_ps2_mode(void);
+
+// PS/2 port selection keycodes (KVM fan-out, see PS2_PORT_COUNT)
+enum kb_keycodes {
+    PS2_PORT_NEXT = QK_KB_0,  // Cycle through the ports
+    PS2_PORT_1,               // Select a port directly
+    PS2_PORT_2,
+    PS2_PORT_3,
+    PS2_PORT_4,
+};
+
+// Send keystrokes to another PS/2 port. Keys held on the old port are
+// released there first.
+void kb_select_ps2_port(uint8_t port);
+
+// Type a string in whichever mode is active. In PS/2 mode the text is
+// streamed as send_buffer drains, so long macros don't overflow it.
+void kb_send_string(const char *str);
+void kb_send_string_P(const char *str);
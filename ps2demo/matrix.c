@@ -0,0 +1,342 @@
+// matrix.c - Bit-parallel matrix scan with vertical-counter debounce (CUSTOM_MATRIX = lite)
+//
+// Two layouts, picked by what info.json defines:
+//  - direct pins (DIRECT_PINS): every key has its own GPIO, and one read of
+//    the GPIO bank samples all of them.
+//  - diode matrix (MATRIX_ROW_PINS/MATRIX_COL_PINS, COL2ROW): rows are
+//    pulled low one at a time, one bank read per row.
+// From there on a row of keys is a matrix_row_t bit vector, and debounce
+// works on whole rows with bitwise operations: its cost grows with the
+// number of rows, not keys.
+//
+// Debounce is asymmetric: a press is reported on the first scan that sees
+// it; a release must read stable for MATRIX_DEBOUNCE_MS before it is
+// reported, which also swallows the bounces after a press. The release
+// timers are vertical counters - bit k of a key's count is bit `col` of
+// plane k - so one ripple-carry add advances every key of a row at once.
+//
+// Every key pin (direct) or column (diode matrix) gets an edge interrupt;
+// between scans all rows are held low, so a press anywhere moves a column.
+// The ISR timestamps the first edge and wakes the main loop, and scans skip
+// the bank reads entirely while nothing has moved and no release is timing.
+// In a diode matrix that holds only while every column reads high: a held
+// key keeps its column low, and a second key on the same column moves
+// nothing. So while a column is low, every pass scans, and the idle sleep
+// is cut to PS2_IDLE_MIN_SLEEP_MS (matrix_idle_plan).
+#include "quantum.h"
+#include "matrix.h"
+#include "ps2_gpio.h"
+#include "ps2_idle.h"
+#include "ps2_profile.h"
+#include "ps2_stats.h"
+#include "ps2_time.h"
+
+#if defined(PROTOCOL_CHIBIOS)
+#    include <ch.h>
+#    include <hal.h>
+#endif
+
+#if defined(MATRIX_ROW_PINS) && defined(MATRIX_COL_PINS)
+#    define MATRIX_DIODES
+static const pin_t row_pins[MATRIX_ROWS] = MATRIX_ROW_PINS;
+static const pin_t col_pins[MATRIX_COLS] = MATRIX_COL_PINS;
+#    define MATRIX_EDGE_SOURCES MATRIX_COLS  // The ISR only knows the column
+#else
+static const pin_t direct_pins[MATRIX_ROWS][MATRIX_COLS] = DIRECT_PINS;
+#    define MATRIX_EDGE_SOURCES (MATRIX_ROWS * MATRIX_COLS)
+#endif
+
+_Static_assert(MATRIX_EDGE_SOURCES <= 32, "matrix.c: one pending-edge bit per pin");
+
+// Scans are skipped only with the edge ISR, or with a harness standing in
+// for it (bench/matrix_check.c)
+#if defined(PROTOCOL_CHIBIOS) || defined(MATRIX_SIM_EDGES)
+#    define MATRIX_EDGE_IRQ
+#endif
+
+// Diode matrix: time for the columns to follow a newly selected row. The
+// pad pullups (~50k) have to recharge what the previous row pulled low.
+#ifndef MATRIX_ROW_SETTLE_US
+#    define MATRIX_ROW_SETTLE_US 2
+#endif
+
+// Planes of the vertical counters: enough to count to MATRIX_DEBOUNCE_MS
+#if MATRIX_DEBOUNCE_MS < 1
+#    error "matrix.c: MATRIX_DEBOUNCE_MS must be at least 1"
+#elif MATRIX_DEBOUNCE_MS < 2
+#    define MATRIX_COUNT_BITS 1
+#elif MATRIX_DEBOUNCE_MS < 4
+#    define MATRIX_COUNT_BITS 2
+#elif MATRIX_DEBOUNCE_MS < 8
+#    define MATRIX_COUNT_BITS 3
+#elif MATRIX_DEBOUNCE_MS < 16
+#    define MATRIX_COUNT_BITS 4
+#else
+#    error "matrix.c: MATRIX_DEBOUNCE_MS must be below 16"
+#endif
+
+#define MATRIX_ROW_MASK ((matrix_row_t)(((uint64_t)1 << MATRIX_COLS) - 1))
+
+#if defined(PS2_GPIO_SIM)
+// Host builds (bench/): the harness says what the bank reads while the
+// rows in `rows_low` are pulled low
+uint32_t matrix_sim_read(uint32_t rows_low);
+#    define MATRIX_BANK_IN() matrix_sim_read(PS2_GPIO_OE())
+#else
+#    define MATRIX_BANK_IN() PS2_GPIO_IN()
+#endif
+
+// Debounce state, one bit per key
+static matrix_row_t count[MATRIX_ROWS][MATRIX_COUNT_BITS];  // ms a release has held
+static matrix_row_t releasing[MATRIX_ROWS];                  // Reported down, reads up
+static uint32_t release_edge_us[MATRIX_ROWS][MATRIX_COLS];   // When the release started, for latency
+static bool keys_releasing = false;                          // Any bit in releasing[]
+static uint32_t last_scan_ms;
+
+// Bank layout, worked out once
+#ifdef MATRIX_DIODES
+static uint32_t row_mask;
+static int8_t col_run;
+#else
+static int8_t direct_run[MATRIX_ROWS];
+#endif
+
+// Written by the edge ISR
+static volatile uint32_t edge_us[MATRIX_EDGE_SOURCES];
+static volatile uint32_t edge_pending = 0;  // Bit per source with an edge in edge_us
+static volatile bool edge_seen = true;      // Scan once at startup
+
+#ifdef MATRIX_EDGE_IRQ
+static void matrix_edge(uint8_t source) {
+    if (!(edge_pending & (1UL << source))) {
+        edge_us[source] = ps2_micros();
+        edge_pending |= 1UL << source;
+    }
+    edge_seen = true;
+    ps2_idle_wake_from_isr();
+}
+#endif
+
+#if defined(PROTOCOL_CHIBIOS)
+static void matrix_edge_cb(void *arg) {
+    matrix_edge((uint8_t)(uintptr_t)arg);
+}
+#elif defined(MATRIX_SIM_EDGES)
+void matrix_sim_edge(uint8_t source) {
+    matrix_edge(source);
+}
+#endif
+
+static void matrix_watch(pin_t pin, uint8_t source) {
+    setPinInputHigh(pin);
+#if defined(PROTOCOL_CHIBIOS)
+    palSetLineCallback(pin, matrix_edge_cb, (void *)(uintptr_t)source);
+    palEnableLineEvent(pin, PAL_EVENT_MODE_BOTH_EDGES);
+#endif
+}
+
+// Pad of pins[0] if the pins are consecutive GPIOs in column order (the
+// usual board layout), else -1
+static int8_t matrix_run(const pin_t pins[MATRIX_COLS]) {
+    for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+        if (pins[col] == NO_PIN || PS2_GPIO_MASK(pins[col]) != PS2_GPIO_MASK(pins[0]) << col) return -1;
+    }
+    return __builtin_ctz(PS2_GPIO_MASK(pins[0]));
+}
+
+// Bank bits (set = low) -> one row of key bits. A run is a single shift;
+// anything else is gathered pin by pin.
+static inline matrix_row_t matrix_gather(uint32_t low, const pin_t pins[MATRIX_COLS], int8_t run) {
+    if (run >= 0) return (low >> run) & MATRIX_ROW_MASK;
+
+    matrix_row_t bits = 0;
+    for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+        if (pins[col] != NO_PIN && (low & PS2_GPIO_MASK(pins[col]))) bits |= MATRIX_ROW_SHIFTER << col;
+    }
+    return bits;
+}
+
+void matrix_init_custom(void) {
+#ifdef MATRIX_DIODES
+    // Rows are open drain like the PS/2 lines: latch low, output enable
+    // pulls the row down. Between scans they are all down.
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        setPinInputHigh(row_pins[row]);
+        writePinLow(row_pins[row]);
+        row_mask |= PS2_GPIO_MASK(row_pins[row]);
+    }
+    PS2_GPIO_OE_SET(row_mask);
+
+    col_run = matrix_run(col_pins);
+    for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+        matrix_watch(col_pins[col], col);
+    }
+#else
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        direct_run[row] = matrix_run(direct_pins[row]);
+        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+            if (direct_pins[row][col] != NO_PIN) matrix_watch(direct_pins[row][col], row * MATRIX_COLS + col);
+        }
+    }
+#endif
+    last_scan_ms = timer_read32();
+}
+
+// Edges since the last call; the ISR starts collecting for the next scan
+static uint32_t matrix_take_edges(void) {
+#if defined(PROTOCOL_CHIBIOS)
+    chSysLock();
+#endif
+    uint32_t pending = edge_pending;
+    edge_pending = 0;
+    edge_seen = false;
+#if defined(PROTOCOL_CHIBIOS)
+    chSysUnlock();
+#endif
+    return pending;
+}
+
+// A key is down that a new press might hide behind: in a diode matrix,
+// a column reading low with all rows held low. Direct pins all have their
+// own edge.
+static bool matrix_columns_low(void) {
+#ifdef MATRIX_DIODES
+    return matrix_gather(~MATRIX_BANK_IN(), col_pins, col_run) != 0;
+#else
+    return false;
+#endif
+}
+
+void matrix_idle_plan(ps2_idle_plan_t *plan) {
+    if (matrix_columns_low()) ps2_idle_plan_deadline(plan, plan->now + PS2_IDLE_MIN_SLEEP_MS);
+}
+
+// An edge no scan has taken yet. The idle sleep reads it under the lock,
+// last thing before it suspends: an edge that came in while the matrix
+// was being read must not be slept through.
+bool matrix_edge_pending(void) {
+    return edge_seen;
+}
+
+// Every key into raw[], bit set = down
+static void matrix_sample(matrix_row_t raw[]) {
+#ifdef MATRIX_DIODES
+    matrix_row_t any = 0;
+
+    PS2_GPIO_OE_CLR(row_mask);
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        uint32_t line = PS2_GPIO_MASK(row_pins[row]);
+        PS2_GPIO_OE_SET(line);
+        ps2_delay_us(MATRIX_ROW_SETTLE_US);
+        raw[row] = matrix_gather(~MATRIX_BANK_IN(), col_pins, col_run);
+        PS2_GPIO_OE_CLR(line);
+        any |= raw[row];
+    }
+    PS2_GPIO_OE_SET(row_mask);
+    ps2_delay_us(MATRIX_ROW_SETTLE_US);
+
+    // Walking the rows toggled the columns of every held key - those edges
+    // are ours. Only columns that disagree with the scan mean a key moved
+    // while we were reading, and call for another pass.
+    matrix_take_edges();
+    if (matrix_gather(~MATRIX_BANK_IN(), col_pins, col_run) != any) edge_seen = true;
+#else
+    uint32_t low = ~MATRIX_BANK_IN();
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        raw[row] = matrix_gather(low, direct_pins[row], direct_run[row]);
+    }
+#endif
+}
+
+// Time of the edge that started a change (now, if the ISR didn't catch one)
+static uint32_t matrix_edge_time(uint8_t row, uint8_t col, uint32_t edges) {
+#ifdef MATRIX_DIODES
+    uint8_t source = col;
+#else
+    uint8_t source = row * MATRIX_COLS + col;
+#endif
+    return (edges & (1UL << source)) ? edge_us[source] : ps2_micros();
+}
+
+// Latency counters, for the few keys that changed this scan
+static void matrix_note_edges(uint8_t row, matrix_row_t started, matrix_row_t pressed, matrix_row_t released, uint32_t edges) {
+    for (; started; started &= started - 1) {
+        uint8_t col = __builtin_ctz(started);
+        release_edge_us[row][col] = matrix_edge_time(row, col, edges);
+    }
+    for (; pressed; pressed &= pressed - 1) {
+        ps2_stats_key_edge(matrix_edge_time(row, __builtin_ctz(pressed), edges));
+    }
+    for (; released; released &= released - 1) {
+        ps2_stats_key_edge(release_edge_us[row][__builtin_ctz(released)]);
+    }
+}
+
+bool matrix_scan_custom(matrix_row_t current_matrix[]) {
+#ifdef MATRIX_EDGE_IRQ
+    // No edge, no release timing and no key another could hide behind:
+    // the matrix can't have changed
+    if (!edge_seen && !keys_releasing && !matrix_columns_low()) return false;
+#endif
+    PS2_PROBE(PS2_PROBE_MATRIX_SCAN);
+
+    uint32_t edges = matrix_take_edges();
+    uint32_t now = timer_read32();
+    uint32_t ticks = now - last_scan_ms;
+    if (ticks > MATRIX_DEBOUNCE_MS) ticks = MATRIX_DEBOUNCE_MS;
+    last_scan_ms = now;
+
+    matrix_row_t raw[MATRIX_ROWS];
+    matrix_sample(raw);
+
+    bool changed = false;
+    keys_releasing = false;
+
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        matrix_row_t reported = current_matrix[row];
+        matrix_row_t up = reported & ~raw[row];
+        matrix_row_t timing = up & releasing[row];  // Read up last scan too
+        matrix_row_t released = 0;
+        matrix_row_t *planes = count[row];
+
+        // A key that read down (or isn't releasing) starts from zero
+        for (uint8_t k = 0; k < MATRIX_COUNT_BITS; k++) {
+            planes[k] &= timing;
+        }
+
+        // Add the ms since the last scan to every running count, one
+        // ripple-carry increment per ms, stopping keys that reach the limit
+        for (uint32_t t = 0; t < ticks && timing; t++) {
+            matrix_row_t carry = timing;
+            matrix_row_t done = timing;
+            for (uint8_t k = 0; k < MATRIX_COUNT_BITS; k++) {
+                matrix_row_t next = planes[k] & carry;
+                planes[k] ^= carry;
+                carry = next;
+                done &= ((MATRIX_DEBOUNCE_MS >> k) & 1) ? planes[k] : ~planes[k];
+            }
+            released |= done;
+            timing &= ~done;
+        }
+        for (uint8_t k = 0; k < MATRIX_COUNT_BITS; k++) {
+            planes[k] &= ~released;
+        }
+
+        // Presses go out on first sight
+        matrix_row_t pressed = raw[row] & ~reported;
+        matrix_row_t started = up & ~releasing[row];
+
+        releasing[row] = up & ~released;
+        if (releasing[row]) keys_releasing = true;
+
+        if (started | pressed | released) {
+            matrix_note_edges(row, started, pressed, released, edges);
+        }
+        if (pressed | released) {
+            current_matrix[row] = (reported | pressed) & ~released;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
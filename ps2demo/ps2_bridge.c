@@ -0,0 +1,461 @@
+// ps2_bridge.c - PS/2-to-USB bridge (we are the PS/2 host)
+//
+// The roles are the reverse of ps2_keyboard.c: the attached keyboard
+// generates the clock and we follow it.
+//   keyboard-to-us: start bit, 8 data bits, odd parity, stop bit, each
+//                   valid on a falling CLK edge
+//   us-to-keyboard: hold CLK low >100us, pull DATA low (start bit), let
+//                   CLK go; the keyboard clocks, we change DATA after each
+//                   falling edge, and it ACKs by holding DATA low on clock 11
+// Every falling edge is one interrupt, so the CPU is free between bits and
+// a received byte is ready as soon as its stop bit is clocked.
+//
+// Decoding runs in the main loop: E0/F0/E1 prefixes go through a reverse
+// index of the set 2 tables, and the result goes to QMK with
+// register_code()/unregister_code(), so reports follow the USB host's
+// 6KRO/NKRO setting like any other key.
+#include "ps2_bridge.h"
+#include "ps2_keyboard.h"
+#include "ps2_sniff.h"
+#include "ps2_stats.h"
+#include "ps2_timer.h"
+#include "ps2_time.h"
+#include "ps2_gpio.h"
+#include "ps2_ram.h"
+#include "kb.h"
+#include <string.h>
+
+#if defined(PROTOCOL_CHIBIOS)
+#    include <ch.h>
+#    include <hal.h>
+#endif
+
+_Static_assert((PS2_BRIDGE_RX_QUEUE_SIZE & (PS2_BRIDGE_RX_QUEUE_SIZE - 1)) == 0, "PS2_BRIDGE_RX_QUEUE_SIZE must be a power of two");
+
+// =============================================================================
+// LINK (falling CLK edge ISR)
+// =============================================================================
+
+typedef enum {
+    LINK_IDLE,
+    LINK_RX,   // Receiving a byte from the keyboard
+    LINK_RTS,  // We are holding CLK low to take the bus
+    LINK_TX    // Keyboard is clocking our byte in
+} link_state_t;
+
+typedef enum {
+    TX_BUSY,
+    TX_ACKED,   // Keyboard held DATA low on clock 11
+    TX_NO_ACK
+} tx_result_t;
+
+static volatile link_state_t link_state = LINK_IDLE;
+static volatile tx_result_t tx_result = TX_BUSY;
+static uint8_t link_bits = 0;
+static uint16_t link_shift = 0;  // Received D0-D7, parity, stop / byte being sent
+static uint32_t link_last_us = 0;
+
+typedef struct {
+    uint16_t frame;  // D0-D7, parity, stop
+    uint32_t at_us;  // Stop bit edge
+} rx_entry_t;
+
+static rx_entry_t rx_queue[PS2_BRIDGE_RX_QUEUE_SIZE];
+static volatile uint8_t rx_head = 0;  // Written by the ISR
+static volatile uint8_t rx_tail = 0;  // Written by the main loop
+
+static inline bool ps2_bridge_odd_parity(uint8_t byte) {
+    return !(__builtin_popcount(byte) & 1);
+}
+
+void PS2_RAM_FUNC(ps2_bridge_clock_fall)(bool data, uint32_t now_us) {
+    if (link_state == LINK_RX && now_us - link_last_us > PS2_BRIDGE_BIT_TIMEOUT_US) {
+        link_state = LINK_IDLE;  // Lost edges - resync on the next start bit
+        PS2_STAT_INC(PS2_STAT_BRIDGE_ERRORS);
+    }
+    link_last_us = now_us;
+
+    switch (link_state) {
+        case LINK_IDLE:
+            if (!data) {
+                link_state = LINK_RX;
+                link_bits = 0;
+                link_shift = 0;
+            }
+            break;
+
+        case LINK_RX:
+            link_shift |= (uint16_t)data << link_bits;
+            if (++link_bits == 10) {
+                uint8_t next = (rx_head + 1) & (PS2_BRIDGE_RX_QUEUE_SIZE - 1);
+                if (next != rx_tail) {
+                    rx_queue[rx_head] = (rx_entry_t){link_shift, now_us};
+                    rx_head = next;
+                } else {
+                    PS2_STAT_INC(PS2_STAT_BRIDGE_ERRORS);
+                }
+                link_state = LINK_IDLE;
+            }
+            break;
+
+        case LINK_RTS:
+            break;  // Our own CLK pull
+
+        case LINK_TX:
+            // Edges 0-8 shift out D0-D7 and parity, 9 releases DATA for
+            // the stop bit, 10 is the keyboard's ACK
+            if (link_bits < 9) {
+                bool bit = (link_shift >> link_bits) & 1;
+                ps2_gpio_drive(PS2_KB_DATA, bit ? 0 : PS2_KB_DATA);
+            } else if (link_bits == 9) {
+                ps2_gpio_release(PS2_KB_DATA);
+            } else {
+                tx_result = data ? TX_NO_ACK : TX_ACKED;
+                link_state = LINK_IDLE;
+            }
+            link_bits++;
+            break;
+    }
+}
+
+// Take the bus and start clocking `byte` out. Returns at once; the rest of
+// the frame is driven from the edge interrupt.
+static void ps2_bridge_transmit(uint8_t byte) {
+    link_shift = byte | ((uint16_t)ps2_bridge_odd_parity(byte) << 8);
+    link_bits = 0;
+    tx_result = TX_BUSY;
+
+    // Holding CLK low also aborts anything the keyboard was sending; it
+    // keeps the byte and sends it again once we're done
+    link_state = LINK_RTS;
+    ps2_gpio_pull_low(PS2_KB_CLK);
+    ps2_delay_us(PS2_BRIDGE_RTS_US);
+    ps2_gpio_pull_low(PS2_KB_DATA);
+    link_state = LINK_TX;
+    ps2_gpio_release(PS2_KB_CLK);
+}
+
+static void ps2_bridge_link_reset(void) {
+    ps2_gpio_release(PS2_KB_LINES);
+    link_state = LINK_IDLE;
+}
+
+// =============================================================================
+// COMMANDS (main loop)
+// =============================================================================
+
+static bool active = false;
+static bool connected = false;  // Self-test seen and settings sent
+static bool wait_bat = false;   // Reset ACKed, self-test result pending
+static bool leds_dirty = false;
+static uint8_t leds = 0;        // 0xED argument format
+
+static uint8_t tx_queue[PS2_BRIDGE_TX_QUEUE_SIZE];
+static uint8_t tx_len = 0;
+static bool awaiting = false;   // tx_queue[0] is on its way or waiting for its ACK
+static uint8_t tries = 0;
+static ps2_timer_t response_timer;
+
+static void ps2_bridge_command(uint8_t byte) {
+    if (tx_len < PS2_BRIDGE_TX_QUEUE_SIZE) {
+        tx_queue[tx_len++] = byte;
+    }
+}
+
+static void ps2_bridge_command_done(void) {
+    tx_len--;
+    for (uint8_t i = 0; i < tx_len; i++) {
+        tx_queue[i] = tx_queue[i + 1];
+    }
+    awaiting = false;
+    tries = 0;
+    ps2_timer_cancel(&response_timer);
+}
+
+static void ps2_bridge_send_next(void) {
+    if (awaiting || tx_len == 0) return;
+    // Don't cut a byte off halfway; the next pass gets to send
+    if (link_state != LINK_IDLE) return;
+
+    awaiting = true;
+    ps2_timer_arm(&response_timer, PS2_BRIDGE_RESPONSE_MS);
+    ps2_bridge_transmit(tx_queue[0]);
+}
+
+static void ps2_bridge_reset_keyboard(void) {
+    tx_len = 0;
+    awaiting = false;
+    tries = 0;
+    connected = false;
+    wait_bat = false;
+    ps2_bridge_command(PS2_CMD_RESET);
+}
+
+// The byte in flight failed (no ACK, Resend, timeout): send it again on
+// the next pass, or drop the queue once it has used up its retries
+static void ps2_bridge_retry(void) {
+    awaiting = false;
+    PS2_STAT_INC(PS2_STAT_BRIDGE_ERRORS);
+
+    if (++tries >= PS2_BRIDGE_RETRIES) {
+        uprintf("[BRIDGE] Command 0x%02X not answered, giving up\n", tx_queue[0]);
+        ps2_timer_cancel(&response_timer);
+        tx_len = 0;
+        tries = 0;
+    }
+}
+
+static void ps2_bridge_response_timeout(void *arg) {
+    (void)arg;
+
+    if (wait_bat) {
+        // No self-test result - most likely nothing plugged in. A keyboard
+        // plugged in later announces itself with 0xAA.
+        wait_bat = false;
+        uprintf("[BRIDGE] No keyboard on the port\n");
+        return;
+    }
+    if (!awaiting) return;
+
+    if (link_state != LINK_IDLE) ps2_bridge_link_reset();  // Never clocked us in
+    ps2_bridge_retry();
+}
+
+// =============================================================================
+// DECODING (main loop)
+// =============================================================================
+
+static uint8_t index_plain[256];
+static uint8_t index_e0[256];
+static bool index_built = false;
+
+static struct {
+    bool e0;
+    bool f0;
+    uint8_t e1_left;  // Bytes of the Pause sequence still to come
+} decode;
+
+// Held keys by (E0, make code): a make for a key already down is typematic
+static uint8_t held[2][32];
+
+static void ps2_bridge_latency(uint32_t at_us) {
+    uint32_t latency = ps2_micros() - at_us;
+    ps2_stats[PS2_STAT_BRIDGE_US_LAST] = latency;
+    PS2_STAT_MAX(PS2_STAT_BRIDGE_US_MAX, latency);
+    PS2_STAT_INC(PS2_STAT_BRIDGE_EVENTS);
+    ps2_stats[PS2_STAT_BRIDGE_US_TOTAL] += latency;
+}
+
+static void ps2_bridge_release_all(void) {
+    for (uint8_t e0 = 0; e0 < 2; e0++) {
+        for (uint16_t code = 0; code < 256; code++) {
+            if (held[e0][code >> 3] & (1 << (code & 7))) {
+                unregister_code(e0 ? index_e0[code] : index_plain[code]);
+            }
+        }
+    }
+    memset(held, 0, sizeof(held));
+    memset(&decode, 0, sizeof(decode));
+}
+
+static void ps2_bridge_key(uint8_t code, uint32_t at_us) {
+    bool e0 = decode.e0;
+    bool release = decode.f0;
+    decode.e0 = decode.f0 = false;
+
+    // Ctrl+Pause is sent as E0 7E instead of the E1 sequence
+    uint8_t keycode = (e0 && code == PS2_SCROLL) ? KC_PAUSE : (e0 ? index_e0 : index_plain)[code];
+    if (keycode == 0) return;  // Fake shifts around Print Screen, unknown keys
+
+    uint8_t *byte = &held[e0][code >> 3];
+    uint8_t bit = 1 << (code & 7);
+
+    if (!release) {
+        if (*byte & bit) return;  // Typematic repeat
+        *byte |= bit;
+        register_code(keycode);
+    } else {
+        if (!(*byte & bit)) return;
+        *byte &= ~bit;
+        unregister_code(keycode);
+    }
+    ps2_bridge_latency(at_us);
+}
+
+void ps2_bridge_receive(uint8_t byte, uint32_t at_us) {
+    if (awaiting) {
+        if (byte == PS2_ACK) {
+            if (tx_queue[0] == PS2_CMD_RESET) {
+                wait_bat = true;
+                ps2_bridge_command_done();
+                ps2_timer_arm(&response_timer, PS2_BRIDGE_BAT_MS);
+            } else {
+                ps2_bridge_command_done();
+            }
+            return;
+        }
+        if (byte == PS2_RESEND) {
+            ps2_bridge_retry();
+            return;
+        }
+    }
+
+    if (decode.e1_left) {
+        // E1 14 77 E1 F0 14 F0 77: press and release in one, no break code
+        if (--decode.e1_left == 0) {
+            register_code(KC_PAUSE);
+            unregister_code(KC_PAUSE);
+            ps2_bridge_latency(at_us);
+        }
+        return;
+    }
+
+    switch (byte) {
+        case PS2_PREFIX_E0:
+            decode.e0 = true;
+            return;
+        case PS2_PREFIX_F0:
+            decode.f0 = true;
+            return;
+        case PS2_PREFIX_E1:
+            decode.e1_left = 7;
+            return;
+        case 0x00:
+        case 0xFF:
+            // Keyboard buffer overrun: a key event is lost
+            PS2_STAT_INC(PS2_STAT_BRIDGE_ERRORS);
+            return;
+    }
+
+    if (byte == PS2_BAT_SUCCESS && !decode.e0 && !decode.f0) {
+        if (!wait_bat) uprintf("[BRIDGE] Keyboard attached\n");
+        ps2_timer_cancel(&response_timer);
+        wait_bat = false;
+        connected = true;
+
+        // A self-test we didn't ask for is a hot-plug or a keyboard reset:
+        // whatever it had held is gone
+        ps2_bridge_release_all();
+        tx_len = 0;
+        awaiting = false;
+        ps2_bridge_command(PS2_CMD_SET_TYPEMATIC);
+        ps2_bridge_command(PS2_BRIDGE_TYPEMATIC);
+        leds_dirty = true;
+        return;
+    }
+    if (byte == PS2_BAT_FAIL) {
+        uprintf("[BRIDGE] Keyboard self-test failed\n");
+        wait_bat = false;
+        return;
+    }
+
+    ps2_bridge_key(byte, at_us);
+}
+
+// =============================================================================
+// CONTROL
+// =============================================================================
+
+bool ps2_bridge_active(void) {
+    return active;
+}
+
+#if defined(PROTOCOL_CHIBIOS)
+
+static void ps2_bridge_edge_cb(void *arg) {
+    (void)arg;
+    ps2_bridge_clock_fall(ps2_gpio_read(PS2_KB_DATA), ps2_micros());
+}
+
+static void ps2_bridge_arm(bool on) {
+    if (on) {
+        palSetLineCallback(PS2_KEYBOARD_CLOCK_PIN, ps2_bridge_edge_cb, NULL);
+        palEnableLineEvent(PS2_KEYBOARD_CLOCK_PIN, PAL_EVENT_MODE_FALLING_EDGE);
+    } else {
+        palDisableLineEvent(PS2_KEYBOARD_CLOCK_PIN);
+    }
+}
+
+#else
+
+// No edge interrupts on this platform - edges only come from ps2_bridge_clock_fall()
+static void ps2_bridge_arm(bool on) {
+    (void)on;
+}
+
+#endif
+
+bool ps2_bridge_start(void) {
+    if (!is_usb_mode() || ps2_sniff_active()) return false;
+    if (active) return true;
+
+    if (!index_built) {
+        ps2_scancode_reverse_index(index_plain, index_e0);
+        ps2_timer_init(&response_timer, ps2_bridge_response_timeout, NULL);
+        index_built = true;
+    }
+
+    // Same open-collector setup as device mode: pull-ups, latches low
+    ps2_gpio_init(PS2_KEYBOARD_CLOCK_PIN, PS2_KEYBOARD_DATA_PIN);
+    link_state = LINK_IDLE;
+    rx_tail = rx_head;
+    memset(held, 0, sizeof(held));
+    memset(&decode, 0, sizeof(decode));
+
+    active = true;
+    ps2_bridge_arm(true);
+    ps2_bridge_reset_keyboard();
+    uprintf("[BRIDGE] Started, resetting keyboard\n");
+    return true;
+}
+
+void ps2_bridge_stop(void) {
+    if (!active) return;
+    ps2_bridge_arm(false);
+    ps2_timer_cancel(&response_timer);
+    ps2_bridge_link_reset();
+    ps2_bridge_release_all();
+    active = false;
+    connected = false;
+    uprintf("[BRIDGE] Stopped\n");
+}
+
+void ps2_bridge_set_leds(led_t state) {
+    uint8_t value = (state.scroll_lock ? 0x01 : 0) | (state.num_lock ? 0x02 : 0) | (state.caps_lock ? 0x04 : 0);
+    if (value != leds) {
+        leds = value;
+        leds_dirty = true;
+    }
+}
+
+void ps2_bridge_task(void) {
+    if (!active) return;
+
+    while (rx_tail != rx_head) {
+        rx_entry_t entry = rx_queue[rx_tail];
+        rx_tail = (rx_tail + 1) & (PS2_BRIDGE_RX_QUEUE_SIZE - 1);
+
+        uint8_t byte = entry.frame & 0xFF;
+        bool parity = (entry.frame >> 8) & 1;
+        bool stop = (entry.frame >> 9) & 1;
+        if (parity != ps2_bridge_odd_parity(byte) || !stop) {
+            // Ask for it again, ahead of anything queued
+            PS2_STAT_INC(PS2_STAT_BRIDGE_ERRORS);
+            if (!awaiting && link_state == LINK_IDLE) ps2_bridge_transmit(PS2_CMD_RESEND);
+            continue;
+        }
+        ps2_bridge_receive(byte, entry.at_us);
+    }
+
+    if (awaiting && tx_result == TX_NO_ACK) {
+        tx_result = TX_BUSY;
+        ps2_bridge_retry();
+    }
+
+    if (connected && leds_dirty && tx_len == 0) {
+        leds_dirty = false;
+        ps2_bridge_command(PS2_CMD_SET_LEDS);
+        ps2_bridge_command(leds);
+    }
+    ps2_bridge_send_next();
+}
@@ -0,0 +1,52 @@
+// ps2_bridge.h
+#ifndef PS2_BRIDGE_H
+#define PS2_BRIDGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "quantum.h"  // led_t
+
+// PS/2-to-USB bridge (USB mode): the keyboard port becomes a PS/2 *host*
+// for a legacy keyboard plugged into GP16/GP17, and its keys go out over
+// USB as if they were typed here. Turn it on with PS2_BRIDGE_ENABLE in
+// config.h. Frames are received from CLK edge interrupts; commands (reset,
+// LEDs, typematic) are sent from the main loop.
+
+// Response time for a command byte. After a reset the keyboard runs its
+// self-test first, which can take most of a second.
+#ifndef PS2_BRIDGE_RESPONSE_MS
+#define PS2_BRIDGE_RESPONSE_MS 25
+#endif
+#define PS2_BRIDGE_BAT_MS 1000
+#define PS2_BRIDGE_RETRIES 3
+
+// Request-to-send: CLK held low at least 100us
+#define PS2_BRIDGE_RTS_US 110
+
+// Gap between clock edges that ends a frame being received
+#define PS2_BRIDGE_BIT_TIMEOUT_US 2000
+
+// Typematic setting for the attached keyboard: longest delay, slowest
+// rate. The USB host repeats keys itself, so repeats are dropped here;
+// this only keeps them from holding the wire ahead of real events.
+#define PS2_BRIDGE_TYPEMATIC 0x7F
+
+// Received bytes waiting for the main loop (power of two)
+#ifndef PS2_BRIDGE_RX_QUEUE_SIZE
+#define PS2_BRIDGE_RX_QUEUE_SIZE 32
+#endif
+#define PS2_BRIDGE_TX_QUEUE_SIZE 8
+
+bool ps2_bridge_start(void);  // USB mode only; fails while the sniffer has the pins
+void ps2_bridge_stop(void);   // Releases any keys still held
+bool ps2_bridge_active(void);
+void ps2_bridge_task(void);   // Main loop: decode received bytes, run commands
+void ps2_bridge_set_leds(led_t leds);  // USB host LED state, mirrored to the keyboard
+
+// Host-role link, split out so a host build can drive it against a
+// simulated keyboard: one call per falling CLK edge with the DATA level
+// (ISR), and one per byte taken off the receive queue (main loop).
+void ps2_bridge_clock_fall(bool data, uint32_t now_us);
+void ps2_bridge_receive(uint8_t byte, uint32_t at_us);
+
+#endif // PS2_BRIDGE_H
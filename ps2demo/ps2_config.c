@@ -0,0 +1,95 @@
+// ps2_config.c - Settings kept in EEPROM, written back lazily
+#include "ps2_config.h"
+#include <string.h>
+#include "eeconfig.h"
+#include "print.h"
+#include "ps2_crc.h"
+#include "ps2_stats.h"
+#include "ps2_timer.h"
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    ps2_config_t config;
+    uint16_t crc;      // Over config
+    uint16_t reserved;
+} ps2_config_block_t;
+
+// EECONFIG_KB_DATA_SIZE (config.h) has to be a plain number for QMK's
+// preprocessor checks - keep it in step with the block
+_Static_assert(sizeof(ps2_config_block_t) == EECONFIG_KB_DATA_SIZE, "EECONFIG_KB_DATA_SIZE must match ps2_config_block_t");
+
+static ps2_config_t stored;   // As in EEPROM (or what we'd find there)
+static ps2_config_t pending;  // Latest settings
+static bool dirty = false;
+
+// Runs PS2_CONFIG_FLUSH_MS after the last change or busy pass; while it's
+// pending the write waits
+static ps2_timer_t flush_timer;
+
+static void ps2_config_flush_due(void *arg) {
+    (void)arg;  // ps2_config_task() does the write
+}
+
+bool ps2_config_load(ps2_config_t *config) {
+    ps2_config_block_t block;
+
+    ps2_timer_init(&flush_timer, ps2_config_flush_due, NULL);
+    eeconfig_read_kb_datablock(&block, 0, sizeof(block));
+
+    bool valid = block.magic == PS2_CONFIG_MAGIC &&
+                 block.version == PS2_CONFIG_VERSION &&
+                 block.size == sizeof(ps2_config_t) &&
+                 block.crc == ps2_crc16(&block.config, sizeof(ps2_config_t));
+    if (!valid) {
+        // Blank, another layout, or a write cut short by power loss
+        uprintf("[CONFIG] No stored settings, using defaults\n");
+        memset(&stored, 0, sizeof(stored));
+        return false;
+    }
+
+    stored = block.config;
+    *config = stored;
+    uprintf("[CONFIG] Loaded stored settings\n");
+    return true;
+}
+
+void ps2_config_update(const ps2_config_t *config) {
+    if (memcmp(config, dirty ? &pending : &stored, sizeof(ps2_config_t)) == 0) {
+        return;
+    }
+
+    pending = *config;
+    dirty = memcmp(&pending, &stored, sizeof(ps2_config_t)) != 0;  // Changed back? Nothing to write.
+    if (dirty) {
+        ps2_timer_arm(&flush_timer, PS2_CONFIG_FLUSH_MS);
+    } else {
+        ps2_timer_cancel(&flush_timer);
+    }
+}
+
+void ps2_config_task(bool link_busy) {
+    if (!dirty) return;
+
+    if (link_busy) {
+        ps2_timer_arm(&flush_timer, PS2_CONFIG_FLUSH_MS);
+        return;
+    }
+    if (ps2_timer_pending(&flush_timer)) return;
+
+    ps2_config_block_t block = {
+        .magic   = PS2_CONFIG_MAGIC,
+        .version = PS2_CONFIG_VERSION,
+        .size    = sizeof(ps2_config_t),
+        .config  = pending,
+        .crc     = ps2_crc16(&pending, sizeof(ps2_config_t)),
+    };
+    // Only changed bytes reach the flash log
+    eeconfig_update_kb_datablock(&block, 0, sizeof(block));
+
+    stored = pending;
+    dirty = false;
+    PS2_STAT_INC(PS2_STAT_CONFIG_WRITES);
+    uprintf("[CONFIG] Settings saved\n");
+}
@@ -0,0 +1,55 @@
+// ps2_config.h
+#ifndef PS2_CONFIG_H
+#define PS2_CONFIG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Persistent settings. What the hosts negotiated (scan set, typematic) and
+// the last mode and port are kept in QMK's keyboard datablock in EEPROM,
+// which on the RP2040 is emulated in wear-leveled flash. Power-cycling
+// the keyboard behind a PC that stays on - a KVM, a hot-plug - then
+// brings it back with the settings that PC gave it, which the PC won't
+// send again. The lifetime link counters (ps2_stats.c) ride along.
+//
+// Changes are only tracked in RAM. A flash write stalls the main loop, so
+// the block is written once the settings have stopped changing and the
+// PS/2 link has been quiet for PS2_CONFIG_FLUSH_MS. Bump
+// PS2_CONFIG_VERSION whenever the layout changes.
+#define PS2_CONFIG_MAGIC   0x43325350  // "PS2C"
+#define PS2_CONFIG_VERSION 2
+#define PS2_CONFIG_PORTS   4           // Fixed layout, independent of PS2_PORT_COUNT
+#define PS2_CONFIG_STATS   10          // Lifetime counters kept, ps2_stats.c picks which
+
+#ifndef PS2_CONFIG_FLUSH_MS
+#define PS2_CONFIG_FLUSH_MS 5000
+#endif
+
+typedef struct {
+    uint8_t scancode_set;
+    uint8_t reserved;
+    uint16_t typematic_delay_ms;
+    uint16_t typematic_rate_ms;
+} ps2_config_port_t;
+
+typedef struct {
+    uint8_t usb_mode;            // Mode at the last write
+    uint8_t active_port;
+    uint8_t port_count;          // Must match on load
+    uint8_t reserved;
+    ps2_config_port_t ports[PS2_CONFIG_PORTS];
+    uint32_t stats[PS2_CONFIG_STATS];  // As of the last checkpoint
+} ps2_config_t;
+
+// At boot, one datablock read: true (and *config filled) if the stored
+// block is valid for this layout
+bool ps2_config_load(ps2_config_t *config);
+
+// Current settings, every housekeeping pass. Cheap when nothing changed
+// (compare, no CRC).
+void ps2_config_update(const ps2_config_t *config);
+
+// Write back if due. link_busy postpones it and restarts the quiet period.
+void ps2_config_task(bool link_busy);
+
+#endif // PS2_CONFIG_H
@@ -0,0 +1,23 @@
+// ps2_crc.h
+#ifndef PS2_CRC_H
+#define PS2_CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC-16/CCITT-FALSE, bitwise. Only run over small state blocks, so no
+// table (and no CRC_ENABLE dependency).
+static inline uint16_t ps2_crc16(const void *data, size_t len) {
+    const uint8_t *p = data;
+    uint16_t crc = 0xFFFF;
+
+    while (len--) {
+        crc ^= (uint16_t)*p++ << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+#endif // PS2_CRC_H
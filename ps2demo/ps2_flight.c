@@ -0,0 +1,48 @@
+// ps2_flight.c - Wire flight recorder freeze and dump
+#include "ps2_flight.h"
+#include "print.h"
+
+ps2_flight_t ps2_flight;
+
+static const char *const ps2_flight_state_names[] = {
+    [PS2_FLIGHT_RUNNING]         = "running",
+    [PS2_FLIGHT_BUFFER_OVERFLOW] = "send buffer overflow",
+    [PS2_FLIGHT_EVENT_OVERFLOW]  = "event queue overflow",
+    [PS2_FLIGHT_WRONG_DRIVER]    = "wrong host driver",
+    [PS2_FLIGHT_WCET_OVERRUN]    = "WCET budget overrun",
+};
+
+void ps2_flight_freeze(ps2_flight_state_t reason) {
+    if (ps2_flight.state != PS2_FLIGHT_RUNNING) return;
+
+    ps2_flight.state = reason;
+    ps2_flight.frozen_at_us = ps2_micros();
+    uprintf("[FLIGHT] Frozen: %s, %lu entries kept\n", ps2_flight_state_names[reason],
+            ps2_flight.head < PS2_FLIGHT_SIZE ? ps2_flight.head : PS2_FLIGHT_SIZE);
+}
+
+void ps2_flight_dump(uint16_t count) {
+    uint32_t kept = ps2_flight.head < PS2_FLIGHT_SIZE ? ps2_flight.head : PS2_FLIGHT_SIZE;
+    if (count == 0 || count > kept) count = kept;
+
+    uprintf("[FLIGHT] ---- last %u of %lu bytes, %s ----\n", count, ps2_flight.head,
+            ps2_flight_state_names[ps2_flight.state]);
+
+    // Times count back from the freeze (or from now, while recording), so a
+    // frozen dump reads as "how long before it went wrong"
+    uint32_t end_us = ps2_flight.state != PS2_FLIGHT_RUNNING ? ps2_flight.frozen_at_us : ps2_micros();
+    for (uint32_t i = ps2_flight.head - count; i != ps2_flight.head; i++) {
+        const ps2_flight_entry_t *entry = &ps2_flight.entries[i & (PS2_FLIGHT_SIZE - 1)];
+        uprintf("[FLIGHT] %9luus ago  port %u %s %02X%s%s%s\n", end_us - entry->time_us, entry->port,
+                (entry->flags & PS2_FLIGHT_HOST) ? "host" : "kbd ", entry->data,
+                (entry->flags & PS2_FLIGHT_ABORTED) ? " aborted" : "",
+                (entry->flags & PS2_FLIGHT_RESEND) ? " resend" : "",
+                (entry->flags & PS2_FLIGHT_ERROR) ? " error" : "");
+    }
+}
+
+void ps2_flight_resume(void) {
+    ps2_flight.head = 0;
+    ps2_flight.state = PS2_FLIGHT_RUNNING;
+    uprintf("[FLIGHT] Recording\n");
+}
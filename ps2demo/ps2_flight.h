@@ -0,0 +1,72 @@
+// ps2_flight.h
+#ifndef PS2_FLIGHT_H
+#define PS2_FLIGHT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ps2_time.h"
+
+// Wire flight recorder. Every byte the PS/2 ports put on or take off the
+// wire lands in a RAM ring with its time and outcome - one timer read and
+// an 8-byte store, so it stays on in production. On an anomaly the ring
+// freezes, keeping the traffic that led up to it until someone dumps it
+// (ps2_tool.py flight), however long after.
+#ifndef PS2_FLIGHT_SIZE
+#define PS2_FLIGHT_SIZE 256  // Entries, power of two (8 bytes each)
+#endif
+_Static_assert((PS2_FLIGHT_SIZE & (PS2_FLIGHT_SIZE - 1)) == 0, "PS2_FLIGHT_SIZE must be a power of two");
+
+// Entry flags. No flag: a device-to-host byte sent in full.
+#define PS2_FLIGHT_HOST    0x01  // Host to device
+#define PS2_FLIGHT_ABORTED 0x02  // Host pulled CLK low mid-frame
+#define PS2_FLIGHT_RESEND  0x04  // Sent again for a host Resend
+#define PS2_FLIGHT_ERROR   0x08  // Received with bad parity or stop bit
+
+typedef struct {
+    uint32_t time_us;  // ps2_micros() at the end of the frame
+    uint8_t data;
+    uint8_t port;
+    uint8_t flags;
+    uint8_t reserved;
+} ps2_flight_entry_t;
+
+// Why the ring stopped recording
+typedef enum {
+    PS2_FLIGHT_RUNNING,
+    PS2_FLIGHT_BUFFER_OVERFLOW,  // A sequence didn't fit in the send buffer
+    PS2_FLIGHT_EVENT_OVERFLOW,   // The key event queue had to defer a press
+    PS2_FLIGHT_WRONG_DRIVER,     // process_record_kb found the USB driver in PS/2 mode
+    PS2_FLIGHT_WCET_OVERRUN,     // A callback ran past its WCET budget (PS2_WCET_ASSERT)
+} ps2_flight_state_t;
+
+typedef struct {
+    ps2_flight_entry_t entries[PS2_FLIGHT_SIZE];
+    uint32_t head;  // Entries ever written; the next one goes at head % size
+    ps2_flight_state_t state;
+    uint32_t frozen_at_us;
+} ps2_flight_t;
+
+extern ps2_flight_t ps2_flight;
+
+static inline void ps2_flight_record(uint8_t port, uint8_t data, uint8_t flags) {
+    if (ps2_flight.state != PS2_FLIGHT_RUNNING) return;
+
+    ps2_flight.entries[ps2_flight.head++ & (PS2_FLIGHT_SIZE - 1)] = (ps2_flight_entry_t){
+        .time_us = ps2_micros(),
+        .data = data,
+        .port = port,
+        .flags = flags,
+    };
+}
+
+// Stop recording. Only the first anomaly counts - later ones are usually
+// its consequences.
+void ps2_flight_freeze(ps2_flight_state_t reason);
+
+// Print the last `count` entries (0 = all) to the console, oldest first
+void ps2_flight_dump(uint16_t count);
+
+// Clear the ring and record again
+void ps2_flight_resume(void);
+
+#endif // PS2_FLIGHT_H
@@ -0,0 +1,81 @@
+// ps2_gpio.h - Compile-time GPIO fast path for the PS/2 lines
+//
+// PS/2 lines are open collector. After ps2_gpio_init() the output latch of
+// every line stays at 0, so a line is pulled low by enabling its output
+// driver and released to the pullup by disabling it. Each helper below is a
+// single store to the SIO output-enable set/clear/xor aliases, with masks
+// known at compile time, and several lines can change in the same write.
+#ifndef PS2_GPIO_H
+#define PS2_GPIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "gpio.h"
+
+#if defined(PS2_GPIO_SIM)
+// Host-side shim: the simulation owns the line state
+typedef struct {
+    uint32_t oe;        // Lines the firmware is pulling low
+    uint32_t host_low;  // Lines the simulated host is pulling low
+} ps2_gpio_sim_t;
+
+extern ps2_gpio_sim_t ps2_gpio_sim;
+
+#    define PS2_GPIO_MASK(pin) (1UL << (pin))
+#    define PS2_GPIO_OE() (ps2_gpio_sim.oe)
+#    define PS2_GPIO_OE_SET(mask) (ps2_gpio_sim.oe |= (mask))
+#    define PS2_GPIO_OE_CLR(mask) (ps2_gpio_sim.oe &= ~(mask))
+#    define PS2_GPIO_OE_XOR(mask) (ps2_gpio_sim.oe ^= (mask))
+#    define PS2_GPIO_IN() (~(ps2_gpio_sim.oe | ps2_gpio_sim.host_low))
+#elif defined(MCU_RP)
+#    include <hal.h>
+#    define PS2_GPIO_MASK(pin) (1UL << PAL_PAD(pin))
+#    define PS2_GPIO_OE() (SIO->GPIO_OE)
+#    define PS2_GPIO_OE_SET(mask) (SIO->GPIO_OE_SET = (mask))
+#    define PS2_GPIO_OE_CLR(mask) (SIO->GPIO_OE_CLR = (mask))
+#    define PS2_GPIO_OE_XOR(mask) (SIO->GPIO_OE_XOR = (mask))
+#    define PS2_GPIO_IN() (SIO->GPIO_IN)
+#else
+#    error "ps2_gpio.h: no GPIO fast path for this MCU (define PS2_GPIO_SIM for host builds)"
+#endif
+
+// Line masks
+#define PS2_KB_CLK PS2_GPIO_MASK(PS2_KEYBOARD_CLOCK_PIN)
+#define PS2_KB_DATA PS2_GPIO_MASK(PS2_KEYBOARD_DATA_PIN)
+#define PS2_KB_LINES (PS2_KB_CLK | PS2_KB_DATA)
+
+#ifdef PS2_MOUSE_CLOCK_PIN
+#    define PS2_MOUSE_CLK PS2_GPIO_MASK(PS2_MOUSE_CLOCK_PIN)
+#    define PS2_MOUSE_DATA PS2_GPIO_MASK(PS2_MOUSE_DATA_PIN)
+#    define PS2_MOUSE_LINES (PS2_MOUSE_CLK | PS2_MOUSE_DATA)
+#endif
+
+// Pads to SIO input with pullup, output latch low, both lines released
+static inline void ps2_gpio_init(pin_t clk_pin, pin_t data_pin) {
+    setPinInputHigh(clk_pin);
+    setPinInputHigh(data_pin);
+    writePinLow(clk_pin);
+    writePinLow(data_pin);
+    PS2_GPIO_OE_CLR(PS2_GPIO_MASK(clk_pin) | PS2_GPIO_MASK(data_pin));
+}
+
+static inline void ps2_gpio_pull_low(uint32_t lines) {
+    PS2_GPIO_OE_SET(lines);
+}
+
+static inline void ps2_gpio_release(uint32_t lines) {
+    PS2_GPIO_OE_CLR(lines);
+}
+
+// One write for all of `lines`: those in `low` are pulled low, the rest
+// released. Lines outside `lines` are left alone.
+static inline void ps2_gpio_drive(uint32_t lines, uint32_t low) {
+    PS2_GPIO_OE_XOR((PS2_GPIO_OE() ^ low) & lines);
+}
+
+// Bits of `lines` that read high
+static inline uint32_t ps2_gpio_read(uint32_t lines) {
+    return PS2_GPIO_IN() & lines;
+}
+
+#endif // PS2_GPIO_H
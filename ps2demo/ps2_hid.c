@@ -0,0 +1,94 @@
+// ps2_hid.c - Raw HID command dispatcher (telemetry and control from the PC)
+#include "ps2_hid.h"
+#include "ps2_flight.h"
+#include "ps2_profile.h"
+#include "ps2_stats.h"
+#include "ps2_sniff.h"
+#include "ps2_stream.h"
+#include "kb.h"
+#include "raw_hid.h"
+
+// Payload starts after [command, status]
+#define PS2_HID_PAYLOAD 2
+
+static uint8_t ps2_hid_stats_get(uint8_t *data, uint8_t length) {
+    uint8_t first = data[1];
+    if (first >= PS2_STAT_COUNT) return PS2_HID_ERROR;
+
+    // Bring the time-in-mode counter up to date before reporting it
+    ps2_stats_mode_update(is_usb_mode());
+
+    uint8_t count = 0;
+    uint8_t *out = &data[PS2_HID_PAYLOAD + 2];
+    while (first + count < PS2_STAT_COUNT && (out + 4) <= (data + length)) {
+        ps2_hid_put_u32(out, ps2_stats[first + count]);
+        out += 4;
+        count++;
+    }
+
+    data[PS2_HID_PAYLOAD] = first;
+    data[PS2_HID_PAYLOAD + 1] = count;
+    return PS2_HID_OK;
+}
+
+void raw_hid_receive(uint8_t *data, uint8_t length) {
+    uint8_t status = PS2_HID_OK;
+
+    switch (data[0]) {
+        case PS2_HID_STATS_GET:
+            status = ps2_hid_stats_get(data, length);
+            break;
+
+        case PS2_HID_STATS_PRINT:
+            ps2_stats_mode_update(is_usb_mode());
+            ps2_stats_print();
+            break;
+
+        case PS2_HID_STATS_RESET:
+            ps2_stats_reset();
+            break;
+
+        case PS2_HID_SNIFF_START:
+            if (!ps2_sniff_start()) status = PS2_HID_ERROR;
+            break;
+
+        case PS2_HID_SNIFF_STOP:
+            ps2_sniff_stop();
+            break;
+
+        case PS2_HID_PROFILE_PRINT:
+            if (!ps2_profile_print()) status = PS2_HID_ERROR;
+            break;
+
+        case PS2_HID_PROFILE_RESET:
+            if (!ps2_profile_reset()) status = PS2_HID_ERROR;
+            break;
+
+        case PS2_HID_FLIGHT_DUMP:
+            ps2_flight_dump(data[1]);
+            break;
+
+        case PS2_HID_FLIGHT_RESUME:
+            ps2_flight_resume();
+            break;
+
+        case PS2_HID_STREAM_OPEN:
+        case PS2_HID_STREAM_CLOSE:
+        case PS2_HID_STREAM_STATUS:
+            status = ps2_stream_command(data, length);
+            break;
+
+        case PS2_HID_STREAM_DATA:
+            // Staged: the STREAM_CREDIT that comes back once it is typed is the reply
+            if (ps2_stream_data(data, length)) return;
+            status = PS2_HID_ERROR;
+            break;
+
+        default:
+            status = PS2_HID_UNKNOWN_COMMAND;
+            break;
+    }
+
+    data[1] = status;
+    raw_hid_send(data, length);
+}
@@ -0,0 +1,43 @@
+// ps2_hid.h
+#ifndef PS2_HID_H
+#define PS2_HID_H
+
+#include <stdint.h>
+
+// Raw HID command interface (usage page 0xFF60, usage 0x61).
+// Request:  [command, args...]
+// Response: [command, status, payload...], always RAW_EPSIZE bytes.
+// Command IDs are a wire protocol shared with ps2_tool.py - never renumber.
+enum ps2_hid_command {
+    PS2_HID_STATS_GET     = 0x01,  // [first_id] -> [first_id, count, u32 LE x count]
+    PS2_HID_STATS_PRINT   = 0x02,  // Dump counters to the console
+    PS2_HID_STATS_RESET   = 0x03,
+    PS2_HID_SNIFF_START   = 0x04,  // Start bus capture (USB mode only)
+    PS2_HID_SNIFF_STOP    = 0x05,
+    PS2_HID_SNIFF_DATA    = 0x06,  // Unsolicited: captured frames (ps2_sniff.h)
+    PS2_HID_PROFILE_PRINT = 0x07,  // Dump hot-path probes to the console (PS2_PROFILE_ENABLE)
+    PS2_HID_PROFILE_RESET = 0x08,
+    PS2_HID_FLIGHT_DUMP   = 0x09,  // [count, 0 = all] Dump the flight recorder to the console
+    PS2_HID_FLIGHT_RESUME = 0x0A,  // Clear it and record again
+    PS2_HID_STREAM_OPEN   = 0x0B,  // -> [credits, chunk size] Start a keystroke stream (PS/2 mode only)
+    PS2_HID_STREAM_DATA   = 0x0C,  // [seq, len, payload] Spends a credit; no reply unless refused
+    PS2_HID_STREAM_CREDIT = 0x0D,  // Unsolicited: [credits returned, next seq] (ps2_stream.h)
+    PS2_HID_STREAM_CLOSE  = 0x0E,  // Type what is staged, then close
+    PS2_HID_STREAM_STATUS = 0x0F,  // -> [bytes, keys, elapsed_ms, us_last, us_max as u32 LE, credits, state]
+};
+
+enum ps2_hid_status {
+    PS2_HID_OK              = 0x00,
+    PS2_HID_ERROR           = 0x01,
+    PS2_HID_UNKNOWN_COMMAND = 0xFF,
+};
+
+// Little-endian helpers for building payloads
+static inline void ps2_hid_put_u32(uint8_t *buf, uint32_t value) {
+    buf[0] = value & 0xFF;
+    buf[1] = (value >> 8) & 0xFF;
+    buf[2] = (value >> 16) & 0xFF;
+    buf[3] = (value >> 24) & 0xFF;
+}
+
+#endif // PS2_HID_H
@@ -0,0 +1,135 @@
+// ps2_idle.c - Tickless idle for PS/2 mode
+//
+// Instead of spinning housekeeping -> ps2_keyboard_task -> timer_read32()
+// as fast as possible, the main loop sleeps until the earliest deadline
+// (typematic, mode-switch debounce, ...) or a pin edge, whichever comes first.
+#include "ps2_idle.h"
+#include "ps2_keyboard.h"
+#include "quantum.h"
+
+#if defined(PROTOCOL_CHIBIOS)
+#    include <ch.h>
+#    include <hal.h>
+#endif
+
+// =============================================================================
+// SCHEDULING (pure logic)
+// =============================================================================
+
+void ps2_idle_plan_begin(ps2_idle_plan_t *plan, uint32_t now) {
+    plan->now = now;
+    plan->deadline = now + PS2_IDLE_MAX_SLEEP_MS;
+    plan->busy = false;
+}
+
+void ps2_idle_plan_busy(ps2_idle_plan_t *plan) {
+    plan->busy = true;
+}
+
+void ps2_idle_plan_deadline(ps2_idle_plan_t *plan, uint32_t deadline) {
+    // Signed compare so the 32-bit ms timer can wrap
+    if ((int32_t)(deadline - plan->deadline) < 0) {
+        plan->deadline = deadline;
+    }
+}
+
+uint32_t ps2_idle_plan_budget(const ps2_idle_plan_t *plan) {
+    if (plan->busy) return 0;
+
+    int32_t remaining = (int32_t)(plan->deadline - plan->now);
+    if (remaining < PS2_IDLE_MIN_SLEEP_MS) return 0;
+
+    return (uint32_t)remaining;
+}
+
+// =============================================================================
+// SLEEP (platform)
+// =============================================================================
+
+// Wake holdoff after an edge, so bounces get scanned and debounced
+static uint32_t awake_until = 0;
+
+#if defined(PROTOCOL_CHIBIOS)
+
+// Host inhibit / request-to-send on any port wakes us
+static const pin_t clock_pins[PS2_PORT_COUNT] = PS2_PORT_CLOCK_PINS;
+
+static thread_reference_t idle_waiter = NULL;
+static volatile uint32_t edge_count = 0;
+static uint32_t scan_edge_count = 0;
+
+void ps2_idle_wake_from_isr(void) {
+    chSysLockFromISR();
+    edge_count++;
+    chThdResumeI(&idle_waiter, MSG_RESET);
+    chSysUnlockFromISR();
+}
+
+static void ps2_idle_edge_cb(void *arg) {
+    (void)arg;
+    ps2_idle_wake_from_isr();
+}
+
+void ps2_idle_init(void) {
+    // The mode pin stays armed: its edges are rare, and an edge between a
+    // matrix scan and the next sleep must not be lost. The key pins are
+    // armed by matrix.c, which wakes us through ps2_idle_wake_from_isr().
+    palSetLineCallback(MODE_SWITCH_PIN, ps2_idle_edge_cb, NULL);
+    palEnableLineEvent(MODE_SWITCH_PIN, PAL_EVENT_MODE_BOTH_EDGES);
+}
+
+// Edges before this were the matrix's and the scan has taken them - or
+// left edge_seen set, which ps2_idle_sleep() checks again
+void ps2_idle_note_scan(void) {
+    scan_edge_count = edge_count;
+}
+
+void ps2_idle_sleep(ps2_idle_plan_t *plan) {
+    if ((int32_t)(plan->now - awake_until) < 0) {
+        ps2_idle_plan_busy(plan);
+    }
+
+    uint32_t budget = ps2_idle_plan_budget(plan);
+    if (budget == 0) return;
+
+    // CLK is only armed while asleep, so our own transmit edges don't
+    // take an interrupt each. Host inhibit/request-to-send pulls it low.
+    bool clocks_high = true;
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        palSetLineCallback(clock_pins[i], ps2_idle_edge_cb, NULL);
+        palEnableLineEvent(clock_pins[i], PAL_EVENT_MODE_FALLING_EDGE);
+    }
+
+    msg_t msg = MSG_RESET;
+    chSysLock();
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        clocks_high &= palReadLine(clock_pins[i]);
+    }
+    // A key edge between the scan taking its edges and note_scan() is in
+    // edge_count already, so only the matrix can say it wasn't scanned
+    if (edge_count == scan_edge_count && clocks_high && !matrix_edge_pending()) {
+        msg = chThdSuspendTimeoutS(&idle_waiter, TIME_MS2I(budget));
+    }
+    chSysUnlock();
+
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        palDisableLineEvent(clock_pins[i]);
+    }
+
+    if (msg != MSG_TIMEOUT) {
+        awake_until = timer_read32() + PS2_IDLE_HOLDOFF_MS;
+    }
+}
+
+#else
+
+// No sleep primitive on this platform - keep polling
+void ps2_idle_init(void) {}
+void ps2_idle_note_scan(void) {}
+void ps2_idle_wake_from_isr(void) {}
+void ps2_idle_sleep(ps2_idle_plan_t *plan) {
+    (void)awake_until;
+    (void)plan;
+}
+
+#endif
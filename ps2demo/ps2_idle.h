@@ -0,0 +1,48 @@
+// ps2_idle.h
+#ifndef PS2_IDLE_H
+#define PS2_IDLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Longest single sleep. Anything we can't wake on (console flush, USB
+// housekeeping) is delayed by at most this much.
+#ifndef PS2_IDLE_MAX_SLEEP_MS
+#define PS2_IDLE_MAX_SLEEP_MS 100
+#endif
+
+// Sleeping for less than this isn't worth the wakeup cost
+#ifndef PS2_IDLE_MIN_SLEEP_MS
+#define PS2_IDLE_MIN_SLEEP_MS 2
+#endif
+
+// Stay awake this long after a pin edge so the matrix debounce can settle
+#ifndef PS2_IDLE_HOLDOFF_MS
+#define PS2_IDLE_HOLDOFF_MS (MATRIX_DEBOUNCE_MS + 10)
+#endif
+
+// One scheduling pass. Every subsystem reports either "busy now" or the
+// absolute time (timer_read32 ms) its next piece of work is due.
+// Pure data - no hardware access - so it can be driven from a host simulation.
+typedef struct {
+    uint32_t now;
+    uint32_t deadline;  // Earliest deadline reported so far
+    bool busy;          // Something has work right now
+} ps2_idle_plan_t;
+
+void ps2_idle_plan_begin(ps2_idle_plan_t *plan, uint32_t now);
+void ps2_idle_plan_busy(ps2_idle_plan_t *plan);
+void ps2_idle_plan_deadline(ps2_idle_plan_t *plan, uint32_t deadline);
+uint32_t ps2_idle_plan_budget(const ps2_idle_plan_t *plan);  // ms we may sleep, 0 = don't
+
+// Hardware side (no-op on platforms without a sleep implementation)
+void ps2_idle_init(void);
+void ps2_idle_note_scan(void);  // Call after every matrix scan
+void ps2_idle_wake_from_isr(void);  // Pin edge ISRs owned by other modules
+void ps2_idle_sleep(ps2_idle_plan_t *plan);
+
+// matrix.c: a diode matrix with a key down can't be woken by every press
+void matrix_idle_plan(ps2_idle_plan_t *plan);
+bool matrix_edge_pending(void);  // Key edge not scanned yet; called with the kernel locked
+
+#endif // PS2_IDLE_H
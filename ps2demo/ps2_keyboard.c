@@ -1,54 +1,191 @@
 // ps2_keyboard.c - FIXED VERSION with better media key debugging
 #include "ps2_keyboard.h"
 #include "quantum.h"  // QMK main header with GPIO functions
+#include <string.h>
 
 #include "report.h"  // For report_keyboard_t, etc.
+#include "ps2_send_string.h"
+#include "ps2_stats.h"
+#include "ps2_flight.h"
+#include "ps2_gpio.h"
+#include "ps2_pio.h"
+#include "ps2_profile.h"
+#include "ps2_ram.h"
+#include "ps2_time.h"
+#include "ps2_timer.h"
 
 // Timing (in microseconds)
 #define PS2_CLK_HALF_PERIOD 50  // 50us = 10kHz clock (was 40us = 12.5kHz)
 #define PS2_INTER_BYTE_DELAY 2  // 2ms delay between bytes
 
-// Previous keyboard report to detect key changes device
-static report_keyboard_t previous_report = {0};
+// Send buffer (one sequence-end bit per slot in a uint32_t)
+#define PS2_SEND_BUFFER_SIZE 32
+_Static_assert(PS2_SEND_BUFFER_SIZE <= 32, "seq_end is a 32-bit mask");
 
-// Configuration
-static uint8_t ps2_clk_pin;
-static uint8_t ps2_data_pin;
+// Response lane: FA AB 83 is the longest response
+#define PS2_RESPONSE_QUEUE_SIZE 4
 
-// State variables
-static ps2_state_t ps2_state = PS2_STATE_IDLE;
-static bool ps2_enabled = true;
-static ps2_led_state_t ps2_leds = {0};
+// Key events between the host driver callbacks and send_buffer (see
+// ps2_event_sync). Must hold a release for everything that can be down at
+// once - 6 keys, 8 modifiers, a consumer and a system key - plus a press.
+#define PS2_EVENT_QUEUE_SIZE 32
+_Static_assert(PS2_EVENT_QUEUE_SIZE >= KEYBOARD_REPORT_KEYS + 8 + 2 + 2, "PS2_EVENT_QUEUE_SIZE too small to guarantee releases");
 
-// Special key send functions
-bool ps2_keyboard_send_printscreen_make(void);
-bool ps2_keyboard_send_printscreen_break(void);
-bool ps2_keyboard_send_pause(void);  // Pause only sends on make, no break!
-bool ps2_keyboard_send_raw_byte(uint8_t byte);
+typedef enum {
+    PS2_EVENT_KEY,       // code = keycode
+    PS2_EVENT_MOD,       // code = modifier bit index
+    PS2_EVENT_CONSUMER,  // code = consumer usage
+    PS2_EVENT_SYSTEM     // code = system control usage
+} ps2_event_kind_t;
 
-// Send buffer
-#define PS2_SEND_BUFFER_SIZE 32
-static uint8_t send_buffer[PS2_SEND_BUFFER_SIZE];
-static uint8_t send_buffer_head = 0;
-static uint8_t send_buffer_tail = 0;
+typedef struct {
+    uint32_t time_us;       // When the report came in (ps2_micros)
+    uint16_t seq;           // Per-port event number
+    uint16_t code;
+    ps2_mapping_t mapping;  // Looked up once, when queued
+    uint8_t kind : 7;       // ps2_event_kind_t
+    uint8_t pressed : 1;
+} ps2_event_t;
+
+// Where a byte on its way out came from, so it can be taken off that lane
+// once it has gone out
+typedef enum {
+    PS2_LANE_NONE,
+    PS2_LANE_RESEND,
+    PS2_LANE_RESPONSE,
+    PS2_LANE_SCANCODE
+} ps2_lane_t;
+
+// Typematic state (Needed because PS/2 device must handle repeats itself unlike USB)
+typedef struct {
+    uint16_t keycode;       // Which QMK keycode is held
+    ps2_timer_t timer;      // Next repeat (pending = typematic armed)
+    uint16_t delay_ms;      // Delay before repeating starts
+    uint16_t rate_ms;       // Time between repeats
+    ps2_mapping_t mapping;  // Full mapping info (scancode + E0 prefix flag)
+} ps2_typematic_t;
 
-// Previous media key to handle repeats
-static uint16_t previous_media_key = 0;
+// One PS/2 port. As far as the machine on the other end is concerned each
+// port is a complete keyboard, with its own LEDs, scan set, typematic
+// settings and key state.
+typedef struct {
+    uint8_t index;
+    pin_t clk_pin;
+    pin_t data_pin;
+    uint32_t clk;   // Line masks (ps2_gpio.h)
+    uint32_t data;
+
+    // State variables
+    ps2_protocol_t protocol;
+    ps2_state_t state;
+    bool enabled;
+    ps2_led_state_t leds;
+    uint8_t scancode_set;
+
+    // Command waiting for its argument byte (0xED, 0xF0, 0xF3), 0 = none
+    uint8_t pending_command;
+
+    // Scancode lane. seq_end marks the slots holding the last byte of a
+    // sequence; mid_sequence is set while one is partly on the wire.
+    uint8_t send_buffer[PS2_SEND_BUFFER_SIZE];
+    uint8_t send_buffer_head;
+    uint8_t send_buffer_tail;
+    uint32_t seq_end;
+    bool mid_sequence;
+    uint32_t queued_total;  // Bytes ever queued here...
+    uint32_t sent_total;    // ...and clocked out (ps2_keyboard_sent_total)
+
+    // Response lane (ACK, Echo, ID, BAT, Resend). Goes ahead of the scancode
+    // lane, but only between sequences; bytes after the first are spaced
+    // PS2_INTER_BYTE_DELAY apart by response_gap.
+    uint8_t response[PS2_RESPONSE_QUEUE_SIZE];
+    uint8_t response_len;
+    ps2_timer_t response_gap;
+
+    // Last byte clocked out, for host Resend (0xFE) requests. A resend goes
+    // out before anything else, since it only repeats what is already sent.
+    uint8_t last_sent_byte;
+    bool resend_pending;
+
+    ps2_typematic_t typematic;
+
+    // XT: host holding CLK low, and since when (ms) - a reset if long enough
+    bool xt_clk_low;
+    uint32_t xt_clk_low_since;
+
+    // PIO transceiver (ps2_pio.h): in use, and the byte it is clocking out
+    bool pio;
+    ps2_lane_t pio_lane;  // PS2_LANE_NONE: nothing in flight
+    uint8_t pio_byte;
+
+    // Key events waiting for send_buffer, oldest at event_head
+    ps2_event_t events[PS2_EVENT_QUEUE_SIZE];
+    uint8_t event_head;
+    uint8_t event_count;
+    uint16_t event_seq;
+    bool event_deferred;  // A press found no room - re-sync as the queue drains
+
+    // Key state three ways: as sent to the host (previous_*), as it will be
+    // once the event queue drains (queued_*), and as QMK last asked for
+    // (desired_*). Consumer and system keys are one usage each, 0 = none.
+    report_keyboard_t previous_report;
+    report_keyboard_t queued_report;
+    report_keyboard_t desired_report;
+    uint16_t previous_media_key;
+    uint16_t queued_media_key;
+    uint16_t desired_media_key;
+    uint16_t previous_system_key;
+    uint16_t queued_system_key;
+    uint16_t desired_system_key;
+
+    // desired_report is QMK's report (host_report) with the keys the PC's
+    // keystroke stream holds (stream_report) on top. Modifiers in
+    // stream_mask are held up whatever QMK says.
+    report_keyboard_t host_report;
+    report_keyboard_t stream_report;
+    uint8_t stream_mask;
+} ps2_port_t;
+
+static const pin_t ps2_port_clock_pins[PS2_PORT_COUNT] = PS2_PORT_CLOCK_PINS;
+static const pin_t ps2_port_data_pins[PS2_PORT_COUNT] = PS2_PORT_DATA_PINS;
+
+static ps2_port_t ps2_ports[PS2_PORT_COUNT];
+static ps2_port_t *active_port = &ps2_ports[0];  // Port that gets our keystrokes
+
+static uint8_t ps2_encode_key(ps2_mapping_t mapping, bool pressed, uint8_t *seq);
+static bool ps2_port_send_sequence(ps2_port_t *port, const uint8_t *bytes, uint8_t len);
+static void ps2_response_cancel(ps2_port_t *port);
+static bool ps2_event_sync(ps2_port_t *port);
 
 // Convert Consumer Control usage code to PS/2 scancode
 static ps2_mapping_t consumer_to_ps2_scancode(uint16_t usage) {
+    PS2_PROBE(PS2_PROBE_CONSUMER_TO_PS2);
+
     for (size_t i = 0; i < PS2_CONSUMER_MAPPINGS_SIZE; i++) {
         if (ps2_consumer_mappings[i].usage_code == usage) {
             return ps2_consumer_mappings[i].mapping;
         }
     }
     // Unknown consumer control code
-    uprintf("[PS2] UNMAPPED consumer control: 0x%04X\n", usage);
+    dprintf("[PS2] UNMAPPED consumer control: 0x%04X\n", usage);
+    return (ps2_mapping_t){0, false, PS2_KEY_NORMAL};
+}
+
+// Convert System Control usage code (ACPI power keys) to PS/2 scancode
+static ps2_mapping_t system_to_ps2_scancode(uint16_t usage) {
+    for (size_t i = 0; i < PS2_SYSTEM_MAPPINGS_SIZE; i++) {
+        if (ps2_system_mappings[i].usage_code == usage) {
+            return ps2_system_mappings[i].mapping;
+        }
+    }
+    dprintf("[PS2] UNMAPPED system control: 0x%04X\n", usage);
     return (ps2_mapping_t){0, false, PS2_KEY_NORMAL};
 }
 
 // Convert QMK keycode to PS/2 scancode
 ps2_mapping_t qmk_to_ps2_scancode(uint16_t keycode) {
+    PS2_PROBE(PS2_PROBE_QMK_TO_PS2);
+
     // FIXED: Check basic keycodes in main lookup table
     // Only use the lookup table if keycode is within bounds AND < 256
     if (keycode < 0x100 && keycode < PS2_SCANCODE_LOOKUP_SIZE) {
@@ -67,48 +204,69 @@ ps2_mapping_t qmk_to_ps2_scancode(uint16_t keycode) {
     }
 
     // Unknown keycode - log it for debugging
-    uprintf("[PS2] UNMAPPED keycode: 0x%04X\n", keycode);
+    dprintf("[PS2] UNMAPPED keycode: 0x%04X\n", keycode);
     return (ps2_mapping_t){0, false, PS2_KEY_NORMAL};
 }
 
+// Reverse of qmk_to_ps2_scancode for the bridge: make code -> keycode, one
+// table for plain codes and one for E0-prefixed ones. First mapping wins,
+// so the main table beats the extended one. Pause (E1 sequence) has no
+// single make code and is left to the caller.
+void ps2_scancode_reverse_index(uint8_t plain[256], uint8_t extended[256]) {
+    memset(plain, 0, 256);
+    memset(extended, 0, 256);
+
+    for (size_t keycode = 0; keycode < PS2_SCANCODE_LOOKUP_SIZE; keycode++) {
+        ps2_mapping_t mapping = ps2_scancode_lookup[keycode];
+        if (mapping.scancode == 0 || mapping.special_type == PS2_KEY_PAUSE) continue;
+
+        // Print Screen's make code is sent E0-prefixed
+        bool e0 = mapping.needs_e0_prefix || mapping.special_type == PS2_KEY_PRINTSCREEN;
+        uint8_t *table = e0 ? extended : plain;
+        if (table[mapping.scancode] == 0) table[mapping.scancode] = keycode;
+    }
+
+    for (size_t i = 0; i < PS2_EXTENDED_KEYS_SIZE; i++) {
+        uint16_t keycode = ps2_extended_keys[i].qmk_keycode;
+        ps2_mapping_t mapping = ps2_extended_keys[i].mapping;
+        if (keycode > 0xFF) continue;
+
+        uint8_t *table = mapping.needs_e0_prefix ? extended : plain;
+        if (table[mapping.scancode] == 0) table[mapping.scancode] = keycode;
+    }
+}
+
 typedef struct {
     uint8_t mod_bit;
-    uint8_t scancode;
-    bool needs_e0;
-    ps2_special_key_type_t special_type;
+    ps2_mapping_t mapping;
 } ps2_modifier_mapping_t;
 
-static const ps2_modifier_mapping_t modifier_mappings[] = {
-    {0x01, PS2_LCTRL, false, PS2_KEY_NORMAL},   // MOD_LCTL
-    {0x02, PS2_LSHIFT, false, PS2_KEY_NORMAL},  // MOD_LSFT
-    {0x04, PS2_LALT, false, PS2_KEY_NORMAL},    // MOD_LALT
-    {0x08, PS2_LGUI, true, PS2_KEY_NORMAL},     // MOD_LGUI (needs E0)
-    {0x10, PS2_RCTRL, true, PS2_KEY_NORMAL},    // MOD_RCTL (needs E0)
-    {0x20, PS2_RSHIFT, false, PS2_KEY_NORMAL},  // MOD_RSFT
-    {0x40, PS2_RALT, true, PS2_KEY_NORMAL},     // MOD_RALT (needs E0)
-    {0x80, PS2_RGUI, true, PS2_KEY_NORMAL},     // MOD_RGUI (needs E0)
+static const ps2_modifier_mapping_t PS2_RAM_DATA(modifier_mappings)[] = {
+    {0x01, {PS2_LCTRL, false, PS2_KEY_NORMAL}},   // MOD_LCTL
+    {0x02, {PS2_LSHIFT, false, PS2_KEY_NORMAL}},  // MOD_LSFT
+    {0x04, {PS2_LALT, false, PS2_KEY_NORMAL}},    // MOD_LALT
+    {0x08, {PS2_LGUI, true, PS2_KEY_NORMAL}},     // MOD_LGUI (needs E0)
+    {0x10, {PS2_RCTRL, true, PS2_KEY_NORMAL}},    // MOD_RCTL (needs E0)
+    {0x20, {PS2_RSHIFT, false, PS2_KEY_NORMAL}},  // MOD_RSFT
+    {0x40, {PS2_RALT, true, PS2_KEY_NORMAL}},     // MOD_RALT (needs E0)
+    {0x80, {PS2_RGUI, true, PS2_KEY_NORMAL}},     // MOD_RGUI (needs E0)
 };
 
-// Typematic state (Needed because PS/2 device must handle repeats itself unlike USB)
-static struct {
-    uint16_t keycode;       // Which QMK keycode is held
-    bool active;            // Is typematic armed?
-    uint32_t press_time;    // When key was first pressed
-    uint32_t last_repeat;   // When we last sent a repeat
-    uint16_t delay_ms;      // Delay before repeating starts
-    uint16_t rate_ms;       // Time between repeats
-    ps2_mapping_t mapping;  // Full mapping info (scancode + E0 prefix flag)
-} typematic_state = {
-    .keycode = 0,
-    .active = false,
-    .press_time = 0,
-    .last_repeat = 0,
-    .delay_ms = 500,  // Default 500ms delay
-    .rate_ms = 33,     // Default ~30Hz repeat rate
-    .mapping = {0, false, PS2_KEY_NORMAL}
-};
+// Set Typematic Rate/Delay (0xF3) argument:
+//   bits 5-6: delay = (n + 1) * 250ms
+//   bits 0-4: period = (8 + bits 0-2) * 2^(bits 3-4) * 4.17ms
+static void ps2_typematic_configure(ps2_port_t *port, uint8_t value) {
+    uint8_t a = value & 0x07;
+    uint8_t b = (value >> 3) & 0x03;
+
+    port->typematic.delay_ms = (((value >> 5) & 0x03) + 1) * 250;
+    port->typematic.rate_ms = ((8 + a) * (1 << b) * 417) / 100;
 
-void ps2_keyboard_typematic_arm(uint16_t keycode, uint8_t scancode) {
+    uprintf("[PS2] Port %u typematic set: delay=%ums, rate=%ums\n",
+            port->index, port->typematic.delay_ms, port->typematic.rate_ms);
+}
+
+static void ps2_typematic_arm(ps2_port_t *port, uint16_t keycode) {
     // Don't arm typematic for modifier keys
     if ((keycode >= KC_LCTL && keycode <= KC_RGUI) ||  // Modifiers
         keycode == KC_CAPS ||  // Caps Lock
@@ -119,461 +277,1310 @@ void ps2_keyboard_typematic_arm(uint16_t keycode, uint8_t scancode) {
         return;
     }
 
-    typematic_state.keycode = keycode;
-    typematic_state.active = true;
-    typematic_state.press_time = timer_read32();
-    typematic_state.last_repeat = timer_read32();
+    port->typematic.keycode = keycode;
 
     // Store the complete mapping to preserve E0 prefix info
-    typematic_state.mapping = qmk_to_ps2_scancode(keycode);
+    port->typematic.mapping = qmk_to_ps2_scancode(keycode);
+
+    ps2_timer_arm(&port->typematic.timer, port->typematic.delay_ms);
 }
 
-void ps2_keyboard_typematic_stop(uint16_t keycode) {
-    if (typematic_state.keycode == keycode) {
-        typematic_state.active = false;
+static void ps2_typematic_stop(ps2_port_t *port, uint16_t keycode) {
+    if (port->typematic.keycode == keycode) {
+        ps2_timer_cancel(&port->typematic.timer);
     }
 }
 
 void ps2_keyboard_typematic_disable(void) {
-    // Completely disable typematic (used when switching modes)
-    typematic_state.active = false;
-    typematic_state.keycode = 0;
-    typematic_state.mapping.scancode = 0;
-    typematic_state.mapping.needs_e0_prefix = false;
-    typematic_state.mapping.special_type = PS2_KEY_NORMAL;
+    // Completely disable typematic on every port (used when switching modes).
+    // Unsent response bytes go too, so no timer touches the lines in USB mode.
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        ps2_typematic_t *typematic = &ps2_ports[i].typematic;
+        ps2_timer_cancel(&typematic->timer);
+        ps2_response_cancel(&ps2_ports[i]);
+        typematic->keycode = 0;
+        typematic->mapping.scancode = 0;
+        typematic->mapping.needs_e0_prefix = false;
+        typematic->mapping.special_type = PS2_KEY_NORMAL;
+    }
 }
 
-void ps2_keyboard_typematic_task(void) {
-    if (!typematic_state.active) return;
+// Timer wheel callback: the delay (first time) or one rate period is up
+static void ps2_typematic_fire(void *arg) {
+    PS2_PROBE(PS2_PROBE_TYPEMATIC);
 
-    uint32_t now = timer_read32();
-    uint32_t held_time = now - typematic_state.press_time;
+    ps2_port_t *port = arg;
+    ps2_typematic_t *typematic = &port->typematic;
 
-    // Has initial delay passed?
-    if (held_time >= typematic_state.delay_ms) {
-        uint32_t since_repeat = now - typematic_state.last_repeat;
-
-        // Time for another repeat?
-        if (since_repeat >= typematic_state.rate_ms) {
-            uprintf("[PS2] Typematic repeat: keycode=0x%04X, scancode=0x%02X%s\n",
-                    typematic_state.keycode, typematic_state.mapping.scancode,
-                    typematic_state.mapping.needs_e0_prefix ? ", E0 prefix" : "");
+    // Newer key events come first - a repeat now would overtake them (a
+    // release for this very key, say). Skip this one.
+    if (port->event_count > 0) {
+        ps2_timer_arm(&typematic->timer, typematic->rate_ms);
+        return;
+    }
 
-            if (typematic_state.mapping.needs_e0_prefix) {
-                ps2_keyboard_send_key_make(PS2_PREFIX_E0);
-            }
-            ps2_keyboard_send_key_make(typematic_state.mapping.scancode);
-            typematic_state.last_repeat = now;
-        }
+    dprintf("[PS2] Typematic repeat: keycode=0x%04X, scancode=0x%02X%s\n",
+            typematic->keycode, typematic->mapping.scancode,
+            typematic->mapping.needs_e0_prefix ? ", E0 prefix" : "");
+
+    uint8_t seq[PS2_MAX_KEY_SEQUENCE];
+    uint8_t len = ps2_encode_key(typematic->mapping, true, seq);
+    if (ps2_port_send_sequence(port, seq, len)) {
+        PS2_STAT_INC(PS2_STAT_TYPEMATIC_REPEATS);
+    } else if (port->enabled) {
+        PS2_STAT_INC(PS2_STAT_BUFFER_DROPS);
+        ps2_flight_freeze(PS2_FLIGHT_BUFFER_OVERFLOW);
     }
+
+    ps2_timer_arm(&typematic->timer, typematic->rate_ms);
+}
+
+// Line helpers - single register writes, see ps2_gpio.h
+static inline void ps2_clk_high(ps2_port_t *port) {
+    ps2_gpio_release(port->clk);  // Release to pullup
 }
 
-// Helper functions using QMK GPIO API
-static inline void ps2_clk_high(void) {
-    setPinInput(ps2_clk_pin);  // Release to pullup (high-Z with pullup)
+static inline void ps2_clk_low(ps2_port_t *port) {
+    ps2_gpio_pull_low(port->clk);
 }
 
-static inline void ps2_clk_low(void) {
-    writePinLow(ps2_clk_pin);
-    setPinOutput(ps2_clk_pin);
+static inline void ps2_data_high(ps2_port_t *port) {
+    ps2_gpio_release(port->data);  // Release to pullup
 }
 
-static inline void ps2_data_high(void) {
-    setPinInput(ps2_data_pin);  // Release to pullup (high-Z with pullup)
+static inline void ps2_data_low(ps2_port_t *port) {
+    ps2_gpio_pull_low(port->data);
 }
 
-static inline void ps2_data_low(void) {
-    writePinLow(ps2_data_pin);
-    setPinOutput(ps2_data_pin);
+// Put one bit on DATA without branching on its value
+static inline void ps2_data_bit(ps2_port_t *port, bool bit) {
+    ps2_gpio_drive(port->data, bit ? 0 : port->data);
 }
 
-static inline bool ps2_clk_read(void) {
-    return readPin(ps2_clk_pin);
+// Release CLK and DATA together
+static inline void ps2_lines_idle(ps2_port_t *port) {
+    ps2_gpio_release(port->clk | port->data);
 }
 
-static inline bool ps2_data_read(void) {
-    return readPin(ps2_data_pin);
+static inline bool ps2_clk_read(ps2_port_t *port) {
+    return ps2_gpio_read(port->clk);
 }
 
-static bool ps2_send_byte(uint8_t data) {
+static inline bool ps2_data_read(ps2_port_t *port) {
+    return ps2_gpio_read(port->data);
+}
+
+// Clock one bit out (data already set up). After releasing CLK it must read
+// back high - if it doesn't, the host is inhibiting and the frame is aborted.
+static bool PS2_RAM_FUNC(ps2_clock_pulse)(ps2_port_t *port) {
+    ps2_clk_low(port);
+    ps2_delay_us(PS2_CLK_HALF_PERIOD * 2);  // Clock low period
+    ps2_clk_high(port);
+    ps2_delay_us(PS2_CLK_HALF_PERIOD * 2);  // Clock high period
+    return ps2_clk_read(port);
+}
+
+// Flight recorder flags for a byte we send. resend_pending stays set until
+// the repeated byte is out.
+static inline uint8_t ps2_flight_flags(ps2_port_t *port) {
+    return port->resend_pending ? PS2_FLIGHT_RESEND : 0;
+}
+
+// Host pulled CLK low mid-frame: release the bus, the byte stays queued and
+// is sent again from the start once the host lets go
+static bool PS2_RAM_FUNC(ps2_abort_frame)(ps2_port_t *port, uint8_t data) {
+    ps2_data_high(port);
+    PS2_STAT_INC(PS2_STAT_INHIBIT_ABORTS);
+    ps2_flight_record(port->index, data, ps2_flight_flags(port) | PS2_FLIGHT_ABORTED);
+    return false;
+}
+
+static bool PS2_RAM_FUNC(ps2_send_byte)(ps2_port_t *port, uint8_t data) {
+    PS2_PROBE(PS2_PROBE_SEND_BYTE);
     uint8_t parity = 1;
 
     // Ensure idle state before starting
-    ps2_data_high();
-    ps2_clk_high();
-    wait_us(100);  // Wait for idle
+    ps2_lines_idle(port);
+    ps2_delay_us(100);  // Wait for idle
+
+    // Host is inhibiting (CLK low) or wants to send (DATA low) - not our turn
+    if (ps2_gpio_read(port->clk | port->data) != (port->clk | port->data)) {
+        return false;
+    }
+
+    uint32_t frame_start = ps2_micros();
 
     // Start bit (data low, then clock pulse)
-    ps2_data_low();
-    wait_us(PS2_CLK_HALF_PERIOD * 2);  // Data setup time
+    ps2_data_low(port);
+    ps2_delay_us(PS2_CLK_HALF_PERIOD * 2);  // Data setup time
 
-    ps2_clk_low();
-    wait_us(PS2_CLK_HALF_PERIOD * 2);  // Clock low period
-    ps2_clk_high();
-    wait_us(PS2_CLK_HALF_PERIOD * 2);  // Clock high period
+    if (!ps2_clock_pulse(port)) return ps2_abort_frame(port, data);
 
     // Data bits (LSB first)
     for (int i = 0; i < 8; i++) {
         // Set data line FIRST
-        if (data & (1 << i)) {
-            ps2_data_high();
-            parity ^= 1;
-        } else {
-            ps2_data_low();
-        }
-        wait_us(PS2_CLK_HALF_PERIOD * 2);  // Data setup time
+        bool bit = (data >> i) & 1;
+        ps2_data_bit(port, bit);
+        parity ^= bit;
+        ps2_delay_us(PS2_CLK_HALF_PERIOD * 2);  // Data setup time
 
         // Then toggle clock
-        ps2_clk_low();
-        wait_us(PS2_CLK_HALF_PERIOD * 2);
-        ps2_clk_high();
-        wait_us(PS2_CLK_HALF_PERIOD * 2);
+        if (!ps2_clock_pulse(port)) return ps2_abort_frame(port, data);
     }
 
     // Parity bit (odd parity)
-    if (parity) {
-        ps2_data_high();
-    } else {
-        ps2_data_low();
-    }
-    wait_us(PS2_CLK_HALF_PERIOD * 2);  // Data setup time
+    ps2_data_bit(port, parity);
+    ps2_delay_us(PS2_CLK_HALF_PERIOD * 2);  // Data setup time
+
+    if (!ps2_clock_pulse(port)) return ps2_abort_frame(port, data);
 
-    ps2_clk_low();
-    wait_us(PS2_CLK_HALF_PERIOD * 2);
-    ps2_clk_high();
-    wait_us(PS2_CLK_HALF_PERIOD * 2);
+    // Stop bit - data MUST be high. Once the 11th clock has gone out the
+    // byte counts as sent, even if the host inhibits right after.
+    ps2_data_high(port);
+    ps2_delay_us(PS2_CLK_HALF_PERIOD * 2);
 
-    // Stop bit - data MUST be high
-    ps2_data_high();
-    wait_us(PS2_CLK_HALF_PERIOD * 2);
+    ps2_clock_pulse(port);
 
-    ps2_clk_low();
-    wait_us(PS2_CLK_HALF_PERIOD * 2);
-    ps2_clk_high();
-    wait_us(PS2_CLK_HALF_PERIOD * 2);
+    uint32_t frame_us = ps2_micros() - frame_start;
+    PS2_STAT_MIN(PS2_STAT_FRAME_US_MIN, frame_us);
+    PS2_STAT_MAX(PS2_STAT_FRAME_US_MAX, frame_us);
 
     // CRITICAL: Long inter-byte delay
     // Both clock and data must be high (idle) for sufficient time
-    ps2_data_high();
-    ps2_clk_high();
-    wait_us(300);  // Much longer inter-byte delay (minimum 300us)
+    ps2_flight_record(port->index, data, ps2_flight_flags(port));
+
+    ps2_lines_idle(port);
+    ps2_delay_us(300);  // Much longer inter-byte delay (minimum 300us)
 
+    port->last_sent_byte = data;
+    PS2_STAT_INC(PS2_STAT_BYTES_SENT);
     return true;
 }
 
-static void ps2_handle_command(uint8_t cmd) {
+// XT frame: a 0 and a 1 start bit, 8 data bits LSB first, no parity, no
+// stop bit. The IBM keyboard's "0" start bit is its request-to-send pulse;
+// hosts that expect a single start bit shift it out unseen. The host can't
+// abort a frame - it only holds DATA low until it has read the last byte,
+// and CLK low to reset us - so the idle check up front is the handshake.
+static bool PS2_RAM_FUNC(ps2_xt_send_byte)(ps2_port_t *port, uint8_t data) {
+    PS2_PROBE(PS2_PROBE_SEND_BYTE);
+
+    ps2_lines_idle(port);
+    ps2_delay_us(100);
+
+    if (ps2_gpio_read(port->clk | port->data) != (port->clk | port->data)) {
+        return false;
+    }
+
+    uint32_t frame_start = ps2_micros();
+
+    ps2_data_low(port);
+    ps2_delay_us(PS2_CLK_HALF_PERIOD * 2);
+    ps2_clock_pulse(port);
+
+    ps2_data_high(port);
+    ps2_delay_us(PS2_CLK_HALF_PERIOD * 2);
+    ps2_clock_pulse(port);
+
+    for (int i = 0; i < 8; i++) {
+        ps2_data_bit(port, (data >> i) & 1);
+        ps2_delay_us(PS2_CLK_HALF_PERIOD * 2);
+        ps2_clock_pulse(port);
+    }
+
+    uint32_t frame_us = ps2_micros() - frame_start;
+    PS2_STAT_MIN(PS2_STAT_FRAME_US_MIN, frame_us);
+    PS2_STAT_MAX(PS2_STAT_FRAME_US_MAX, frame_us);
+    ps2_flight_record(port->index, data, 0);
+
+    ps2_lines_idle(port);
+    ps2_delay_us(300);
+
+    port->last_sent_byte = data;
+    PS2_STAT_INC(PS2_STAT_BYTES_SENT);
+    return true;
+}
+
+static inline bool ps2_port_send_byte(ps2_port_t *port, uint8_t data) {
+    if (port->protocol == PS2_PROTOCOL_XT) return ps2_xt_send_byte(port, data);
+    return ps2_send_byte(port, data);
+}
+
+// Host wants to send: it has released CLK and is holding DATA low (start bit)
+static inline bool ps2_host_request_to_send(ps2_port_t *port) {
+    return ps2_clk_read(port) && !ps2_data_read(port);
+}
+
+// Clock one host-to-device bit in. The host changes DATA while CLK is low,
+// we sample it in the middle of the high phase.
+static bool PS2_RAM_FUNC(ps2_receive_bit)(ps2_port_t *port, bool *bit) {
+    ps2_clk_low(port);
+    ps2_delay_us(PS2_CLK_HALF_PERIOD);
+    ps2_clk_high(port);
+    ps2_delay_us(PS2_CLK_HALF_PERIOD / 2);
+    *bit = ps2_data_read(port);
+    ps2_delay_us(PS2_CLK_HALF_PERIOD / 2);
+    return ps2_clk_read(port);  // Low = host inhibited mid-frame
+}
+
+// Count a complete host frame, bit-banged or from the PIO. False on a
+// parity or framing error. Runs after the ACK clock, so it stays in flash.
+static bool PS2_FLASH_FUNC(ps2_receive_check)(ps2_port_t *port, uint8_t data, bool parity_ok, bool stop_ok) {
+    if (!stop_ok || !parity_ok) {
+        ps2_flight_record(port->index, data, PS2_FLIGHT_HOST | PS2_FLIGHT_ERROR);
+    }
+    if (!stop_ok) {
+        uprintf("[PS2] Host frame error (no stop bit), data=0x%02X\n", data);
+        PS2_STAT_INC(PS2_STAT_FRAMING_ERRORS);
+        return false;
+    }
+    if (!parity_ok) {
+        uprintf("[PS2] Host frame parity error, data=0x%02X\n", data);
+        PS2_STAT_INC(PS2_STAT_PARITY_ERRORS);
+        return false;
+    }
+
+    PS2_STAT_INC(PS2_STAT_COMMANDS_RECEIVED);
+    ps2_flight_record(port->index, data, PS2_FLIGHT_HOST);
+    return true;
+}
+
+// Receive one host-to-device frame: 8 data bits LSB first, odd parity,
+// stop, then our ACK bit - 11 clocks. The start bit is the request-to-send
+// itself; the host moves DATA to D0 on our first falling edge, so there is
+// no clock for it. Returns false if the frame was aborted or had a
+// parity/framing error.
+static bool PS2_RAM_FUNC(ps2_receive_byte)(ps2_port_t *port, uint8_t *out) {
+    uint8_t data = 0;
+    uint8_t ones = 0;
+    bool bit;
+
+    port->state = PS2_STATE_RECEIVING;
+
+    // Clocks 1-8: data
+    for (uint8_t i = 0; i < 8; i++) {
+        if (!ps2_receive_bit(port, &bit)) goto aborted;
+        if (bit) {
+            data |= (1 << i);
+            ones++;
+        }
+    }
+
+    // Clock 9: parity (odd parity over data + parity)
+    if (!ps2_receive_bit(port, &bit)) goto aborted;
+    ones += bit;
+
+    // Clock 10: stop bit - host releases DATA, it must read high
+    if (!ps2_receive_bit(port, &bit)) goto aborted;
+    bool stop_ok = bit;
+
+    // Clock 11: ACK, DATA held low across the pulse
+    ps2_data_low(port);
+    ps2_clk_low(port);
+    ps2_delay_us(PS2_CLK_HALF_PERIOD);
+    ps2_clk_high(port);
+    ps2_delay_us(PS2_CLK_HALF_PERIOD);
+    ps2_data_high(port);
+
+    port->state = PS2_STATE_IDLE;
+
+    *out = data;
+    return ps2_receive_check(port, data, ones & 1, stop_ok);
+
+aborted:
+    ps2_data_high(port);
+    port->state = PS2_STATE_IDLE;
+    PS2_STAT_INC(PS2_STAT_INHIBIT_ABORTS);
+    ps2_flight_record(port->index, data, PS2_FLIGHT_HOST | PS2_FLIGHT_ABORTED);  // Bits so far
+    return false;
+}
+
+// Queue a response byte. The first one goes out as soon as no scancode
+// sequence is half sent; the rest follow PS2_INTER_BYTE_DELAY apart.
+static void ps2_respond(ps2_port_t *port, uint8_t byte) {
+    if (port->response_len < PS2_RESPONSE_QUEUE_SIZE) {
+        port->response[port->response_len++] = byte;
+    }
+}
+
+static void ps2_response_cancel(ps2_port_t *port) {
+    port->response_len = 0;
+    port->resend_pending = false;
+    ps2_timer_cancel(&port->response_gap);
+}
+
+// Nothing to do when the gap is over - the port task checks the timer
+static void ps2_response_gap_done(void *arg) {
+    (void)arg;
+}
+
+// Argument byte for a command that takes one (0xED, 0xF0, 0xF3)
+static void ps2_handle_argument(ps2_port_t *port, uint8_t cmd, uint8_t arg) {
     switch (cmd) {
         case PS2_CMD_SET_LEDS:
-            // Wait for LED data byte (will be implemented when needed)
+            port->leds.scroll_lock = (arg >> 0) & 1;
+            port->leds.num_lock = (arg >> 1) & 1;
+            port->leds.caps_lock = (arg >> 2) & 1;
+            ps2_respond(port, PS2_ACK);
             break;
 
-        // Echo back
-        case PS2_CMD_ECHO:
-            ps2_send_byte(PS2_ECHO_RESPONSE);
+        case PS2_CMD_SET_SCANCODE_SET:
+            ps2_respond(port, PS2_ACK);
+            if (arg == 0) {
+                // Query: report the active set
+                ps2_respond(port, port->scancode_set);
+            } else if (arg == 1 || arg == 2) {
+                port->scancode_set = arg;
+            } else {
+                // No set 3 - host will see that if it queries
+                uprintf("[PS2] Port %u host asked for scancode set %u, staying on set %u\n", port->index, arg, port->scancode_set);
+            }
             break;
 
-        // For now, we only support Set 2
+        case PS2_CMD_SET_TYPEMATIC:
+            ps2_typematic_configure(port, arg);
+            ps2_respond(port, PS2_ACK);
+            break;
+    }
+}
+
+// Restore power-on defaults (0xF5, 0xF6, 0xFF)
+static void ps2_keyboard_set_defaults(ps2_port_t *port) {
+    port->typematic.delay_ms = PS2_TYPEMATIC_DEFAULT_DELAY_MS;
+    port->typematic.rate_ms = PS2_TYPEMATIC_DEFAULT_RATE_MS;
+    port->scancode_set = 2;
+}
+
+static void ps2_handle_command(ps2_port_t *port, uint8_t cmd) {
+    // Argument byte for the previous command? Anything that looks like a
+    // command (>= 0xED) instead starts a new one.
+    if (port->pending_command != 0) {
+        uint8_t prev = port->pending_command;
+        port->pending_command = 0;
+        if (cmd < PS2_CMD_SET_LEDS) {
+            ps2_handle_argument(port, prev, cmd);
+            return;
+        }
+    }
+
+    switch (cmd) {
+        // These take an argument byte - ACK and wait for it
+        case PS2_CMD_SET_LEDS:
         case PS2_CMD_SET_SCANCODE_SET:
-            ps2_send_byte(PS2_ACK);
+        case PS2_CMD_SET_TYPEMATIC:
+            port->pending_command = cmd;
+            ps2_respond(port, PS2_ACK);
+            break;
+
+        // Echo back
+        case PS2_CMD_ECHO:
+            ps2_respond(port, PS2_ECHO_RESPONSE);
             break;
 
         // Respond with keyboard ID (AB 83)
         case PS2_CMD_IDENTIFY:
-            ps2_send_byte(PS2_ACK);
-            wait_ms(PS2_INTER_BYTE_DELAY);
-            ps2_send_byte(0xAB);
-            wait_ms(PS2_INTER_BYTE_DELAY);
-            ps2_send_byte(0x83);
+            ps2_respond(port, PS2_ACK);
+            ps2_respond(port, 0xAB);
+            ps2_respond(port, 0x83);
             break;
 
         // Enable/Disable commands
         case PS2_CMD_ENABLE:
-            ps2_enabled = true;
-            ps2_send_byte(PS2_ACK);
+            port->enabled = true;
+            ps2_respond(port, PS2_ACK);
             break;
 
-        // Disables keyboard sending
+        // Disables keyboard sending (and restores defaults)
         case PS2_CMD_DISABLE:
-            ps2_enabled = false;
-            ps2_send_byte(PS2_ACK);
+            port->enabled = false;
+            ps2_keyboard_set_defaults(port);
+            ps2_respond(port, PS2_ACK);
             break;
 
         // Set Defaults command
         case PS2_CMD_SET_DEFAULTS:
-            ps2_send_byte(PS2_ACK);
+            ps2_keyboard_set_defaults(port);
+            ps2_respond(port, PS2_ACK);
+            break;
+
+        // Host didn't get our last byte - send it again
+        case PS2_CMD_RESEND:
+            PS2_STAT_INC(PS2_STAT_HOST_RESENDS);
+            port->resend_pending = true;
             break;
 
         // Reset command
         case PS2_CMD_RESET:
-            ps2_send_byte(PS2_ACK);
-            wait_ms(PS2_INTER_BYTE_DELAY);
-            ps2_send_byte(PS2_BAT_SUCCESS);
+            port->enabled = true;
+            ps2_keyboard_set_defaults(port);
+            port->leds = (ps2_led_state_t){0};
+            ps2_respond(port, PS2_ACK);
+            ps2_respond(port, PS2_BAT_SUCCESS);
             break;
 
         default:
-            ps2_send_byte(PS2_RESEND);
+            ps2_respond(port, PS2_RESEND);
             break;
     }
 }
 
-void ps2_keyboard_init(uint8_t clk_pin, uint8_t data_pin) {
-    ps2_clk_pin = clk_pin;
-    ps2_data_pin = data_pin;
+// One-time port setup. Settings the hosts gave us survive mode switches.
+static void ps2_keyboard_configure(void) {
+    static bool configured = false;
+    if (configured) return;
+
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        ps2_port_t *port = &ps2_ports[i];
+
+        port->index = i;
+        port->clk_pin = ps2_port_clock_pins[i];
+        port->data_pin = ps2_port_data_pins[i];
+        port->clk = PS2_GPIO_MASK(port->clk_pin);
+        port->data = PS2_GPIO_MASK(port->data_pin);
+        ps2_timer_init(&port->typematic.timer, ps2_typematic_fire, port);
+        ps2_timer_init(&port->response_gap, ps2_response_gap_done, port);
+        ps2_keyboard_set_defaults(port);
+    }
+    configured = true;
+}
+
+// PIO transceiver for AT ports (when built in), bit-banging for XT ports.
+// Restarting it drops a byte in flight; it is still queued, so it goes
+// out again.
+static void ps2_pio_port_setup(ps2_port_t *port) {
+#ifdef PS2_PIO_ENABLE
+    port->pio_lane = PS2_LANE_NONE;
+    if (port->protocol == PS2_PROTOCOL_AT) {
+        port->pio = ps2_pio_init(port->index, port->clk_pin, port->data_pin);
+    } else if (port->pio) {
+        ps2_pio_stop(port->index, port->clk_pin, port->data_pin);
+        port->pio = false;
+    }
+#endif
+}
+
+void ps2_keyboard_init(void) {
+    ps2_keyboard_configure();
+
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        ps2_port_t *port = &ps2_ports[i];
 
-    // Set pins as inputs with pullups
-    setPinInputHigh(ps2_clk_pin);
-    setPinInputHigh(ps2_data_pin);
+        // Inputs with pullups, both lines released
+        ps2_gpio_init(port->clk_pin, port->data_pin);
+        ps2_pio_port_setup(port);
 
-    ps2_enabled = true;
-    ps2_state = PS2_STATE_IDLE;
+        port->enabled = true;
+        port->state = PS2_STATE_IDLE;
+        port->pending_command = 0;
+        ps2_response_cancel(port);
 
-    // Initialize LED state
-    ps2_leds.caps_lock = 0;
-    ps2_leds.num_lock = 0;
-    ps2_leds.scroll_lock = 0;
+        // Initialize LED state
+        port->leds.caps_lock = 0;
+        port->leds.num_lock = 0;
+        port->leds.scroll_lock = 0;
 
-    uprintf("[PS2] Device initialized on CLK=%d, DATA=%d\n", clk_pin, data_pin);
+        uprintf("[PS2] Port %u initialized on CLK=%d, DATA=%d\n", i, (int)port->clk_pin, (int)port->data_pin);
+    }
 }
 
-bool ps2_keyboard_send_printscreen_make(void) {
-    // PrintScreen make: E0 12 E0 7C
-    ps2_keyboard_send_raw_byte(PS2_PREFIX_E0);
-    ps2_keyboard_send_raw_byte(0x12);
-    ps2_keyboard_send_raw_byte(PS2_PREFIX_E0);
-    ps2_keyboard_send_raw_byte(PS2_PSCREEN);
-    return true;
+// The lines go to the sniffer or the bridge next, so the state machines
+// let go of them. ps2_keyboard_init() starts them again.
+void ps2_keyboard_stop(void) {
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        ps2_port_t *port = &ps2_ports[i];
+
+#ifdef PS2_PIO_ENABLE
+        if (port->pio) {
+            ps2_pio_stop(port->index, port->clk_pin, port->data_pin);
+            port->pio = false;
+            port->pio_lane = PS2_LANE_NONE;
+        }
+#endif
+        ps2_lines_idle(port);
+        port->state = PS2_STATE_IDLE;
+    }
 }
 
-bool ps2_keyboard_send_printscreen_break(void) {
-    // PrintScreen break: E0 F0 7C E0 F0 12
-    ps2_keyboard_send_raw_byte(PS2_PREFIX_E0);
-    ps2_keyboard_send_raw_byte(PS2_PREFIX_F0);
-    ps2_keyboard_send_raw_byte(PS2_PSCREEN);
-    ps2_keyboard_send_raw_byte(PS2_PREFIX_E0);
-    ps2_keyboard_send_raw_byte(PS2_PREFIX_F0);
-    ps2_keyboard_send_raw_byte(0x12);
-    return true;
+_Static_assert(PS2_PORT_MAX <= PS2_WARM_PORTS, "warm state block too small for PS2_PORT_MAX");
+
+void ps2_keyboard_warm_save(ps2_warm_state_t *state) {
+    memset(state, 0, sizeof(*state));  // Padding too - the block is compared bytewise
+    state->active_port = active_port->index;
+    state->port_count = PS2_PORT_COUNT;
+
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        ps2_port_t *port = &ps2_ports[i];
+        ps2_warm_port_t *warm = &state->ports[i];
+
+        warm->enabled = port->enabled;
+        warm->leds = port->leds.scroll_lock | (port->leds.num_lock << 1) | (port->leds.caps_lock << 2);
+        warm->scancode_set = port->scancode_set;
+        warm->typematic_delay_ms = port->typematic.delay_ms;
+        warm->typematic_rate_ms = port->typematic.rate_ms;
+        warm->held = port->previous_report;
+    }
+}
+
+void ps2_keyboard_warm_resume(const ps2_warm_state_t *state) {
+    if (state->port_count != PS2_PORT_COUNT) return;  // Different build
+
+    ps2_keyboard_configure();
+
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        ps2_port_t *port = &ps2_ports[i];
+        const ps2_warm_port_t *warm = &state->ports[i];
+
+        port->enabled = warm->enabled;
+        port->leds.scroll_lock = (warm->leds >> 0) & 1;
+        port->leds.num_lock = (warm->leds >> 1) & 1;
+        port->leds.caps_lock = (warm->leds >> 2) & 1;
+        port->scancode_set = warm->scancode_set;
+        port->typematic.delay_ms = warm->typematic_delay_ms;
+        port->typematic.rate_ms = warm->typematic_rate_ms;
+
+        // The host still thinks these are down; syncing to nothing queues
+        // their releases (matrix scans re-press whatever really is held)
+        port->previous_report = warm->held;
+        port->queued_report = warm->held;
+        memset(&port->desired_report, 0, sizeof(port->desired_report));
+        memset(&port->host_report, 0, sizeof(port->host_report));
+        memset(&port->stream_report, 0, sizeof(port->stream_report));
+        port->stream_mask = 0;
+        port->event_count = 0;
+        port->event_deferred = !ps2_event_sync(port);
+    }
+
+    ps2_keyboard_select_port(state->active_port);
+    uprintf("[PS2] Warm restart: resumed port settings, active port %u\n", ps2_keyboard_active_port());
+}
+
+_Static_assert(PS2_PORT_MAX <= PS2_CONFIG_PORTS, "config block too small for PS2_PORT_MAX");
+
+void ps2_keyboard_config_save(ps2_config_t *config) {
+    memset(config, 0, sizeof(*config));  // Compared bytewise
+    config->active_port = active_port->index;
+    config->port_count = PS2_PORT_COUNT;
+
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        config->ports[i].scancode_set = ps2_ports[i].scancode_set;
+        config->ports[i].typematic_delay_ms = ps2_ports[i].typematic.delay_ms;
+        config->ports[i].typematic_rate_ms = ps2_ports[i].typematic.rate_ms;
+    }
+}
+
+void ps2_keyboard_config_apply(const ps2_config_t *config) {
+    if (config->port_count != PS2_PORT_COUNT) return;  // Different build
+
+    ps2_keyboard_configure();
+
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        ps2_ports[i].scancode_set = config->ports[i].scancode_set;
+        ps2_ports[i].typematic.delay_ms = config->ports[i].typematic_delay_ms;
+        ps2_ports[i].typematic.rate_ms = config->ports[i].typematic_rate_ms;
+    }
+    ps2_keyboard_select_port(config->active_port);
+}
+
+// Encode one key transition. Returns the number of bytes written to seq
+// (at most PS2_MAX_KEY_SEQUENCE); 0 means there is nothing to send.
+static uint8_t ps2_encode_key(ps2_mapping_t mapping, bool pressed, uint8_t *seq) {
+    uint8_t len = 0;
+
+    if (mapping.scancode == 0) return 0;
+
+    switch (mapping.special_type) {
+        case PS2_KEY_PRINTSCREEN:
+            if (pressed) {
+                // PrintScreen make: E0 12 E0 7C
+                seq[len++] = PS2_PREFIX_E0;
+                seq[len++] = 0x12;
+                seq[len++] = PS2_PREFIX_E0;
+                seq[len++] = PS2_PSCREEN;
+            } else {
+                // PrintScreen break: E0 F0 7C E0 F0 12
+                seq[len++] = PS2_PREFIX_E0;
+                seq[len++] = PS2_PREFIX_F0;
+                seq[len++] = PS2_PSCREEN;
+                seq[len++] = PS2_PREFIX_E0;
+                seq[len++] = PS2_PREFIX_F0;
+                seq[len++] = 0x12;
+            }
+            break;
+
+        case PS2_KEY_PAUSE:
+            // Pause make: E1 14 77 E1 F0 14 F0 77
+            // Pause has NO break code - only sends on make!
+            if (pressed) {
+                seq[len++] = PS2_PREFIX_E1;
+                seq[len++] = 0x14;
+                seq[len++] = PS2_PAUSE;
+                seq[len++] = PS2_PREFIX_E1;
+                seq[len++] = PS2_PREFIX_F0;
+                seq[len++] = 0x14;
+                seq[len++] = PS2_PREFIX_F0;
+                seq[len++] = PS2_PAUSE;
+            }
+            break;
+
+        default:
+            if (mapping.needs_e0_prefix) {
+                seq[len++] = PS2_PREFIX_E0;
+            }
+            if (!pressed) {
+                seq[len++] = PS2_PREFIX_F0;
+            }
+            seq[len++] = mapping.scancode;
+            break;
+    }
+
+    return len;
 }
 
-bool ps2_keyboard_send_pause(void) {
-    // Pause make: E1 14 77 E1 F0 14 F0 77
-    // Pause has NO break code - only sends on make!
-    ps2_keyboard_send_raw_byte(PS2_PREFIX_E1);
-    ps2_keyboard_send_raw_byte(0x14);
-    ps2_keyboard_send_raw_byte(PS2_PAUSE);
-    ps2_keyboard_send_raw_byte(PS2_PREFIX_E1);
-    ps2_keyboard_send_raw_byte(PS2_PREFIX_F0);
-    ps2_keyboard_send_raw_byte(0x14);
-    ps2_keyboard_send_raw_byte(PS2_PREFIX_F0);
-    ps2_keyboard_send_raw_byte(PS2_PAUSE);
+// Free slots in send_buffer (one slot always stays empty to tell full from empty)
+static uint8_t ps2_buffer_free(ps2_port_t *port) {
+    return (port->send_buffer_tail - port->send_buffer_head - 1 + PS2_SEND_BUFFER_SIZE) % PS2_SEND_BUFFER_SIZE;
+}
+
+static inline void ps2_buffer_note_depth(ps2_port_t *port) {
+    PS2_STAT_MAX(PS2_STAT_QUEUE_HIGH_WATER, PS2_SEND_BUFFER_SIZE - 1 - ps2_buffer_free(port));
+}
+
+// Rewrite a whole set 2 sequence as set 1, in place. Never longer: each
+// F0 prefix folds into the byte after it.
+static uint8_t ps2_set1_translate(uint8_t *seq, uint8_t len) {
+    uint8_t out = 0;
+    uint8_t release = 0;
+
+    for (uint8_t i = 0; i < len; i++) {
+        uint8_t byte = seq[i];
+        if (byte == PS2_PREFIX_F0) {
+            release = 0x80;
+            continue;
+        }
+        if (byte < 0x80) {
+            byte = ps2_set1_translation[byte] | release;
+        } else if (byte == PS2_F7) {
+            byte = PS2_SET1_F7 | release;
+        }  // E0, E1 pass through
+        seq[out++] = byte;
+        release = 0;
+    }
+    return out;
+}
+
+static inline bool ps2_port_set1(const ps2_port_t *port) {
+    return port->protocol == PS2_PROTOCOL_XT || port->scancode_set == 1;
+}
+
+// Queue a complete make/break sequence (always built in set 2), or nothing
+// at all if it doesn't fit
+static bool ps2_port_send_sequence(ps2_port_t *port, const uint8_t *bytes, uint8_t len) {
+    uint8_t set1[PS2_MAX_KEY_SEQUENCE];
+
+    if (!port->enabled) return false;
+    if (ps2_port_set1(port) && len <= PS2_MAX_KEY_SEQUENCE) {
+        memcpy(set1, bytes, len);
+        len = ps2_set1_translate(set1, len);
+        bytes = set1;
+    }
+    if (ps2_buffer_free(port) < len) return false;
+
+    for (uint8_t i = 0; i < len; i++) {
+        uint8_t slot = port->send_buffer_head;
+        port->send_buffer[slot] = bytes[i];
+        if (i == len - 1) {
+            port->seq_end |= 1UL << slot;
+        } else {
+            port->seq_end &= ~(1UL << slot);
+        }
+        port->send_buffer_head = (slot + 1) % PS2_SEND_BUFFER_SIZE;
+    }
+    port->queued_total += len;
+    ps2_buffer_note_depth(port);
     return true;
 }
 
-static bool ps2_buffer_has_space(uint8_t needed) {
-    uint8_t used;
-    if (send_buffer_head >= send_buffer_tail) {
-        used = send_buffer_head - send_buffer_tail;
+// Text injection and the rest of the keyboard-level API act on the active port
+uint8_t ps2_keyboard_send_free(void) {
+    return ps2_buffer_free(active_port);
+}
+
+bool ps2_keyboard_send_sequence(const uint8_t *bytes, uint8_t len) {
+    return ps2_port_send_sequence(active_port, bytes, len);
+}
+
+uint32_t ps2_keyboard_queued_total(void) {
+    return active_port->queued_total;
+}
+
+uint32_t ps2_keyboard_sent_total(void) {
+    return active_port->sent_total;
+}
+
+uint8_t ps2_keyboard_encode_keycode(uint8_t keycode, bool pressed, uint8_t *seq) {
+    ps2_mapping_t mapping;
+
+    if (keycode >= KC_LCTL && keycode <= KC_RGUI) {
+        mapping = modifier_mappings[keycode - KC_LCTL].mapping;
     } else {
-        used = PS2_SEND_BUFFER_SIZE - (send_buffer_tail - send_buffer_head);
+        mapping = qmk_to_ps2_scancode(keycode);
     }
-    return (PS2_SEND_BUFFER_SIZE - used) >= needed;
+    return ps2_encode_key(mapping, pressed, seq);
 }
 
-void ps2_keyboard_task(void) {
-    if (send_buffer_head != send_buffer_tail) {
-        uint8_t byte = send_buffer[send_buffer_tail];
-        if (ps2_send_byte(byte)) {
-            send_buffer_tail = (send_buffer_tail + 1) % PS2_SEND_BUFFER_SIZE;
-        }
+static void ps2_event_drain(ps2_port_t *port);
+
+static void ps2_host_command(ps2_port_t *port, uint8_t cmd) {
+    uprintf("[PS2] Port %u host command: 0x%02X\n", port->index, cmd);
+    // A new command supersedes any unsent response. A Resend doesn't: it
+    // asks for the last byte again, and the rest of the answer follows it.
+    if (cmd != PS2_CMD_RESEND) ps2_response_cancel(port);
+    ps2_handle_command(port, cmd);
+}
+
+// Next byte to go out, chosen by priority: a host Resend, then the
+// response lane, then the scancode lane. Responses wait for the end of the
+// sequence on the wire (8 bytes at most, ~10ms - inside the host's ~20ms
+// command timeout however full the scancode lane is), and scancodes wait
+// for a response that has started to go out in full.
+static ps2_lane_t ps2_port_next_byte(ps2_port_t *port, uint8_t *byte) {
+    if (port->resend_pending) {
+        *byte = port->last_sent_byte;
+        return PS2_LANE_RESEND;
+    }
+
+    if (port->response_len > 0 && !port->mid_sequence) {
+        if (ps2_timer_pending(&port->response_gap)) return PS2_LANE_NONE;
+        *byte = port->response[0];
+        return PS2_LANE_RESPONSE;
     }
 
-    ps2_keyboard_typematic_task();
+    if (port->send_buffer_head != port->send_buffer_tail) {
+        *byte = port->send_buffer[port->send_buffer_tail];
+        return PS2_LANE_SCANCODE;
+    }
+    return PS2_LANE_NONE;
 }
 
-bool ps2_keyboard_send_raw_byte(uint8_t byte) {
-    uint8_t next_head = (send_buffer_head + 1) % PS2_SEND_BUFFER_SIZE;
-    if (next_head == send_buffer_tail) {
-        uprintf("[PS2] WARNING: Send buffer full! Dropping byte 0x%02X\n", byte);
-        return false;
+// The byte ps2_port_next_byte() picked from `lane` is on the wire
+static void ps2_port_byte_sent(ps2_port_t *port, ps2_lane_t lane) {
+    switch (lane) {
+        case PS2_LANE_RESEND:
+            port->resend_pending = false;
+            break;
+
+        case PS2_LANE_RESPONSE:
+            port->response_len--;
+            for (uint8_t i = 0; i < port->response_len; i++) {
+                port->response[i] = port->response[i + 1];
+            }
+            if (port->response_len > 0) {
+                ps2_timer_arm(&port->response_gap, PS2_INTER_BYTE_DELAY);
+            }
+            break;
+
+        case PS2_LANE_SCANCODE: {
+            uint8_t slot = port->send_buffer_tail;
+            port->mid_sequence = !(port->seq_end & (1UL << slot));
+            port->send_buffer_tail = (slot + 1) % PS2_SEND_BUFFER_SIZE;
+            port->sent_total++;
+            break;
+        }
+
+        case PS2_LANE_NONE:
+            break;
     }
+}
 
-    send_buffer[send_buffer_head] = byte;
-    send_buffer_head = next_head;
+#ifdef PS2_PIO_ENABLE
+// The state machine clocks the byte out by itself; whether it made it
+// comes back through ps2_pio_port_poll(). One byte in flight at a time,
+// so a frame the host aborts is simply picked again.
+static void ps2_pio_port_transmit(ps2_port_t *port) {
+    if (port->pio_lane != PS2_LANE_NONE) return;
+
+    uint8_t byte;
+    ps2_lane_t lane = ps2_port_next_byte(port, &byte);
+    if (lane == PS2_LANE_NONE) return;
+
+    port->pio_lane = lane;
+    port->pio_byte = byte;
+    port->state = PS2_STATE_SENDING;
+    ps2_pio_put(port->index, ps2_pio_tx_word(byte));
+}
 
-    return true;
+// Everything the state machine reported, in wire order: the outcome of
+// our byte, and host frames it has already clocked in and ACKed
+static void ps2_pio_port_poll(ps2_port_t *port) {
+    uint32_t word;
+
+    while (ps2_pio_get(port->index, &word)) {
+        if (word == PS2_PIO_SENT || (word == PS2_PIO_ABORTED && port->pio_lane != PS2_LANE_NONE)) {
+            ps2_lane_t lane = port->pio_lane;
+            uint8_t data = port->pio_byte;
+
+            port->pio_lane = PS2_LANE_NONE;
+            port->state = PS2_STATE_IDLE;
+            if (word == PS2_PIO_ABORTED) {
+                PS2_STAT_INC(PS2_STAT_INHIBIT_ABORTS);
+                ps2_flight_record(port->index, data, ps2_flight_flags(port) | PS2_FLIGHT_ABORTED);
+                continue;
+            }
+            ps2_flight_record(port->index, data, ps2_flight_flags(port));
+            port->last_sent_byte = data;
+            PS2_STAT_INC(PS2_STAT_BYTES_SENT);
+            ps2_port_byte_sent(port, lane);
+        } else if (word == PS2_PIO_ABORTED) {
+            // The host gave up on its own frame
+            PS2_STAT_INC(PS2_STAT_INHIBIT_ABORTS);
+            ps2_flight_record(port->index, 0, PS2_FLIGHT_HOST | PS2_FLIGHT_ABORTED);
+        } else {
+            uint8_t cmd = ps2_pio_rx_data(word);
+            if (ps2_receive_check(port, cmd, ps2_pio_rx_parity_ok(word), ps2_pio_rx_stop_ok(word))) {
+                ps2_host_command(port, cmd);
+            } else {
+                ps2_response_cancel(port);
+                ps2_respond(port, PS2_RESEND);
+            }
+        }
+    }
 }
+#endif
+
+// One byte per pass. Bit-banged, the whole frame goes out before this
+// returns; it stays queued if the host inhibited it.
+static void ps2_port_transmit(ps2_port_t *port) {
+#ifdef PS2_PIO_ENABLE
+    if (port->pio) {
+        ps2_pio_port_transmit(port);
+        return;
+    }
+#endif
+
+    uint8_t byte;
+    ps2_lane_t lane = ps2_port_next_byte(port, &byte);
+    if (lane != PS2_LANE_NONE && ps2_port_send_byte(port, byte)) {
+        ps2_port_byte_sent(port, lane);
+    }
+}
+
+// XT hosts send nothing but a reset: CLK held low for PS2_XT_RESET_MS.
+// The keyboard answers with its self-test result once CLK is released.
+static void ps2_xt_watch_reset(ps2_port_t *port) {
+    if (!ps2_clk_read(port)) {
+        if (!port->xt_clk_low) {
+            port->xt_clk_low = true;
+            port->xt_clk_low_since = timer_read32();
+        }
+        return;
+    }
 
-bool ps2_keyboard_send_key_make(uint8_t scancode) {
-    if (!ps2_enabled) return false;
+    if (port->xt_clk_low) {
+        port->xt_clk_low = false;
+        if (timer_elapsed32(port->xt_clk_low_since) >= PS2_XT_RESET_MS) {
+            uprintf("[PS2] Port %u XT host reset\n", port->index);
+            ps2_response_cancel(port);
+            ps2_respond(port, PS2_BAT_SUCCESS);
+        }
+    }
+}
 
-    uint8_t next_head = (send_buffer_head + 1) % PS2_SEND_BUFFER_SIZE;
-    if (next_head == send_buffer_tail) {
-        // Buffer full - this shouldn't happen in normal use!
-        uprintf("[PS2] WARNING: Send buffer full! Dropping scancode 0x%02X\n", scancode);
-        return false; // Buffer full
+static void ps2_port_task(ps2_port_t *port) {
+    // Host commands take priority over anything we have queued. (An XT
+    // host holds DATA low while busy - that's not a request to send.)
+#ifdef PS2_PIO_ENABLE
+    if (port->pio) {
+        ps2_pio_port_poll(port);
+    } else
+#endif
+    if (port->protocol == PS2_PROTOCOL_XT) {
+        ps2_xt_watch_reset(port);
+    } else if (ps2_host_request_to_send(port)) {
+        uint8_t cmd;
+        if (ps2_receive_byte(port, &cmd)) {
+            ps2_host_command(port, cmd);
+        } else if (ps2_clk_read(port)) {
+            // Bad parity/stop bit (not an inhibit) - ask for it again
+            ps2_response_cancel(port);
+            ps2_respond(port, PS2_RESEND);
+        }
     }
 
-    send_buffer[send_buffer_head] = scancode;
-    send_buffer_head = next_head;
+    // Refill from pending key events and any string being typed before draining
+    ps2_event_drain(port);
+    if (port == active_port) {
+        ps2_send_string_task();
+    }
 
-    return true;
+    ps2_port_transmit(port);
 }
 
-bool ps2_keyboard_send_key_break(uint8_t scancode) {
-    if (!ps2_enabled) return false;
+// Every port is serviced on every pass, active or not: the machines behind
+// the inactive ports still expect their LED, reset and ID commands answered,
+// and keys released on a port we just left still have to reach it.
+void ps2_keyboard_task(void) {
+    PS2_PROBE(PS2_PROBE_KEYBOARD_TASK);
+
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        ps2_port_task(&ps2_ports[i]);
+    }
+}
 
-    // Send break prefix (0xF0) then scancode
-    uint8_t next_head = (send_buffer_head + 1) % PS2_SEND_BUFFER_SIZE;
-    if (next_head == send_buffer_tail) return false;
+bool ps2_keyboard_busy(void) {
+    if (ps2_send_string_busy()) return true;
 
-    send_buffer[send_buffer_head] = PS2_PREFIX_F0;
-    send_buffer_head = next_head;
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        ps2_port_t *port = &ps2_ports[i];
 
-    next_head = (send_buffer_head + 1) % PS2_SEND_BUFFER_SIZE;
-    if (next_head == send_buffer_tail) return false;
+        // Bytes still queued or a transfer in progress. A response waiting
+        // out its gap is on the timer wheel.
+        bool response_ready = port->response_len > 0 && !ps2_timer_pending(&port->response_gap);
+        if (port->send_buffer_head != port->send_buffer_tail || port->state != PS2_STATE_IDLE ||
+            response_ready || port->resend_pending || port->event_count > 0) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    send_buffer[send_buffer_head] = scancode;
-    send_buffer_head = next_head;
+void ps2_keyboard_idle_plan(ps2_idle_plan_t *plan) {
+    if (ps2_keyboard_busy()) {
+        ps2_idle_plan_busy(plan);
+    }
 
-    return true;
+    // Typematic repeats and response gaps are on the timer wheel, whose
+    // deadline the caller adds
 }
 
 ps2_led_state_t ps2_keyboard_get_leds(void) {
-    return ps2_leds;
+    return active_port->leds;
+}
+
+bool ps2_keyboard_is_enabled(void) {
+    return active_port->enabled;
+}
+
+uint8_t ps2_keyboard_get_mods(void) {
+    return active_port->previous_report.mods;
+}
+
+uint8_t ps2_keyboard_active_port(void) {
+    return active_port->index;
 }
 
-bool ps2_device_is_enabled(void) {
-    return ps2_enabled;
+void ps2_keyboard_select_port(uint8_t index) {
+    if (index >= PS2_PORT_COUNT) return;
+    active_port = &ps2_ports[index];
+}
+
+void ps2_keyboard_set_protocol(ps2_protocol_t protocol) {
+    for (uint8_t i = 0; i < PS2_PORT_COUNT; i++) {
+        ps2_ports[i].protocol = protocol;
+        ps2_ports[i].xt_clk_low = false;
+        ps2_pio_port_setup(&ps2_ports[i]);
+    }
+    uprintf("[PS2] Protocol: %s\n", protocol == PS2_PROTOCOL_XT ? "XT (set 1)" : "AT/PS/2");
 }
 
-static uint8_t ps2_keyboard_leds(void) {
-    ps2_led_state_t leds = ps2_keyboard_get_leds();
+ps2_protocol_t ps2_keyboard_protocol(void) {
+    return active_port->protocol;
+}
+
+// QMK LED bits (num/caps/scroll) as seen by this port's host
+static uint8_t ps2_keyboard_leds(ps2_port_t *port) {
+    ps2_led_state_t leds = port->leds;
     return (leds.caps_lock << 1) | (leds.num_lock) | (leds.scroll_lock << 2);
 }
 
-static void ps2_send_keyboard(report_keyboard_t *report) {
-    if (report->keys[0] != 0 || report->keys[1] != 0) {
-        uprintf("[PS2] Report contains keys: ");
-        for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
-            if (report->keys[i] != 0) {
-                uprintf("0x%02X ", report->keys[i]);
-            }
-        }
-        uprintf("\n");
+// Key event pipeline. The host driver callbacks only record the state QMK
+// asks for (desired_*) and turn the change into events - key, modifier,
+// consumer and system transitions, each stamped with a sequence number and
+// the time - in one FIFO per port. The encoder takes events off the front
+// only when their whole make/break sequence fits in send_buffer, so the
+// host sees every transition in the order QMK produced it, whichever
+// report it came from (a media key pressed while Shift is held comes out
+// after the Shift make, and before its break).
+//
+// Memory is bounded by PS2_EVENT_QUEUE_SIZE. The queue always keeps room
+// for one release per key that is (or will be) down, so a release is never
+// refused and every press that goes out is released. A press that finds
+// no room is deferred: desired_* is synced again as the queue drains, so a
+// held key still arrives, only later, while a tap made entirely during the
+// backlog collapses to nothing.
+static bool report_has_key(const report_keyboard_t *report, uint8_t keycode) {
+    for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        if (report->keys[i] == keycode) return true;
     }
+    return false;
+}
 
-    // Handle modifier changes
-    uint8_t mod_changes = previous_report.mods ^ report->mods;
-
-    if (mod_changes) {
-        for (uint8_t i = 0; i < 8; i++) {
-            const ps2_modifier_mapping_t *mapping = &modifier_mappings[i];
-
-            if (mod_changes & mapping->mod_bit) {
-                bool is_pressed = report->mods & mapping->mod_bit;
-
-                if (is_pressed) {
-                    uprintf("[PS2] Modifier pressed: 0x%02X (scancode: 0x%02X%s)\n",
-                            mapping->mod_bit, mapping->scancode,
-                            mapping->needs_e0 ? ", E0 prefix" : "");
-                    if (mapping->needs_e0) {
-                        ps2_keyboard_send_key_make(PS2_PREFIX_E0);
-                    }
-                    ps2_keyboard_send_key_make(mapping->scancode);
-                // ... inside ps2_send_keyboard ...
-                } else {
-                    uprintf("[PS2] Modifier released: 0x%02X (scancode: 0x%02X%s)\n",
-                            mapping->mod_bit, mapping->scancode,
-                            mapping->needs_e0 ? ", E0 prefix" : "");
-
-                    // Corrected Release Sequence for Extended Modifiers
-                    if (mapping->needs_e0) {
-                        ps2_keyboard_send_raw_byte(PS2_PREFIX_E0);
-                    }
-                    ps2_keyboard_send_key_break(mapping->scancode);
-                }
-            }
+// False if all the slots are taken. queued_* and previous_* only ever
+// take keys from desired_report, so they always find one.
+static bool report_add_key(report_keyboard_t *report, uint8_t keycode) {
+    for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        if (report->keys[i] == 0) {
+            report->keys[i] = keycode;
+            return true;
         }
     }
+    return false;
+}
 
-    // Handle regular key releases
+static void report_del_key(report_keyboard_t *report, uint8_t keycode) {
     for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
-        uint8_t prev_keycode = previous_report.keys[i];
-        bool still_pressed = false;
+        if (report->keys[i] == keycode) report->keys[i] = 0;
+    }
+}
 
-        if (prev_keycode == 0) continue;
+// Releases the queue owes: everything down once it has drained
+static uint8_t ps2_event_owed(ps2_port_t *port) {
+    uint8_t owed = __builtin_popcount(port->queued_report.mods);
+    for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        if (port->queued_report.keys[i] != 0) owed++;
+    }
+    return owed + (port->queued_media_key != 0) + (port->queued_system_key != 0);
+}
 
-        for (int j = 0; j < KEYBOARD_REPORT_KEYS; j++) {
-            if (report->keys[j] == prev_keycode) {
-                still_pressed = true;
-                break;
-            }
+static bool ps2_event_push(ps2_port_t *port, ps2_event_kind_t kind, uint16_t code, bool pressed) {
+    // A press has to leave room for its own release and every other one owed
+    uint8_t free = PS2_EVENT_QUEUE_SIZE - port->event_count;
+    if (pressed && free < ps2_event_owed(port) + 2) return false;
+
+    ps2_mapping_t mapping;
+    switch (kind) {
+        case PS2_EVENT_KEY:
+            mapping = qmk_to_ps2_scancode(code);
+            break;
+        case PS2_EVENT_MOD:
+            mapping = modifier_mappings[code].mapping;
+            break;
+        case PS2_EVENT_CONSUMER:
+            mapping = consumer_to_ps2_scancode(code);
+            break;
+        default:
+            mapping = system_to_ps2_scancode(code);
+            break;
+    }
+
+    port->events[(port->event_head + port->event_count) % PS2_EVENT_QUEUE_SIZE] = (ps2_event_t){
+        .time_us = ps2_micros(),
+        .seq = port->event_seq++,
+        .code = code,
+        .mapping = mapping,
+        .kind = kind,
+        .pressed = pressed,
+    };
+    port->event_count++;
+    return true;
+}
+
+// Queue the transitions from queued_* to desired_*: releases first, then
+// modifiers, then presses. Returns false if a press had to be deferred.
+static bool ps2_event_sync(ps2_port_t *port) {
+    report_keyboard_t *queued = &port->queued_report;
+    const report_keyboard_t *desired = &port->desired_report;
+    bool complete = true;
+
+    for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        uint8_t keycode = queued->keys[i];
+        if (keycode == 0 || report_has_key(desired, keycode)) continue;
+        ps2_event_push(port, PS2_EVENT_KEY, keycode, false);
+        queued->keys[i] = 0;
+    }
+    if (port->queued_media_key != 0 && port->queued_media_key != port->desired_media_key) {
+        ps2_event_push(port, PS2_EVENT_CONSUMER, port->queued_media_key, false);
+        port->queued_media_key = 0;
+    }
+    if (port->queued_system_key != 0 && port->queued_system_key != port->desired_system_key) {
+        ps2_event_push(port, PS2_EVENT_SYSTEM, port->queued_system_key, false);
+        port->queued_system_key = 0;
+    }
+
+    uint8_t mod_changes = queued->mods ^ desired->mods;
+    for (uint8_t i = 0; i < 8 && mod_changes; i++) {
+        uint8_t bit = modifier_mappings[i].mod_bit;
+        if (!(mod_changes & bit)) continue;
+        if (ps2_event_push(port, PS2_EVENT_MOD, i, desired->mods & bit)) {
+            queued->mods ^= bit;
+        } else {
+            complete = false;
         }
+    }
 
-        if (!still_pressed) {
-            ps2_mapping_t mapping = qmk_to_ps2_scancode(prev_keycode);
-            if (mapping.scancode != 0) {
-                if (mapping.special_type == PS2_KEY_PRINTSCREEN) {
-                    ps2_keyboard_send_printscreen_break();
-                    continue;
-                }
+    for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        uint8_t keycode = desired->keys[i];
+        if (keycode == 0 || report_has_key(queued, keycode)) continue;
+        if (ps2_event_push(port, PS2_EVENT_KEY, keycode, true)) {
+            report_add_key(queued, keycode);
+        } else {
+            complete = false;
+        }
+    }
+    if (port->desired_media_key != 0 && port->queued_media_key == 0) {
+        if (ps2_event_push(port, PS2_EVENT_CONSUMER, port->desired_media_key, true)) {
+            port->queued_media_key = port->desired_media_key;
+        } else {
+            complete = false;
+        }
+    }
+    if (port->desired_system_key != 0 && port->queued_system_key == 0) {
+        if (ps2_event_push(port, PS2_EVENT_SYSTEM, port->desired_system_key, true)) {
+            port->queued_system_key = port->desired_system_key;
+        } else {
+            complete = false;
+        }
+    }
 
-                if (mapping.special_type == PS2_KEY_PAUSE) {
-                    continue;
-                }
+    return complete;
+}
 
-                uprintf("[PS2] Key released: keycode=0x%04X, scancode=0x%02X%s\n",
-                        prev_keycode, mapping.scancode,
-                        mapping.needs_e0_prefix ? ", E0 prefix" : "");
-                if (mapping.needs_e0_prefix) {
-                    ps2_keyboard_send_key_make(PS2_PREFIX_E0);
+static const char *const ps2_event_kind_names[] = {
+    [PS2_EVENT_KEY]      = "Key",
+    [PS2_EVENT_MOD]      = "Modifier",
+    [PS2_EVENT_CONSUMER] = "Media key",
+    [PS2_EVENT_SYSTEM]   = "System key",
+};
+
+// The event has reached the host (or was dropped on a disabled port, where
+// the host sees nothing and is owed nothing): move previous_* along
+static void ps2_event_apply(ps2_port_t *port, const ps2_event_t *event, bool sent) {
+    switch (event->kind) {
+        case PS2_EVENT_KEY:
+            if (event->pressed) {
+                report_add_key(&port->previous_report, event->code);
+                if (sent && event->mapping.scancode != 0 && event->mapping.special_type == PS2_KEY_NORMAL) {
+                    ps2_typematic_arm(port, event->code);
                 }
-                ps2_keyboard_send_key_break(mapping.scancode);
-                ps2_keyboard_typematic_stop(prev_keycode);
+            } else {
+                report_del_key(&port->previous_report, event->code);
+                ps2_typematic_stop(port, event->code);
             }
-        }
+            break;
+        case PS2_EVENT_MOD:
+            port->previous_report.mods ^= modifier_mappings[event->code].mod_bit;
+            break;
+        case PS2_EVENT_CONSUMER:
+            port->previous_media_key = event->pressed ? event->code : 0;
+            break;
+        case PS2_EVENT_SYSTEM:
+            port->previous_system_key = event->pressed ? event->code : 0;
+            break;
     }
+}
 
-    // Handle regular key presses
-    for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
-        uint8_t keycode = report->keys[i];
-        bool was_pressed = false;
+// Move events into send_buffer, oldest first, while whole sequences fit
+static void ps2_event_drain(ps2_port_t *port) {
+    uint8_t seq[PS2_MAX_KEY_SEQUENCE];
 
-        if (keycode == 0) continue;
+    while (port->event_count > 0) {
+        const ps2_event_t *event = &port->events[port->event_head];
 
-        for (int j = 0; j < KEYBOARD_REPORT_KEYS; j++) {
-            if (previous_report.keys[j] == keycode) {
-                was_pressed = true;
-                break;
+        if (port->enabled) {
+            uint8_t len = ps2_encode_key(event->mapping, event->pressed, seq);
+            if (!ps2_port_send_sequence(port, seq, len)) break;
+
+            if (len != 0) {
+                dprintf("[PS2] #%u %s %s: code=0x%04X, scancode=0x%02X%s\n",
+                        event->seq, ps2_event_kind_names[event->kind],
+                        event->pressed ? "pressed" : "released", event->code,
+                        event->mapping.scancode, event->mapping.needs_e0_prefix ? ", E0 prefix" : "");
             }
+            PS2_STAT_MAX(PS2_STAT_EVENT_WAIT_US_MAX, ps2_micros() - event->time_us);
         }
+        ps2_event_apply(port, event, port->enabled);
 
-        if (!was_pressed) {
-            ps2_mapping_t mapping = qmk_to_ps2_scancode(keycode);
-            if (mapping.scancode != 0) {
-                if (mapping.special_type == PS2_KEY_PRINTSCREEN) {
-                    ps2_keyboard_send_printscreen_make();
-                    continue;
-                }
+        port->event_head = (port->event_head + 1) % PS2_EVENT_QUEUE_SIZE;
+        port->event_count--;
+    }
 
-                if (mapping.special_type == PS2_KEY_PAUSE) {
-                    ps2_keyboard_send_pause();
-                    continue;
-                }
+    if (port->event_deferred) {
+        port->event_deferred = !ps2_event_sync(port);
+    }
+}
 
-                uprintf("[PS2] Key pressed: keycode=0x%04X, scancode=0x%02X%s\n",
-                        keycode, mapping.scancode,
-                        mapping.needs_e0_prefix ? ", E0 prefix" : "");
-                if (mapping.needs_e0_prefix) {
-                    ps2_keyboard_send_key_make(PS2_PREFIX_E0);
-                }
-                ps2_keyboard_send_key_make(mapping.scancode);
-                ps2_keyboard_typematic_arm(keycode, mapping.scancode);
+// QMK asked for a new state: queue the difference and send what fits
+// QMK's keys first; a stream key that finds no free slot is left out
+static void ps2_desired_merge(ps2_port_t *port) {
+    report_keyboard_t *desired = &port->desired_report;
+
+    *desired = port->host_report;
+    desired->mods = (desired->mods & ~port->stream_mask) | port->stream_report.mods;
+    for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        uint8_t keycode = port->stream_report.keys[i];
+        if (keycode != 0 && !report_has_key(desired, keycode)) report_add_key(desired, keycode);
+    }
+}
+
+static void ps2_event_update(ps2_port_t *port) {
+    if (!ps2_event_sync(port) && !port->event_deferred) {
+        uprintf("[PS2] WARNING: Event queue full! Deferring a key press\n");
+        PS2_STAT_INC(PS2_STAT_EVENT_DROPS);
+        ps2_flight_freeze(PS2_FLIGHT_EVENT_OVERFLOW);
+        port->event_deferred = true;
+    }
+    ps2_event_drain(port);
+}
+
+static void ps2_send_keyboard(ps2_port_t *port, report_keyboard_t *report) {
+    PS2_PROBE(PS2_PROBE_SEND_KEYBOARD);
+
+    ps2_stats_key_reported();
+
+    // Trace lines in the callbacks are formatted only with QMK's debug on
+    // (dprintf), so the budget doesn't depend on the console
+    if (debug_enable && (report->keys[0] != 0 || report->keys[1] != 0)) {
+        uprintf("[PS2] Report contains keys: ");
+        for (int i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+            if (report->keys[i] != 0) {
+                uprintf("0x%02X ", report->keys[i]);
             }
         }
+        uprintf("\n");
     }
 
-    previous_report = *report;
+    port->host_report = *report;
+    ps2_desired_merge(port);
+    ps2_event_update(port);
+}
+
+// The stream's keys take the same path as QMK's: through the event queue,
+// repeating while held, released the same way
+bool ps2_keyboard_stream_key(uint8_t keycode, bool pressed) {
+    ps2_port_t *port = active_port;
+    report_keyboard_t *stream = &port->stream_report;
+    bool modifier = keycode >= KC_LCTL && keycode <= KC_RGUI;
+
+    if (modifier) {
+        uint8_t bit = MOD_BIT(keycode);
+        stream->mods = pressed ? stream->mods | bit : stream->mods & ~bit;
+        port->stream_mask = pressed ? port->stream_mask & ~bit : port->stream_mask | bit;
+    } else if (!pressed) {
+        report_del_key(stream, keycode);
+    } else if (!report_has_key(stream, keycode) && !report_add_key(stream, keycode)) {
+        return false;
+    }
+
+    ps2_desired_merge(port);
+    if (pressed && !modifier && !report_has_key(&port->desired_report, keycode)) {
+        // No slot left beside QMK's keys
+        report_del_key(stream, keycode);
+        return false;
+    }
+    ps2_event_update(port);
+    return true;
+}
+
+void ps2_keyboard_stream_release(void) {
+    ps2_port_t *port = active_port;
+
+    memset(&port->stream_report, 0, sizeof(port->stream_report));
+    port->stream_mask = 0;
+    ps2_desired_merge(port);
+    ps2_event_update(port);
+}
+
+bool ps2_keyboard_events_pending(void) {
+    return active_port->event_count > 0;
 }
 
 static void ps2_send_nkro(report_nkro_t *report) {
@@ -584,69 +1591,103 @@ static void ps2_send_mouse(report_mouse_t *report) {
     // Not implemented
 }
 
-// Handle media/consumer keys - FIXED VERSION
-static void ps2_send_extra(report_extra_t *report) {
-    uint16_t current_media_key = 0;
+// Media (consumer) and ACPI power (system) keys: one usage each, 0 = released
+static void ps2_send_extra(ps2_port_t *port, report_extra_t *report) {
+    PS2_PROBE(PS2_PROBE_SEND_EXTRA);
+
+    dprintf("[PS2] Extra key report: id=%u, usage=0x%04X\n", report->report_id, report->usage);
 
     if (report->report_id == REPORT_ID_CONSUMER) {
-        current_media_key = report->usage;
-        uprintf("[PS2] Extra key report: usage=0x%04X\n", current_media_key);
-    }
-
-    if (current_media_key != previous_media_key) {
-        // 1. Handle Release (Break)
-        if (previous_media_key != 0) {
-            // USE CONSUMER MAPPING for consumer control codes
-            ps2_mapping_t mapping = consumer_to_ps2_scancode(previous_media_key);
-            // Ensure space for: E0 (prefix) + F0 (break) + Scancode = 3 bytes
-            if (mapping.scancode != 0 && ps2_buffer_has_space(3)) {
-                uprintf("[PS2] Media key RELEASE: usage=0x%04X, scancode=0x%02X%s\n",
-                        previous_media_key, mapping.scancode,
-                        mapping.needs_e0_prefix ? ", E0 prefix" : "");
-                if (mapping.needs_e0_prefix) {
-                    ps2_keyboard_send_raw_byte(PS2_PREFIX_E0);
-                }
-                ps2_keyboard_send_key_break(mapping.scancode);
-            } else if (mapping.scancode == 0) {
-                uprintf("[PS2] WARNING: Previous consumer code 0x%04X has no PS/2 mapping!\n", previous_media_key);
-            }
-        }
+        port->desired_media_key = report->usage;
+    } else if (report->report_id == REPORT_ID_SYSTEM) {
+        port->desired_system_key = report->usage;
+    } else {
+        return;
+    }
+    ps2_event_update(port);
+}
 
-        // 2. Handle Press (Make)
-        if (current_media_key != 0) {
-            // USE CONSUMER MAPPING for consumer control codes
-            ps2_mapping_t mapping = consumer_to_ps2_scancode(current_media_key);
-            // Ensure space for: E0 (prefix) + Scancode = 2 bytes
-            if (mapping.scancode != 0 && ps2_buffer_has_space(2)) {
-                uprintf("[PS2] Media key PRESS: usage=0x%04X, scancode=0x%02X%s\n",
-                        current_media_key, mapping.scancode,
-                        mapping.needs_e0_prefix ? ", E0 prefix" : "");
-                if (mapping.needs_e0_prefix) {
-                    ps2_keyboard_send_raw_byte(PS2_PREFIX_E0);
-                }
-                ps2_keyboard_send_key_make(mapping.scancode);
+// One host driver per port. QMK's driver callbacks carry no context, so
+// each port gets a set of trampolines bound to its index.
+#define PS2_PORT_DRIVER(n)                                                      \
+    static uint8_t ps2_port##n##_leds(void) {                                   \
+        return ps2_keyboard_leds(&ps2_ports[n]);                                \
+    }                                                                           \
+    static void ps2_port##n##_send_keyboard(report_keyboard_t *report) {        \
+        ps2_send_keyboard(&ps2_ports[n], report);                               \
+    }                                                                           \
+    static void ps2_port##n##_send_extra(report_extra_t *report) {              \
+        ps2_send_extra(&ps2_ports[n], report);                                  \
+    }
 
-                // NOTE: We do NOT call ps2_keyboard_typematic_arm() here
-                // because media keys should not repeat in PS/2.
-            } else if (mapping.scancode == 0) {
-                uprintf("[PS2] WARNING: Current consumer code 0x%04X has no PS/2 mapping!\n", current_media_key);
-            }
-        }
-        previous_media_key = current_media_key;
+#define PS2_PORT_DRIVER_ENTRY(n)                    \
+    {                                               \
+        .keyboard_leds = ps2_port##n##_leds,        \
+        .send_keyboard = ps2_port##n##_send_keyboard, \
+        .send_nkro = ps2_send_nkro,                 \
+        .send_mouse = ps2_send_mouse,               \
+        .send_extra = ps2_port##n##_send_extra,     \
     }
+
+// XT hosts never tell the keyboard their lock state
+static uint8_t ps2_xt_leds(void) {
+    return 0;
 }
 
-// Create the driver struct
-host_driver_t ps2_keyboard_host_driver = {
-    .keyboard_leds = ps2_keyboard_leds,
-    .send_keyboard = ps2_send_keyboard,
-    .send_nkro = ps2_send_nkro,
-    .send_mouse = ps2_send_mouse,
-    .send_extra = ps2_send_extra,
+#define PS2_XT_DRIVER_ENTRY(n)                      \
+    {                                               \
+        .keyboard_leds = ps2_xt_leds,               \
+        .send_keyboard = ps2_port##n##_send_keyboard, \
+        .send_nkro = ps2_send_nkro,                 \
+        .send_mouse = ps2_send_mouse,               \
+        .send_extra = ps2_port##n##_send_extra,     \
+    }
+
+PS2_PORT_DRIVER(0)
+#if PS2_PORT_COUNT > 1
+PS2_PORT_DRIVER(1)
+#endif
+#if PS2_PORT_COUNT > 2
+PS2_PORT_DRIVER(2)
+#endif
+#if PS2_PORT_COUNT > 3
+PS2_PORT_DRIVER(3)
+#endif
+
+static host_driver_t ps2_port_drivers[PS2_PORT_COUNT] = {
+    PS2_PORT_DRIVER_ENTRY(0),
+#if PS2_PORT_COUNT > 1
+    PS2_PORT_DRIVER_ENTRY(1),
+#endif
+#if PS2_PORT_COUNT > 2
+    PS2_PORT_DRIVER_ENTRY(2),
+#endif
+#if PS2_PORT_COUNT > 3
+    PS2_PORT_DRIVER_ENTRY(3),
+#endif
+};
+
+static host_driver_t ps2_xt_drivers[PS2_PORT_COUNT] = {
+    PS2_XT_DRIVER_ENTRY(0),
+#if PS2_PORT_COUNT > 1
+    PS2_XT_DRIVER_ENTRY(1),
+#endif
+#if PS2_PORT_COUNT > 2
+    PS2_XT_DRIVER_ENTRY(2),
+#endif
+#if PS2_PORT_COUNT > 3
+    PS2_XT_DRIVER_ENTRY(3),
+#endif
 };
 
-// Keep ps2_handle_command available for future host-to-device implementation
-// Mark as used to avoid compiler warnings
-void __attribute__((used)) ps2_device_process_host_command(uint8_t cmd) {
-    ps2_handle_command(cmd);
+host_driver_t *ps2_keyboard_driver(uint8_t index) {
+    if (index >= PS2_PORT_COUNT) index = 0;
+    if (ps2_ports[index].protocol == PS2_PROTOCOL_XT) return &ps2_xt_drivers[index];
+    return &ps2_port_drivers[index];
+}
+
+// Feed a host command to the active port as if it had been received on
+// the wire (debugging / host simulation)
+void ps2_device_process_host_command(uint8_t cmd) {
+    ps2_handle_command(active_port, cmd);
 }
@@ -6,10 +6,29 @@
 #include <stdbool.h>
 #include "ps2_scancodes.h"
 #include "host_driver.h"    // For host_driver_t
+#include "ps2_idle.h"
+#include "ps2_warm.h"
+#include "ps2_config.h"
+
+// PS/2 ports (KVM fan-out). Port 0 defaults to the keyboard pins; to drive
+// more machines, define all three in config.h.
+#ifndef PS2_PORT_COUNT
+#define PS2_PORT_COUNT 1
+#define PS2_PORT_CLOCK_PINS { PS2_KEYBOARD_CLOCK_PIN }
+#define PS2_PORT_DATA_PINS  { PS2_KEYBOARD_DATA_PIN }
+#endif
+
+#define PS2_PORT_MAX 4
+
+// Longest single key sequence (Pause: E1 14 77 E1 F0 14 F0 77)
+#define PS2_MAX_KEY_SEQUENCE 8
+#if PS2_PORT_COUNT < 1 || PS2_PORT_COUNT > PS2_PORT_MAX
+#error "PS2_PORT_COUNT must be 1..4"
+#endif
 
-extern host_driver_t ps2_keyboard_host_driver;  // Declare the PS/2 driver
 extern ps2_special_key_type_t ps2_key_type; // Declare modifier mappings
 extern ps2_mapping_t qmk_to_ps2_scancode(uint16_t keycode); // Declare mapping function
+void ps2_scancode_reverse_index(uint8_t plain[256], uint8_t extended[256]);  // Make code -> keycode (bridge)
 
 // PS/2 Commands from host
 #define PS2_CMD_SET_LEDS           0xED
@@ -23,6 +42,10 @@ extern ps2_mapping_t qmk_to_ps2_scancode(uint16_t keycode); // Declare mapping f
 #define PS2_CMD_RESEND             0xFE
 #define PS2_CMD_RESET              0xFF
 
+// Typematic defaults (also restored by 0xF5/0xF6/0xFF)
+#define PS2_TYPEMATIC_DEFAULT_DELAY_MS 500  // 500ms delay
+#define PS2_TYPEMATIC_DEFAULT_RATE_MS  33   // ~30Hz repeat rate
+
 // PS/2 Responses
 #define PS2_ACK                    0xFA
 #define PS2_RESEND                 0xFE
@@ -42,6 +65,18 @@ uint8_t ps2_keyboard_get_scancode_set(void);
 void ps2_keyboard_set_scancode_set(ps2_scancode_set_t set);
 */
 
+// Wire protocol, per port. XT is device-to-host only: two start bits,
+// 8 data bits, no parity, no host commands, scan set 1.
+typedef enum {
+    PS2_PROTOCOL_AT,  // PS/2 (and AT): bidirectional, scan set 2 unless the host picks 1
+    PS2_PROTOCOL_XT
+} ps2_protocol_t;
+
+// XT hosts reset the keyboard by holding CLK low this long
+#ifndef PS2_XT_RESET_MS
+#define PS2_XT_RESET_MS 10
+#endif
+
 // PS/2 State Machine
 typedef enum {
     PS2_STATE_IDLE,
@@ -58,16 +93,59 @@ typedef struct {
 } ps2_led_state_t;
 
 // PS/2 Keyboard Device functions (all renamed)
-void ps2_keyboard_init(uint8_t clk_pin, uint8_t data_pin);
-void ps2_keyboard_task(void);
-bool ps2_keyboard_send_key_make(uint8_t scancode);
-bool ps2_keyboard_send_key_break(uint8_t scancode);
+void ps2_keyboard_init(void);  // All ports, pins from PS2_PORT_CLOCK_PINS / PS2_PORT_DATA_PINS
+void ps2_keyboard_task(void);  // Services every port
+void ps2_keyboard_stop(void);  // Leaving PS/2 mode: PIO state machines stopped, lines released
+void ps2_device_process_host_command(uint8_t cmd);
+
+// Port selection. Each port has its own host driver; keystrokes go to
+// whichever one QMK's host driver is set to.
+host_driver_t *ps2_keyboard_driver(uint8_t port);
+void ps2_keyboard_select_port(uint8_t port);
+uint8_t ps2_keyboard_active_port(void);
+
+// Every port. Call after ps2_keyboard_init(); the host driver changes with
+// it, so set QMK's host driver afterwards.
+void ps2_keyboard_set_protocol(ps2_protocol_t protocol);
+ps2_protocol_t ps2_keyboard_protocol(void);
+
+// These act on the active port
+bool ps2_keyboard_send_sequence(const uint8_t *bytes, uint8_t len);
+uint8_t ps2_keyboard_send_free(void);
+uint32_t ps2_keyboard_queued_total(void);  // Bytes ever queued; wraps
+uint32_t ps2_keyboard_sent_total(void);    // Of those, clocked out; wraps
+
+// Set 2 make or break of a basic keycode (modifiers included), at most
+// PS2_MAX_KEY_SEQUENCE bytes for ps2_keyboard_send_sequence(); 0 if unmapped
+uint8_t ps2_keyboard_encode_keycode(uint8_t keycode, bool pressed, uint8_t *seq);
+uint8_t ps2_keyboard_get_mods(void);  // As the host sees them
+
+// Keys held by the PC's keystroke stream (ps2_stream.c), merged into QMK's
+// report and sent through the same event queue. A modifier the stream
+// releases stays up even while QMK holds it. False if a press found no free
+// report slot. ps2_keyboard_stream_release() lets go of all of them: the
+// queue always has room for the releases.
+bool ps2_keyboard_stream_key(uint8_t keycode, bool pressed);
+void ps2_keyboard_stream_release(void);
+bool ps2_keyboard_events_pending(void);  // Key events not yet in send_buffer
 ps2_led_state_t ps2_keyboard_get_leds(void);
 bool ps2_keyboard_is_enabled(void);
 
 // Typematic functions (renamed)
-void ps2_keyboard_typematic_task(void);
-void ps2_keyboard_typematic_arm(uint16_t keycode, uint8_t scancode);
-void ps2_keyboard_typematic_stop(uint16_t keycode);
-void ps2_keyboard_typematic_disable(void);
+void ps2_keyboard_typematic_disable(void);  // All ports
+
+// Idle scheduling - report pending work / next deadline
+void ps2_keyboard_idle_plan(ps2_idle_plan_t *plan);
+bool ps2_keyboard_busy(void);  // Bytes queued or on the wire, any port
+
+// Warm restart (ps2_warm.h): per-port host settings, held keys, active port.
+// Resume re-creates what the hosts last saw; in PS/2 mode call it after
+// ps2_keyboard_init(). Keys still held go out as releases on the next task.
+void ps2_keyboard_warm_save(ps2_warm_state_t *state);
+void ps2_keyboard_warm_resume(const ps2_warm_state_t *state);
+
+// Persistent settings (ps2_config.h): per-port scan set and typematic,
+// active port. Apply at boot, before any host talks to us.
+void ps2_keyboard_config_save(ps2_config_t *config);
+void ps2_keyboard_config_apply(const ps2_config_t *config);
 #endif // PS2_DEVICE_H
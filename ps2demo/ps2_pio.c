@@ -0,0 +1,101 @@
+// ps2_pio.c - PIO transceiver for the PS/2 lines (PS2_PIO_ENABLE)
+//
+// Set up like QMK's own RP2040 PIO drivers (ws2812, PS/2 host): the
+// pico-sdk hardware_pio API on top of ChibiOS. The program and its
+// settings are in ps2_pio_program.h.
+#include "ps2_pio.h"
+
+#if defined(PS2_PIO_ENABLE) && !defined(PS2_GPIO_SIM)
+
+#    include "quantum.h"
+#    include "print.h"
+#    include "ps2_gpio.h"
+#    include "ps2_keyboard.h"
+#    include "ps2_pio_program.h"
+#    include "hardware/pio.h"
+#    include "hardware/clocks.h"
+
+#    if defined(PS2_PIO_USE_PIO1)
+static const PIO pio = pio1;
+#        define PS2_PIO_PAL_MODE PAL_MODE_ALTERNATE_PIO1
+#        define PS2_PIO_RESET RESETS_ALLREG_PIO1
+#    else
+static const PIO pio = pio0;
+#        define PS2_PIO_PAL_MODE PAL_MODE_ALTERNATE_PIO0
+#        define PS2_PIO_RESET RESETS_ALLREG_PIO0
+#    endif
+
+static const struct pio_program ps2_pio_program_def = {
+    .instructions = ps2_pio_program,
+    .length = PS2_PIO_PROGRAM_LENGTH,
+    .origin = -1,
+};
+
+static int program_offset = -1;
+static int port_sm[PS2_PORT_MAX] = {-1, -1, -1, -1};
+
+bool ps2_pio_init(uint8_t port, pin_t clk_pin, pin_t data_pin) {
+    uint clk = PAL_PAD(clk_pin);
+
+    if (PAL_PAD(data_pin) != clk + 1) {
+        uprintf("[PS2] Port %u: PIO needs DATA on the GPIO after CLK, bit-banging instead\n", port);
+        return false;
+    }
+
+    if (program_offset < 0) {
+        hal_lld_peripheral_unreset(PS2_PIO_RESET);
+        program_offset = pio_add_program(pio, &ps2_pio_program_def);
+    }
+    if (port_sm[port] < 0) {
+        port_sm[port] = pio_claim_unused_sm(pio, false);
+        if (port_sm[port] < 0) {
+            uprintf("[PS2] Port %u: no free PIO state machine, bit-banging instead\n", port);
+            return false;
+        }
+    }
+    uint sm = port_sm[port];
+
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, program_offset + PS2_PIO_WRAP_TARGET, program_offset + PS2_PIO_WRAP);
+    sm_config_set_sideset(&c, PS2_PIO_SIDESET_BITS, false, true);
+    sm_config_set_sideset_pins(&c, clk);
+    sm_config_set_set_pins(&c, clk, 2);
+    sm_config_set_out_pins(&c, clk + 1, 1);
+    sm_config_set_in_pins(&c, clk + 1);
+    sm_config_set_jmp_pin(&c, clk);
+    sm_config_set_out_shift(&c, true, false, 32);
+    sm_config_set_in_shift(&c, true, false, 32);
+    sm_config_set_mov_status(&c, STATUS_TX_LESSTHAN, 1);
+    sm_config_set_clkdiv(&c, (float)clock_get_hz(clk_sys) / PS2_PIO_HZ);
+
+    // Latches low and both lines released before the pads change hands
+    pio_sm_set_pins_with_mask(pio, sm, 0, 3u << clk);
+    pio_sm_set_pindirs_with_mask(pio, sm, 0, 3u << clk);
+    palSetLineMode(clk_pin, PS2_PIO_PAL_MODE | PAL_RP_PAD_PUE);
+    palSetLineMode(data_pin, PS2_PIO_PAL_MODE | PAL_RP_PAD_PUE);
+
+    pio_sm_init(pio, sm, program_offset + PS2_PIO_WRAP_TARGET, &c);
+    pio_sm_set_enabled(pio, sm, true);
+    return true;
+}
+
+void ps2_pio_stop(uint8_t port, pin_t clk_pin, pin_t data_pin) {
+    if (port_sm[port] < 0) return;
+
+    pio_sm_set_enabled(pio, port_sm[port], false);
+    pio_sm_unclaim(pio, port_sm[port]);
+    port_sm[port] = -1;
+    ps2_gpio_init(clk_pin, data_pin);
+}
+
+void ps2_pio_put(uint8_t port, uint32_t word) {
+    pio_sm_put(pio, port_sm[port], word);
+}
+
+bool ps2_pio_get(uint8_t port, uint32_t *word) {
+    if (pio_sm_is_rx_fifo_empty(pio, port_sm[port])) return false;
+    *word = pio_sm_get(pio, port_sm[port]);
+    return true;
+}
+
+#endif
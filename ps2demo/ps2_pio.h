@@ -0,0 +1,60 @@
+// ps2_pio.h - PIO transceiver for the PS/2 lines (PS2_PIO_ENABLE)
+#ifndef PS2_PIO_H
+#define PS2_PIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "gpio.h"
+
+// One state machine per port runs ps2_pio_program (ps2_pio_program.h): it
+// watches for host inhibit and request-to-send, clocks frames out of its TX
+// FIFO and host frames into its RX FIFO, ACK bit included. The CPU queues a
+// byte and collects the outcome a frame later, and bit timing no longer
+// depends on what else the CPU is doing. AT/PS/2 framing only - XT ports
+// stay bit-banged.
+//
+// DATA must be the GPIO right after CLK (the program sets both with one
+// SET, and reaches CLK as the input pin below DATA). Host builds (PS2_GPIO_SIM) get these functions from the harness,
+// which runs the same program in bench/pio_sim.c.
+
+// RX FIFO words
+#define PS2_PIO_SENT 0xFFFFFFFFu  // The queued byte went out
+#define PS2_PIO_ABORTED 2u        // Host inhibited mid-frame (ours, or its own)
+// Anything else is a host frame: bits 22..31 = 8 data, parity, stop
+
+// Claim port `port`'s state machine and hand it the pins, loading the
+// program on first use. Starts with empty FIFOs. False if the pins don't
+// fit or no state machine is free - the port stays bit-banged.
+bool ps2_pio_init(uint8_t port, pin_t clk_pin, pin_t data_pin);
+
+// Stop the state machine and free it; the pins go back to SIO (ps2_gpio.h)
+void ps2_pio_stop(uint8_t port, pin_t clk_pin, pin_t data_pin);
+
+// Queue one frame word (ps2_pio_tx_word). The caller waits for its
+// SENT/ABORTED before queueing another, so the FIFO never fills.
+void ps2_pio_put(uint8_t port, uint32_t word);
+
+// Next RX FIFO word, if any
+bool ps2_pio_get(uint8_t port, uint32_t *word);
+
+// Device frame for `data`, LSB first, inverted - each bit is a pindir, and
+// 1 pulls DATA low: start, 8 data bits, odd parity, stop
+static inline uint32_t ps2_pio_tx_word(uint8_t data) {
+    uint32_t parity = !__builtin_parity(data);
+    uint32_t frame = ((uint32_t)data << 1) | (parity << 9) | (1u << 10);
+    return ~frame & 0x7FF;
+}
+
+static inline uint8_t ps2_pio_rx_data(uint32_t word) {
+    return (word >> 22) & 0xFF;
+}
+
+static inline bool ps2_pio_rx_parity_ok(uint32_t word) {
+    return __builtin_parity(word >> 22 & 0x1FF);  // Data + parity: odd
+}
+
+static inline bool ps2_pio_rx_stop_ok(uint32_t word) {
+    return word >> 31;
+}
+
+#endif // PS2_PIO_H
@@ -0,0 +1,109 @@
+// ps2_pio_program.h - PS/2 device-side transceiver, as a PIO program
+//
+// Machine code plus the state machine settings it assumes. Shared by the
+// firmware (ps2_pio.c) and the host-side interpreter (bench/pio_sim.c), so
+// both run exactly these words. Encoded by hand from the source below, in
+// the layout pioasm would give; keep the two in step.
+//
+//   .program ps2_device
+//   .side_set 1 pindirs              ; CLK: 1 pulls it low
+//   ; SET pins: CLK, DATA   OUT/IN pins: DATA   JMP pin: CLK
+//   ; MOV STATUS: all ones while the TX FIFO is empty
+//   ; Both output latches are 0: a pindir of 1 pulls the line low.
+//
+//   .wrap_target
+//   idle:
+//    0     wait 1 pin 31        side 0 [9]  ; CLK (the pin below DATA) high, then 50us
+//    1     jmp pin, clk_high    side 0
+//    2     jmp idle             side 0      ; Inhibited again meanwhile
+//   clk_high:
+//    3     mov osr, pins        side 0
+//    4     out y, 1             side 0      ; DATA
+//    5     jmp !y, host_rts     side 0      ; CLK high, DATA low: request to send
+//    6     mov y, status        side 0
+//    7     jmp y--, idle        side 0      ; Nothing to send (y wraps to ~0 = SENT below)
+//   send:
+//    8     pull block           side 0      ; Frame word, see ps2_pio_tx_word()
+//    9     set x, 10            side 0      ; Start, 8 data, parity, stop
+//   txbit:
+//   10     out pindirs, 1       side 0 [4]  ; Next bit, 25us before CLK falls
+//   11     nop                  side 1 [9]  ; CLK low 50us
+//   12     jmp x--, tx_check    side 0 [3]  ; CLK high 50us, next bit halfway
+//   13     jmp report_y         side 0      ; Stop bit out: the byte counts as sent
+//   tx_check:
+//   14     jmp pin, txbit       side 0      ; CLK held low after release: inhibit
+//   abort:
+//   15     set y, 2             side 0      ; PS2_PIO_ABORTED
+//   report_y:
+//   16     mov isr, y           side 0
+//   release:
+//   17     set pindirs, 0       side 0      ; Let go of DATA (and CLK)
+//   18     push block           side 0
+//   19     set x, 31            side 0
+//   gap:
+//   20     jmp x--, gap         side 0 [1]  ; 320us of idle bus between frames
+//   .wrap
+//   host_rts:
+//   21     set x, 9             side 0      ; 8 data, parity, stop (the start
+//                                           ; bit is the request to send)
+//   rxbit:
+//   22     nop                  side 1 [9]  ; CLK low 50us: host sets DATA
+//   23     nop                  side 0 [4]
+//   24     in pins, 1           side 0 [2]  ; Sample 25us into the high phase
+//   25     jmp pin, rx_next     side 0
+//   26     jmp abort            side 0
+//   rx_next:
+//   27     jmp x--, rxbit       side 0
+//   28     set pindirs, 2       side 1 [9]  ; ACK on clock 11: DATA and CLK low 50us
+//   29     jmp release          side 0 [9]  ; CLK high 50us, then DATA
+//
+// At PS2_PIO_HZ (one cycle = 5us) the device clock is 50us low, 50us high:
+// 10kHz both ways, the bit-banged PS2_CLK_HALF_PERIOD. A host frame is 11
+// clocks: the host moves DATA to D0 on the first fall, so bits are sampled
+// on clocks 1-10 and the ACK goes out on clock 11.
+#ifndef PS2_PIO_PROGRAM_H
+#define PS2_PIO_PROGRAM_H
+
+#include <stdint.h>
+
+#define PS2_PIO_HZ 200000  // State machine clock: 5us per instruction cycle
+
+#define PS2_PIO_PROGRAM_LENGTH 30
+#define PS2_PIO_WRAP_TARGET 0
+#define PS2_PIO_WRAP 20
+#define PS2_PIO_SIDESET_BITS 1  // Not optional, drives pindirs
+
+static const uint16_t ps2_pio_program[PS2_PIO_PROGRAM_LENGTH] = {
+    0x29bf,  //  0: wait   1 pin, 31       side 0 [9]
+    0x00c3,  //  1: jmp    pin, 3          side 0
+    0x0000,  //  2: jmp    0               side 0
+    0xa0e0,  //  3: mov    osr, pins       side 0
+    0x6041,  //  4: out    y, 1            side 0
+    0x0075,  //  5: jmp    !y, 21          side 0
+    0xa045,  //  6: mov    y, status       side 0
+    0x0080,  //  7: jmp    y--, 0          side 0
+    0x80a0,  //  8: pull   block           side 0
+    0xe02a,  //  9: set    x, 10           side 0
+    0x6481,  // 10: out    pindirs, 1      side 0 [4]
+    0xb942,  // 11: nop                    side 1 [9]
+    0x034e,  // 12: jmp    x--, 14         side 0 [3]
+    0x0010,  // 13: jmp    16              side 0
+    0x00ca,  // 14: jmp    pin, 10         side 0
+    0xe042,  // 15: set    y, 2            side 0
+    0xa0c2,  // 16: mov    isr, y          side 0
+    0xe080,  // 17: set    pindirs, 0      side 0
+    0x8020,  // 18: push   block           side 0
+    0xe03f,  // 19: set    x, 31           side 0
+    0x0154,  // 20: jmp    x--, 20         side 0 [1]
+    0xe029,  // 21: set    x, 9            side 0
+    0xb942,  // 22: nop                    side 1 [9]
+    0xa442,  // 23: nop                    side 0 [4]
+    0x4201,  // 24: in     pins, 1         side 0 [2]
+    0x00db,  // 25: jmp    pin, 27         side 0
+    0x000f,  // 26: jmp    15              side 0
+    0x0056,  // 27: jmp    x--, 22         side 0
+    0xf982,  // 28: set    pindirs, 2      side 1 [9]
+    0x0911,  // 29: jmp    17              side 0 [9]
+};
+
+#endif // PS2_PIO_PROGRAM_H
@@ -0,0 +1,86 @@
+// ps2_profile.c - Hot-path probe storage and console dump
+#include "ps2_profile.h"
+#include "ps2_flight.h"
+#include "ps2_keyboard.h"
+#include "ps2_stats.h"
+#include "print.h"
+
+#ifdef PS2_PROFILE_ENABLE
+
+ps2_probe_t ps2_probes[PS2_PROBE_COUNT];
+
+static const char *const ps2_probe_names[PS2_PROBE_COUNT] = {
+    [PS2_PROBE_SEND_KEYBOARD]   = "send_keyboard",
+    [PS2_PROBE_SEND_EXTRA]      = "send_extra",
+    [PS2_PROBE_QMK_TO_PS2]      = "qmk_to_ps2",
+    [PS2_PROBE_CONSUMER_TO_PS2] = "consumer_to_ps2",
+    [PS2_PROBE_SEND_BYTE]       = "send_byte",
+    [PS2_PROBE_KEYBOARD_TASK]   = "keyboard_task",
+    [PS2_PROBE_HOUSEKEEPING]    = "housekeeping",
+    [PS2_PROBE_MATRIX_SCAN]     = "matrix_scan",
+    [PS2_PROBE_TYPEMATIC]       = "typematic",
+};
+
+// Ticks to ns, saturating
+static uint32_t ps2_profile_ns(uint64_t ticks) {
+    uint64_t ns = ticks * 1000 / PS2_PROFILE_TICKS_PER_US;
+    return ns > UINT32_MAX ? UINT32_MAX : ns;
+}
+
+#ifdef PS2_WCET_ASSERT
+#    define PS2_WCET_TICKS(us) ((uint32_t)(us) * PS2_PROFILE_TICKS_PER_US)
+#    define PS2_WCET_NONE UINT32_MAX
+
+// The host-driver callbacks and the main loop passes; the rest are parts of
+// those and are only timed
+const uint32_t ps2_probe_budgets[PS2_PROBE_COUNT] = {
+    [PS2_PROBE_SEND_KEYBOARD]   = PS2_WCET_TICKS(PS2_WCET_SEND_KEYBOARD_US),
+    [PS2_PROBE_SEND_EXTRA]      = PS2_WCET_TICKS(PS2_WCET_SEND_EXTRA_US),
+    [PS2_PROBE_QMK_TO_PS2]      = PS2_WCET_NONE,
+    [PS2_PROBE_CONSUMER_TO_PS2] = PS2_WCET_NONE,
+    [PS2_PROBE_SEND_BYTE]       = PS2_WCET_NONE,
+    [PS2_PROBE_KEYBOARD_TASK]   = PS2_WCET_TICKS(PS2_WCET_KEYBOARD_TASK_US),
+    [PS2_PROBE_HOUSEKEEPING]    = PS2_WCET_TICKS(PS2_WCET_HOUSEKEEPING_US),
+    [PS2_PROBE_MATRIX_SCAN]     = PS2_WCET_NONE,
+    [PS2_PROBE_TYPEMATIC]       = PS2_WCET_TICKS(PS2_WCET_TYPEMATIC_US),
+};
+
+void ps2_wcet_overrun(ps2_probe_id_t id, uint32_t ticks) {
+    PS2_STAT_INC(PS2_STAT_WCET_OVERRUNS);
+    ps2_flight_freeze(PS2_FLIGHT_WCET_OVERRUN);
+    uprintf("[PROF] WCET overrun: %s took %lu ns, budget %lu ns\n", ps2_probe_names[id],
+            ps2_profile_ns(ticks), ps2_profile_ns(ps2_probe_budgets[id]));
+}
+#endif
+
+bool ps2_profile_print(void) {
+    uprintf("[PROF] ---- hot path, %u tick(s)/us ----\n", PS2_PROFILE_TICKS_PER_US);
+    uprintf("[PROF] %-16s %10s %10s %10s %10s %12s\n", "probe", "calls", "min_ns", "mean_ns", "max_ns", "total_us");
+    for (uint8_t i = 0; i < PS2_PROBE_COUNT; i++) {
+        const ps2_probe_t *probe = &ps2_probes[i];
+        uint64_t mean = probe->count ? probe->total / probe->count : 0;
+        uprintf("[PROF] %-16s %10lu %10lu %10lu %10lu %12lu\n", ps2_probe_names[i], probe->count,
+                ps2_profile_ns(probe->min), ps2_profile_ns(mean), ps2_profile_ns(probe->max),
+                (uint32_t)(probe->total / PS2_PROFILE_TICKS_PER_US));
+    }
+    return true;
+}
+
+bool ps2_profile_reset(void) {
+    for (uint8_t i = 0; i < PS2_PROBE_COUNT; i++) {
+        ps2_probes[i] = (ps2_probe_t){0};
+    }
+    return true;
+}
+
+#else
+
+bool ps2_profile_print(void) {
+    return false;
+}
+
+bool ps2_profile_reset(void) {
+    return false;
+}
+
+#endif
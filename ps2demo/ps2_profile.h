@@ -0,0 +1,127 @@
+// ps2_profile.h
+#ifndef PS2_PROFILE_H
+#define PS2_PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Hot-path profiler. PS2_PROBE(id) at the top of a scope times it to the
+// end of the scope (every return path included) and folds the result into
+// that probe's count/min/max/total. Define PS2_PROFILE_ENABLE in config.h
+// to build it in; without it the probes compile to nothing.
+//
+// PS2_WCET_ASSERT (debug builds) adds a worst-case budget to the callbacks
+// QMK's main loop runs: a probe that overruns its budget counts a
+// wcet_overruns stat, freezes the flight recorder on the traffic that led
+// up to it and logs the probe. It turns the profiler on.
+//
+// Time source: the Cortex-M0+ has no cycle counter (no DWT), so on the
+// RP2040 probes read the 1MHz system timer - 1us resolution, one bus read
+// per edge. Host builds (PS2_GPIO_SIM) use CLOCK_MONOTONIC in ns behind
+// the same macros, so a simulated run produces the same table.
+
+// Probe IDs - also the order of the dump
+typedef enum {
+    PS2_PROBE_SEND_KEYBOARD,   // ps2_send_keyboard: report -> events -> send_buffer
+    PS2_PROBE_SEND_EXTRA,      // ps2_send_extra
+    PS2_PROBE_QMK_TO_PS2,      // qmk_to_ps2_scancode
+    PS2_PROBE_CONSUMER_TO_PS2, // consumer_to_ps2_scancode
+    PS2_PROBE_SEND_BYTE,       // ps2_send_byte: one frame on the wire
+    PS2_PROBE_KEYBOARD_TASK,   // ps2_keyboard_task: every port, one pass
+    PS2_PROBE_HOUSEKEEPING,    // housekeeping_task_kb, idle sleep excluded
+    PS2_PROBE_MATRIX_SCAN,     // matrix_scan_custom: one full pass (skipped scans not counted)
+    PS2_PROBE_TYPEMATIC,       // ps2_typematic_fire: one repeat
+    PS2_PROBE_COUNT
+} ps2_probe_id_t;
+
+// WCET budgets in us: bench/wcet_check.c's worst cases, CPU part scaled to
+// the Cortex-M0+, with headroom (ps2_profile.c). keyboard_task and
+// housekeeping are mostly wire: on each port a host command clocked in
+// (1.2ms) and the ACK clocked out (3.7ms) in the same pass.
+#ifndef PS2_WCET_SEND_KEYBOARD_US
+#    define PS2_WCET_SEND_KEYBOARD_US 600
+#endif
+#ifndef PS2_WCET_SEND_EXTRA_US
+#    define PS2_WCET_SEND_EXTRA_US 250
+#endif
+#ifndef PS2_WCET_TYPEMATIC_US
+#    define PS2_WCET_TYPEMATIC_US 80
+#endif
+#ifndef PS2_WCET_KEYBOARD_TASK_US
+#    define PS2_WCET_KEYBOARD_TASK_US (PS2_PORT_COUNT * 5000 + 300)
+#endif
+#ifndef PS2_WCET_HOUSEKEEPING_US
+#    define PS2_WCET_HOUSEKEEPING_US (PS2_WCET_KEYBOARD_TASK_US + 700)
+#endif
+
+#if defined(PS2_WCET_ASSERT) && !defined(PS2_PROFILE_ENABLE)
+#    define PS2_PROFILE_ENABLE
+#endif
+
+#ifdef PS2_PROFILE_ENABLE
+
+#    if defined(PS2_GPIO_SIM)
+#        include <time.h>
+#        define PS2_PROFILE_TICKS_PER_US 1000
+static inline uint32_t ps2_profile_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec * 1000000000u + ts.tv_nsec;  // Wraps; only differences matter
+}
+#    else
+#        include "ps2_time.h"
+#        define PS2_PROFILE_TICKS_PER_US 1
+static inline uint32_t ps2_profile_now(void) {
+    return ps2_micros();
+}
+#    endif
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;    // Ticks
+    uint32_t max;
+    uint64_t total;
+} ps2_probe_t;
+
+extern ps2_probe_t ps2_probes[PS2_PROBE_COUNT];
+
+#    ifdef PS2_WCET_ASSERT
+extern const uint32_t ps2_probe_budgets[PS2_PROBE_COUNT];  // Ticks, UINT32_MAX = none
+
+// Out of line: only an overrun pays for the logging
+void ps2_wcet_overrun(ps2_probe_id_t id, uint32_t ticks);
+#    endif
+
+typedef struct {
+    ps2_probe_id_t id;
+    uint32_t start;
+} ps2_probe_scope_t;
+
+// Inline, so a probe in a PS2_RAM_FUNC doesn't call out to flash
+static inline void ps2_probe_exit(ps2_probe_scope_t *scope) {
+    uint32_t ticks = ps2_profile_now() - scope->start;
+    ps2_probe_t *probe = &ps2_probes[scope->id];
+
+    if (probe->count == 0 || ticks < probe->min) probe->min = ticks;
+    if (ticks > probe->max) probe->max = ticks;
+    probe->total += ticks;
+    probe->count++;
+#    ifdef PS2_WCET_ASSERT
+    if (ticks > ps2_probe_budgets[scope->id]) ps2_wcet_overrun(scope->id, ticks);
+#    endif
+}
+
+#    define PS2_PROBE(id) \
+        ps2_probe_scope_t ps2_probe_scope __attribute__((cleanup(ps2_probe_exit), unused)) = {(id), ps2_profile_now()}
+
+#else
+
+#    define PS2_PROBE(id) ((void)0)
+
+#endif
+
+// Dump to the console / clear. Report false if profiling isn't built in.
+bool ps2_profile_print(void);
+bool ps2_profile_reset(void);
+
+#endif // PS2_PROFILE_H
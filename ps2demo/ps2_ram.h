@@ -0,0 +1,38 @@
+// ps2_ram.h - Keep the bit-level PS/2 path out of XIP flash
+//
+// On the RP2040, code and const data normally execute/load from QSPI flash
+// through a 16KB XIP cache, and a cache miss in the middle of a clock phase
+// stretches it by microseconds. QMK's RP2040 linker script copies
+// .time_critical.* sections into SRAM at startup (the same sections as the
+// pico-sdk's __not_in_flash_func), so anything tagged here runs from RAM.
+//
+// PS2_FLASH_FUNC keeps a function a RAM function calls out of line, so it
+// stays in flash: for work done once the frame is over, like error prints,
+// that would otherwise be inlined into the SRAM copy.
+//
+// Define PS2_NO_RAM_PLACEMENT to leave everything in flash (for comparing
+// frame_us_min/frame_us_max with and without; bench/ram_check.py checks
+// both builds).
+//
+// PS2_NOINIT puts data in ChibiOS's .ram0 section, which startup neither
+// loads nor clears, so it survives a watchdog or soft reset (ps2_warm.c).
+#ifndef PS2_RAM_H
+#define PS2_RAM_H
+
+#if defined(MCU_RP) && !defined(PS2_NO_RAM_PLACEMENT)
+#    define PS2_RAM_FUNC(name) __attribute__((section(".time_critical." #name), noinline)) name
+#    define PS2_RAM_DATA(name) __attribute__((section(".time_critical." #name))) name
+#    define PS2_FLASH_FUNC(name) __attribute__((noinline)) name
+#else
+#    define PS2_RAM_FUNC(name) name
+#    define PS2_RAM_DATA(name) name
+#    define PS2_FLASH_FUNC(name) name
+#endif
+
+#if defined(MCU_RP)
+#    define PS2_NOINIT(name) __attribute__((section(".ram0"))) name
+#else
+#    define PS2_NOINIT(name) name
+#endif
+
+#endif // PS2_RAM_H
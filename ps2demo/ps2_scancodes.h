@@ -5,6 +5,7 @@
 
 #include <stdint.h>
 #include "quantum.h"  // For QMK keycodes
+#include "ps2_ram.h"
 
 // Forward declare the mapping type (defined in ps2_keyboard.h)
 typedef enum {
@@ -13,12 +14,15 @@ typedef enum {
     PS2_KEY_PAUSE
 } ps2_special_key_type_t;
 
+// Packed to 2 bytes: scancode, then E0 flag and special type as bit fields
 typedef struct {
     uint8_t scancode;
-    bool needs_e0_prefix;
-    ps2_special_key_type_t special_type;
+    uint8_t needs_e0_prefix : 1;
+    uint8_t special_type    : 2;  // ps2_special_key_type_t
 } ps2_mapping_t;
 
+_Static_assert(sizeof(ps2_mapping_t) == 2, "ps2_mapping_t must stay packed");
+
 // PS/2 Scan Code Set 2 - Standard Keys
 // Make codes only (break = 0xF0 + make code)
 #define PS2_A             0x1C
@@ -207,8 +211,9 @@ typedef struct {
 // LOOKUP TABLES
 // =============================================================================
 
-// Main lookup table for basic keycodes (0x00-0xFF)
-static const ps2_mapping_t ps2_scancode_lookup[] = {
+// Main lookup table for basic keycodes (0x00-0xFF). Hit on every key event,
+// so it lives in SRAM.
+static const ps2_mapping_t PS2_RAM_DATA(ps2_scancode_lookup)[] = {
     // Letters (0x04-0x1D)
     [KC_A] = {PS2_A, false, PS2_KEY_NORMAL},
     [KC_B] = {PS2_B, false, PS2_KEY_NORMAL},
@@ -424,9 +429,38 @@ static const struct {
     {0x0194, {PS2_APP_MYCOMP, true, PS2_KEY_NORMAL}},    // My Computer
 };
 
+// SYSTEM CONTROL USAGE CODES TO PS/2 MAPPING (ACPI power keys)
+// Usages come through in report_extra_t with REPORT_ID_SYSTEM
+static const struct {
+    uint16_t usage_code;  // USB HID Generic Desktop System Control usage
+    ps2_mapping_t mapping;
+} ps2_system_mappings[] = {
+    {0x0081, {PS2_POWER, true, PS2_KEY_NORMAL}},  // System Power Down
+    {0x0082, {PS2_SLEEP, true, PS2_KEY_NORMAL}},  // System Sleep
+    {0x0083, {PS2_WAKE, true, PS2_KEY_NORMAL}},   // System Wake Up
+};
+
+// SET 2 TO SET 1 TRANSLATION (the i8042 controller's table)
+// Set 1 is generated from the set 2 sequences above rather than kept as a
+// second set of tables: E0/E1 pass through, F0 xx becomes xx|0x80.
+// PS2_F7 (0x83) is the one set 2 make code above 0x7F.
+#define PS2_SET1_F7 0x41
+
+static const uint8_t ps2_set1_translation[128] = {
+    0xFF, 0x43, 0x41, 0x3F, 0x3D, 0x3B, 0x3C, 0x58, 0x64, 0x44, 0x42, 0x40, 0x3E, 0x0F, 0x29, 0x59,  // 0x00
+    0x65, 0x38, 0x2A, 0x70, 0x1D, 0x10, 0x02, 0x5A, 0x66, 0x71, 0x2C, 0x1F, 0x1E, 0x11, 0x03, 0x5B,  // 0x10
+    0x67, 0x2E, 0x2D, 0x20, 0x12, 0x05, 0x04, 0x5C, 0x68, 0x39, 0x2F, 0x21, 0x14, 0x13, 0x06, 0x5D,  // 0x20
+    0x69, 0x31, 0x30, 0x23, 0x22, 0x15, 0x07, 0x5E, 0x6A, 0x72, 0x32, 0x24, 0x16, 0x08, 0x09, 0x5F,  // 0x30
+    0x6B, 0x33, 0x25, 0x17, 0x18, 0x0B, 0x0A, 0x60, 0x6C, 0x34, 0x35, 0x26, 0x27, 0x19, 0x0C, 0x61,  // 0x40
+    0x6D, 0x73, 0x28, 0x74, 0x1A, 0x0D, 0x62, 0x6E, 0x3A, 0x36, 0x1C, 0x1B, 0x75, 0x2B, 0x63, 0x76,  // 0x50
+    0x55, 0x56, 0x77, 0x78, 0x79, 0x7A, 0x0E, 0x7B, 0x7C, 0x4F, 0x7D, 0x4B, 0x47, 0x7E, 0x7F, 0x6F,  // 0x60
+    0x52, 0x53, 0x50, 0x4C, 0x4D, 0x48, 0x01, 0x45, 0x57, 0x4E, 0x51, 0x4A, 0x37, 0x49, 0x46, 0x54,  // 0x70
+};
+
 // Size definitions for lookup tables
 #define PS2_SCANCODE_LOOKUP_SIZE (sizeof(ps2_scancode_lookup) / sizeof(ps2_scancode_lookup[0]))
 #define PS2_EXTENDED_KEYS_SIZE (sizeof(ps2_extended_keys) / sizeof(ps2_extended_keys[0]))
 #define PS2_CONSUMER_MAPPINGS_SIZE (sizeof(ps2_consumer_mappings) / sizeof(ps2_consumer_mappings[0]))
+#define PS2_SYSTEM_MAPPINGS_SIZE (sizeof(ps2_system_mappings) / sizeof(ps2_system_mappings[0]))
 
 #endif // PS2_SCANCODES_H
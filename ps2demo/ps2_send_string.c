@@ -0,0 +1,143 @@
+// ps2_send_string.c - Paced text injection over PS/2
+#include "ps2_send_string.h"
+#include "ps2_keyboard.h"
+#include "quantum.h"
+#include "send_string.h"  // ascii_to_keycode_lut / ascii_to_shift_lut
+
+static struct {
+    const char *str;        // Next character to type
+    bool progmem;           // str points into flash
+    bool active;
+    bool shift;             // Left Shift state as the host sees it
+    bool mods_shift;        // ...as the event queue last sent it (the user's)
+    uint32_t chars;         // Characters typed so far
+    uint32_t start_time;
+} inject = {0};
+
+static char ps2_send_string_peek(void) {
+    return inject.progmem ? (char)pgm_read_byte(inject.str) : *inject.str;
+}
+
+static bool ps2_send_string_start(const char *str, bool progmem) {
+    if (inject.active) {
+        uprintf("[PS2] send_string busy, ignoring new string\n");
+        return false;
+    }
+
+    inject.str = str;
+    inject.progmem = progmem;
+    inject.active = true;
+    inject.mods_shift = ps2_keyboard_get_mods() & MOD_BIT(KC_LSFT);
+    inject.shift = inject.mods_shift;
+    inject.chars = 0;
+    inject.start_time = timer_read32();
+    return true;
+}
+
+bool ps2_send_string(const char *str) {
+    return ps2_send_string_start(str, false);
+}
+
+bool ps2_send_string_P(const char *str) {
+    return ps2_send_string_start(str, true);
+}
+
+// The event queue sends Left Shift too, when the user presses or lets go
+// of it mid-string. Whatever it sent last is what the host has now.
+static void ps2_send_string_reconcile(void) {
+    bool mods_shift = ps2_keyboard_get_mods() & MOD_BIT(KC_LSFT);
+
+    if (mods_shift != inject.mods_shift) {
+        inject.mods_shift = mods_shift;
+        inject.shift = mods_shift;
+    }
+}
+
+void ps2_send_string_cancel(void) {
+    if (!inject.active) return;
+
+    // Give the user's Shift back if it fits; the port is being left anyway
+    uint8_t seq[2];
+    ps2_send_string_reconcile();
+    if (ps2_keyboard_send_free() >= 2) {
+        uint8_t len = ps2_send_string_shift(seq, &inject.shift, inject.mods_shift);
+        ps2_keyboard_send_sequence(seq, len);
+    }
+    inject.active = false;
+}
+
+bool ps2_send_string_busy(void) {
+    return inject.active;
+}
+
+uint8_t ps2_send_string_shift(uint8_t *seq, bool *shift, bool want) {
+    if (*shift == want) return 0;
+
+    *shift = want;
+    if (want) {
+        seq[0] = PS2_LSHIFT;
+        return 1;
+    }
+    seq[0] = PS2_PREFIX_F0;
+    seq[1] = PS2_LSHIFT;
+    return 2;
+}
+
+uint8_t ps2_send_string_encode(uint8_t c, bool *shift, uint8_t *seq) {
+    if (c >= 0x80) return 0;  // Not ASCII
+
+    uint8_t keycode = pgm_read_byte(&ascii_to_keycode_lut[c]);
+    if (keycode == KC_NO) return 0;
+
+    ps2_mapping_t mapping = qmk_to_ps2_scancode(keycode);
+    if (mapping.scancode == 0 || mapping.special_type != PS2_KEY_NORMAL) return 0;
+
+    bool shifted = (pgm_read_byte(&ascii_to_shift_lut[c / 8]) >> (c % 8)) & 1;
+
+    uint8_t len = ps2_send_string_shift(seq, shift, shifted);
+    if (mapping.needs_e0_prefix) seq[len++] = PS2_PREFIX_E0;
+    seq[len++] = mapping.scancode;
+    if (mapping.needs_e0_prefix) seq[len++] = PS2_PREFIX_E0;
+    seq[len++] = PS2_PREFIX_F0;
+    seq[len++] = mapping.scancode;
+    return len;
+}
+
+static void ps2_send_string_finish(void) {
+    // Only called with room for a whole character, so this always fits.
+    // Shift goes back to what the user holds now, not at the start.
+    uint8_t seq[2];
+    ps2_send_string_reconcile();
+    uint8_t len = ps2_send_string_shift(seq, &inject.shift, inject.mods_shift);
+    ps2_keyboard_send_sequence(seq, len);
+
+    uint32_t elapsed = timer_elapsed32(inject.start_time);
+    uprintf("[PS2] send_string done: %lu chars in %lu ms (%lu chars/s)\n",
+            inject.chars, elapsed, elapsed ? inject.chars * 1000 / elapsed : 0);
+    inject.active = false;
+}
+
+void ps2_send_string_task(void) {
+    if (!inject.active || !ps2_keyboard_is_enabled()) return;
+
+    // Top the queue up as far as it goes. Generating only when a whole
+    // character fits keeps us at exactly the rate the wire drains.
+    while (ps2_keyboard_send_free() >= PS2_SEND_STRING_MAX_SEQ + PS2_SEND_STRING_RESERVE) {
+        uint8_t c = (uint8_t)ps2_send_string_peek();
+
+        if (c == 0) {
+            ps2_send_string_finish();
+            return;
+        }
+
+        inject.str++;
+
+        uint8_t seq[PS2_SEND_STRING_MAX_SEQ];
+        ps2_send_string_reconcile();
+        uint8_t len = ps2_send_string_encode(c, &inject.shift, seq);
+        if (len == 0) continue;
+
+        ps2_keyboard_send_sequence(seq, len);
+        inject.chars++;
+    }
+}
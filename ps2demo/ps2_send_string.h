@@ -0,0 +1,36 @@
+// ps2_send_string.h
+#ifndef PS2_SEND_STRING_H
+#define PS2_SEND_STRING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Bytes of send_buffer left free for real key events while a string is
+// being typed, so the physical keys never get dropped
+#ifndef PS2_SEND_STRING_RESERVE
+#define PS2_SEND_STRING_RESERVE 8
+#endif
+
+// Worst case per character: shift toggle (F0 12) + E0 make + E0 F0 break
+#define PS2_SEND_STRING_MAX_SEQ 7
+
+// Streaming text injection. Unlike QMK's SEND_STRING (one report per
+// keystroke, all at once), make/break bytes are generated lazily as
+// send_buffer drains, so arbitrarily long strings go out with no drops.
+// The string must stay valid until ps2_send_string_busy() returns false.
+bool ps2_send_string(const char *str);
+bool ps2_send_string_P(const char *str);  // PROGMEM string
+void ps2_send_string_cancel(void);
+bool ps2_send_string_busy(void);
+void ps2_send_string_task(void);
+
+// The set 2 bytes that type ASCII `c` (make and break), given whether Left
+// Shift is down on the wire; *shift is updated. At most
+// PS2_SEND_STRING_MAX_SEQ bytes, 0 if `c` has no key. Shared with
+// ps2_stream.c.
+uint8_t ps2_send_string_encode(uint8_t c, bool *shift, uint8_t *seq);
+
+// Left Shift make/break bringing *shift to `want`, 0-2 bytes
+uint8_t ps2_send_string_shift(uint8_t *seq, bool *shift, bool want);
+
+#endif // PS2_SEND_STRING_H
@@ -0,0 +1,229 @@
+// ps2_sniff.c - Passive PS/2 bus sniffer
+//
+// Both directions are told apart by what happens before the first clock:
+//   device-to-host: DATA goes low (start bit), then the device clocks 11
+//                   falling edges; bits are valid on the falling edge
+//   host-to-device: the host holds CLK low (>100us), pulls DATA low and
+//                   releases CLK; the device clocks, bits are valid on the
+//                   rising edge, and it ACKs by holding DATA low on clock 11
+// Edges come from a PAL interrupt on CLK, so a missed edge shows up as a
+// parity/framing error rather than a stalled decoder.
+#include "ps2_sniff.h"
+#include "ps2_bridge.h"
+#include "ps2_hid.h"
+#include "ps2_stats.h"
+#include "ps2_time.h"
+#include "ps2_gpio.h"
+#include "kb.h"
+#include "quantum.h"
+#include "raw_hid.h"
+
+#if defined(PROTOCOL_CHIBIOS)
+#    include <ch.h>
+#    include <hal.h>
+#endif
+
+_Static_assert((PS2_SNIFF_QUEUE_SIZE & (PS2_SNIFF_QUEUE_SIZE - 1)) == 0, "PS2_SNIFF_QUEUE_SIZE must be a power of two");
+_Static_assert(PS2_SNIFF_HEADER + PS2_SNIFF_FRAMES_PER_REPORT * sizeof(ps2_sniff_frame_t) <= RAW_EPSIZE, "sniff report too big");
+
+// =============================================================================
+// DECODER (pure logic, runs in the edge ISR)
+// =============================================================================
+
+typedef enum {
+    SNIFF_IDLE,
+    SNIFF_DEVICE,  // Device-to-host frame in progress
+    SNIFF_HOST     // Host-to-device frame in progress
+} sniff_state_t;
+
+static struct {
+    sniff_state_t state;
+    bool clk;
+    uint8_t bits;       // Bits collected after the start bit
+    uint16_t shift;     // D0-D7, parity, stop
+    uint32_t start_us;
+    uint32_t fall_us;   // Last falling edge, for inhibit detection
+    uint32_t last_us;   // Last edge of any kind
+} sniff = {.clk = true};
+
+static ps2_sniff_frame_t queue[PS2_SNIFF_QUEUE_SIZE];
+static volatile uint8_t queue_head = 0;  // Written by the ISR
+static volatile uint8_t queue_tail = 0;  // Written by the main loop
+static volatile uint16_t queue_drops = 0;
+
+static void sniff_finish(uint32_t now_us, uint8_t flags) {
+    uint8_t data = sniff.shift & 0xFF;
+
+    if (!(flags & PS2_SNIFF_ABORTED)) {
+        bool parity = (sniff.shift >> 8) & 1;
+        if ((__builtin_popcount(data) + parity) % 2 == 0) flags |= PS2_SNIFF_PARITY_ERR;
+        if (!((sniff.shift >> 9) & 1)) flags |= PS2_SNIFF_FRAMING_ERR;
+    }
+    if (sniff.state == SNIFF_HOST) flags |= PS2_SNIFF_FROM_HOST;
+
+    uint8_t next = (queue_head + 1) & (PS2_SNIFF_QUEUE_SIZE - 1);
+    if (next == queue_tail) {
+        queue_drops++;
+        PS2_STAT_INC(PS2_STAT_SNIFF_DROPS);
+    } else {
+        uint32_t duration = now_us - sniff.start_us;
+        queue[queue_head] = (ps2_sniff_frame_t){
+            .start_us = sniff.start_us,
+            .duration_us = duration > 0xFFFF ? 0xFFFF : duration,
+            .data = data,
+            .flags = flags,
+        };
+        queue_head = next;
+        PS2_STAT_INC(PS2_STAT_SNIFF_FRAMES);
+    }
+    sniff.state = SNIFF_IDLE;
+}
+
+static void sniff_begin(sniff_state_t state, uint32_t now_us) {
+    sniff.state = state;
+    sniff.bits = 0;
+    sniff.shift = 0;
+    sniff.start_us = now_us;
+}
+
+static void sniff_collect(bool data) {
+    sniff.shift |= (uint16_t)data << sniff.bits;
+    sniff.bits++;
+}
+
+void ps2_sniff_edge(bool clk, bool data, uint32_t now_us) {
+    if (clk == sniff.clk) return;  // Two edges merged into one interrupt
+    sniff.clk = clk;
+
+    if (sniff.state != SNIFF_IDLE) {
+        bool waiting = sniff.state == SNIFF_HOST && sniff.bits == 0;
+        uint32_t limit = waiting ? PS2_SNIFF_RTS_TIMEOUT_US : PS2_SNIFF_BIT_TIMEOUT_US;
+        if (now_us - sniff.last_us > limit) {
+            sniff_finish(sniff.last_us, PS2_SNIFF_ABORTED);
+        }
+    }
+    sniff.last_us = now_us;
+
+    if (!clk) {
+        sniff.fall_us = now_us;
+
+        switch (sniff.state) {
+            case SNIFF_IDLE:
+                // DATA already low: a device start bit. DATA high is the
+                // host starting an inhibit - sorted out on the rising edge.
+                if (!data) sniff_begin(SNIFF_DEVICE, now_us);
+                break;
+
+            case SNIFF_DEVICE:
+                sniff_collect(data);
+                if (sniff.bits == 10) sniff_finish(now_us, 0);
+                break;
+
+            case SNIFF_HOST:
+                if (sniff.bits == 10) sniff_finish(now_us, data ? 0 : PS2_SNIFF_ACK);
+                break;
+        }
+        return;
+    }
+
+    if (now_us - sniff.fall_us >= PS2_SNIFF_INHIBIT_US) {
+        // The host held CLK low: an inhibit, which cuts short whatever the
+        // device was sending, and a request-to-send if DATA is low
+        if (sniff.state != SNIFF_IDLE) sniff_finish(sniff.fall_us, PS2_SNIFF_ABORTED);
+        if (!data) sniff_begin(SNIFF_HOST, now_us);
+    } else if (sniff.state == SNIFF_HOST && sniff.bits < 10) {
+        sniff_collect(data);
+    }
+}
+
+bool ps2_sniff_pop(ps2_sniff_frame_t *frame) {
+    if (queue_tail == queue_head) return false;
+    *frame = queue[queue_tail];
+    queue_tail = (queue_tail + 1) & (PS2_SNIFF_QUEUE_SIZE - 1);
+    return true;
+}
+
+// =============================================================================
+// CAPTURE AND STREAMING (platform)
+// =============================================================================
+
+static bool active = false;
+static uint8_t report_seq = 0;
+
+bool ps2_sniff_active(void) {
+    return active;
+}
+
+#if defined(PROTOCOL_CHIBIOS)
+
+static void ps2_sniff_edge_cb(void *arg) {
+    (void)arg;
+    uint32_t lines = ps2_gpio_read(PS2_KB_LINES);
+    ps2_sniff_edge(lines & PS2_KB_CLK, lines & PS2_KB_DATA, ps2_micros());
+}
+
+static void ps2_sniff_arm(bool on) {
+    if (on) {
+        // Plain inputs: the bus under test has its own pull-ups
+        setPinInput(PS2_KEYBOARD_CLOCK_PIN);
+        setPinInput(PS2_KEYBOARD_DATA_PIN);
+        palSetLineCallback(PS2_KEYBOARD_CLOCK_PIN, ps2_sniff_edge_cb, NULL);
+        palEnableLineEvent(PS2_KEYBOARD_CLOCK_PIN, PAL_EVENT_MODE_BOTH_EDGES);
+    } else {
+        palDisableLineEvent(PS2_KEYBOARD_CLOCK_PIN);
+    }
+}
+
+#else
+
+// No edge interrupts on this platform - frames only come from ps2_sniff_edge()
+static void ps2_sniff_arm(bool on) {
+    (void)on;
+}
+
+#endif
+
+bool ps2_sniff_start(void) {
+    if (!is_usb_mode() || ps2_bridge_active()) return false;
+    if (active) return true;
+
+    sniff.state = SNIFF_IDLE;
+    sniff.clk = true;
+    queue_tail = queue_head;
+    active = true;
+    ps2_sniff_arm(true);
+    uprintf("[SNIFF] Capture started\n");
+    return true;
+}
+
+void ps2_sniff_stop(void) {
+    if (!active) return;
+    ps2_sniff_arm(false);
+    active = false;
+    uprintf("[SNIFF] Capture stopped\n");
+}
+
+void ps2_sniff_task(void) {
+    if (!active || queue_tail == queue_head) return;
+
+    uint8_t report[RAW_EPSIZE] = {PS2_HID_SNIFF_DATA, PS2_HID_OK};
+    uint8_t count = 0;
+    ps2_sniff_frame_t frame;
+
+    while (count < PS2_SNIFF_FRAMES_PER_REPORT && ps2_sniff_pop(&frame)) {
+        uint8_t *out = &report[PS2_SNIFF_HEADER + count * sizeof(frame)];
+        ps2_hid_put_u32(out, frame.start_us);
+        out[4] = frame.duration_us & 0xFF;
+        out[5] = frame.duration_us >> 8;
+        out[6] = frame.data;
+        out[7] = frame.flags;
+        count++;
+    }
+
+    uint16_t drops = queue_drops;
+    report[2] = report_seq++;
+    report[3] = count;
+    report[4] = drops & 0xFF;
+    report[5] = drops >> 8;
+    raw_hid_send(report, sizeof(report));
+}
@@ -0,0 +1,58 @@
+// ps2_sniff.h
+#ifndef PS2_SNIFF_H
+#define PS2_SNIFF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Passive PS/2 bus capture on the keyboard port's CLK/DATA pins (USB mode
+// only). Frames in both directions are decoded from clock-edge interrupts
+// and streamed to the PC over raw HID (ps2_tool.py sniff).
+
+// A host holds CLK low at least 100us to inhibit / request-to-send; device
+// clock low phases are 30-50us
+#ifndef PS2_SNIFF_INHIBIT_US
+#define PS2_SNIFF_INHIBIT_US 75
+#endif
+
+// Gap between edges that ends a frame in progress. After a request-to-send
+// the device may take up to 15ms to start clocking.
+#define PS2_SNIFF_BIT_TIMEOUT_US 2000
+#define PS2_SNIFF_RTS_TIMEOUT_US 15000
+
+// Captured frames waiting for USB (power of two)
+#ifndef PS2_SNIFF_QUEUE_SIZE
+#define PS2_SNIFF_QUEUE_SIZE 64
+#endif
+
+// Frame flags. Wire format, shared with ps2_tool.py - never renumber.
+#define PS2_SNIFF_FROM_HOST   0x01  // Host-to-device (else device-to-host)
+#define PS2_SNIFF_PARITY_ERR  0x02
+#define PS2_SNIFF_FRAMING_ERR 0x04  // Stop bit low
+#define PS2_SNIFF_ACK         0x08  // Host frame acknowledged by the device
+#define PS2_SNIFF_ABORTED     0x10  // Cut short by an inhibit or timeout; data is partial
+
+typedef struct __attribute__((packed)) {
+    uint32_t start_us;     // First clock edge (RP2040 1MHz timer)
+    uint16_t duration_us;  // First to last clock edge, saturating
+    uint8_t data;
+    uint8_t flags;
+} ps2_sniff_frame_t;
+
+// Raw HID stream: [PS2_HID_SNIFF_DATA, status, seq, count, drops u16 LE,
+// count x ps2_sniff_frame_t]. seq counts reports, drops counts frames lost
+// on a full queue (both wrap).
+#define PS2_SNIFF_HEADER 6
+#define PS2_SNIFF_FRAMES_PER_REPORT 3
+
+bool ps2_sniff_start(void);  // Fails in PS/2 mode or while bridging, where we drive the lines
+void ps2_sniff_stop(void);
+bool ps2_sniff_active(void);
+void ps2_sniff_task(void);   // Main loop: stream captured frames
+
+// Decoder, one call per CLK edge with both line levels. Pure logic - the
+// ISR feeds it from the pins, a host build can feed it recorded edges.
+void ps2_sniff_edge(bool clk, bool data, uint32_t now_us);
+bool ps2_sniff_pop(ps2_sniff_frame_t *frame);
+
+#endif // PS2_SNIFF_H
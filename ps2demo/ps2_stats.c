@@ -0,0 +1,151 @@
+// ps2_stats.c - Link health counters
+#include "ps2_stats.h"
+#include <string.h>
+#include "quantum.h"
+#include "ps2_config.h"
+#include "ps2_time.h"
+
+uint32_t ps2_stats[PS2_STAT_COUNT] = {0};
+
+static const char *const ps2_stat_names[PS2_STAT_COUNT] = {
+    [PS2_STAT_BYTES_SENT]         = "bytes_sent",
+    [PS2_STAT_INHIBIT_ABORTS]     = "inhibit_aborts",
+    [PS2_STAT_HOST_RESENDS]       = "host_resends",
+    [PS2_STAT_PARITY_ERRORS]      = "parity_errors",
+    [PS2_STAT_BUFFER_DROPS]       = "buffer_drops",
+    [PS2_STAT_QUEUE_HIGH_WATER]   = "queue_high_water",
+    [PS2_STAT_TYPEMATIC_REPEATS]  = "typematic_repeats",
+    [PS2_STAT_MODE_SWITCHES]      = "mode_switches",
+    [PS2_STAT_USB_MODE_SECONDS]   = "usb_mode_seconds",
+    [PS2_STAT_PS2_MODE_SECONDS]   = "ps2_mode_seconds",
+    [PS2_STAT_EVENT_DROPS]        = "event_drops",
+    [PS2_STAT_COMMANDS_RECEIVED]  = "commands_received",
+    [PS2_STAT_FRAMING_ERRORS]     = "framing_errors",
+    [PS2_STAT_LATENCY_LAST_US]    = "latency_last_us",
+    [PS2_STAT_LATENCY_MAX_US]     = "latency_max_us",
+    [PS2_STAT_LATENCY_SAMPLES]    = "latency_samples",
+    [PS2_STAT_LATENCY_TOTAL_US]   = "latency_total_us",
+    [PS2_STAT_FRAME_US_MIN]       = "frame_us_min",
+    [PS2_STAT_FRAME_US_MAX]       = "frame_us_max",
+    [PS2_STAT_SNIFF_FRAMES]       = "sniff_frames",
+    [PS2_STAT_SNIFF_DROPS]        = "sniff_drops",
+    [PS2_STAT_BRIDGE_US_LAST]     = "bridge_us_last",
+    [PS2_STAT_BRIDGE_US_MAX]      = "bridge_us_max",
+    [PS2_STAT_BRIDGE_EVENTS]      = "bridge_events",
+    [PS2_STAT_BRIDGE_US_TOTAL]    = "bridge_us_total",
+    [PS2_STAT_BRIDGE_ERRORS]      = "bridge_errors",
+    [PS2_STAT_EVENT_WAIT_US_MAX]  = "event_wait_us_max",
+    [PS2_STAT_CONFIG_WRITES]      = "config_writes",
+    [PS2_STAT_STREAM_BYTES]       = "stream_bytes",
+    [PS2_STAT_STREAM_KEYS]        = "stream_keys",
+    [PS2_STAT_STREAM_US_LAST]     = "stream_us_last",
+    [PS2_STAT_STREAM_US_MAX]      = "stream_us_max",
+    [PS2_STAT_STREAM_CHUNKS]      = "stream_chunks",
+    [PS2_STAT_STREAM_US_TOTAL]    = "stream_us_total",
+    [PS2_STAT_STREAM_ERRORS]      = "stream_errors",
+    [PS2_STAT_WCET_OVERRUNS]      = "wcet_overruns",
+};
+
+// Kept across power cycles; the rest describe this session. Order is the
+// EEPROM layout - bump PS2_CONFIG_VERSION if it changes.
+static const uint8_t lifetime_ids[PS2_CONFIG_STATS] = {
+    PS2_STAT_BYTES_SENT,         PS2_STAT_INHIBIT_ABORTS,   PS2_STAT_HOST_RESENDS,
+    PS2_STAT_PARITY_ERRORS,      PS2_STAT_BUFFER_DROPS,     PS2_STAT_QUEUE_HIGH_WATER,
+    PS2_STAT_TYPEMATIC_REPEATS,  PS2_STAT_MODE_SWITCHES,    PS2_STAT_USB_MODE_SECONDS,
+    PS2_STAT_PS2_MODE_SECONDS,
+};
+
+static uint32_t checkpoint[PS2_CONFIG_STATS];  // What the store was last handed
+static uint32_t checkpoint_at = 0;
+
+static void ps2_stats_snapshot(void) {
+    for (uint8_t i = 0; i < PS2_CONFIG_STATS; i++) {
+        checkpoint[i] = ps2_stats[lifetime_ids[i]];
+    }
+    checkpoint_at = timer_read32();
+}
+
+// Mode time is accrued in whole seconds; the remainder carries over
+static uint32_t mode_since = 0;
+static uint32_t mode_remainder_ms = 0;
+
+void ps2_stats_mode_update(bool usb_mode) {
+    uint32_t now = timer_read32();
+    uint32_t elapsed = mode_remainder_ms + (now - mode_since);
+    mode_since = now;
+
+    ps2_stats[usb_mode ? PS2_STAT_USB_MODE_SECONDS : PS2_STAT_PS2_MODE_SECONDS] += elapsed / 1000;
+    mode_remainder_ms = elapsed % 1000;
+}
+
+void ps2_stats_mode_switch(bool usb_mode) {
+    // Close out the time spent in the mode we're leaving
+    ps2_stats_mode_update(!usb_mode);
+    mode_remainder_ms = 0;
+    PS2_STAT_INC(PS2_STAT_MODE_SWITCHES);
+    ps2_stats_snapshot();  // Rare, and the mode goes to EEPROM anyway
+}
+
+// Oldest matrix edge not yet carried by a report
+static uint32_t key_edge_us = 0;
+static bool key_edge_pending = false;
+
+void ps2_stats_key_edge(uint32_t edge_us) {
+    if (!key_edge_pending) {
+        key_edge_us = edge_us;
+        key_edge_pending = true;
+    }
+}
+
+void ps2_stats_key_reported(void) {
+    if (!key_edge_pending) return;
+    key_edge_pending = false;
+
+    uint32_t latency = ps2_micros() - key_edge_us;
+    ps2_stats[PS2_STAT_LATENCY_LAST_US] = latency;
+    PS2_STAT_MAX(PS2_STAT_LATENCY_MAX_US, latency);
+    PS2_STAT_INC(PS2_STAT_LATENCY_SAMPLES);
+    ps2_stats[PS2_STAT_LATENCY_TOTAL_US] += latency;
+}
+
+void ps2_stats_restore(const uint32_t *saved) {
+    for (uint8_t i = 0; i < PS2_CONFIG_STATS; i++) {
+        ps2_stats[lifetime_ids[i]] = saved[i];
+    }
+    ps2_stats_snapshot();
+}
+
+// Any lifetime counter but the mode time moved since the checkpoint. Mode
+// time moves all the time, so on its own it never makes a new one.
+static bool ps2_stats_link_moved(void) {
+    for (uint8_t i = 0; i < PS2_CONFIG_STATS; i++) {
+        uint8_t id = lifetime_ids[i];
+        if (id == PS2_STAT_USB_MODE_SECONDS || id == PS2_STAT_PS2_MODE_SECONDS) continue;
+        if (ps2_stats[id] != checkpoint[i]) return true;
+    }
+    return false;
+}
+
+void ps2_stats_checkpoint(bool usb_mode, uint32_t *saved) {
+    if (timer_elapsed32(checkpoint_at) >= PS2_STATS_SAVE_MS && ps2_stats_link_moved()) {
+        ps2_stats_mode_update(usb_mode);
+        ps2_stats_snapshot();
+    }
+    memcpy(saved, checkpoint, sizeof(checkpoint));
+}
+
+void ps2_stats_reset(void) {
+    for (uint8_t i = 0; i < PS2_STAT_COUNT; i++) {
+        ps2_stats[i] = 0;
+    }
+    mode_since = timer_read32();
+    mode_remainder_ms = 0;
+    ps2_stats_snapshot();  // Cleared in EEPROM too
+}
+
+void ps2_stats_print(void) {
+    uprintf("[STATS] ---- PS/2 link statistics ----\n");
+    for (uint8_t i = 0; i < PS2_STAT_COUNT; i++) {
+        uprintf("[STATS] %-18s %lu\n", ps2_stat_names[i], ps2_stats[i]);
+    }
+}
@@ -0,0 +1,89 @@
+// ps2_stats.h
+#ifndef PS2_STATS_H
+#define PS2_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Link health counters. Plain uint32_t increments, cheap enough to stay in
+// production builds. IDs are part of the raw HID protocol (ps2_hid.h) -
+// append new ones at the end, never reorder.
+typedef enum {
+    PS2_STAT_BYTES_SENT,          // Bytes clocked out completely
+    PS2_STAT_INHIBIT_ABORTS,      // Frames aborted because the host pulled CLK low
+    PS2_STAT_HOST_RESENDS,        // 0xFE Resend requests from the host
+    PS2_STAT_PARITY_ERRORS,       // Host-to-device frames with bad parity
+    PS2_STAT_BUFFER_DROPS,        // Bytes dropped on a full send_buffer
+    PS2_STAT_QUEUE_HIGH_WATER,    // Most bytes ever waiting in send_buffer
+    PS2_STAT_TYPEMATIC_REPEATS,   // Typematic repeats emitted
+    PS2_STAT_MODE_SWITCHES,       // USB <-> PS/2 transitions
+    PS2_STAT_USB_MODE_SECONDS,    // Time spent in USB mode
+    PS2_STAT_PS2_MODE_SECONDS,    // Time spent in PS/2 mode
+    PS2_STAT_EVENT_DROPS,         // Key presses deferred on a full event queue
+    PS2_STAT_COMMANDS_RECEIVED,   // Good host-to-device frames
+    PS2_STAT_FRAMING_ERRORS,      // Host-to-device frames without a stop bit
+    PS2_STAT_LATENCY_LAST_US,     // Key edge -> PS/2 report, most recent
+    PS2_STAT_LATENCY_MAX_US,      // Key edge -> PS/2 report, worst seen
+    PS2_STAT_LATENCY_SAMPLES,     // Number of latency samples
+    PS2_STAT_LATENCY_TOTAL_US,    // Sum of samples (mean = total / samples)
+    PS2_STAT_FRAME_US_MIN,        // Shortest device-to-host frame, start to stop bit
+    PS2_STAT_FRAME_US_MAX,        // Longest one (max - min = clock jitter)
+    PS2_STAT_SNIFF_FRAMES,        // Frames captured in sniffer mode
+    PS2_STAT_SNIFF_DROPS,         // Captured frames lost on a full sniff queue
+    PS2_STAT_BRIDGE_US_LAST,      // Bridge: last byte of a key event -> USB report, most recent
+    PS2_STAT_BRIDGE_US_MAX,       // Bridge: worst conversion latency seen
+    PS2_STAT_BRIDGE_EVENTS,       // Bridge: key events converted (latency samples)
+    PS2_STAT_BRIDGE_US_TOTAL,     // Bridge: sum of latencies (mean = total / events)
+    PS2_STAT_BRIDGE_ERRORS,       // Bridge: bad frames, overruns, unanswered commands
+    PS2_STAT_EVENT_WAIT_US_MAX,   // Longest a key event waited to be encoded (backpressure)
+    PS2_STAT_CONFIG_WRITES,       // Settings written to EEPROM (flash wear)
+    PS2_STAT_STREAM_BYTES,        // Stream: payload bytes received from the PC
+    PS2_STAT_STREAM_KEYS,         // Stream: characters and key ops typed
+    PS2_STAT_STREAM_US_LAST,      // Stream: chunk arrival -> last byte on the wire, most recent
+    PS2_STAT_STREAM_US_MAX,       // Stream: worst chunk latency seen
+    PS2_STAT_STREAM_CHUNKS,       // Stream: chunks timed (latency samples)
+    PS2_STAT_STREAM_US_TOTAL,     // Stream: sum of latencies (mean = total / chunks)
+    PS2_STAT_STREAM_ERRORS,       // Stream: chunks refused (no credit, bad seq) or malformed
+    PS2_STAT_WCET_OVERRUNS,       // Probes over their WCET budget (PS2_WCET_ASSERT)
+    PS2_STAT_COUNT
+} ps2_stat_id_t;
+
+extern uint32_t ps2_stats[PS2_STAT_COUNT];
+
+#define PS2_STAT_INC(id) (ps2_stats[(id)]++)
+#define PS2_STAT_MAX(id, value)                    \
+    do {                                           \
+        if ((uint32_t)(value) > ps2_stats[(id)]) { \
+            ps2_stats[(id)] = (value);             \
+        }                                          \
+    } while (0)
+// Minimum; 0 means no sample yet
+#define PS2_STAT_MIN(id, value)                                           \
+    do {                                                                  \
+        if (ps2_stats[(id)] == 0 || (uint32_t)(value) < ps2_stats[(id)]) { \
+            ps2_stats[(id)] = (value);                                    \
+        }                                                                 \
+    } while (0)
+
+void ps2_stats_mode_update(bool usb_mode);  // Accrue time in the current mode
+void ps2_stats_mode_switch(bool usb_mode);  // Count a switch into usb_mode
+void ps2_stats_key_edge(uint32_t edge_us);  // Matrix accepted a change that started at edge_us
+void ps2_stats_key_reported(void);          // The report carrying it reached the PS/2 driver
+void ps2_stats_reset(void);
+void ps2_stats_print(void);
+
+// Lifetime counters: the link and mode ones above, kept in EEPROM by
+// ps2_config.c (PS2_CONFIG_STATS of them). The store is handed a new
+// checkpoint on a mode switch or a reset, and otherwise at most every
+// PS2_STATS_SAVE_MS once a link counter has moved: the mode time rides
+// along but doesn't count as a change. That is at most 6 writes an hour
+// while the keyboard is in use, and none while it sits idle, however long.
+// A power cut loses what was counted since, mode time included.
+#ifndef PS2_STATS_SAVE_MS
+#    define PS2_STATS_SAVE_MS 600000  // 10 minutes
+#endif
+
+void ps2_stats_restore(const uint32_t *saved);             // At boot, from a loaded block
+void ps2_stats_checkpoint(bool usb_mode, uint32_t *saved);  // Every pass: what to store
+
+#endif // PS2_STATS_H
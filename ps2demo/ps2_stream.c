@@ -0,0 +1,330 @@
+// ps2_stream.c - Keystrokes streamed from the PC over raw HID, typed over PS/2
+//
+// Chunks land in a ring of staging slots. The task types the oldest one as
+// send_buffer drains, one item (character or key op) at a time and only
+// when the whole item fits, leaving PS2_SEND_STRING_RESERVE for the physical
+// keys like ps2_send_string() does. A slot that has been typed out is a
+// credit owed to the PC, returned in the next STREAM_CREDIT report.
+//
+// Keys the stream holds - key ops, and Left Shift between characters - go
+// through the port's event queue as stream keys (ps2_keyboard_stream_key),
+// so closing, the idle timeout and cancelling all let go of them the same
+// way. Characters are taps and go straight into send_buffer, each once the
+// queue has drained so that it lands after the Shift change it needs.
+//
+// Latency is timed one chunk at a time: from the chunk arriving to the last
+// of its bytes being clocked out, which is when ps2_keyboard_sent_total()
+// passes the queue position its last item ended at.
+#include "ps2_stream.h"
+#include "ps2_hid.h"
+#include "ps2_keyboard.h"
+#include "ps2_send_string.h"
+#include "ps2_stats.h"
+#include "ps2_time.h"
+#include "ps2_timer.h"
+#include "kb.h"
+#include "quantum.h"
+#include "raw_hid.h"
+
+// Payload bytes per STREAM_DATA report
+#define PS2_STREAM_CHUNK (RAW_EPSIZE - PS2_STREAM_HEADER)
+
+// Longest item: OP_TAP, a press and a release
+#define PS2_STREAM_MAX_ITEM (2 * PS2_MAX_KEY_SEQUENCE)
+
+_Static_assert(PS2_STREAM_SLOTS > 0 && PS2_STREAM_SLOTS < 256, "credits travel in one byte");
+_Static_assert(PS2_STREAM_MAX_ITEM + PS2_SEND_STRING_RESERVE <= 32, "an item must fit in send_buffer");
+
+typedef struct {
+    uint8_t data[PS2_STREAM_CHUNK];
+    uint8_t len;
+    uint8_t pos;          // Next byte to type
+    uint32_t arrival_us;
+} ps2_stream_slot_t;
+
+static struct {
+    ps2_stream_state_t state;
+    ps2_stream_slot_t slots[PS2_STREAM_SLOTS];
+    uint8_t head;          // Next slot to fill
+    uint8_t tail;          // Slot being typed
+    uint8_t staged;        // Slots holding a chunk
+    uint8_t credits_owed;  // Slots freed since the last STREAM_CREDIT report
+    uint8_t next_seq;      // seq the next STREAM_DATA must carry
+    bool finishing;        // Everything queued, waiting for the wire
+    uint32_t end_total;    // queued_total once it was
+
+    // The chunk being timed
+    bool timing;
+    uint32_t mark_total;
+    uint32_t mark_us;
+
+    // This stream, for STREAM_STATUS
+    uint32_t bytes;
+    uint32_t keys;
+    uint32_t start_ms;
+    uint32_t elapsed_ms;
+    uint32_t us_last;
+    uint32_t us_max;
+} stream = {0};
+
+static ps2_timer_t stream_timeout;
+
+static void ps2_stream_timed_out(void *arg) {
+    (void)arg;
+    if (stream.state != PS2_STREAM_OPEN) return;
+
+    // Still typing what the PC sent - it isn't the one keeping us waiting
+    if (stream.staged > 0) {
+        ps2_timer_arm(&stream_timeout, PS2_STREAM_TIMEOUT_MS);
+        return;
+    }
+    uprintf("[PS2] Stream idle for %u ms, closing\n", PS2_STREAM_TIMEOUT_MS);
+    stream.state = PS2_STREAM_DRAINING;
+}
+
+void ps2_stream_init(void) {
+    ps2_timer_init(&stream_timeout, ps2_stream_timed_out, NULL);
+}
+
+void ps2_stream_cancel(void) {
+    if (stream.state == PS2_STREAM_CLOSED) return;
+
+    // Still the port we were typing to, and the releases always fit
+    ps2_keyboard_stream_release();
+    ps2_timer_cancel(&stream_timeout);
+    stream.state = PS2_STREAM_CLOSED;
+    stream.staged = 0;
+    stream.credits_owed = 0;
+    stream.timing = false;
+    stream.elapsed_ms = timer_elapsed32(stream.start_ms);
+    uprintf("[PS2] Stream cancelled\n");
+}
+
+bool ps2_stream_busy(void) {
+    return stream.state != PS2_STREAM_CLOSED || stream.credits_owed > 0;
+}
+
+// =============================================================================
+// HID SIDE
+// =============================================================================
+
+static uint8_t ps2_stream_open(uint8_t *data) {
+    // A stream left open by a PC that went away closes on its own
+    if (is_usb_mode() || stream.state != PS2_STREAM_CLOSED || ps2_send_string_busy()) {
+        return PS2_HID_ERROR;
+    }
+
+    stream.state = PS2_STREAM_OPEN;
+    stream.head = 0;
+    stream.tail = 0;
+    stream.staged = 0;
+    stream.credits_owed = 0;
+    stream.next_seq = 0;
+    stream.finishing = false;
+    stream.timing = false;
+    stream.bytes = 0;
+    stream.keys = 0;
+    stream.start_ms = timer_read32();
+    stream.elapsed_ms = 0;
+    stream.us_last = 0;
+    stream.us_max = 0;
+    ps2_timer_arm(&stream_timeout, PS2_STREAM_TIMEOUT_MS);
+    uprintf("[PS2] Stream open\n");
+
+    data[2] = PS2_STREAM_SLOTS;
+    data[3] = PS2_STREAM_CHUNK;
+    return PS2_HID_OK;
+}
+
+static void ps2_stream_status(uint8_t *data) {
+    uint32_t elapsed = stream.state == PS2_STREAM_CLOSED ? stream.elapsed_ms : timer_elapsed32(stream.start_ms);
+
+    ps2_hid_put_u32(&data[2], stream.bytes);
+    ps2_hid_put_u32(&data[6], stream.keys);
+    ps2_hid_put_u32(&data[10], elapsed);
+    ps2_hid_put_u32(&data[14], stream.us_last);
+    ps2_hid_put_u32(&data[18], stream.us_max);
+    data[22] = stream.state == PS2_STREAM_OPEN ? PS2_STREAM_SLOTS - stream.staged - stream.credits_owed : 0;
+    data[23] = stream.state;
+}
+
+uint8_t ps2_stream_command(uint8_t *data, uint8_t length) {
+    (void)length;  // Always RAW_EPSIZE, and STATUS needs 24
+
+    switch (data[0]) {
+        case PS2_HID_STREAM_OPEN:
+            return ps2_stream_open(data);
+
+        case PS2_HID_STREAM_CLOSE:
+            if (stream.state == PS2_STREAM_OPEN) {
+                ps2_timer_cancel(&stream_timeout);
+                stream.state = PS2_STREAM_DRAINING;
+            }
+            return PS2_HID_OK;
+
+        case PS2_HID_STREAM_STATUS:
+            ps2_stream_status(data);
+            return PS2_HID_OK;
+    }
+    return PS2_HID_UNKNOWN_COMMAND;
+}
+
+bool ps2_stream_data(const uint8_t *data, uint8_t length) {
+    uint8_t seq = data[1];
+    uint8_t len = data[2];
+
+    // No credit for it, or one went missing: the PC is out of step
+    if (stream.state != PS2_STREAM_OPEN || stream.staged == PS2_STREAM_SLOTS || seq != stream.next_seq ||
+        len > PS2_STREAM_CHUNK || len > length - PS2_STREAM_HEADER) {
+        PS2_STAT_INC(PS2_STAT_STREAM_ERRORS);
+        return false;
+    }
+
+    ps2_stream_slot_t *slot = &stream.slots[stream.head];
+    memcpy(slot->data, &data[PS2_STREAM_HEADER], len);
+    slot->len = len;
+    slot->pos = 0;
+    slot->arrival_us = ps2_micros();
+
+    stream.head = (stream.head + 1) % PS2_STREAM_SLOTS;
+    stream.staged++;
+    stream.next_seq++;
+    stream.bytes += len;
+    ps2_stats[PS2_STAT_STREAM_BYTES] += len;
+    ps2_timer_arm(&stream_timeout, PS2_STREAM_TIMEOUT_MS);
+    return true;
+}
+
+// =============================================================================
+// PS/2 SIDE
+// =============================================================================
+
+// Type the item at slot->pos. False if send_buffer has no room for it yet.
+static bool ps2_stream_type_next(ps2_stream_slot_t *slot) {
+    uint8_t seq[PS2_STREAM_MAX_ITEM];
+    uint8_t len = 0;
+    uint8_t c = slot->data[slot->pos];
+
+    // Whatever is still in the event queue goes out first
+    if (ps2_keyboard_events_pending()) return false;
+
+    if (c >= PS2_STREAM_OP_PRESS && c <= PS2_STREAM_OP_TAP) {
+        if (slot->pos + 1 >= slot->len) {
+            // Keycode cut off by the end of the chunk
+            PS2_STAT_INC(PS2_STAT_STREAM_ERRORS);
+            slot->pos = slot->len;
+            return true;
+        }
+
+        // Encoded only to size it: the event queue sends it
+        uint8_t keycode = slot->data[slot->pos + 1];
+        if (c != PS2_STREAM_OP_RELEASE) len = ps2_keyboard_encode_keycode(keycode, true, seq);
+        if (c != PS2_STREAM_OP_PRESS) len += ps2_keyboard_encode_keycode(keycode, false, &seq[len]);
+
+        if (len > 0) {
+            if (ps2_keyboard_send_free() < len + PS2_SEND_STRING_RESERVE) return false;
+
+            bool held = c == PS2_STREAM_OP_RELEASE || ps2_keyboard_stream_key(keycode, true);
+            if (c != PS2_STREAM_OP_PRESS) ps2_keyboard_stream_key(keycode, false);
+            if (held) {
+                stream.keys++;
+                PS2_STAT_INC(PS2_STAT_STREAM_KEYS);
+            } else {
+                // Six keys down already
+                PS2_STAT_INC(PS2_STAT_STREAM_ERRORS);
+            }
+        }
+        slot->pos += 2;
+        return true;
+    }
+
+    bool shift = ps2_keyboard_get_mods() & MOD_BIT(KC_LSFT);
+    bool want = shift;
+    len = ps2_send_string_encode(c, &want, seq);
+
+    if (len > 0) {
+        if (ps2_keyboard_send_free() < len + PS2_SEND_STRING_RESERVE) return false;
+
+        // Shift held as a stream key, then the bare make/break
+        if (want != shift) {
+            ps2_keyboard_stream_key(KC_LSFT, want);
+            len = ps2_send_string_encode(c, &want, seq);
+        }
+        ps2_keyboard_send_sequence(seq, len);
+        stream.keys++;
+        PS2_STAT_INC(PS2_STAT_STREAM_KEYS);
+    }
+
+    slot->pos++;
+    return true;
+}
+
+static void ps2_stream_fill(void) {
+    while (stream.staged > 0) {
+        ps2_stream_slot_t *slot = &stream.slots[stream.tail];
+
+        while (slot->pos < slot->len) {
+            if (!ps2_stream_type_next(slot)) return;
+        }
+
+        if (!stream.timing) {
+            stream.timing = true;
+            stream.mark_total = ps2_keyboard_queued_total();
+            stream.mark_us = slot->arrival_us;
+        }
+        stream.tail = (stream.tail + 1) % PS2_STREAM_SLOTS;
+        stream.staged--;
+        if (stream.state == PS2_STREAM_OPEN) stream.credits_owed++;
+    }
+
+    // Nothing left to type after a close: let go of every key the stream
+    // holds, then wait for the wire to catch up
+    if (stream.state == PS2_STREAM_DRAINING && !stream.finishing) {
+        ps2_keyboard_stream_release();
+        if (ps2_keyboard_events_pending()) return;
+        stream.end_total = ps2_keyboard_queued_total();
+        stream.finishing = true;
+    }
+}
+
+static void ps2_stream_sample(void) {
+    if (!stream.timing || (int32_t)(ps2_keyboard_sent_total() - stream.mark_total) < 0) return;
+
+    uint32_t us = ps2_micros() - stream.mark_us;
+    stream.timing = false;
+    stream.us_last = us;
+    if (us > stream.us_max) stream.us_max = us;
+
+    ps2_stats[PS2_STAT_STREAM_US_LAST] = us;
+    PS2_STAT_MAX(PS2_STAT_STREAM_US_MAX, us);
+    PS2_STAT_INC(PS2_STAT_STREAM_CHUNKS);
+    ps2_stats[PS2_STAT_STREAM_US_TOTAL] += us;
+}
+
+static void ps2_stream_report_credits(void) {
+    if (stream.credits_owed == 0) return;
+
+    uint8_t report[RAW_EPSIZE] = {PS2_HID_STREAM_CREDIT, PS2_HID_OK, stream.credits_owed, stream.next_seq};
+    stream.credits_owed = 0;
+    raw_hid_send(report, sizeof(report));
+}
+
+void ps2_stream_task(void) {
+    if (stream.state == PS2_STREAM_CLOSED) return;
+
+    ps2_stream_sample();
+
+    // Strings typed from the keymap go first; a disabled keyboard (F5)
+    // holds everything, like the matrix
+    if (ps2_keyboard_is_enabled() && !ps2_send_string_busy()) {
+        ps2_stream_fill();
+    }
+    ps2_stream_report_credits();
+
+    if (stream.finishing && (int32_t)(ps2_keyboard_sent_total() - stream.end_total) >= 0) {
+        stream.state = PS2_STREAM_CLOSED;
+        stream.elapsed_ms = timer_elapsed32(stream.start_ms);
+        uprintf("[PS2] Stream done: %lu keys, %lu bytes in %lu ms (%lu keys/s)\n", stream.keys, stream.bytes,
+                stream.elapsed_ms, stream.elapsed_ms ? stream.keys * 1000 / stream.elapsed_ms : 0);
+    }
+}
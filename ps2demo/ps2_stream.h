@@ -0,0 +1,56 @@
+// ps2_stream.h
+#ifndef PS2_STREAM_H
+#define PS2_STREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Keystroke streaming from the PC (PS/2 mode only). The PC sends chunks over
+// raw HID (ps2_tool.py stream); they are staged here and typed on the active
+// port as send_buffer drains, the way ps2_send_string() types a string.
+//
+// Flow control is credit based: OPEN grants one credit per staging slot,
+// every DATA report spends one, and each slot that has been typed out is
+// handed back in an unsolicited STREAM_CREDIT report. The PC never has more
+// chunks in flight than there are slots, so however fast it writes nothing
+// is dropped, and the rate it ends up at is the rate the wire drains.
+
+// Chunks staged at once = credits in flight
+#ifndef PS2_STREAM_SLOTS
+#define PS2_STREAM_SLOTS 4
+#endif
+
+// An open stream with nothing staged closes itself after this long
+#ifndef PS2_STREAM_TIMEOUT_MS
+#define PS2_STREAM_TIMEOUT_MS 5000
+#endif
+
+// STREAM_DATA report: [PS2_HID_STREAM_DATA, seq, len, payload...]. seq
+// counts chunks from 0 at OPEN and wraps.
+#define PS2_STREAM_HEADER 3
+
+// Payload bytes are ASCII, typed with the send_string tables, except these
+// ops, which take the QMK basic keycode (KC_A..KC_RGUI) in the next byte. An
+// op and its keycode must be in the same chunk.
+#define PS2_STREAM_OP_PRESS   0x01
+#define PS2_STREAM_OP_RELEASE 0x02
+#define PS2_STREAM_OP_TAP     0x03
+
+typedef enum {
+    PS2_STREAM_CLOSED,
+    PS2_STREAM_OPEN,
+    PS2_STREAM_DRAINING,  // Closed by the PC or the timeout, still typing
+} ps2_stream_state_t;
+
+void ps2_stream_init(void);
+void ps2_stream_task(void);    // Main loop, PS/2 mode: type staged chunks, return credits
+void ps2_stream_cancel(void);  // Drop everything staged, release held keys (mode or port change)
+bool ps2_stream_busy(void);    // Open, or still has something to type or report
+
+// Raw HID handlers (ps2_hid.c). ps2_stream_command() serves OPEN, CLOSE and
+// STATUS in place and returns the status byte. ps2_stream_data() returns
+// true if the chunk was staged - its reply is the credit that comes back.
+uint8_t ps2_stream_command(uint8_t *data, uint8_t length);
+bool ps2_stream_data(const uint8_t *data, uint8_t length);
+
+#endif // PS2_STREAM_H
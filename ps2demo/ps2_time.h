@@ -0,0 +1,34 @@
+// ps2_time.h
+#ifndef PS2_TIME_H
+#define PS2_TIME_H
+
+#include <stdint.h>
+#include "timer.h"
+#include "wait.h"
+
+#if defined(MCU_RP)
+#    include <hal.h>
+#endif
+
+// Free-running microsecond clock (wraps every ~71 minutes). Safe from ISRs.
+static inline uint32_t ps2_micros(void) {
+#if defined(MCU_RP)
+    return TIMER->TIMERAWL;  // RP2040 1MHz system timer, low word
+#else
+    return timer_read32() * 1000;
+#endif
+}
+
+// Busy-wait on the microsecond clock. Inlined, so inside a PS2_RAM_FUNC it
+// runs from SRAM too, unlike wait_us().
+static inline void ps2_delay_us(uint32_t us) {
+#if defined(MCU_RP)
+    uint32_t start = ps2_micros();
+    while (ps2_micros() - start < us) {
+    }
+#else
+    wait_us(us);
+#endif
+}
+
+#endif // PS2_TIME_H
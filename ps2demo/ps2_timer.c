@@ -0,0 +1,208 @@
+// ps2_timer.c - Hierarchical timer wheel for PS/2-side deadlines
+//
+// Level 0 has one slot per millisecond of the current 32ms block, level 1
+// one slot per 32ms block, level 2 one per 1024ms block. A timer sits in
+// the coarsest level that can still tell its slot apart; when the clock
+// reaches the start of a block, that block's slot one level up is cascaded
+// down. An occupancy bitmap per level lets the run loop and the deadline
+// query jump straight to the next slot with something in it.
+#include "ps2_timer.h"
+#include "timer.h"
+#include <stddef.h>
+
+#define PS2_TIMER_MASK   (PS2_TIMER_SLOTS - 1)
+#define PS2_TIMER_FIRING PS2_TIMER_LEVELS  // Pseudo-level: detached list being run
+
+static ps2_timer_t *wheel[PS2_TIMER_LEVELS][PS2_TIMER_SLOTS];
+static uint32_t occupied[PS2_TIMER_LEVELS];
+static ps2_timer_t *firing = NULL;
+static uint32_t wheel_clock = 0;    // Last tick fully processed
+static uint16_t armed = 0;
+static bool running = false;        // Inside ps2_timer_run(), callbacks firing
+
+static inline uint8_t ps2_timer_shift(uint8_t level) {
+    return level * PS2_TIMER_SLOT_BITS;
+}
+
+static ps2_timer_t **ps2_timer_head(uint8_t level, uint8_t slot) {
+    return level == PS2_TIMER_FIRING ? &firing : &wheel[level][slot];
+}
+
+static void ps2_timer_unlink(ps2_timer_t *timer) {
+    ps2_timer_t **head = ps2_timer_head(timer->level, timer->slot);
+
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        *head = timer->next;
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    if (*head == NULL && timer->level != PS2_TIMER_FIRING) {
+        occupied[timer->level] &= ~(1UL << timer->slot);
+    }
+
+    timer->next = timer->prev = NULL;
+    timer->pending = false;
+    armed--;
+}
+
+// Queue relative to `next`, the first tick not yet processed
+static void ps2_timer_insert(ps2_timer_t *timer, uint32_t next) {
+    int32_t delta = (int32_t)(timer->expires - next);
+    uint32_t when = timer->expires;
+    uint8_t level;
+
+    if (delta < 0) {
+        when = next;  // Overdue - next tick
+        level = 0;
+    } else if (delta < PS2_TIMER_SLOTS) {
+        level = 0;
+    } else if (delta < (1L << ps2_timer_shift(2))) {
+        level = 1;
+    } else {
+        level = 2;
+        if (delta >= (1L << ps2_timer_shift(3))) {
+            when = next + (1UL << ps2_timer_shift(3)) - 1;  // Parked, re-cascaded later
+        }
+    }
+
+    uint8_t slot = (when >> ps2_timer_shift(level)) & PS2_TIMER_MASK;
+    ps2_timer_t **head = &wheel[level][slot];
+
+    timer->level = level;
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = *head;
+    if (*head) (*head)->prev = timer;
+    *head = timer;
+    occupied[level] |= 1UL << slot;
+    timer->pending = true;
+    armed++;
+}
+
+void ps2_timer_init(ps2_timer_t *timer, ps2_timer_callback_t callback, void *arg) {
+    timer->next = timer->prev = NULL;
+    timer->callback = callback;
+    timer->arg = arg;
+    timer->pending = false;
+}
+
+void ps2_timer_arm_at(ps2_timer_t *timer, uint32_t expires) {
+    if (timer->pending) ps2_timer_unlink(timer);
+    timer->expires = expires;
+    ps2_timer_insert(timer, wheel_clock + 1);
+}
+
+// The wheel's clock only moves in ps2_timer_run() and can be a whole idle
+// sleep behind, so outside a callback the delay counts from timer_read32().
+// A callback counts from its own tick: periodic timers don't drift.
+void ps2_timer_arm(ps2_timer_t *timer, uint32_t delay_ms) {
+    ps2_timer_arm_at(timer, (running ? wheel_clock : timer_read32()) + delay_ms);
+}
+
+void ps2_timer_cancel(ps2_timer_t *timer) {
+    if (timer->pending) ps2_timer_unlink(timer);
+}
+
+bool ps2_timer_pending(const ps2_timer_t *timer) {
+    return timer->pending;
+}
+
+uint32_t ps2_timer_now(void) {
+    return wheel_clock;
+}
+
+// Distance from `from` to the next occupied slot, wrapping; -1 if none
+static int8_t ps2_timer_scan(uint32_t map, uint8_t from) {
+    if (map == 0) return -1;
+    uint32_t rotated = (map >> from) | (from ? map << (PS2_TIMER_SLOTS - from) : 0);
+    return __builtin_ctz(rotated);
+}
+
+bool ps2_timer_next_deadline(uint32_t *deadline) {
+    if (armed == 0) return false;
+
+    uint32_t next = wheel_clock + 1;
+    uint8_t index = next & PS2_TIMER_MASK;
+    uint32_t best = UINT32_MAX;  // Distance from `next`
+
+    // Level 0 is exact: slots from `index` on are this block, the ones
+    // before it belong to the next block
+    if (occupied[0] >> index) {
+        best = __builtin_ctz(occupied[0] >> index);
+    } else if (occupied[0]) {
+        best = ((next | PS2_TIMER_MASK) + 1) + __builtin_ctz(occupied[0]) - next;
+    }
+
+    // Higher levels: when their next occupied slot gets cascaded. This can
+    // be `next` itself, ahead of anything already on level 0.
+    for (uint8_t level = 1; level < PS2_TIMER_LEVELS; level++) {
+        uint8_t shift = ps2_timer_shift(level);
+        uint32_t boundary = ((next - 1) | ((1UL << shift) - 1)) + 1;
+        int8_t distance = ps2_timer_scan(occupied[level], (boundary >> shift) & PS2_TIMER_MASK);
+        if (distance >= 0) {
+            uint32_t due = boundary + ((uint32_t)distance << shift) - next;
+            if (due < best) best = due;
+        }
+    }
+
+    *deadline = next + best;
+    return true;
+}
+
+static void ps2_timer_cascade(uint8_t level, uint32_t tick) {
+    uint8_t slot = (tick >> ps2_timer_shift(level)) & PS2_TIMER_MASK;
+    ps2_timer_t *timer;
+
+    while ((timer = wheel[level][slot]) != NULL) {
+        ps2_timer_unlink(timer);
+        ps2_timer_insert(timer, tick);
+    }
+}
+
+static void ps2_timer_tick(uint32_t tick) {
+    // Coarsest first, so a timer can fall through several levels at once
+    for (uint8_t level = PS2_TIMER_LEVELS - 1; level > 0; level--) {
+        if ((tick & ((1UL << ps2_timer_shift(level)) - 1)) == 0) {
+            ps2_timer_cascade(level, tick);
+        }
+    }
+
+    wheel_clock = tick;
+
+    // Detach the due slot first: callbacks may re-arm (even with 0 delay)
+    // or cancel other timers without disturbing the walk
+    uint8_t slot = tick & PS2_TIMER_MASK;
+    firing = wheel[0][slot];
+    wheel[0][slot] = NULL;
+    occupied[0] &= ~(1UL << slot);
+    for (ps2_timer_t *t = firing; t; t = t->next) {
+        t->level = PS2_TIMER_FIRING;
+    }
+
+    ps2_timer_t *timer;
+    while ((timer = firing) != NULL) {
+        ps2_timer_unlink(timer);
+        timer->callback(timer->arg);
+    }
+}
+
+void ps2_timer_run(uint32_t now) {
+    if (armed == 0) {
+        wheel_clock = now;  // Empty wheel: just follow the clock (covers the first call too)
+        return;
+    }
+
+    running = true;
+    while ((int32_t)(now - wheel_clock) > 0) {
+        uint32_t due;
+        if (!ps2_timer_next_deadline(&due) || (int32_t)(due - now) > 0) {
+            wheel_clock = now;  // Nothing due before now - skip the empty ticks
+            break;
+        }
+        ps2_timer_tick(due);
+    }
+    running = false;
+}
@@ -0,0 +1,51 @@
+// ps2_timer.h
+#ifndef PS2_TIMER_H
+#define PS2_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Hierarchical timer wheel, 1ms ticks. Arm and cancel are O(1); timers are
+// intrusive, so the caller owns the storage and nothing is allocated.
+//
+// Time comes in through ps2_timer_run(now), and through timer_read32() when
+// a timer is armed outside a callback, so a host build can drive it from a
+// virtual clock.
+#define PS2_TIMER_SLOT_BITS 5                        // 32 slots per level
+#define PS2_TIMER_SLOTS     (1 << PS2_TIMER_SLOT_BITS)
+#define PS2_TIMER_LEVELS    3                        // Exact up to 32^3 ms (~32s), longer is re-cascaded
+
+typedef void (*ps2_timer_callback_t)(void *arg);
+
+typedef struct ps2_timer {
+    struct ps2_timer *next;
+    struct ps2_timer *prev;
+    uint32_t expires;               // Absolute time in ms (timer_read32 clock)
+    ps2_timer_callback_t callback;  // Runs from ps2_timer_run(), main loop context
+    void *arg;
+    uint8_t level;                  // Where it is queued (internal)
+    uint8_t slot;
+    bool pending;
+} ps2_timer_t;
+
+void ps2_timer_init(ps2_timer_t *timer, ps2_timer_callback_t callback, void *arg);
+
+// (Re)arm relative to now - timer_read32(), or from a callback the tick it
+// runs on - or at an absolute time. Re-arming a pending timer moves it. A
+// time already in the past fires on the next tick.
+void ps2_timer_arm(ps2_timer_t *timer, uint32_t delay_ms);
+void ps2_timer_arm_at(ps2_timer_t *timer, uint32_t expires);
+void ps2_timer_cancel(ps2_timer_t *timer);
+bool ps2_timer_pending(const ps2_timer_t *timer);
+
+// Advance the wheel to `now`, running every callback that has come due
+void ps2_timer_run(uint32_t now);
+
+// Earliest time the wheel needs to run again. Exact for timers due within
+// the current 32ms block, otherwise the next cascade that has work (never
+// late). Returns false if no timer is armed.
+bool ps2_timer_next_deadline(uint32_t *deadline);
+
+uint32_t ps2_timer_now(void);  // The wheel's clock
+
+#endif // PS2_TIMER_H
@@ -0,0 +1,51 @@
+// ps2_warm.c - State block that survives a warm restart
+#include "ps2_warm.h"
+#include <string.h>
+#include "ps2_crc.h"
+#include "ps2_ram.h"
+
+typedef struct {
+    uint32_t magic;    // Written last, cleared first
+    uint16_t version;
+    uint16_t size;
+    ps2_warm_state_t state;
+    uint16_t crc;      // Over state
+} ps2_warm_block_t;
+
+// Not cleared by startup - whatever was here before the reset, or noise
+// after a power cycle (which the magic and CRC reject)
+static ps2_warm_block_t PS2_NOINIT(warm_block);
+
+static bool ps2_warm_valid(void) {
+    return warm_block.magic == PS2_WARM_MAGIC &&
+           warm_block.version == PS2_WARM_VERSION &&
+           warm_block.size == sizeof(ps2_warm_state_t) &&
+           warm_block.crc == ps2_crc16(&warm_block.state, sizeof(ps2_warm_state_t));
+}
+
+bool ps2_warm_load(ps2_warm_state_t *state) {
+    bool valid = ps2_warm_valid();
+
+    if (valid) {
+        *state = warm_block.state;
+    }
+    warm_block.magic = 0;
+    return valid;
+}
+
+void ps2_warm_save(const ps2_warm_state_t *state) {
+    if (warm_block.magic == PS2_WARM_MAGIC &&
+        memcmp(&warm_block.state, state, sizeof(ps2_warm_state_t)) == 0) {
+        return;
+    }
+
+    // A reset halfway through leaves no magic, never a half-written block
+    warm_block.magic = 0;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);  // Keep the compiler from reordering around the magic
+    warm_block.version = PS2_WARM_VERSION;
+    warm_block.size = sizeof(ps2_warm_state_t);
+    warm_block.state = *state;
+    warm_block.crc = ps2_crc16(&warm_block.state, sizeof(ps2_warm_state_t));
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    warm_block.magic = PS2_WARM_MAGIC;
+}
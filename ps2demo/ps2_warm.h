@@ -0,0 +1,43 @@
+// ps2_warm.h
+#ifndef PS2_WARM_H
+#define PS2_WARM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "report.h"  // For report_keyboard_t
+
+// Warm restart. A copy of the state the hosts would otherwise lose in a
+// reset is kept up to date in RAM that startup doesn't clear; after a
+// watchdog or soft reset it is validated and the session resumes without
+// the host handshake. Bump PS2_WARM_VERSION whenever the layout changes.
+#define PS2_WARM_MAGIC   0x57325350  // "PS2W"
+#define PS2_WARM_VERSION 1
+#define PS2_WARM_PORTS   4           // Fixed layout, independent of PS2_PORT_COUNT
+
+typedef struct {
+    uint8_t enabled;
+    uint8_t leds;                // Set LEDs (0xED) argument format
+    uint8_t scancode_set;
+    uint8_t reserved;
+    uint16_t typematic_delay_ms;
+    uint16_t typematic_rate_ms;
+    report_keyboard_t held;      // Keys as the host sees them
+} ps2_warm_port_t;
+
+typedef struct {
+    uint8_t usb_mode;
+    uint8_t active_port;
+    uint8_t port_count;          // Must match on restore
+    uint8_t reserved;
+    ps2_warm_port_t ports[PS2_WARM_PORTS];
+} ps2_warm_state_t;
+
+// At boot: true (and *state filled) if a valid block from this firmware
+// layout survived the reset. The block is consumed either way, so a
+// crash right after resuming falls back to a cold start.
+bool ps2_warm_load(ps2_warm_state_t *state);
+
+// Keep the block current. Cheap when nothing changed (compare, no CRC).
+void ps2_warm_save(const ps2_warm_state_t *state);
+
+#endif // PS2_WARM_H
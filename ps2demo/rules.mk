@@ -10,8 +10,34 @@ BOOTLOADER = rp2040
 # Custom source files for PS/2 device implementation
 SRC += ps2_keyboard.c \
        ps2_mouse.c \
+       ps2_idle.c \
+       ps2_send_string.c \
+       ps2_stream.c \
+       ps2_stats.c \
+       ps2_hid.c \
+       ps2_timer.c \
+       ps2_warm.c \
+       ps2_config.c \
+       ps2_flight.c \
+       ps2_sniff.c \
+       ps2_bridge.c \
+       ps2_profile.c \
+       ps2_pio.c \
        kb.c
 
+# Bit-parallel matrix (direct pins or diode rows/cols) with eager-on-press,
+# vertical-counter debounce
+CUSTOM_MATRIX = lite
+SRC += matrix.c
+
+# Settings store (ps2_config.c): QMK's EEPROM emulation in wear-leveled
+# flash. These are the RP2040 defaults, spelled out because we rely on them.
+EEPROM_DRIVER = wear_leveling
+WEAR_LEVELING_DRIVER = rp2040_flash
+
+# ps2_send_string.c uses the ASCII lookup tables from send_string
+SEND_STRING_ENABLE = yes
+
 # Compiler optimization
 OPT_DEFS += -O2
 